@@ -0,0 +1,80 @@
+#include "AST.h"
+
+#include <deque>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace MattScript {
+namespace Ast {
+
+Tree::Tree() {}
+Tree::~Tree() {}
+
+NodeId
+Tree::add(NodeData data) {
+    NodeId id = (NodeId)_nodes.size();
+    _nodes.push_back(Node{ std::move(data) });
+    return id;
+}
+
+const Node&
+Tree::get(NodeId id) const {
+    return _nodes[id];
+}
+
+NodeList
+Tree::add_list(const std::vector<NodeId>& ids) {
+    NodeList l = { (uint32_t)_lists.size(), (uint32_t)ids.size() };
+    _lists.insert(_lists.end(), ids.begin(), ids.end());
+    return l;
+}
+
+std::span<const NodeId>
+Tree::list(NodeList l) const {
+    return std::span<const NodeId>(_lists.data() + l.first, l.count);
+}
+
+Name
+Tree::intern(std::string_view text) {
+    auto it = _name_lookup.find(text);
+    if (it != _name_lookup.end()) {
+        return it->second;
+    }
+    Name n = (Name)_names.size();
+    _names.emplace_back(text);
+    _name_lookup[_names.back()] = n;
+    return n;
+}
+
+const std::string&
+Tree::name(Name n) const {
+    return _names[n];
+}
+
+NameList
+Tree::add_names(const std::vector<Name>& names) {
+    NameList l = { (uint32_t)_name_lists.size(), (uint32_t)names.size() };
+    _name_lists.insert(_name_lists.end(), names.begin(), names.end());
+    return l;
+}
+
+std::span<const Name>
+Tree::names(NameList l) const {
+    return std::span<const Name>(_name_lists.data() + l.first, l.count);
+}
+
+size_t
+Tree::size() const {
+    return _nodes.size();
+}
+
+void
+Tree::reserve(size_t nodes) {
+    _nodes.reserve(nodes);
+}
+
+}
+}
@@ -1,16 +1,28 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <typeindex>
 #include <typeinfo>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
 #include "VMFFI.h"
 
 namespace MattScript {
+
+// Types.h needs the operators below, so only declare what is used from it.
+namespace Types {
+typedef uint32_t TypeId;
+enum class Mutable;
+}
+
 namespace Ast {
 
 // Tokenizer takes file contents (string) and produces list of tokens
@@ -23,16 +35,37 @@ namespace Ast {
 //    5. generate a to-link table
 // Linker phase will link the addresses in bytecode to produce a Program
 
+// A method on an imported struct that only reads or writes one of its members.
+// Calls to it are generated as the member access, the runnable is never called.
+struct ImportedAccessor {
+    std::string member;
+    bool setter;
+};
+
 struct ImportedMethod {
     std::vector<std::string> scopes;
     std::string name;
     std::shared_ptr<IRunnable> runnable;
-    std::string type;
+    Types::TypeId type;
     std::type_index ret_type;
     std::vector<std::type_index> param_types;
+    std::optional<ImportedAccessor> accessor;
 };
 
-struct Node;
+// Nodes refer to each other by index into the Tree that owns them.
+typedef uint32_t NodeId;
+// An interned string, an index into the Tree's names.
+typedef uint32_t Name;
+
+// A run of ids stored back to back in the Tree.
+struct NodeList {
+    uint32_t first;
+    uint32_t count;
+};
+struct NameList {
+    uint32_t first;
+    uint32_t count;
+};
 
 struct ConstS32 {
     int num;
@@ -46,6 +79,22 @@ struct ConstBool {
     bool value;
 };
 
+struct ConstS64 {
+    int64_t num;
+};
+
+struct ConstU32 {
+    uint32_t num;
+};
+
+struct ConstU64 {
+    uint64_t num;
+};
+
+struct ConstF64 {
+    double num;
+};
+
 enum class BinaryOps {
     // int/float types
     Add,
@@ -76,8 +125,8 @@ enum class BinaryOps {
 
 struct BinaryOperation {
     BinaryOps op;
-    std::shared_ptr<Node> lhs;
-    std::shared_ptr<Node> rhs;
+    NodeId lhs;
+    NodeId rhs;
 };
 
 enum class UnaryOps {
@@ -93,109 +142,192 @@ enum class UnaryOps {
 
 struct UnaryOperation {
     UnaryOps op;
-    std::shared_ptr<Node> value;
+    NodeId value;
 };
 
 struct SetOperation {
     // no op set means a standard assignment.
     std::optional<BinaryOps> op;
-    std::shared_ptr<Node> lhs;
-    std::shared_ptr<Node> rhs;
+    NodeId lhs;
+    NodeId rhs;
 };
 
 struct Identifier {
-    std::vector<std::string> scopes;
-    std::string name;
+    NameList scopes;
+    Name name;
 };
 
 struct AccessMember {
-    std::shared_ptr<Node> container;
-    std::shared_ptr<Node> member;
+    NodeId container;
+    NodeId member;
+};
+
+// container[index]
+struct IndexAccess {
+    NodeId container;
+    NodeId index;
 };
 
 struct VariableDeclaration {
-    std::string name;
-    std::string type;
+    Name name;
+    Types::TypeId type;
     Types::Mutable is_mutable;
 };
 
 struct Block {
-    std::vector<std::shared_ptr<Node>> nodes;
+    NodeList nodes;
 };
 struct GlobalBlock {
-    std::vector<std::shared_ptr<Node>> nodes;
+    NodeList nodes;
 };
 
 struct IfStmt {
-    std::shared_ptr<Node> condition;
-    std::shared_ptr<Node> then;
-    std::optional<std::shared_ptr<Node>> otherwise;
+    NodeId condition;
+    NodeId then;
+    std::optional<NodeId> otherwise;
 };
 struct DoWhile {
-    std::shared_ptr<Node> block;
-    std::shared_ptr<Node> condition;
+    NodeId block;
+    NodeId condition;
+    // runs after the block, where a continue goes to.
+    std::optional<NodeId> iteration;
+};
+
+// for name in start..end, counting up from start and stopping before end.
+struct ForRange {
+    Name name;
+    NodeId start;
+    NodeId end;
+    NodeId block;
+};
+
+// for name in array, each element in order.
+struct ForEach {
+    Name name;
+    NodeId array;
+    NodeId block;
+};
+
+struct BreakStmt {};
+struct ContinueStmt {};
+
+// match value { a, b {...} c {...} else {...} }
+// Only the block of the case holding the value runs, or otherwise when none does.
+struct MatchStmt {
+    NodeId value;
+    NodeList cases;
+    std::optional<NodeId> otherwise;
+};
+// each value is a constant s32 or enum value.
+struct MatchCase {
+    NodeList values;
+    NodeId block;
 };
 
 struct MethodDeclaration {
-    std::vector<std::string> scopes;
-    std::string name;
-    std::string type;
+    NameList scopes;
+    Name name;
+    Types::TypeId type;
 };
 struct MethodDefinition {
-    std::vector<std::string> scopes;
-    std::string name;
-    std::string type;
-    std::vector<std::string> param_names;
-    std::shared_ptr<Node> node;
+    NameList scopes;
+    Name name;
+    Types::TypeId type;
+    NameList param_names;
+    NodeId node;
 };
 struct ReturnValue {
-    std::optional<std::shared_ptr<Node>> value;
+    std::optional<NodeId> value;
 };
 
 struct CallParam {
     // TODO: named params?
-    std::shared_ptr<Node> value;
+    NodeId value;
 };
 struct MethodCall {
-    std::shared_ptr<Node> callable;
-    std::vector<std::shared_ptr<Node>> params;
+    NodeId callable;
+    NodeList params;
 };
 
 struct CppTypeid {
-    std::string type;
+    Types::TypeId type;
 };
 
 struct UnknownAST{};
 
+typedef std::variant<
+    UnknownAST,
+    ConstS32,
+    ConstF32,
+    ConstBool,
+    ConstS64,
+    ConstU32,
+    ConstU64,
+    ConstF64,
+    BinaryOperation,
+    UnaryOperation,
+    SetOperation,
+    Identifier,
+    AccessMember,
+    IndexAccess,
+    VariableDeclaration,
+    GlobalBlock,
+    Block,
+    IfStmt,
+    DoWhile,
+    ForRange,
+    ForEach,
+    BreakStmt,
+    ContinueStmt,
+    MatchStmt,
+    MatchCase,
+    MethodDeclaration,
+    MethodDefinition,
+    ReturnValue,
+    CallParam,
+    MethodCall,
+    CppTypeid
+> NodeData;
+
 struct Node {
-    std::variant<
-        UnknownAST,
-        ConstS32,
-        ConstF32,
-        ConstBool,
-        BinaryOperation,
-        UnaryOperation,
-        SetOperation,
-        Identifier,
-        AccessMember,
-        VariableDeclaration,
-        GlobalBlock,
-        Block,
-        IfStmt,
-        DoWhile,
-        MethodDeclaration,
-        MethodDefinition,
-        ReturnValue,
-        CallParam,
-        MethodCall,
-        CppTypeid
-    > data;
+    NodeData data;
+};
+
+// Owns every node, list and name of one compilation.
+// Nothing is freed individually; the whole tree goes away at once.
+class Tree {
+public:
+    Tree();
+    ~Tree();
+
+    NodeId add(NodeData data);
+    const Node& get(NodeId id) const;
+
+    NodeList add_list(const std::vector<NodeId>& ids);
+    std::span<const NodeId> list(NodeList l) const;
+
+    Name intern(std::string_view text);
+    const std::string& name(Name n) const;
+
+    NameList add_names(const std::vector<Name>& names);
+    std::span<const Name> names(NameList l) const;
+
+    size_t size() const;
+    void reserve(size_t nodes);
+
+private:
+    std::vector<Node> _nodes;
+    std::vector<NodeId> _lists;
+    std::vector<Name> _name_lists;
+    // a deque so the views in the lookup stay valid as it grows.
+    std::deque<std::string> _names;
+    std::unordered_map<std::string_view, Name> _name_lookup;
 };
 
 struct FileNode {
     std::string filename;
-    std::shared_ptr<Node> root;
-    std::vector<std::shared_ptr<Node>> nodes;
+    NodeId root;
+    Tree tree;
 };
 
 } // Ast
@@ -1,12 +1,20 @@
 #include "BytecodeGenerator.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <optional>
+#include <span>
 #include <sstream>
 #include <string>
 #include <typeindex>
 #include <typeinfo>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -15,6 +23,7 @@
 #include "Types.h"
 #include "VMBytecode.h"
 #include "VMFFI.h"
+#include "VMProfile.h"
 
 //
 // default, included types
@@ -37,32 +46,41 @@
 namespace MattScript {
 namespace Generator {
 
-// TODO: get rid of these or move them to somewhere central
-const std::string type_empty = "void";
-const std::string type_bool = "bool";
-const std::string type_s32 = "s32";
-const std::string type_f32 = "f32";
-
-std::unordered_map<Ast::BinaryOps, Bytecode> jump_opcode(std::string type) {
-    // so these have to be the inverse to work right.
-    if (type == type_s32) {
-        return {
-            {Ast::BinaryOps::Eq, Bytecode::s32JNE},
-            {Ast::BinaryOps::NotEq, Bytecode::s32JEQ},
-            {Ast::BinaryOps::Less, Bytecode::s32JGE},
-            {Ast::BinaryOps::LessEqual, Bytecode::s32JGT},
-            {Ast::BinaryOps::Greater, Bytecode::s32JLE},
-            {Ast::BinaryOps::GreaterEqual, Bytecode::s32JLT},
-        };
-    } else if (type == type_f32) {
-        return {
-            {Ast::BinaryOps::Eq, Bytecode::f32JNE},
-            {Ast::BinaryOps::NotEq, Bytecode::f32JEQ},
-            {Ast::BinaryOps::Less, Bytecode::f32JGE},
-            {Ast::BinaryOps::LessEqual, Bytecode::f32JGT},
-            {Ast::BinaryOps::Greater, Bytecode::f32JLE},
-            {Ast::BinaryOps::GreaterEqual, Bytecode::f32JLT},
+const Types::TypeId type_empty = Types::type_void;
+const Types::TypeId type_bool = Types::type_bool;
+const Types::TypeId type_s32 = Types::type_s32;
+const Types::TypeId type_f32 = Types::type_f32;
+const Types::TypeId type_s64 = Types::type_s64;
+const Types::TypeId type_u32 = Types::type_u32;
+const Types::TypeId type_u64 = Types::type_u64;
+const Types::TypeId type_f64 = Types::type_f64;
+const Types::TypeId type_vec2 = Types::type_vec2;
+const Types::TypeId type_vec3 = Types::type_vec3;
+const Types::TypeId type_vec4 = Types::type_vec4;
+const Types::TypeId type_u8 = Types::type_u8;
+const Types::TypeId type_s8 = Types::type_s8;
+const Types::TypeId type_u16 = Types::type_u16;
+const Types::TypeId type_s16 = Types::type_s16;
+
+// so these have to be the inverse to work right.
+#define JUMP_OPCODES(vmtype) \
+        return { \
+            {Ast::BinaryOps::Eq, Bytecode::vmtype##JNE}, \
+            {Ast::BinaryOps::NotEq, Bytecode::vmtype##JEQ}, \
+            {Ast::BinaryOps::Less, Bytecode::vmtype##JGE}, \
+            {Ast::BinaryOps::LessEqual, Bytecode::vmtype##JGT}, \
+            {Ast::BinaryOps::Greater, Bytecode::vmtype##JLE}, \
+            {Ast::BinaryOps::GreaterEqual, Bytecode::vmtype##JLT}, \
         };
+
+std::unordered_map<Ast::BinaryOps, Bytecode> jump_opcode(Types::TypeId type) {
+    switch (type) {
+    case type_s32: JUMP_OPCODES(s32)
+    case type_f32: JUMP_OPCODES(f32)
+    case type_s64: JUMP_OPCODES(s64)
+    case type_u32: JUMP_OPCODES(u32)
+    case type_u64: JUMP_OPCODES(u64)
+    case type_f64: JUMP_OPCODES(f64)
     }
     return {};
 }
@@ -76,7 +94,7 @@ struct methodlink {
 };
 
 struct compiled_result {
-    std::string type;
+    Types::TypeId type;
     Types::Mutable is_mutable;
     bool assignable;
     // the current address information for the resulting data of this expression.
@@ -106,14 +124,14 @@ struct methodlinkable {
 
 struct variableinfo {
     std::string name;
-    std::string type;
+    Types::TypeId type;
     Types::Mutable is_mutable;
     size_t address;
 };
 
 struct methodinfo {
     std::string name;
-    std::string type;
+    Types::TypeId type;
     Types::Mutable return_mutable;
     bool defined;
     size_t index;
@@ -121,39 +139,140 @@ struct methodinfo {
     size_t size;
     size_t param_bytes;
     size_t stack_bytes;
+    uint64_t fingerprint;
+    // what the body refers to by name, for stripping unreachable code.
+    std::unordered_set<std::string> uses_methods;
+    std::unordered_set<std::string> uses_globals;
+    // the ifs of the method, numbered as they are compiled.
+    size_t next_branch_site;
+    std::vector<BranchSite> branches;
+};
+
+// a method as it is in the Program being recompiled.
+struct previousmethod {
+    size_t address;
+    const MethodMetadata* metadata;
+};
+
+// the jump of an if, which moves with it when an enclosing if is swapped.
+struct ifbranch {
+    size_t site;
+    bool inverted;
 };
 
 struct operation {
     Opcode opcode;
     std::optional<labellinkable> label_link;
     std::optional<methodlinkable> method_link;
+    std::optional<ifbranch> branch;
+};
+
+struct symbolinfo {
+    variableinfo variable;
+    // 0 is the global level
+    size_t depth;
+    // the symbol this one hides, if any.
+    std::optional<size_t> shadowed;
+};
+
+// All the variables visible at a point, in one flat list.
+// Each name maps to its innermost symbol, which links to the one it hides.
+// Popping a scope only drops the symbols it added.
+class symboltable {
+public:
+    symboltable() {}
+
+    void push_scope() {
+        _scope_starts.push_back(_symbols.size());
+    }
+
+    void pop_scope() {
+        size_t start = _scope_starts.back();
+        _scope_starts.pop_back();
+        while (_symbols.size() > start) {
+            auto& sym = _symbols.back();
+            if (sym.shadowed) {
+                _index[sym.variable.name] = sym.shadowed.value();
+            }
+            else {
+                _index.erase(sym.variable.name);
+            }
+            _symbols.pop_back();
+        }
+    }
+
+    size_t depth() const {
+        return _scope_starts.size();
+    }
+
+    const symbolinfo* find(const std::string& name) const {
+        auto it = _index.find(name);
+        if (it == _index.end()) {
+            return nullptr;
+        }
+        return &_symbols[it->second];
+    }
+
+    bool declared_in_scope(const std::string& name) const {
+        auto sym = find(name);
+        return sym && sym->depth == depth();
+    }
+
+    void add(variableinfo v) {
+        std::optional<size_t> shadowed;
+        auto it = _index.find(v.name);
+        if (it != _index.end()) {
+            shadowed = it->second;
+        }
+        _index[v.name] = _symbols.size();
+        _symbols.push_back(symbolinfo{ std::move(v), depth(), shadowed });
+    }
+
+    // the global level, valid once every other scope is popped.
+    const std::vector<symbolinfo>& symbols() const {
+        return _symbols;
+    }
+
+private:
+    std::vector<symbolinfo> _symbols;
+    std::vector<size_t> _scope_starts;
+    std::unordered_map<std::string, size_t> _index;
+};
+
+// where a break and a continue in the loop being generated go.
+struct loopinfo {
+    size_t break_label;
+    size_t continue_label;
 };
 
 struct compilerscope {
     // TODO: how to have starting values for globals
-    std::vector<std::unordered_map<std::string, variableinfo>> local_variables;
+    symboltable variables;
     std::unordered_map<std::string, methodinfo> methods;
     std::unordered_map<std::string, size_t> imported_method_names;
     std::unordered_map<std::string, compilerscope> subscopes;
-
-public:
-    compilerscope() {
-        local_variables.push_back({});
-    }
 };
 
 // holds all the necessary tables as we move through the compilation step
 class compiler_wip {
 public:
-    compiler_wip(const Types::TypeTable& t, const ImportedMethods& m) : types(t), imported_methods(m), next_label(0), next_stack(0), next_method(0), next_const(0), rootscope(), current_scope(&rootscope) {
+    compiler_wip(const Ast::Tree& a, const Types::TypeTable& t, const ImportedMethods& m, const ProfileData* p) : tree(a), types(t), imported_methods(m), profile(p), current_method(nullptr), regenerate_all(true), lazy(false), bounds_checks(true), next_label(0), next_stack(0), next_method(0), next_const(0), rootscope(), current_scope(&rootscope) {
         for (size_t i = 0; i < m.size(); i++) {
-            Ast::ImportedMethod method = m[i];
+            const Ast::ImportedMethod& method = m[i];
             auto s = get_scope(method.scopes);
             s->imported_method_names[method.name] = i;
         }
     }
 
-    compilerscope* get_scope(std::vector<std::string> scopepath) {
+    std::vector<std::string> scope_path(Ast::NameList scopes) const {
+        std::vector<std::string> path;
+        for (auto n : tree.names(scopes)) {
+            path.push_back(tree.name(n));
+        }
+        return path;
+    }
+
+    compilerscope* get_scope(const std::vector<std::string>& scopepath) {
         compilerscope* s = current_scope;
         for (auto& it : scopepath) {
             auto maybe = s->subscopes.find(it);
@@ -167,20 +286,46 @@ public:
 
 
     void add_bytecode(Opcode oc) {
-        bytecodes.push_back(operation{oc, {}, {}});
+        bytecodes.push_back(operation{oc, {}, {}, {}});
     }
 
     void add_bytecode_linked_method(Opcode oc, methodlink method, linkedparamindex param_index) {
-        bytecodes.push_back(operation{oc, {}, methodlinkable{param_index, method}});
+        bytecodes.push_back(operation{oc, {}, methodlinkable{param_index, method}, {}});
     }
 
     void add_bytecode_linked_label(Opcode oc, labellink label, linkedparamindex param_index) {
-        bytecodes.push_back(operation{oc, labellinkable{param_index, label}, {}});
+        bytecodes.push_back(operation{oc, labellinkable{param_index, label}, {}, {}});
     }
 
+    const Ast::Tree& tree;
     const Types::TypeTable& types;
     const ImportedMethods& imported_methods;
 
+    // optional, used for profile guided layout.
+    const ProfileData* profile;
+    // the method being generated, if any.
+    methodinfo* current_method;
+
+    // When recompiling, the methods already in the Program by name.
+    // Unless regenerate_all is set, a method with the same fingerprint is not generated again.
+    std::unordered_map<std::string, previousmethod> previous_methods;
+    bool regenerate_all;
+    // when set, every other method is kept as it is in the Program.
+    std::optional<std::string> only_method;
+    // only a Stub is generated for each method, see generate_lazy.
+    bool lazy;
+    // the methods that were generated, in order.
+    std::vector<methodinfo*> generated;
+    // when set, only these methods and globals are generated, see strip_unreachable.
+    std::optional<std::unordered_set<std::string>> keep_methods;
+    std::unordered_set<std::string> keep_globals;
+    // when unset, array indexes are never checked.
+    bool bounds_checks;
+    // array and index variables of the loops being generated, where the index is known to be in range.
+    std::vector<std::pair<std::string, std::string>> unchecked_indexes;
+    // the loops around what is being generated, innermost last.
+    std::vector<loopinfo> loops;
+
     std::vector<operation> bytecodes;
     std::unordered_map<size_t, size_t> labels;
     size_t next_label;
@@ -188,64 +333,112 @@ public:
     size_t next_stack;
     size_t next_method;
 
+    // a u64 is kept as a size_t, which is the same 8 bytes.
     std::vector<std::variant<
         float,
         int,
-        size_t
+        size_t,
+        double,
+        int64_t,
+        uint32_t
     >> constant_values;
     std::unordered_map<std::string, size_t> constant_addresses;
     size_t next_const;
 
+    CopyStats copies = {};
+
     compilerscope rootscope;
     compilerscope* current_scope;
 };
 
 bool compatible_types(const Types::TypeInfo& a, const Types::TypeInfo& b) {
-    if (a.name == b.name) {
+    if (a.id == b.id) {
         return true;
     }
-    if (a.ref_type && a.ref_type.value() == b.name) {
+    if (a.ref_type == b.id) {
         return true;
     }
-    if (b.ref_type && b.ref_type.value() == a.name) {
+    if (b.ref_type == a.id) {
         return true;
     }
     return false;
 }
 
-const Types::TypeInfo& get_type(std::string type_name, compiler_wip& wip) {
-    return wip.types.get_type(type_name);
+const Types::TypeInfo& get_type(Types::TypeId type, compiler_wip& wip) {
+    return wip.types.get_type(type);
 }
 
-bool compatible_types_by_name(std::string a, std::string b, compiler_wip& wip) {
-    return compatible_types(get_type(a, wip), get_type(b, wip));
+bool compatible_types_by_id(Types::TypeId a, Types::TypeId b, compiler_wip& wip) {
+    return a == b || compatible_types(get_type(a, wip), get_type(b, wip));
 }
 
-Bytecode assignment_opcode(std::string type_name, compiler_wip& wip) {
-    auto type = get_type(type_name, wip);
+Bytecode assignment_opcode(Types::TypeId type_id, compiler_wip& wip) {
+    const auto& type = get_type(type_id, wip);
     if (type.ref_type) {
         return Bytecode::refSet;
     }
     if (std::holds_alternative<Types::PrimitiveType>(type.type)) {
         auto prim = std::get<Types::PrimitiveType>(type.type);
-        if (prim == Types::PrimitiveType::s32) {
-            return Bytecode::s32Set;
-        }
-        else if (prim == Types::PrimitiveType::f32) {
-            return Bytecode::f32Set;
-        }
-        else if (prim == Types::PrimitiveType::boolean) {
-            return Bytecode::s32Set;
+        switch (prim) {
+        case Types::PrimitiveType::s32: return Bytecode::s32Set;
+        case Types::PrimitiveType::f32: return Bytecode::f32Set;
+        case Types::PrimitiveType::boolean: return Bytecode::s32Set;
+        case Types::PrimitiveType::s64: return Bytecode::s64Set;
+        case Types::PrimitiveType::u32: return Bytecode::u32Set;
+        case Types::PrimitiveType::u64: return Bytecode::u64Set;
+        case Types::PrimitiveType::f64: return Bytecode::f64Set;
+        case Types::PrimitiveType::u8: return Bytecode::u8Set;
+        case Types::PrimitiveType::s8: return Bytecode::s8Set;
+        case Types::PrimitiveType::u16: return Bytecode::u16Set;
+        case Types::PrimitiveType::s16: return Bytecode::s16Set;
+        default: break;
         }
     }
     return Bytecode::memSet;
 }
 
+// a struct or vector is copied as bytes, which CopyStats counts.
+bool copied_by_value(Types::TypeId type_id, compiler_wip& wip) {
+    return assignment_opcode(type_id, wip) == Bytecode::memSet;
+}
+
+void count_copy(Types::TypeId type_id, size_t bytes, bool elided, compiler_wip& wip) {
+    if (!copied_by_value(type_id, wip)) {
+        return;
+    }
+    if (elided) {
+        wip.copies.elided++;
+        wip.copies.bytes_elided += bytes;
+    }
+    else {
+        wip.copies.copies++;
+        wip.copies.bytes_copied += bytes;
+    }
+}
+
+// how an element of an array of type is read and written.
+std::pair<Bytecode, Bytecode> indexed_opcodes(Types::TypeId type) {
+    switch (type) {
+    case type_s32: return {Bytecode::s32SetFromIndexed, Bytecode::s32SetIntoIndexed};
+    case type_f32: return {Bytecode::f32SetFromIndexed, Bytecode::f32SetIntoIndexed};
+    case type_s64: return {Bytecode::s64SetFromIndexed, Bytecode::s64SetIntoIndexed};
+    case type_u32: return {Bytecode::u32SetFromIndexed, Bytecode::u32SetIntoIndexed};
+    case type_u64: return {Bytecode::u64SetFromIndexed, Bytecode::u64SetIntoIndexed};
+    case type_f64: return {Bytecode::f64SetFromIndexed, Bytecode::f64SetIntoIndexed};
+    case type_u8: return {Bytecode::u8SetFromIndexed, Bytecode::u8SetIntoIndexed};
+    case type_s8: return {Bytecode::s8SetFromIndexed, Bytecode::s8SetIntoIndexed};
+    case type_u16: return {Bytecode::u16SetFromIndexed, Bytecode::u16SetIntoIndexed};
+    case type_s16: return {Bytecode::s16SetFromIndexed, Bytecode::s16SetIntoIndexed};
+    }
+    throw "Arrays can only hold numbers";
+}
+
 template<typename T>
 size_t constant(T v, compiler_wip& wip) {
-    std::ostringstream iss;
-    iss << typeid(v).name() << v;
-    std::string key = iss.str();
+    static_assert(std::is_trivially_copyable<T>::value, "Constants are pooled by their bytes");
+    // keyed on the exact bytes, so values that print the same still get their own slot.
+    std::string key = typeid(v).name();
+    key.append(reinterpret_cast<const char*>(&v), sizeof(v));
 
     auto it = wip.constant_addresses.find(key);
     if (it != wip.constant_addresses.end()) {
@@ -259,18 +452,196 @@ size_t constant(T v, compiler_wip& wip) {
 }
 
 std::optional<methodinfo*>
-get_method_named(std::vector<std::string> scopepath, std::string name, compiler_wip& wip) {
+get_method_named(const std::vector<std::string>& scopepath, const std::string& name, compiler_wip& wip) {
     auto s = wip.get_scope(scopepath);
     auto maybe = s->methods.find(name);
     if (maybe == s->methods.end()) {
         return {};
     }
-    return &s->methods[name];
+    return &maybe->second;
 }
 
-compiled_result compile_node(std::shared_ptr<Ast::Node> n, compiler_wip& wip, std::optional<BytecodeParam> suggested_return);
+compiled_result compile_node(Ast::NodeId n, compiler_wip& wip, std::optional<BytecodeParam> suggested_return);
+
+// FNV-1a over everything in a node that affects the code generated for it.
+// Names and types are hashed by their text, so it does not depend on the order they were interned in.
+class fingerprinter {
+public:
+    fingerprinter(const compiler_wip& wip) : _wip(wip), _hash(14695981039346656037ull) {}
+
+    template <typename T>
+    void add(T v) {
+        add_bytes(&v, sizeof(v));
+    }
+    void add_bytes(const void* data, size_t size) {
+        auto bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            _hash = (_hash ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+    void add_text(const std::string& s) {
+        add(s.size());
+        add_bytes(s.data(), s.size());
+    }
+    void add_name(Ast::Name n) {
+        add_text(_wip.tree.name(n));
+    }
+    void add_names(Ast::NameList l) {
+        add(l.count);
+        for (auto n : _wip.tree.names(l)) {
+            add_name(n);
+        }
+    }
+    void add_type(Types::TypeId type) {
+        add_text(_wip.types.get_type(type).name);
+    }
+    void add_nodes(Ast::NodeList l) {
+        add(l.count);
+        for (auto n : _wip.tree.list(l)) {
+            add_node(n);
+        }
+    }
+    void add_optional_node(std::optional<Ast::NodeId> n) {
+        add(n.has_value());
+        if (n) {
+            add_node(n.value());
+        }
+    }
+    void add_node(Ast::NodeId id) {
+        auto& data = _wip.tree.get(id).data;
+        add(data.index());
+        if (auto* v = std::get_if<Ast::ConstS32>(&data)) {
+            add(v->num);
+        }
+        else if (auto* v = std::get_if<Ast::ConstF32>(&data)) {
+            add(v->num);
+        }
+        else if (auto* v = std::get_if<Ast::ConstBool>(&data)) {
+            add(v->value);
+        }
+        else if (auto* v = std::get_if<Ast::ConstS64>(&data)) {
+            add(v->num);
+        }
+        else if (auto* v = std::get_if<Ast::ConstU32>(&data)) {
+            add(v->num);
+        }
+        else if (auto* v = std::get_if<Ast::ConstU64>(&data)) {
+            add(v->num);
+        }
+        else if (auto* v = std::get_if<Ast::ConstF64>(&data)) {
+            add(v->num);
+        }
+        else if (auto* v = std::get_if<Ast::BinaryOperation>(&data)) {
+            add(v->op);
+            add_node(v->lhs);
+            add_node(v->rhs);
+        }
+        else if (auto* v = std::get_if<Ast::UnaryOperation>(&data)) {
+            add(v->op);
+            add_node(v->value);
+        }
+        else if (auto* v = std::get_if<Ast::SetOperation>(&data)) {
+            add(v->op.has_value());
+            if (v->op) {
+                add(v->op.value());
+            }
+            add_node(v->lhs);
+            add_node(v->rhs);
+        }
+        else if (auto* v = std::get_if<Ast::Identifier>(&data)) {
+            add_names(v->scopes);
+            add_name(v->name);
+        }
+        else if (auto* v = std::get_if<Ast::AccessMember>(&data)) {
+            add_node(v->container);
+            add_node(v->member);
+        }
+        else if (auto* v = std::get_if<Ast::IndexAccess>(&data)) {
+            add_node(v->container);
+            add_node(v->index);
+        }
+        else if (auto* v = std::get_if<Ast::VariableDeclaration>(&data)) {
+            add_name(v->name);
+            add_type(v->type);
+            add(v->is_mutable);
+        }
+        else if (auto* v = std::get_if<Ast::GlobalBlock>(&data)) {
+            add_nodes(v->nodes);
+        }
+        else if (auto* v = std::get_if<Ast::Block>(&data)) {
+            add_nodes(v->nodes);
+        }
+        else if (auto* v = std::get_if<Ast::IfStmt>(&data)) {
+            add_node(v->condition);
+            add_node(v->then);
+            add_optional_node(v->otherwise);
+        }
+        else if (auto* v = std::get_if<Ast::DoWhile>(&data)) {
+            add_node(v->block);
+            add_node(v->condition);
+            add_optional_node(v->iteration);
+        }
+        else if (auto* v = std::get_if<Ast::ForRange>(&data)) {
+            add_name(v->name);
+            add_node(v->start);
+            add_node(v->end);
+            add_node(v->block);
+        }
+        else if (auto* v = std::get_if<Ast::ForEach>(&data)) {
+            add_name(v->name);
+            add_node(v->array);
+            add_node(v->block);
+        }
+        else if (auto* v = std::get_if<Ast::MatchStmt>(&data)) {
+            add_node(v->value);
+            add_nodes(v->cases);
+            add_optional_node(v->otherwise);
+        }
+        else if (auto* v = std::get_if<Ast::MatchCase>(&data)) {
+            add_nodes(v->values);
+            add_node(v->block);
+        }
+        else if (auto* v = std::get_if<Ast::MethodDeclaration>(&data)) {
+            add_names(v->scopes);
+            add_name(v->name);
+            add_type(v->type);
+        }
+        else if (auto* v = std::get_if<Ast::MethodDefinition>(&data)) {
+            add_method(*v);
+        }
+        else if (auto* v = std::get_if<Ast::ReturnValue>(&data)) {
+            add_optional_node(v->value);
+        }
+        else if (auto* v = std::get_if<Ast::CallParam>(&data)) {
+            add_node(v->value);
+        }
+        else if (auto* v = std::get_if<Ast::MethodCall>(&data)) {
+            add_node(v->callable);
+            add_nodes(v->params);
+        }
+        else if (auto* v = std::get_if<Ast::CppTypeid>(&data)) {
+            add_type(v->type);
+        }
+    }
+
+    void add_method(const Ast::MethodDefinition& method) {
+        add_names(method.scopes);
+        add_name(method.name);
+        add_type(method.type);
+        add_names(method.param_names);
+        add_node(method.node);
+    }
+
+    uint64_t value() const {
+        return _hash;
+    }
+
+private:
+    const compiler_wip& _wip;
+    uint64_t _hash;
+};
 
-compiled_result compile_const_s32(Ast::ConstS32& s32node, compiler_wip& wip) {
+compiled_result compile_const_s32(const Ast::ConstS32& s32node, compiler_wip& wip) {
     size_t address = constant<int>(s32node.num, wip);
     return {
         type_s32,
@@ -282,7 +653,7 @@ compiled_result compile_const_s32(Ast::ConstS32& s32node, compiler_wip& wip) {
     };
 }
 
-compiled_result compile_const_f32(Ast::ConstF32& f32node, compiler_wip& wip) {
+compiled_result compile_const_f32(const Ast::ConstF32& f32node, compiler_wip& wip) {
     size_t address = constant<float>(f32node.num, wip);
     return {
         type_f32,
@@ -294,7 +665,7 @@ compiled_result compile_const_f32(Ast::ConstF32& f32node, compiler_wip& wip) {
     };
 }
 
-compiled_result compile_const_bool(Ast::ConstBool& bnode, compiler_wip& wip) {
+compiled_result compile_const_bool(const Ast::ConstBool& bnode, compiler_wip& wip) {
     size_t address = constant<bool>(bnode.value, wip);
     return {
         type_bool,
@@ -306,10 +677,27 @@ compiled_result compile_const_bool(Ast::ConstBool& bnode, compiler_wip& wip) {
     };
 }
 
+// the 64-bit and unsigned constants, T being how the constant table holds them.
+template<typename T>
+compiled_result compile_const_number(T num, Types::TypeId type, compiler_wip& wip) {
+    size_t address = constant<T>(num, wip);
+    return {
+        type,
+        Types::Mutable::yes,
+        false,
+        ConstantAddress(LocMemoryDirect, address),
+        0,
+        0
+    };
+}
+
 std::optional<compiled_result>
-find_method(std::vector<std::string> scope_names, std::string ident, compiler_wip& wip) {
+find_method(const std::vector<std::string>& scope_names, const std::string& ident, compiler_wip& wip) {
     auto maybe_method = get_method_named(scope_names, ident, wip);
     if (maybe_method) {
+        if (wip.current_method) {
+            wip.current_method->uses_methods.insert(ident);
+        }
         // Note that method references would be handled above.
         return compiled_result{
             maybe_method.value()->type,
@@ -324,7 +712,7 @@ find_method(std::vector<std::string> scope_names, std::string ident, compiler_wi
     auto scope = wip.get_scope(scope_names);
     auto maybe_imported = scope->imported_method_names.find(ident);
     if (maybe_imported != scope->imported_method_names.end()) {
-        auto method = wip.imported_methods[maybe_imported->second];
+        const auto& method = wip.imported_methods[maybe_imported->second];
         return compiled_result{
             method.type,
             Types::Mutable::no,
@@ -337,51 +725,54 @@ find_method(std::vector<std::string> scope_names, std::string ident, compiler_wi
     return {};
 }
 
-compiled_result compile_identifier(Ast::Identifier n, compiler_wip& wip) {
-    auto ident = n.name;
+compiled_result compile_identifier(const Ast::Identifier& n, compiler_wip& wip) {
+    const auto& ident = wip.tree.name(n.name);
+    auto scopes = wip.scope_path(n.scopes);
 
-    auto scope = wip.get_scope(n.scopes);
+    auto scope = wip.get_scope(scopes);
 
-    for (size_t i = scope->local_variables.size(); i--;) {
-        auto lv = scope->local_variables[i];
-        auto it = lv.find(ident);
-        if (it != lv.end()) {
-            auto type = wip.types.get_type(it->second.type);
-            DataLoc ptr = LocMemoryDirect;
-            if (type.ref_type) {
-                ptr = LocMemoryIndirect;
-            }
-            BytecodeParam ret;
-            if (i == 0) {
-                ret = GlobalAddress(ptr, it->second.address);
-            }
-            else {
-                ret = StackAddressForward(ptr, it->second.address);
+    if (auto sym = scope->variables.find(ident)) {
+        const auto& var = sym->variable;
+        const auto& type = wip.types.get_type(var.type);
+        DataLoc ptr = LocMemoryDirect;
+        if (type.ref_type) {
+            ptr = LocMemoryIndirect;
+        }
+        BytecodeParam ret;
+        if (sym->depth == 0) {
+            ret = GlobalAddress(ptr, var.address);
+            if (wip.current_method) {
+                wip.current_method->uses_globals.insert(ident);
             }
-            return {
-                type.name,
-                it->second.is_mutable,
-                it->second.is_mutable == Types::Mutable::yes,
-                ret,
-                0,
-                0
-            };
         }
+        else {
+            ret = StackAddressForward(ptr, var.address);
+        }
+        return {
+            type.id,
+            var.is_mutable,
+            var.is_mutable == Types::Mutable::yes,
+            ret,
+            0,
+            0
+        };
     }
 
-    auto maybe_method = find_method(n.scopes, ident, wip);
+    auto maybe_method = find_method(scopes, ident, wip);
     if (maybe_method) {
         return maybe_method.value();
     }
 
     // TODO: any way to have enum in a scope?
-    if (n.scopes.size() == 1 && wip.types.type_exists(n.scopes[0])) {
-        auto t = wip.types.get_type(n.scopes[0]);
+    auto maybe_enum = scopes.size() == 1 ? wip.types.find_type(scopes[0]) : std::nullopt;
+    if (maybe_enum) {
+        const auto& t = wip.types.get_type(maybe_enum.value());
         if (std::holds_alternative<Types::EnumType>(t.type)) {
-            auto enum_values = std::get<Types::EnumType>(t.type).values;
+            const auto& enum_values = std::get<Types::EnumType>(t.type).values;
 
-            if (enum_values.contains(ident)) {
-                int value = enum_values[ident];
+            auto it = enum_values.find(ident);
+            if (it != enum_values.end()) {
+                int value = it->second;
 
                 size_t address = constant<int>(value, wip);
                 return {
@@ -399,10 +790,173 @@ compiled_result compile_identifier(Ast::Identifier n, compiler_wip& wip) {
     throw "Identifier not found";
 }
 
-compiled_result compile_memberaccess(Ast::AccessMember& access, compiler_wip& wip) {
-    auto lhs = compile_node(access.container, wip, {});
-    auto lhstype = wip.types.get_type(lhs.type);
+// The member of a struct value, or of the struct a ref points to.
+std::optional<compiled_result>
+compile_structmember(const compiled_result& lhs, const std::string& name, compiler_wip& wip) {
+    const auto& lhstype = wip.types.get_type(lhs.type);
+    if (!std::holds_alternative<Types::StructType>(lhstype.type)) {
+        return {};
+    }
+    const auto& structinfo = std::get<Types::StructType>(lhstype.type);
+    auto maybe_value = structinfo.members.find(name);
+    if (maybe_value == structinfo.members.end()) {
+        return {};
+    }
     auto address = std::get<BytecodeParam>(lhs.address);
+    const auto& value = maybe_value->second;
+    const auto& value_type = get_type(value.type, wip);
+
+    if (lhstype.ref_type) {
+        // TODO: could we save stack by re-using space here?
+        // we create a new ptr to the value by doing a sizet add.
+        size_t temp = wip.next_stack;
+        wip.next_stack += sizeof(size_t);
+        auto offsetaddr = ConstantAddress(LocMemoryDirect, constant<size_t>(value.offset, wip));
+
+        // the result of an access to a ref is always a ref.
+        // We set the direct/indirect loc of dest/P2 of the bytecode to signify the VM needs to deref.
+        auto resultaddr = StackAddressForward(LocMemoryDirect, temp);
+        Types::TypeId value_type_id = value.type;
+        if (value_type.ref_type) {
+            // if the member is a ref, we need to deref the first to not return a double-ptr.
+            resultaddr = StackAddressForward(LocMemoryIndirect, temp);
+        }
+        else {
+            // even if the member is not a ref, we still return a ptr.
+            value_type_id = value_type.ref_to.value();
+        }
+        wip.add_bytecode(Opcode(Bytecode::refAdd, address, offsetaddr, resultaddr));
+
+        return compiled_result{
+            value_type_id,
+            lhs.is_mutable == Types::Mutable::yes ? value.is_mutable : Types::Mutable::no,
+            lhs.assignable && value.is_mutable == Types::Mutable::yes,
+            // always return an indirect for another to use
+            StackAddressForward(LocMemoryIndirect, temp),
+            sizeof(size_t),
+            lhs.stack_bytes_used + value_type.size
+        };
+    }
+    else {
+        address.offset += value.offset;
+
+        // For non-refs, we just return the value as-is.
+        // We don't wrap into a ref.
+        return compiled_result{
+            value.type,
+            lhs.is_mutable == Types::Mutable::yes ? value.is_mutable : Types::Mutable::no,
+            lhs.assignable && value.is_mutable == Types::Mutable::yes,
+            address,
+            lhs.stack_bytes_returned,
+            lhs.stack_bytes_used
+        };
+    }
+}
+
+// A chain of member accesses from a base value.
+// The offsets of members held by value are added up, so a.b.c through a ref is a single add.
+struct fieldpath {
+    compiled_result base;
+    Types::TypeId type;
+    Types::Mutable is_mutable;
+    bool assignable;
+    size_t offset;
+    size_t steps;
+};
+
+fieldpath
+start_fieldpath(const compiled_result& base) {
+    return {base, base.type, base.is_mutable, base.assignable, 0, 0};
+}
+
+// The path only reaches a field once there is at least one member in it.
+bool
+through_ref(const fieldpath& path, compiler_wip& wip) {
+    return path.steps > 0 && get_type(path.base.type, wip).ref_type.has_value();
+}
+
+// Fields that are loaded and stored straight from the ref with the *Field opcodes.
+bool
+fused_field(const fieldpath& path, compiler_wip& wip) {
+    return through_ref(path, wip)
+        && (path.type == type_s32 || path.type == type_f32)
+        && path.offset <= ParamAddressOffsetMask;
+}
+
+// Emits what is needed for the address of the whole path.
+compiled_result
+materialize_fieldpath(const fieldpath& path, compiler_wip& wip) {
+    if (path.steps == 0) {
+        return path.base;
+    }
+    auto address = std::get<BytecodeParam>(path.base.address);
+    const auto& value_type = get_type(path.type, wip);
+
+    if (!through_ref(path, wip)) {
+        address.offset += path.offset;
+        return {
+            path.type,
+            path.is_mutable,
+            path.assignable,
+            address,
+            path.base.stack_bytes_returned,
+            path.base.stack_bytes_used
+        };
+    }
+
+    // a single add for all of the members, like compile_structmember would for one.
+    size_t temp = wip.next_stack;
+    wip.next_stack += sizeof(size_t);
+    auto offsetaddr = ConstantAddress(LocMemoryDirect, constant<size_t>(path.offset, wip));
+    wip.add_bytecode(Opcode(Bytecode::refAdd, address, offsetaddr, StackAddressForward(LocMemoryDirect, temp)));
+
+    return {
+        value_type.ref_to.value(),
+        path.is_mutable,
+        path.assignable,
+        StackAddressForward(LocMemoryIndirect, temp),
+        sizeof(size_t),
+        path.base.stack_bytes_used + value_type.size
+    };
+}
+
+// Moves the path on to a member of the struct it is at, false if there is no such member.
+bool
+extend_fieldpath(fieldpath& path, const std::string& name, compiler_wip& wip) {
+    const auto& type = get_type(path.type, wip);
+    if (std::holds_alternative<Types::StructType>(type.type)) {
+        const auto& structinfo = std::get<Types::StructType>(type.type);
+        auto maybe_value = structinfo.members.find(name);
+        if (maybe_value != structinfo.members.end() && !get_type(maybe_value->second.type, wip).ref_type) {
+            const auto& value = maybe_value->second;
+            path.type = value.type;
+            path.is_mutable = path.is_mutable == Types::Mutable::yes ? value.is_mutable : Types::Mutable::no;
+            path.assignable = path.assignable && value.is_mutable == Types::Mutable::yes;
+            path.offset += value.offset;
+            path.steps++;
+            return true;
+        }
+    }
+
+    // a member that is a ref has to be loaded before going on.
+    path = start_fieldpath(materialize_fieldpath(path, wip));
+    auto maybe_member = compile_structmember(path.base, name, wip);
+    if (!maybe_member) {
+        return false;
+    }
+    path = start_fieldpath(maybe_member.value());
+    return true;
+}
+
+fieldpath
+compile_fieldpath(const Ast::AccessMember& access, compiler_wip& wip) {
+    fieldpath path;
+    if (auto* container = std::get_if<Ast::AccessMember>(&wip.tree.get(access.container).data)) {
+        path = compile_fieldpath(*container, wip);
+    }
+    else {
+        path = start_fieldpath(compile_node(access.container, wip, {}));
+    }
 
     // Tuples use consts32 (ex mytup.0) for accesses.
     //if (std::holds_alternative<TupleType>(lhstype.type)) {
@@ -431,75 +985,21 @@ compiled_result compile_memberaccess(Ast::AccessMember& access, compiler_wip& wi
     //        };
     //    }
     //}
-    if (std::holds_alternative<Types::StructType>(lhstype.type)) {
-        auto structinfo = std::get<Types::StructType>(lhstype.type);
-        if (std::holds_alternative<Ast::Identifier>(access.member->data)) {
-            std::string name = std::get<Ast::Identifier>(access.member->data).name;
-            auto maybe_value = structinfo.members.find(name);
-            if (maybe_value != structinfo.members.end()) {
-                auto value = maybe_value->second;
-                auto value_type = get_type(value.type, wip);
-
-                if (lhstype.ref_type) {
-                    // TODO: could we save stack by re-using space here?
-                    // we create a new ptr to the value by doing a sizet add.
-                    size_t temp = wip.next_stack;
-                    wip.next_stack += sizeof(size_t);
-                    auto offsetaddr = ConstantAddress(LocMemoryDirect, constant<size_t>(value.offset, wip));
-
-                    // the result of an access to a ref is always a ref.
-                    // We set the direct/indirect loc of dest/P2 of the bytecode to signify the VM needs to deref.
-                    auto resultaddr = StackAddressForward(LocMemoryDirect, temp);
-                    std::string value_type_name = value.type;
-                    if (value_type.ref_type) {
-                        // if the member is a ref, we need to deref the first to not return a double-ptr.
-                        resultaddr = StackAddressForward(LocMemoryIndirect, temp);
-                    }
-                    else {
-                        // even if the member is not a ref, we still return a ptr.
-                        value_type_name = "ref " + value_type_name;
-                    }
-                    wip.add_bytecode(Opcode(Bytecode::refAdd, address, offsetaddr, resultaddr));
-
-                    return {
-                        value_type_name,
-                        lhs.is_mutable == Types::Mutable::yes ? value.is_mutable : Types::Mutable::no,
-                        lhs.assignable && value.is_mutable == Types::Mutable::yes,
-                        // always return an indirect for another to use
-                        StackAddressForward(LocMemoryIndirect, temp),
-                        sizeof(size_t),
-                        lhs.stack_bytes_used + value_type.size
-                    };
-                }
-                else {
-                    address.offset += value.offset;
-
-                    // For non-refs, we just return the value as-is.
-                    // We don't wrap into a ref.
-                    return {
-                        value.type,
-                        lhs.is_mutable == Types::Mutable::yes ? value.is_mutable : Types::Mutable::no,
-                        lhs.assignable && value.is_mutable == Types::Mutable::yes,
-                        address,
-                        lhs.stack_bytes_returned,
-                        lhs.stack_bytes_used
-                    };
-                }
-            }
+    if (auto* member = std::get_if<Ast::Identifier>(&wip.tree.get(access.member).data)) {
+        const auto& name = wip.tree.name(member->name);
+        if (extend_fieldpath(path, name, wip)) {
+            return path;
         }
-    }
-
-    if (std::holds_alternative<Ast::Identifier>(access.member->data)) {
-        std::string name = std::get<Ast::Identifier>(access.member->data).name;
 
-        auto maybe_method = find_method({lhs.type}, name, wip);
+        const auto& lhstype = wip.types.get_type(path.base.type);
+        auto maybe_method = find_method({lhstype.name}, name, wip);
         if (maybe_method) {
-            return maybe_method.value();
+            return start_fieldpath(maybe_method.value());
         }
         if (lhstype.ref_type) {
-            auto maybe_method = find_method({lhstype.ref_type.value()}, name, wip);
+            auto maybe_method = find_method({get_type(lhstype.ref_type.value(), wip).name}, name, wip);
             if (maybe_method) {
-                return maybe_method.value();
+                return start_fieldpath(maybe_method.value());
             }
         }
         std::cout << "Did not find " << name << "\n";
@@ -508,78 +1008,256 @@ compiled_result compile_memberaccess(Ast::AccessMember& access, compiler_wip& wi
     throw "Unknown member to access";
 }
 
-compiled_result reserve_local(std::string name, std::string type_name, Types::Mutable is_mutable, compiler_wip& wip) {
-    auto& loc = wip.current_scope->local_variables[wip.current_scope->local_variables.size() - 1];
-    if (loc.find(name) != loc.end()) {
-        // TODO: shadow probably would work fine without
-        throw "Ident already declared";
-    }
-    auto type = wip.types.get_type(type_name);
-    auto address = wip.next_stack;
-    auto size = type.size;
+compiled_result
+compile_loadfield(const fieldpath& path, compiler_wip& wip) {
+    auto ref = std::get<BytecodeParam>(path.base.address);
+    ref.loc = LocMemoryDirect;
+    size_t size = get_type(path.type, wip).size;
+    size_t temp = wip.next_stack;
     wip.next_stack += size;
-    loc[name] = {
-        name, type_name, is_mutable, address
+
+    auto opcode = path.type == type_s32 ? Bytecode::s32LoadField : Bytecode::f32LoadField;
+    wip.add_bytecode(Opcode(opcode, ref, StackSize(LocMemoryDirect, path.offset), StackAddressForward(LocMemoryDirect, temp)));
+
+    return {
+        path.type,
+        path.is_mutable,
+        false,
+        StackAddressForward(LocMemoryDirect, temp),
+        size,
+        path.base.stack_bytes_used + size
     };
-    DataLoc dloc = LocMemoryDirect;
-    if (type.ref_type) {
-        dloc = LocMemoryIndirect;
+}
+
+// Stores value into the field, freeing the stack back to stack_begin.
+compiled_result
+compile_storefield(const fieldpath& path, const compiled_result& value, size_t stack_begin, compiler_wip& wip) {
+    if (!path.assignable) {
+        throw "lhs is not assignable";
+    }
+    if (path.is_mutable == Types::Mutable::yes && value.is_mutable == Types::Mutable::no) {
+        throw "Unable to assign immutable value to a mutable variable";
+    }
+    if (!compatible_types_by_id(path.type, value.type, wip)) {
+        throw "Cannot set lhs to rhs as the types do not match";
     }
+    auto ref = std::get<BytecodeParam>(path.base.address);
+    ref.loc = LocMemoryDirect;
+
+    auto opcode = path.type == type_s32 ? Bytecode::s32StoreField : Bytecode::f32StoreField;
+    wip.add_bytecode(Opcode(opcode, std::get<BytecodeParam>(value.address), StackSize(LocMemoryDirect, path.offset), ref));
+    size_t total_used = std::max(value.stack_bytes_used, path.base.stack_bytes_used + value.stack_bytes_returned);
+    wip.next_stack = stack_begin;
+
     return {
-        type_name,
-        is_mutable,
-        true,
-        StackAddressForward(dloc, address),
-        size,
-        size
+        path.type,
+        path.is_mutable,
+        false,
+        value.address,
+        0,
+        total_used
     };
 }
 
-compiled_result compile_vardecl(Ast::VariableDeclaration& decl, compiler_wip& wip) {
-    return reserve_local(decl.name, decl.type, decl.is_mutable, wip);
+// A field read through a ref is loaded straight into a temp, unless its address is wanted.
+compiled_result compile_memberaccess(const Ast::AccessMember& access, compiler_wip& wip, bool want_address = false) {
+    auto path = compile_fieldpath(access, wip);
+    if (!want_address && fused_field(path, wip)) {
+        return compile_loadfield(path, wip);
+    }
+    return materialize_fieldpath(path, wip);
 }
 
-compiled_result compile_unaryop(Ast::UnaryOperation& opnode, compiler_wip& wip, std::optional<BytecodeParam> suggested_return) {
-    size_t stack = 0;
-    size_t stack_start = wip.next_stack;
+// An element of an array, ready for one of the indexed opcodes.
+struct indexedelement {
+    // where the pointer to the elements is, as an indirect.
+    BytecodeParam data;
+    BytecodeParam index;
+    Types::TypeId type;
+    Types::Mutable is_mutable;
+    size_t stack_bytes_used;
+};
 
-    size_t total_used = 0;
+bool
+is_local_named(Ast::NodeId id, const std::string& name, compiler_wip& wip) {
+    auto* ident = std::get_if<Ast::Identifier>(&wip.tree.get(id).data);
+    return ident && ident->scopes.count == 0 && wip.tree.name(ident->name) == name;
+}
 
-    auto value_ret = compile_node(opnode.value, wip, {});
-    total_used = value_ret.stack_bytes_used;
+// Whether a loop already keeps the index within the array, see compile_block.
+bool
+index_in_range(const Ast::IndexAccess& access, compiler_wip& wip) {
+    for (auto& [array, index] : wip.unchecked_indexes) {
+        if (is_local_named(access.container, array, wip) && is_local_named(access.index, index, wip)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+indexedelement
+compile_indexed(const Ast::IndexAccess& access, compiler_wip& wip) {
+    auto array = compile_node(access.container, wip, {});
+    const auto* arraytype = &get_type(array.type, wip);
+    auto address = std::get<BytecodeParam>(array.address);
+    size_t total_used = array.stack_bytes_used;
 
-    auto lhstypeinfo = get_type(value_ret.type, wip);
-    if (lhstypeinfo.ref_type) {
-        lhstypeinfo = get_type(lhstypeinfo.ref_type.value(), wip);
+    if (arraytype->ref_type) {
+        // the opcodes want the array itself, not a pointer to it.
+        arraytype = &get_type(arraytype->ref_type.value(), wip);
+        size_t temp = wip.next_stack;
+        wip.next_stack += arraytype->size;
+        wip.add_bytecode(Opcode(Bytecode::Dereference, address, StackSize(LocMemoryDirect, arraytype->size), StackAddressForward(LocMemoryDirect, temp)));
+        address = StackAddressForward(LocMemoryDirect, temp);
+        total_used += arraytype->size;
     }
-    auto maybeOp = lhstypeinfo.unary_operators.find(opnode.op);
-    if (maybeOp == lhstypeinfo.unary_operators.end()) {
-        throw "Operator not supported by type";
+    if (!arraytype->element_type) {
+        throw "Only arrays can be indexed";
     }
-    auto op = maybeOp->second.method;
-    auto optype = maybeOp->second.return_type;
 
-    BytecodeParam ret;
-    if (suggested_return) {
-        ret = suggested_return.value();
+    auto index = compile_node(access.index, wip, {});
+    if (index.type != type_s32) {
+        throw "An array index must be s32";
     }
-    else if (value_ret.stack_bytes_returned >= wip.types.get_type(optype).size) {
-        // attempt to re-use any temporaries from the rhs
-        ret = std::get<BytecodeParam>(value_ret.address);
-        stack = value_ret.stack_bytes_returned;
-    }
-    else {
-        size_t addr = wip.next_stack;
-        size_t size = wip.types.get_type(optype).size;
-        wip.next_stack += size;
-        ret = StackAddressForward(LocMemoryDirect, addr);
-        stack = value_ret.stack_bytes_returned + size;
-        total_used += size;
+    total_used = std::max(total_used, index.stack_bytes_used);
+
+    if (wip.bounds_checks && !index_in_range(access, wip)) {
+        wip.add_bytecode(Opcode(Bytecode::arrayCheck, address, std::get<BytecodeParam>(index.address)));
     }
+    address.loc = LocMemoryIndirect;
 
-    if (std::holds_alternative<Types::TypeOperatorBytecode>(op)) {
-        auto bc = std::get<Types::TypeOperatorBytecode>(op).bytecode;
-        wip.add_bytecode(
+    return {
+        address,
+        std::get<BytecodeParam>(index.address),
+        arraytype->element_type.value(),
+        array.is_mutable,
+        total_used
+    };
+}
+
+compiled_result compile_indexaccess(const Ast::IndexAccess& access, compiler_wip& wip) {
+    auto element = compile_indexed(access, wip);
+    size_t size = get_type(element.type, wip).size;
+    size_t temp = wip.next_stack;
+    wip.next_stack += size;
+
+    auto opcode = indexed_opcodes(element.type).first;
+    wip.add_bytecode(Opcode(opcode, element.data, element.index, StackAddressForward(LocMemoryDirect, temp)));
+
+    return {
+        element.type,
+        // a copy of the element.
+        Types::Mutable::yes,
+        false,
+        StackAddressForward(LocMemoryDirect, temp),
+        size,
+        element.stack_bytes_used + size
+    };
+}
+
+// Stores value into the element, freeing the stack back to stack_begin.
+compiled_result
+compile_indexstore(const indexedelement& element, const compiled_result& value, size_t stack_begin, compiler_wip& wip) {
+    if (element.is_mutable == Types::Mutable::no) {
+        throw "lhs is not assignable";
+    }
+    if (value.is_mutable == Types::Mutable::no) {
+        throw "Unable to assign immutable value to a mutable variable";
+    }
+    if (!compatible_types_by_id(element.type, value.type, wip)) {
+        throw "Cannot set lhs to rhs as the types do not match";
+    }
+
+    auto opcode = indexed_opcodes(element.type).second;
+    wip.add_bytecode(Opcode(opcode, std::get<BytecodeParam>(value.address), element.index, element.data));
+    size_t total_used = std::max(value.stack_bytes_used, element.stack_bytes_used + value.stack_bytes_returned);
+    wip.next_stack = stack_begin;
+
+    return {
+        element.type,
+        element.is_mutable,
+        false,
+        value.address,
+        0,
+        total_used
+    };
+}
+
+compiled_result reserve_local(const std::string& name, Types::TypeId type_id, Types::Mutable is_mutable, compiler_wip& wip) {
+    auto& variables = wip.current_scope->variables;
+    if (variables.declared_in_scope(name)) {
+        // TODO: shadow probably would work fine without
+        throw "Ident already declared";
+    }
+    const auto& type = wip.types.get_type(type_id);
+    // a narrow global only takes its own bytes, lined up to its size. Everything else is on a 4 byte slot.
+    bool packed = variables.depth() == 0 && type.narrow_size;
+    size_t align = packed ? type.narrow_size.value() : runtimesizeof<int>();
+    auto address = ((wip.next_stack + align - 1) / align) * align;
+    auto size = packed ? type.narrow_size.value() : type.size;
+    wip.next_stack = address + size;
+    variables.add({
+        name, type_id, is_mutable, address
+    });
+    DataLoc dloc = LocMemoryDirect;
+    if (type.ref_type) {
+        dloc = LocMemoryIndirect;
+    }
+    return {
+        type_id,
+        is_mutable,
+        true,
+        StackAddressForward(dloc, address),
+        size,
+        size
+    };
+}
+
+compiled_result compile_vardecl(const Ast::VariableDeclaration& decl, compiler_wip& wip) {
+    return reserve_local(wip.tree.name(decl.name), decl.type, decl.is_mutable, wip);
+}
+
+compiled_result compile_unaryop(const Ast::UnaryOperation& opnode, compiler_wip& wip, std::optional<BytecodeParam> suggested_return) {
+    size_t stack = 0;
+    size_t stack_start = wip.next_stack;
+
+    size_t total_used = 0;
+
+    auto value_ret = compile_node(opnode.value, wip, {});
+    total_used = value_ret.stack_bytes_used;
+
+    const auto* lhstypeinfo = &get_type(value_ret.type, wip);
+    if (lhstypeinfo->ref_type) {
+        lhstypeinfo = &get_type(lhstypeinfo->ref_type.value(), wip);
+    }
+    auto maybeOp = lhstypeinfo->unary_operators.find(opnode.op);
+    if (maybeOp == lhstypeinfo->unary_operators.end()) {
+        throw "Operator not supported by type";
+    }
+    const auto& op = maybeOp->second.method;
+    Types::TypeId optype = maybeOp->second.return_type;
+
+    BytecodeParam ret;
+    if (suggested_return) {
+        ret = suggested_return.value();
+    }
+    else if (value_ret.stack_bytes_returned >= wip.types.get_type(optype).size) {
+        // attempt to re-use any temporaries from the rhs
+        ret = std::get<BytecodeParam>(value_ret.address);
+        stack = value_ret.stack_bytes_returned;
+    }
+    else {
+        size_t addr = wip.next_stack;
+        size_t size = wip.types.get_type(optype).size;
+        wip.next_stack += size;
+        ret = StackAddressForward(LocMemoryDirect, addr);
+        stack = value_ret.stack_bytes_returned + size;
+        total_used += size;
+    }
+
+    if (std::holds_alternative<Types::TypeOperatorBytecode>(op)) {
+        auto bc = std::get<Types::TypeOperatorBytecode>(op).bytecode;
+        wip.add_bytecode(
             Opcode(bc, std::get<BytecodeParam>(value_ret.address), ret)
         );
     }
@@ -600,7 +1278,7 @@ compiled_result compile_unaryop(Ast::UnaryOperation& opnode, compiler_wip& wip,
     };
 }
 
-compiled_result compile_shared_binop(std::shared_ptr<Ast::Node> lhs, std::shared_ptr<Ast::Node> rhs, Ast::BinaryOps operation, compiler_wip& wip, std::optional<BytecodeParam> suggested_return) {
+compiled_result compile_shared_binop(Ast::NodeId lhs, Ast::NodeId rhs, Ast::BinaryOps operation, compiler_wip& wip, std::optional<BytecodeParam> suggested_return) {
     // TODO: reduce temporary/stack usage
     // I think I should pass down a "please store here"
     size_t stack = 0;
@@ -619,20 +1297,20 @@ compiled_result compile_shared_binop(std::shared_ptr<Ast::Node> lhs, std::shared
         total_used = lhs_ret.stack_bytes_used + rhs_ret.stack_bytes_returned;
     }
 
-    if (!compatible_types_by_name(lhs_ret.type, rhs_ret.type, wip)) {
+    if (!compatible_types_by_id(lhs_ret.type, rhs_ret.type, wip)) {
         throw "Incompatible types";
     }
 
-    auto lhstypeinfo = get_type(lhs_ret.type, wip);
-    if (lhstypeinfo.ref_type) {
-        lhstypeinfo = get_type(lhstypeinfo.ref_type.value(), wip);
+    const auto* lhstypeinfo = &get_type(lhs_ret.type, wip);
+    if (lhstypeinfo->ref_type) {
+        lhstypeinfo = &get_type(lhstypeinfo->ref_type.value(), wip);
     }
-    auto maybeOp = lhstypeinfo.binary_operators.find(operation);
-    if (maybeOp == lhstypeinfo.binary_operators.end()) {
+    auto maybeOp = lhstypeinfo->binary_operators.find(operation);
+    if (maybeOp == lhstypeinfo->binary_operators.end()) {
         throw "Operator not supported by type";
     }
-    auto op = maybeOp->second.method;
-    auto optype = maybeOp->second.return_type;
+    const auto& op = maybeOp->second.method;
+    Types::TypeId optype = maybeOp->second.return_type;
 
     // TODO: there is one more re-use case I hadnt thought before:
     // we could reuse params / stack elements.
@@ -684,20 +1362,55 @@ compiled_result compile_shared_binop(std::shared_ptr<Ast::Node> lhs, std::shared
     };
 }
 
-compiled_result compile_binop(Ast::BinaryOperation& opnode, compiler_wip& wip, std::optional<BytecodeParam> suggested_return) {
+compiled_result compile_binop(const Ast::BinaryOperation& opnode, compiler_wip& wip, std::optional<BytecodeParam> suggested_return) {
     return compile_shared_binop(opnode.lhs, opnode.rhs, opnode.op, wip, suggested_return);
 }
 
-compiled_result compile_setop(Ast::SetOperation& opnode, compiler_wip& wip) {
+compiled_result compile_setop(const Ast::SetOperation& opnode, compiler_wip& wip) {
     compiled_result assign_value;
     size_t stack_begin = wip.next_stack;
 
-    auto assign_to = compile_node(opnode.lhs, wip, {});
+    compiled_result assign_to;
+    if (auto* access = std::get_if<Ast::IndexAccess>(&wip.tree.get(opnode.lhs).data)) {
+        auto element = compile_indexed(*access, wip);
+        if (opnode.op) {
+            assign_value = compile_shared_binop(opnode.lhs, opnode.rhs, opnode.op.value(), wip, {});
+        }
+        else {
+            assign_value = compile_node(opnode.rhs, wip, {});
+        }
+        return compile_indexstore(element, assign_value, stack_begin, wip);
+    }
+    else if (auto* access = std::get_if<Ast::AccessMember>(&wip.tree.get(opnode.lhs).data)) {
+        auto path = compile_fieldpath(*access, wip);
+        if (fused_field(path, wip)) {
+            if (opnode.op) {
+                assign_value = compile_shared_binop(opnode.lhs, opnode.rhs, opnode.op.value(), wip, {});
+            }
+            else {
+                assign_value = compile_node(opnode.rhs, wip, {});
+            }
+            return compile_storefield(path, assign_value, stack_begin, wip);
+        }
+        assign_to = materialize_fieldpath(path, wip);
+    }
+    else {
+        assign_to = compile_node(opnode.lhs, wip, {});
+    }
     if (!assign_to.assignable) {
         throw "lhs is not assignable";
     }
     BytecodeParam assign_address = std::get<BytecodeParam>(assign_to.address);
 
+    // let x: T = f(...) makes the call with its frame where x is, so f returns straight into x.
+    // x is not set yet, so the arguments may overwrite it, and any temps left may overlap it.
+    auto* decl = std::get_if<Ast::VariableDeclaration>(&wip.tree.get(opnode.lhs).data);
+    if (decl && !opnode.op && wip.current_scope->variables.depth() > 0
+        && assign_address == StackAddressForward(LocMemoryDirect, stack_begin)
+        && std::holds_alternative<Ast::MethodCall>(wip.tree.get(opnode.rhs).data)) {
+        wip.next_stack = stack_begin;
+    }
+
     if (opnode.op) {
         assign_value = compile_shared_binop(opnode.lhs, opnode.rhs, opnode.op.value(), wip, assign_address);
     }
@@ -711,10 +1424,10 @@ compiled_result compile_setop(Ast::SetOperation& opnode, compiler_wip& wip) {
     BytecodeParam from_address = std::get<BytecodeParam>(assign_value.address);
     size_t total_used = assign_value.stack_bytes_used;
 
-    auto optype = assign_value.type;
-    auto optypeinfo = get_type(optype, wip);
+    Types::TypeId optype = assign_value.type;
+    const auto& optypeinfo = get_type(optype, wip);
 
-    if (!compatible_types_by_name(assign_to.type, optype, wip)) {
+    if (!compatible_types_by_id(assign_to.type, optype, wip)) {
         throw "Cannot set lhs to rhs as the types do not match";
     }
     if (total_used < assign_to.stack_bytes_used + assign_value.stack_bytes_returned) {
@@ -723,12 +1436,30 @@ compiled_result compile_setop(Ast::SetOperation& opnode, compiler_wip& wip) {
 
     if (from_address != assign_address) {
         auto opcode = assignment_opcode(optype, wip);
+        size_t size = optypeinfo.size;
+        // a value read through a ref is copied, only a ref variable is pointed somewhere else.
+        bool to_member = std::holds_alternative<Ast::AccessMember>(wip.tree.get(opnode.lhs).data);
+        if (optypeinfo.ref_type && (to_member || !get_type(assign_to.type, wip).ref_type)) {
+            opcode = Bytecode::memSet;
+            size = get_type(optypeinfo.ref_type.value(), wip).packed_size();
+            count_copy(optypeinfo.ref_type.value(), size, false, wip);
+        }
+        else {
+            count_copy(optype, size, false, wip);
+        }
         wip.add_bytecode(
-            Opcode(opcode, from_address, StackSize(LocMemoryDirect, optypeinfo.size), assign_address)
+            Opcode(opcode, from_address, StackSize(LocMemoryDirect, size), assign_address)
         );
     }
-    // can free all stack since the result is stored
+    else {
+        count_copy(optype, optypeinfo.size, true, wip);
+    }
+    // can free all stack since the result is stored.
+    // A declaration (let x: T = ...) keeps the variable it reserved.
     wip.next_stack = stack_begin;
+    if (std::holds_alternative<Ast::VariableDeclaration>(wip.tree.get(opnode.lhs).data)) {
+        wip.next_stack += assign_to.stack_bytes_returned;
+    }
 
     return {
         optype,
@@ -741,7 +1472,7 @@ compiled_result compile_setop(Ast::SetOperation& opnode, compiler_wip& wip) {
 }
 
 // TODO: finish with && and || shortcuts
-compiled_result compile_testbinop(Ast::BinaryOperation& opnode, compiler_wip& wip, size_t else_label) {
+compiled_result compile_testbinop(const Ast::BinaryOperation& opnode, compiler_wip& wip, size_t else_label) {
     size_t stack = 0;
     size_t stack_start = wip.next_stack;
 
@@ -758,15 +1489,15 @@ compiled_result compile_testbinop(Ast::BinaryOperation& opnode, compiler_wip& wi
         total_used = lhs_ret.stack_bytes_used + rhs_ret.stack_bytes_returned;
     }
 
-    if (!compatible_types_by_name(lhs_ret.type, rhs_ret.type, wip)) {
+    if (!compatible_types_by_id(lhs_ret.type, rhs_ret.type, wip)) {
         throw "Incompatible types";
     }
 
-    auto lhstypeinfo = get_type(lhs_ret.type, wip);
-    if (lhstypeinfo.ref_type) {
-        lhstypeinfo = get_type(lhstypeinfo.ref_type.value(), wip);
+    const auto* lhstypeinfo = &get_type(lhs_ret.type, wip);
+    if (lhstypeinfo->ref_type) {
+        lhstypeinfo = &get_type(lhstypeinfo->ref_type.value(), wip);
     }
-    auto optable = jump_opcode(lhstypeinfo.name);
+    auto optable = jump_opcode(lhstypeinfo->id);
     auto maybeOp = optable.find(opnode.op);
     if (maybeOp == optable.end()) {
         throw "Operator not supported by type";
@@ -792,11 +1523,11 @@ compiled_result compile_testbinop(Ast::BinaryOperation& opnode, compiler_wip& wi
 }
 
 
-compiled_result compile_nodelist(std::vector<std::shared_ptr<Ast::Node>> nodes, compiler_wip& wip) {
+compiled_result compile_nodelist(std::span<const Ast::NodeId> nodes, compiler_wip& wip) {
     // TODO: support block-expressions
     size_t last_stack = wip.next_stack;
     size_t total_used = 0;
-    for (auto& subnode : nodes) {
+    for (auto subnode : nodes) {
         compiled_result last = compile_node(subnode, wip, {});
         if (last.stack_bytes_used > total_used) {
             total_used = last.stack_bytes_used;
@@ -815,21 +1546,270 @@ compiled_result compile_nodelist(std::vector<std::shared_ptr<Ast::Node>> nodes,
     };
 }
 
-compiled_result compile_block(Ast::Block& block, compiler_wip& wip) {
-    wip.current_scope->local_variables.push_back({});
-    auto ret = compile_nodelist(block.nodes, wip);
-    wip.current_scope->local_variables.pop_back();
+// Whether node leaves the index and array variables of a loop as they are.
+bool
+keeps_loop_variables(Ast::NodeId id, const std::string& array, const std::string& index, compiler_wip& wip) {
+    auto keeps = [&](Ast::NodeId n) {
+        return keeps_loop_variables(n, array, index, wip);
+    };
+    const auto& data = wip.tree.get(id).data;
+    if (auto* v = std::get_if<Ast::SetOperation>(&data)) {
+        return !is_local_named(v->lhs, array, wip) && !is_local_named(v->lhs, index, wip) && keeps(v->lhs) && keeps(v->rhs);
+    }
+    else if (auto* v = std::get_if<Ast::VariableDeclaration>(&data)) {
+        const auto& name = wip.tree.name(v->name);
+        return name != array && name != index;
+    }
+    else if (auto* v = std::get_if<Ast::CallParam>(&data)) {
+        // a ref parameter could change either.
+        return !is_local_named(v->value, array, wip) && !is_local_named(v->value, index, wip) && keeps(v->value);
+    }
+    else if (auto* v = std::get_if<Ast::BinaryOperation>(&data)) {
+        return keeps(v->lhs) && keeps(v->rhs);
+    }
+    else if (auto* v = std::get_if<Ast::UnaryOperation>(&data)) {
+        return keeps(v->value);
+    }
+    else if (auto* v = std::get_if<Ast::AccessMember>(&data)) {
+        return keeps(v->container);
+    }
+    else if (auto* v = std::get_if<Ast::IndexAccess>(&data)) {
+        return keeps(v->container) && keeps(v->index);
+    }
+    else if (auto* v = std::get_if<Ast::Block>(&data)) {
+        auto nodes = wip.tree.list(v->nodes);
+        return std::all_of(nodes.begin(), nodes.end(), keeps);
+    }
+    else if (auto* v = std::get_if<Ast::IfStmt>(&data)) {
+        return keeps(v->condition) && keeps(v->then) && (!v->otherwise || keeps(v->otherwise.value()));
+    }
+    else if (auto* v = std::get_if<Ast::DoWhile>(&data)) {
+        return keeps(v->block) && keeps(v->condition) && (!v->iteration || keeps(v->iteration.value()));
+    }
+    else if (auto* v = std::get_if<Ast::ForRange>(&data)) {
+        const auto& name = wip.tree.name(v->name);
+        return name != array && name != index && keeps(v->start) && keeps(v->end) && keeps(v->block);
+    }
+    else if (auto* v = std::get_if<Ast::ForEach>(&data)) {
+        const auto& name = wip.tree.name(v->name);
+        return name != array && name != index && keeps(v->array) && keeps(v->block);
+    }
+    else if (auto* v = std::get_if<Ast::MatchStmt>(&data)) {
+        auto cases = wip.tree.list(v->cases);
+        return keeps(v->value) && std::all_of(cases.begin(), cases.end(), keeps) && (!v->otherwise || keeps(v->otherwise.value()));
+    }
+    else if (auto* v = std::get_if<Ast::MatchCase>(&data)) {
+        return keeps(v->block);
+    }
+    else if (auto* v = std::get_if<Ast::ReturnValue>(&data)) {
+        return !v->value || keeps(v->value.value());
+    }
+    else if (auto* v = std::get_if<Ast::MethodCall>(&data)) {
+        auto params = wip.tree.list(v->params);
+        return keeps(v->callable) && std::all_of(params.begin(), params.end(), keeps);
+    }
+    else if (std::holds_alternative<Ast::MethodDefinition>(data) || std::holds_alternative<Ast::MethodDeclaration>(data)) {
+        return false;
+    }
+    return true;
+}
+
+// A loop of the form `for i = 0; i < a.len; i += 1 {...}` keeps i within a,
+// when i and a are locals and only the iteration changes either of them.
+// The check of a[i] is then left out of the loop, rather than done on each pass.
+std::optional<std::pair<std::string, std::string>>
+range_checked_loop(const Ast::Block& block, compiler_wip& wip) {
+    auto nodes = wip.tree.list(block.nodes);
+    if (nodes.size() != 2) {
+        return {};
+    }
+    auto* init = std::get_if<Ast::SetOperation>(&wip.tree.get(nodes[0]).data);
+    auto* enter = std::get_if<Ast::IfStmt>(&wip.tree.get(nodes[1]).data);
+    if (!init || init->op || !enter || enter->otherwise) {
+        return {};
+    }
+    auto* loop = std::get_if<Ast::DoWhile>(&wip.tree.get(enter->then).data);
+    auto* condition = std::get_if<Ast::BinaryOperation>(&wip.tree.get(enter->condition).data);
+    if (!loop || loop->condition != enter->condition || !condition || condition->op != Ast::BinaryOps::Less) {
+        return {};
+    }
+    auto* index = std::get_if<Ast::Identifier>(&wip.tree.get(condition->lhs).data);
+    auto* len = std::get_if<Ast::AccessMember>(&wip.tree.get(condition->rhs).data);
+    if (!index || index->scopes.count != 0 || !len || !is_local_named(len->member, "len", wip)) {
+        return {};
+    }
+    auto* array = std::get_if<Ast::Identifier>(&wip.tree.get(len->container).data);
+    if (!array || array->scopes.count != 0) {
+        return {};
+    }
+    std::string index_name = wip.tree.name(index->name);
+    std::string array_name = wip.tree.name(array->name);
+
+    // both locals, so no call can change them.
+    auto* index_symbol = wip.current_scope->variables.find(index_name);
+    auto* array_symbol = wip.current_scope->variables.find(array_name);
+    if (!index_symbol || index_symbol->depth == 0 || index_symbol->variable.type != type_s32
+        || !array_symbol || array_symbol->depth == 0 || !get_type(array_symbol->variable.type, wip).element_type) {
+        return {};
+    }
+
+    auto* start = std::get_if<Ast::ConstS32>(&wip.tree.get(init->rhs).data);
+    if (!is_local_named(init->lhs, index_name, wip) || !start || start->num < 0) {
+        return {};
+    }
+
+    // the iteration is the only change to i.
+    if (!loop->iteration) {
+        return {};
+    }
+    auto* step = std::get_if<Ast::SetOperation>(&wip.tree.get(loop->iteration.value()).data);
+    if (!step || step->op != Ast::BinaryOps::Add || !is_local_named(step->lhs, index_name, wip)) {
+        return {};
+    }
+    auto* step_by = std::get_if<Ast::ConstS32>(&wip.tree.get(step->rhs).data);
+    if (!step_by || step_by->num != 1) {
+        return {};
+    }
+    if (!keeps_loop_variables(loop->block, array_name, index_name, wip)) {
+        return {};
+    }
+    return std::make_pair(array_name, index_name);
+}
+
+compiled_result compile_block(const Ast::Block& block, compiler_wip& wip) {
+    std::optional<std::pair<std::string, std::string>> in_range;
+    if (wip.bounds_checks) {
+        in_range = range_checked_loop(block, wip);
+    }
+    if (in_range) {
+        wip.unchecked_indexes.push_back(in_range.value());
+    }
+
+    wip.current_scope->variables.push_scope();
+    auto ret = compile_nodelist(wip.tree.list(block.nodes), wip);
+    wip.current_scope->variables.pop_scope();
 
+    if (in_range) {
+        wip.unchecked_indexes.pop_back();
+    }
     return ret;
 }
 
-compiled_result compile_if(Ast::IfStmt& stmt, compiler_wip& wip) {
+// the opposite condition for each conditional jump. A float compare is false for a NaN,
+// so its opposite is the "jump unless" form rather than the opposite compare.
+Bytecode inverse_jump(Bytecode op) {
+    switch (op) {
+    case Bytecode::boolJTrue: return Bytecode::boolJFalse;
+    case Bytecode::boolJFalse: return Bytecode::boolJTrue;
+    case Bytecode::s32JLT: return Bytecode::s32JGE;
+    case Bytecode::s32JLE: return Bytecode::s32JGT;
+    case Bytecode::s32JGT: return Bytecode::s32JLE;
+    case Bytecode::s32JGE: return Bytecode::s32JLT;
+    case Bytecode::s32JEQ: return Bytecode::s32JNE;
+    case Bytecode::s32JNE: return Bytecode::s32JEQ;
+    case Bytecode::f32JLT: return Bytecode::f32JNLT;
+    case Bytecode::f32JLE: return Bytecode::f32JNLE;
+    case Bytecode::f32JGT: return Bytecode::f32JNGT;
+    case Bytecode::f32JGE: return Bytecode::f32JNGE;
+    case Bytecode::f32JEQ: return Bytecode::f32JNE;
+    case Bytecode::f32JNE: return Bytecode::f32JEQ;
+    case Bytecode::f32JNLT: return Bytecode::f32JLT;
+    case Bytecode::f32JNLE: return Bytecode::f32JLE;
+    case Bytecode::f32JNGT: return Bytecode::f32JGT;
+    case Bytecode::f32JNGE: return Bytecode::f32JGE;
+    case Bytecode::s64JLT: return Bytecode::s64JGE;
+    case Bytecode::s64JLE: return Bytecode::s64JGT;
+    case Bytecode::s64JGT: return Bytecode::s64JLE;
+    case Bytecode::s64JGE: return Bytecode::s64JLT;
+    case Bytecode::s64JEQ: return Bytecode::s64JNE;
+    case Bytecode::s64JNE: return Bytecode::s64JEQ;
+    case Bytecode::u32JLT: return Bytecode::u32JGE;
+    case Bytecode::u32JLE: return Bytecode::u32JGT;
+    case Bytecode::u32JGT: return Bytecode::u32JLE;
+    case Bytecode::u32JGE: return Bytecode::u32JLT;
+    case Bytecode::u32JEQ: return Bytecode::u32JNE;
+    case Bytecode::u32JNE: return Bytecode::u32JEQ;
+    case Bytecode::u64JLT: return Bytecode::u64JGE;
+    case Bytecode::u64JLE: return Bytecode::u64JGT;
+    case Bytecode::u64JGT: return Bytecode::u64JLE;
+    case Bytecode::u64JGE: return Bytecode::u64JLT;
+    case Bytecode::u64JEQ: return Bytecode::u64JNE;
+    case Bytecode::u64JNE: return Bytecode::u64JEQ;
+    case Bytecode::f64JLT: return Bytecode::f64JNLT;
+    case Bytecode::f64JLE: return Bytecode::f64JNLE;
+    case Bytecode::f64JGT: return Bytecode::f64JNGT;
+    case Bytecode::f64JGE: return Bytecode::f64JNGE;
+    case Bytecode::f64JEQ: return Bytecode::f64JNE;
+    case Bytecode::f64JNE: return Bytecode::f64JEQ;
+    case Bytecode::f64JNLT: return Bytecode::f64JLT;
+    case Bytecode::f64JNLE: return Bytecode::f64JLE;
+    case Bytecode::f64JNGT: return Bytecode::f64JGT;
+    case Bytecode::f64JNGE: return Bytecode::f64JGE;
+    default:
+        throw "Not a conditional jump";
+    }
+}
+
+// looks up how often the condition of an if held, keyed by which if of the method it is.
+std::optional<ProfileCondition>
+profiled_branch(size_t site, compiler_wip& wip) {
+    if (!wip.profile || !wip.current_method) {
+        return {};
+    }
+    return wip.profile->get_branch(wip.current_method->name, site);
+}
+
+void
+remap_method_addresses(compilerscope& scope, const std::function<size_t(size_t)>& remap) {
+    for (auto& it : scope.methods) {
+        if (it.second.defined) {
+            it.second.address = remap(it.second.address);
+        }
+    }
+    for (auto& it : scope.subscopes) {
+        remap_method_addresses(it.second, remap);
+    }
+}
+
+// Turns "then, jump, else" into "else, jump, then".
+// Labels (and any methods) inside either side move with their code.
+// A label at the end of then (the jump) goes to the new end.
+void
+swap_branches(size_t then_start, size_t jump_index, compiler_wip& wip) {
+    size_t else_start = jump_index + 1;
+    size_t end = wip.bytecodes.size();
+    size_t then_size = else_start - then_start;
+    size_t else_size = end - else_start;
+
+    std::vector<operation> swapped;
+    swapped.reserve(end - then_start);
+    std::copy(wip.bytecodes.begin() + else_start, wip.bytecodes.end(), std::back_inserter(swapped));
+    swapped.push_back(wip.bytecodes[jump_index]);
+    std::copy(wip.bytecodes.begin() + then_start, wip.bytecodes.begin() + jump_index, std::back_inserter(swapped));
+    std::copy(swapped.begin(), swapped.end(), wip.bytecodes.begin() + then_start);
+
+    auto remap = [=](size_t address) {
+        if (address >= then_start && address <= jump_index) {
+            return address + else_size + 1;
+        }
+        if (address >= else_start && address < end) {
+            return address - then_size;
+        }
+        return address;
+    };
+    for (auto& it : wip.labels) {
+        it.second = remap(it.second);
+    }
+    remap_method_addresses(wip.rootscope, remap);
+}
+
+compiled_result compile_if(const Ast::IfStmt& stmt, compiler_wip& wip) {
     size_t stack_start = wip.next_stack;
     size_t else_label = wip.next_label++;
     size_t end_label = wip.next_label++;
     size_t max_used = 0;
 
-    if (auto* cond = std::get_if<Ast::BinaryOperation>(&stmt.condition->data)) {
+    if (auto* cond = std::get_if<Ast::BinaryOperation>(&wip.tree.get(stmt.condition).data)) {
         compile_testbinop(*cond, wip, stmt.otherwise ? else_label : end_label);
     }
     else {
@@ -846,6 +1826,14 @@ compiled_result compile_if(Ast::IfStmt& stmt, compiler_wip& wip) {
             linkedparamindex::second
         );
     }
+    size_t branch_index = wip.bytecodes.size() - 1;
+    // numbered before anything inside is compiled, so the number doesn't depend on the layout.
+    std::optional<ProfileCondition> profiled;
+    if (wip.current_method) {
+        size_t site = wip.current_method->next_branch_site++;
+        wip.bytecodes[branch_index].branch = ifbranch{site, false};
+        profiled = profiled_branch(site, wip);
+    }
 
     // at this point, the condition is no longer needed
     wip.next_stack = stack_start;
@@ -857,6 +1845,7 @@ compiled_result compile_if(Ast::IfStmt& stmt, compiler_wip& wip) {
 
     if (stmt.otherwise) {
         // need to jump Then to the end to skip Else
+        size_t jump_index = wip.bytecodes.size();
         wip.add_bytecode_linked_label(
             Opcode(Bytecode::Jump, BytecodeParam(0, 0)),
             labellink{end_label},
@@ -871,6 +1860,18 @@ compiled_result compile_if(Ast::IfStmt& stmt, compiler_wip& wip) {
         if (otherwise.stack_bytes_used > max_used) {
             max_used = otherwise.stack_bytes_used;
         }
+
+        // If Else is the common case then it becomes the fall-through.
+        if (profiled && profiled.value().false_count > profiled.value().true_count) {
+            swap_branches(branch_index + 1, jump_index, wip);
+
+            size_t then_label = wip.next_label++;
+            wip.labels[then_label] = wip.bytecodes.size() - (jump_index - branch_index - 1);
+            auto& branch = wip.bytecodes[branch_index];
+            branch.opcode.op = inverse_jump(branch.opcode.op);
+            branch.label_link.value().label = labellink{then_label};
+            branch.branch.value().inverted = true;
+        }
     }
     wip.labels[end_label] = wip.bytecodes.size();
 
@@ -885,33 +1886,410 @@ compiled_result compile_if(Ast::IfStmt& stmt, compiler_wip& wip) {
     };
 }
 
-compiled_result compile_dowhile(Ast::DoWhile& dowhile, compiler_wip& wip) {
+// The body of a loop, where a break goes to break_label and a continue to continue_label.
+compiled_result compile_loopblock(Ast::NodeId block, loopinfo loop, compiler_wip& wip) {
+    wip.loops.push_back(loop);
+    auto value = compile_node(block, wip, {});
+    wip.loops.pop_back();
+    return value;
+}
+
+compiled_result compile_loopexit(bool is_continue, compiler_wip& wip) {
+    if (wip.loops.empty()) {
+        throw is_continue ? "continue must be inside a loop" : "break must be inside a loop";
+    }
+    const auto& loop = wip.loops.back();
+    wip.add_bytecode_linked_label(
+        Opcode(Bytecode::Jump, BytecodeParam(0, 0)),
+        labellink{is_continue ? loop.continue_label : loop.break_label},
+        linkedparamindex::first
+    );
+    return {
+        type_empty,
+        Types::Mutable::no,
+        false,
+        BytecodeParam(0, 0),
+        0,
+        0
+    };
+}
+
+// `i += 1` then `i < end` is done by one s32ForLoop, when end is a value that needs no code.
+bool
+compile_countedstep(const Ast::DoWhile& dowhile, size_t start_label, compiler_wip& wip) {
+    if (!dowhile.iteration) {
+        return false;
+    }
+    auto* step = std::get_if<Ast::SetOperation>(&wip.tree.get(dowhile.iteration.value()).data);
+    auto* condition = std::get_if<Ast::BinaryOperation>(&wip.tree.get(dowhile.condition).data);
+    if (!step || step->op != Ast::BinaryOps::Add || !condition || condition->op != Ast::BinaryOps::Less) {
+        return false;
+    }
+    auto* step_by = std::get_if<Ast::ConstS32>(&wip.tree.get(step->rhs).data);
+    auto* counter_name = std::get_if<Ast::Identifier>(&wip.tree.get(step->lhs).data);
+    if (!step_by || step_by->num != 1 || !counter_name || counter_name->scopes.count != 0
+        || !is_local_named(condition->lhs, wip.tree.name(counter_name->name), wip)) {
+        return false;
+    }
+    const auto& end_data = wip.tree.get(condition->rhs).data;
+    if (!std::holds_alternative<Ast::Identifier>(end_data) && !std::holds_alternative<Ast::ConstS32>(end_data) && !std::holds_alternative<Ast::AccessMember>(end_data)) {
+        return false;
+    }
+
+    size_t code_start = wip.bytecodes.size();
+    size_t stack_start = wip.next_stack;
+    auto counter = compile_node(step->lhs, wip, {});
+    auto end = compile_node(condition->rhs, wip, {});
+    if (wip.bytecodes.size() != code_start || counter.type != type_s32 || !counter.assignable || end.type != type_s32) {
+        // such as a field loaded through a ref, the step and condition are generated the usual way.
+        wip.bytecodes.erase(wip.bytecodes.begin() + code_start, wip.bytecodes.end());
+        wip.next_stack = stack_start;
+        return false;
+    }
+
+    wip.add_bytecode_linked_label(
+        Opcode(Bytecode::s32ForLoop, std::get<BytecodeParam>(counter.address), std::get<BytecodeParam>(end.address), BytecodeParam(0, 0)),
+        labellink{start_label},
+        linkedparamindex::third
+    );
+    wip.next_stack = stack_start;
+    return true;
+}
+
+compiled_result compile_dowhile(const Ast::DoWhile& dowhile, compiler_wip& wip) {
     size_t stack_start = wip.next_stack;
     size_t start_label = wip.next_label++;
     wip.labels[start_label] = wip.bytecodes.size();
+    loopinfo loop = {wip.next_label++, wip.next_label++};
     size_t max_used = 0;
 
-    auto value = compile_node(dowhile.block, wip, {});
+    auto value = compile_loopblock(dowhile.block, loop, wip);
     max_used = value.stack_bytes_used;
+    wip.labels[loop.continue_label] = wip.bytecodes.size();
 
-    auto condition = compile_node(dowhile.condition, wip, {});
-    if (condition.type != type_bool) {
-        throw "Dowhile condition must be a boolean";
+    if (!compile_countedstep(dowhile, start_label, wip)) {
+        if (dowhile.iteration) {
+            auto iteration = compile_node(dowhile.iteration.value(), wip, {});
+            if (max_used < iteration.stack_bytes_used) {
+                max_used = iteration.stack_bytes_used;
+            }
+        }
+
+        auto condition = compile_node(dowhile.condition, wip, {});
+        if (condition.type != type_bool) {
+            throw "Dowhile condition must be a boolean";
+        }
+        if (max_used < (condition.stack_bytes_used + value.stack_bytes_returned)) {
+            max_used = condition.stack_bytes_used + value.stack_bytes_returned;
+        }
+
+        wip.add_bytecode_linked_label(
+            Opcode(Bytecode::boolJTrue, std::get<BytecodeParam>(condition.address), BytecodeParam(0, 0)),
+            labellink{start_label},
+            linkedparamindex::second
+        );
     }
-    if (max_used < (condition.stack_bytes_used + value.stack_bytes_returned)) {
-        max_used = condition.stack_bytes_used + value.stack_bytes_returned;
+    wip.labels[loop.break_label] = wip.bytecodes.size();
+
+    // free all stack used above
+    wip.next_stack = stack_start;
+
+    // TODO: figure out a return one day
+
+    return {
+        type_empty,
+        Types::Mutable::no,
+        false,
+        BytecodeParam(0, 0),
+        0,
+        max_used
+    };
+}
+
+// The value of a match case, which has to be known while generating.
+int
+match_case_value(Ast::NodeId id, compiler_wip& wip) {
+    const auto& data = wip.tree.get(id).data;
+    if (auto* v = std::get_if<Ast::ConstS32>(&data)) {
+        return v->num;
+    }
+    if (auto* v = std::get_if<Ast::UnaryOperation>(&data)) {
+        auto* num = std::get_if<Ast::ConstS32>(&wip.tree.get(v->value).data);
+        if (v->op == Ast::UnaryOps::Negate && num) {
+            return -num->num;
+        }
     }
+    if (auto* v = std::get_if<Ast::Identifier>(&data)) {
+        auto scopes = wip.scope_path(v->scopes);
+        auto maybe_enum = scopes.size() == 1 ? wip.types.find_type(scopes[0]) : std::nullopt;
+        if (maybe_enum) {
+            const auto& t = wip.types.get_type(maybe_enum.value());
+            if (auto* e = std::get_if<Types::EnumType>(&t.type)) {
+                auto it = e->values.find(wip.tree.name(v->name));
+                if (it != e->values.end()) {
+                    return it->second;
+                }
+            }
+        }
+    }
+    throw "A match case must be a constant s32 or enum value";
+}
 
+// Jumps to the label of the case holding value, or to default_label, for the cases [first, last).
+// A few cases are compared in turn, more are split in half on the middle value.
+void
+compile_matchsearch(BytecodeParam value, const std::vector<std::pair<int, size_t>>& cases, size_t first, size_t last, size_t default_label, compiler_wip& wip) {
+    if (last - first <= 3) {
+        for (size_t i = first; i < last; i++) {
+            wip.add_bytecode_linked_label(
+                Opcode(Bytecode::s32JEQ, value, ConstantAddress(LocMemoryDirect, constant<int>(cases[i].first, wip)), BytecodeParam(0, 0)),
+                labellink{cases[i].second},
+                linkedparamindex::third
+            );
+        }
+        wip.add_bytecode_linked_label(Opcode(Bytecode::Jump, BytecodeParam(0, 0)), labellink{default_label}, linkedparamindex::first);
+        return;
+    }
+
+    size_t middle = first + (last - first) / 2;
+    size_t upper_label = wip.next_label++;
     wip.add_bytecode_linked_label(
-        Opcode(Bytecode::boolJTrue, std::get<BytecodeParam>(condition.address), BytecodeParam(0, 0)),
+        Opcode(Bytecode::s32JGE, value, ConstantAddress(LocMemoryDirect, constant<int>(cases[middle].first, wip)), BytecodeParam(0, 0)),
+        labellink{upper_label},
+        linkedparamindex::third
+    );
+    compile_matchsearch(value, cases, first, middle, default_label, wip);
+    wip.labels[upper_label] = wip.bytecodes.size();
+    compile_matchsearch(value, cases, middle, last, default_label, wip);
+}
+
+// Cases that fill at least half of the values from the lowest to the highest use a s32JumpTable,
+// the rest are found by a binary search. Each block jumps to the end, so no case runs into the next.
+compiled_result compile_match(const Ast::MatchStmt& match, compiler_wip& wip) {
+    size_t stack_start = wip.next_stack;
+    size_t end_label = wip.next_label++;
+    size_t default_label = match.otherwise ? wip.next_label++ : end_label;
+
+    auto value = compile_node(match.value, wip, {});
+    if (value.type != type_s32) {
+        throw "Match value must be a s32 or enum";
+    }
+    auto value_address = std::get<BytecodeParam>(value.address);
+    size_t max_used = value.stack_bytes_used;
+
+    // each value with the label of its case, lowest first.
+    auto case_nodes = wip.tree.list(match.cases);
+    std::vector<size_t> case_labels;
+    std::vector<std::pair<int, size_t>> cases;
+    for (auto id : case_nodes) {
+        const auto& matchcase = std::get<Ast::MatchCase>(wip.tree.get(id).data);
+        case_labels.push_back(wip.next_label++);
+        for (auto v : wip.tree.list(matchcase.values)) {
+            cases.push_back(std::make_pair(match_case_value(v, wip), case_labels.back()));
+        }
+    }
+    std::sort(cases.begin(), cases.end());
+    for (size_t i = 1; i < cases.size(); i++) {
+        if (cases[i - 1].first == cases[i].first) {
+            throw "The same value is in more than one match case";
+        }
+    }
+
+    if (cases.size() > 3 && uint64_t(int64_t(cases.back().first) - cases.front().first) < 2 * cases.size()) {
+        size_t count = size_t(cases.back().first - cases.front().first) + 1;
+        wip.add_bytecode(Opcode(
+            Bytecode::s32JumpTable,
+            value_address,
+            ConstantAddress(LocMemoryDirect, constant<int>(cases.front().first, wip)),
+            StackSize(LocMemoryDirect, count)
+        ));
+        // one Jump per value in the range, the gaps go to the default.
+        auto it = cases.begin();
+        for (size_t i = 0; i < count; i++) {
+            size_t label = default_label;
+            if (it->first == cases.front().first + int(i)) {
+                label = it->second;
+                ++it;
+            }
+            wip.add_bytecode_linked_label(Opcode(Bytecode::Jump, BytecodeParam(0, 0)), labellink{label}, linkedparamindex::first);
+        }
+        wip.add_bytecode_linked_label(Opcode(Bytecode::Jump, BytecodeParam(0, 0)), labellink{default_label}, linkedparamindex::first);
+    }
+    else {
+        compile_matchsearch(value_address, cases, 0, cases.size(), default_label, wip);
+    }
+
+    // the value is no longer needed by any case.
+    wip.next_stack = stack_start;
+
+    for (size_t i = 0; i < case_nodes.size(); i++) {
+        const auto& matchcase = std::get<Ast::MatchCase>(wip.tree.get(case_nodes[i]).data);
+        wip.labels[case_labels[i]] = wip.bytecodes.size();
+        auto block = compile_node(matchcase.block, wip, {});
+        max_used = std::max(max_used, block.stack_bytes_used);
+        if (match.otherwise || i + 1 < case_nodes.size()) {
+            wip.add_bytecode_linked_label(Opcode(Bytecode::Jump, BytecodeParam(0, 0)), labellink{end_label}, linkedparamindex::first);
+        }
+        wip.next_stack = stack_start;
+    }
+    if (match.otherwise) {
+        wip.labels[default_label] = wip.bytecodes.size();
+        auto otherwise = compile_node(match.otherwise.value(), wip, {});
+        max_used = std::max(max_used, otherwise.stack_bytes_used);
+        wip.next_stack = stack_start;
+    }
+    wip.labels[end_label] = wip.bytecodes.size();
+
+    return {
+        type_empty,
+        Types::Mutable::no,
+        false,
+        BytecodeParam(0, 0),
+        0,
+        max_used
+    };
+}
+
+// Counts counter up to end around block, with one s32ForLoop for each pass:
+//   if counter >= end goto break; top: each, block; continue: s32ForLoop counter end top; break:
+// each is generated at the top of every pass, before the block.
+size_t
+compile_countedloop(Ast::NodeId block, BytecodeParam counter, BytecodeParam end, const std::function<void()>& each, compiler_wip& wip) {
+    size_t start_label = wip.next_label++;
+    loopinfo loop = {wip.next_label++, wip.next_label++};
+
+    wip.add_bytecode_linked_label(
+        Opcode(Bytecode::s32JGE, counter, end, BytecodeParam(0, 0)),
+        labellink{loop.break_label},
+        linkedparamindex::third
+    );
+    wip.labels[start_label] = wip.bytecodes.size();
+    each();
+    auto value = compile_loopblock(block, loop, wip);
+
+    wip.labels[loop.continue_label] = wip.bytecodes.size();
+    wip.add_bytecode_linked_label(
+        Opcode(Bytecode::s32ForLoop, counter, end, BytecodeParam(0, 0)),
         labellink{start_label},
-        linkedparamindex::second
+        linkedparamindex::third
     );
+    wip.labels[loop.break_label] = wip.bytecodes.size();
+    return value.stack_bytes_used;
+}
 
-    // free all stack used above
+compiled_result compile_forrange(const Ast::ForRange& loop, compiler_wip& wip) {
+    size_t stack_start = wip.next_stack;
+    wip.current_scope->variables.push_scope();
+
+    // the block can only read the counter, so it counts in place.
+    const auto& name = wip.tree.name(loop.name);
+    auto counter = reserve_local(name, type_s32, Types::Mutable::no, wip);
+    auto counter_address = std::get<BytecodeParam>(counter.address);
+    size_t s32_size = get_type(type_s32, wip).size;
+
+    auto start = compile_node(loop.start, wip, counter_address);
+    if (start.type != type_s32) {
+        throw "A range must be of s32";
+    }
+    if (std::get<BytecodeParam>(start.address) != counter_address) {
+        wip.add_bytecode(Opcode(Bytecode::s32Set, std::get<BytecodeParam>(start.address), StackSize(LocMemoryDirect, s32_size), counter_address));
+    }
+    size_t max_used = counter.stack_bytes_used + start.stack_bytes_used;
+    wip.next_stack = stack_start + s32_size;
+
+    // the end is only evaluated once, so it is kept unless it is a constant.
+    BytecodeParam end_address;
+    if (std::holds_alternative<Ast::ConstS32>(wip.tree.get(loop.end).data)) {
+        end_address = std::get<BytecodeParam>(compile_node(loop.end, wip, {}).address);
+    }
+    else {
+        end_address = StackAddressForward(LocMemoryDirect, wip.next_stack);
+        wip.next_stack += s32_size;
+        auto end = compile_node(loop.end, wip, end_address);
+        if (end.type != type_s32) {
+            throw "A range must be of s32";
+        }
+        if (std::get<BytecodeParam>(end.address) != end_address) {
+            wip.add_bytecode(Opcode(Bytecode::s32Set, std::get<BytecodeParam>(end.address), StackSize(LocMemoryDirect, s32_size), end_address));
+        }
+        max_used = std::max(max_used, 2 * s32_size + end.stack_bytes_used);
+        wip.next_stack = stack_start + 2 * s32_size;
+    }
+
+    // `for i in 0..a.len` never takes i out of a, as long as a stays the same.
+    std::optional<std::pair<std::string, std::string>> in_range;
+    auto* start_at = std::get_if<Ast::ConstS32>(&wip.tree.get(loop.start).data);
+    auto* len = std::get_if<Ast::AccessMember>(&wip.tree.get(loop.end).data);
+    if (start_at && start_at->num >= 0 && len && is_local_named(len->member, "len", wip)) {
+        if (auto* array = std::get_if<Ast::Identifier>(&wip.tree.get(len->container).data)) {
+            const auto& array_name = wip.tree.name(array->name);
+            auto* symbol = wip.current_scope->variables.find(array_name);
+            if (array->scopes.count == 0 && symbol && symbol->depth > 0 && get_type(symbol->variable.type, wip).element_type
+                && keeps_loop_variables(loop.block, array_name, "", wip)) {
+                in_range = std::make_pair(array_name, name);
+                wip.unchecked_indexes.push_back(in_range.value());
+            }
+        }
+    }
+
+    size_t loop_stack = wip.next_stack - stack_start;
+    size_t body_used = compile_countedloop(loop.block, counter_address, end_address, [] {}, wip);
+    max_used = std::max(max_used, loop_stack + body_used);
+
+    if (in_range) {
+        wip.unchecked_indexes.pop_back();
+    }
+    wip.current_scope->variables.pop_scope();
     wip.next_stack = stack_start;
 
-    // TODO: figure out a return one day
+    return {
+        type_empty,
+        Types::Mutable::no,
+        false,
+        BytecodeParam(0, 0),
+        0,
+        max_used
+    };
+}
+
+compiled_result compile_foreach(const Ast::ForEach& loop, compiler_wip& wip) {
+    size_t stack_start = wip.next_stack;
+    wip.current_scope->variables.push_scope();
+
+    // a copy of the array, so what the block does to the variable does not change the loop.
+    auto array = compile_node(loop.array, wip, {});
+    const auto* arraytype = &get_type(array.type, wip);
+    bool is_ref = arraytype->ref_type.has_value();
+    if (is_ref) {
+        arraytype = &get_type(arraytype->ref_type.value(), wip);
+    }
+    if (!arraytype->element_type) {
+        throw "Only arrays can be looped over";
+    }
+    size_t max_used = array.stack_bytes_used;
+    size_t copy = wip.next_stack;
+    wip.next_stack += arraytype->size;
+    wip.add_bytecode(Opcode(is_ref ? Bytecode::Dereference : Bytecode::memSet, std::get<BytecodeParam>(array.address), StackSize(LocMemoryDirect, arraytype->size), StackAddressForward(LocMemoryDirect, copy)));
+
+    size_t index = wip.next_stack;
+    wip.next_stack += get_type(type_s32, wip).size;
+    auto index_address = StackAddressForward(LocMemoryDirect, index);
+    wip.add_bytecode(Opcode(Bytecode::s32Set, ConstantAddress(LocMemoryDirect, constant<int>(0, wip)), StackSize(LocMemoryDirect, get_type(type_s32, wip).size), index_address));
+
+    Types::TypeId element_type = arraytype->element_type.value();
+    auto element = reserve_local(wip.tree.name(loop.name), element_type, Types::Mutable::no, wip);
+    size_t len_offset = std::get<Types::StructType>(arraytype->type).members.at("len").offset;
+
+    auto data = StackAddressForward(LocMemoryIndirect, copy);
+    auto load = indexed_opcodes(element_type).first;
+    size_t loop_stack = wip.next_stack - stack_start;
+    size_t body_used = compile_countedloop(loop.block, index_address, StackAddressForward(LocMemoryDirect, copy + len_offset), [&] {
+        wip.add_bytecode(Opcode(load, data, index_address, std::get<BytecodeParam>(element.address)));
+    }, wip);
+    max_used = std::max(max_used, loop_stack + body_used);
+
+    wip.current_scope->variables.pop_scope();
+    wip.next_stack = stack_start;
 
     return {
         type_empty,
@@ -923,23 +2301,95 @@ compiled_result compile_dowhile(Ast::DoWhile& dowhile, compiler_wip& wip) {
     };
 }
 
-compiled_result compile_globalblock(Ast::GlobalBlock& block, compiler_wip& wip) {
-    return compile_nodelist(block.nodes, wip);
+// Drops the methods and globals that are not kept, along with the statements at the global level.
+// Those never run, and a global initializer could use anything.
+std::vector<Ast::NodeId>
+kept_nodes(std::span<const Ast::NodeId> list, compiler_wip& wip) {
+    std::vector<Ast::NodeId> nodes;
+    const auto& keep_methods = wip.keep_methods.value();
+    for (auto n : list) {
+        const auto& data = wip.tree.get(n).data;
+        if (auto* decl = std::get_if<Ast::MethodDeclaration>(&data)) {
+            if (keep_methods.count(wip.tree.name(decl->name))) {
+                nodes.push_back(n);
+            }
+        }
+        else if (auto* def = std::get_if<Ast::MethodDefinition>(&data)) {
+            if (keep_methods.count(wip.tree.name(def->name))) {
+                nodes.push_back(n);
+            }
+        }
+        else if (auto* var = std::get_if<Ast::VariableDeclaration>(&data)) {
+            if (wip.keep_globals.count(wip.tree.name(var->name))) {
+                nodes.push_back(n);
+            }
+        }
+        else if (auto* set = std::get_if<Ast::SetOperation>(&data)) {
+            auto* var = std::get_if<Ast::VariableDeclaration>(&wip.tree.get(set->lhs).data);
+            if (var && wip.keep_globals.count(wip.tree.name(var->name))) {
+                nodes.push_back(set->lhs);
+            }
+        }
+    }
+    return nodes;
 }
 
-compiled_result compile_methoddecl(Ast::MethodDeclaration& method, compiler_wip& wip) {
-    auto type = wip.types.get_type(method.type);
-    auto typedata = std::get<Types::MethodType>(type.type);
+compiled_result compile_globalblock(const Ast::GlobalBlock& block, compiler_wip& wip) {
+    auto list = wip.tree.list(block.nodes);
+    std::vector<Ast::NodeId> nodes;
+    if (wip.keep_methods) {
+        nodes = kept_nodes(list, wip);
+        list = nodes;
+    }
+    if (!wip.profile) {
+        return compile_nodelist(list, wip);
+    }
+
+    // With a profile, the most called methods are placed first so hot code is packed together.
+    // Only the method definitions are reordered; everything else keeps its place.
+    nodes.assign(list.begin(), list.end());
+    std::vector<size_t> slots;
+    std::vector<Ast::NodeId> methods;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (std::holds_alternative<Ast::MethodDefinition>(wip.tree.get(nodes[i]).data)) {
+            slots.push_back(i);
+            methods.push_back(nodes[i]);
+        }
+    }
+    std::stable_sort(methods.begin(), methods.end(), [&](Ast::NodeId a, Ast::NodeId b) {
+        auto& ma = std::get<Ast::MethodDefinition>(wip.tree.get(a).data);
+        auto& mb = std::get<Ast::MethodDefinition>(wip.tree.get(b).data);
+        return wip.profile->get_method_entries(wip.tree.name(ma.name)) > wip.profile->get_method_entries(wip.tree.name(mb.name));
+    });
+    for (size_t i = 0; i < slots.size(); i++) {
+        nodes[slots[i]] = methods[i];
+    }
+    return compile_nodelist(nodes, wip);
+}
+
+compiled_result compile_methoddecl(const Ast::MethodDeclaration& method, compiler_wip& wip) {
+    const auto& name = wip.tree.name(method.name);
+    const auto& type = wip.types.get_type(method.type);
+    const auto& typedata = std::get<Types::MethodType>(type.type);
+
+    // a method that was compiled before keeps its index.
+    size_t index;
+    auto previous = wip.previous_methods.find(name);
+    if (previous != wip.previous_methods.end()) {
+        index = previous->second.metadata->index;
+    }
+    else {
+        index = wip.next_method++;
+    }
 
-    wip.current_scope->methods[method.name] = methodinfo{
-        method.name,
+    wip.current_scope->methods[name] = methodinfo{
+        name,
         method.type,
         typedata.return_mutable,
         false,
-        wip.next_method,
-        0, 0, 0, 0
+        index,
+        0, 0, 0, 0, 0
     };
-    wip.next_method++;
 
     return {
         type_empty,
@@ -951,51 +2401,102 @@ compiled_result compile_methoddecl(Ast::MethodDeclaration& method, compiler_wip&
     };
 }
 
-compiled_result compile_methoddef(Ast::MethodDefinition& method, compiler_wip& wip) {
-    auto maybemethod = get_method_named(method.scopes, method.name, wip);
+compiled_result compile_methoddef(const Ast::MethodDefinition& method, compiler_wip& wip) {
+    auto maybemethod = get_method_named(wip.scope_path(method.scopes), wip.tree.name(method.name), wip);
     if (!maybemethod) {
         throw "Method was not declared.";
     }
     auto minfo = maybemethod.value();
+    auto method_result = compiled_result{
+        type_empty,
+        Types::Mutable::no,
+        false,
+        ScriptCall(LocMemoryDirect, minfo->address),
+        0,
+        0
+    };
 
-    size_t start_stack = wip.next_stack;
-    wip.next_stack = 0;
-    wip.current_scope->local_variables.push_back({});
-
-    size_t param_size = 0;
-    auto type = wip.types.get_type(minfo->type);
-    auto typedata = std::get<Types::MethodType>(type.type);
+    const auto& type = wip.types.get_type(minfo->type);
+    const auto& typedata = std::get<Types::MethodType>(type.type);
 
-    if (typedata.parameters.size() != method.param_names.size()) {
+    auto param_names = wip.tree.names(method.param_names);
+    if (typedata.parameters.size() != param_names.size()) {
         throw "Method definition parameters do not match declaration.";
     }
 
-    for (size_t i = 0; i < typedata.parameters.size(); i++) {
-        std::string ptype_name = typedata.parameters[i].type;
-        auto& pt = wip.types.get_type(ptype_name);
-        param_size += pt.size;
-        reserve_local(method.param_names[i], ptype_name, typedata.parameters[i].is_mutable, wip);
+    size_t param_size = 0;
+    for (auto& p : typedata.parameters) {
+        param_size += wip.types.get_type(p.type).size;
     }
-
     // always reserve at least the ret type
-    auto rettype = wip.types.get_type(typedata.return_type);
+    const auto& rettype = wip.types.get_type(typedata.return_type);
     if (param_size < rettype.size) {
         param_size = rettype.size;
     }
+
+    if (wip.lazy) {
+        // the stub knows its method, the stack is only known once it is generated.
+        minfo->defined = true;
+        minfo->address = wip.bytecodes.size();
+        minfo->size = 1;
+        minfo->param_bytes = param_size;
+        minfo->stack_bytes = 0;
+        minfo->fingerprint = 0;
+        wip.add_bytecode(Opcode(Bytecode::Stub, ScriptCall(LocMemoryDirect, minfo->index)));
+        return method_result;
+    }
+
+    auto previous = wip.previous_methods.find(minfo->name);
+    bool keep = wip.only_method && wip.only_method.value() != minfo->name;
+    if (!keep) {
+        fingerprinter fingerprint(wip);
+        fingerprint.add_method(method);
+        minfo->fingerprint = fingerprint.value();
+        keep = !wip.regenerate_all && previous != wip.previous_methods.end() && previous->second.metadata->fingerprint == minfo->fingerprint;
+    }
+    if (keep) {
+        // unchanged, so the code already in the Program is kept.
+        const auto& m = *previous->second.metadata;
+        minfo->defined = true;
+        minfo->address = previous->second.address;
+        minfo->size = m.code_size;
+        minfo->param_bytes = m.param_size;
+        minfo->stack_bytes = m.stack_size;
+        minfo->fingerprint = m.fingerprint;
+        minfo->branches = m.branches;
+        return method_result;
+    }
+
+    size_t start_stack = wip.next_stack;
+    wip.next_stack = 0;
+    wip.current_scope->variables.push_scope();
+
+    for (size_t i = 0; i < typedata.parameters.size(); i++) {
+        reserve_local(wip.tree.name(param_names[i]), typedata.parameters[i].type, typedata.parameters[i].is_mutable, wip);
+    }
     wip.next_stack = param_size;
 
     size_t address = wip.bytecodes.size();
+    minfo->address = address;
+    methodinfo* outer_method = wip.current_method;
+    wip.current_method = minfo;
 
     auto r = compile_node(method.node, wip, {});
-
-    if (wip.bytecodes[wip.bytecodes.size() - 1].opcode.op != Bytecode::Ret) {
-        if (rettype.size == 0) {
+    wip.current_method = outer_method;
+
+    // a jump to the end of the method also needs somewhere to land
+    bool jumps_to_end = std::any_of(wip.labels.begin(), wip.labels.end(), [&](const auto& it) {
+        return it.second == wip.bytecodes.size();
+    });
+    bool ends_in_ret = wip.bytecodes[wip.bytecodes.size() - 1].opcode.op == Bytecode::Ret;
+    if (rettype.size == 0) {
+        if (jumps_to_end || !ends_in_ret) {
             wip.add_bytecode(Opcode(Bytecode::Ret));
         }
-        else {
-            // TODO: need a better "exit" detector to make sure all paths exit
-            throw "Must have a return from a method";
-        }
+    }
+    else if (!ends_in_ret) {
+        // TODO: need a better "exit" detector to make sure all paths exit
+        throw "Must have a return from a method";
     }
 
     minfo->defined = true;
@@ -1003,9 +2504,16 @@ compiled_result compile_methoddef(Ast::MethodDefinition& method, compiler_wip& w
     minfo->size = wip.bytecodes.size() - address;
     minfo->param_bytes = param_size;
     minfo->stack_bytes = r.stack_bytes_used;
+    minfo->branches.clear();
+    for (size_t i = address; i < wip.bytecodes.size(); i++) {
+        if (auto& b = wip.bytecodes[i].branch) {
+            minfo->branches.push_back(BranchSite{i - address, b->site, b->inverted});
+        }
+    }
+    wip.generated.push_back(minfo);
 
     wip.next_stack = start_stack;
-    wip.current_scope->local_variables.pop_back();
+    wip.current_scope->variables.pop_scope();
 
     return {
         type_empty,
@@ -1017,7 +2525,7 @@ compiled_result compile_methoddef(Ast::MethodDefinition& method, compiler_wip& w
     };
 }
 
-compiled_result compile_return(Ast::ReturnValue& ret, compiler_wip& wip) {
+compiled_result compile_return(const Ast::ReturnValue& ret, compiler_wip& wip) {
     size_t max_used = 0;
 
     if (ret.value) {
@@ -1025,8 +2533,10 @@ compiled_result compile_return(Ast::ReturnValue& ret, compiler_wip& wip) {
         auto value = compile_node(ret.value.value(), wip, ret_address);
         max_used = value.stack_bytes_used;
 
-        if (ret_address != std::get<BytecodeParam>(value.address)) {
-            auto optypeinfo = get_type(value.type, wip);
+        const auto& optypeinfo = get_type(value.type, wip);
+        bool in_place = ret_address == std::get<BytecodeParam>(value.address);
+        count_copy(value.type, optypeinfo.size, in_place, wip);
+        if (!in_place) {
             auto opcode = assignment_opcode(value.type, wip);
             wip.add_bytecode(
                 Opcode(opcode, std::get<BytecodeParam>(value.address), StackSize(LocMemoryDirect, optypeinfo.size), StackAddressForward(LocMemoryDirect, 0))
@@ -1046,7 +2556,7 @@ compiled_result compile_return(Ast::ReturnValue& ret, compiler_wip& wip) {
     };
 }
 
-compiled_result compile_methodparam(Ast::CallParam& param, Types::MethodTypeParameter type, compiler_wip& wip) {
+compiled_result compile_methodparam(const Ast::CallParam& param, const Types::MethodTypeParameter& type, compiler_wip& wip) {
     // but how do I make sure I append to the END of the stack.
     // if some other step makes the stack even larger, then these values are wrong.
     // call passes the new base ptr which is right at the start
@@ -1055,13 +2565,22 @@ compiled_result compile_methodparam(Ast::CallParam& param, Types::MethodTypePara
 
     size_t last_stack = wip.next_stack;
     auto store_address = StackAddressForward(LocMemoryDirect, wip.next_stack);
-    auto typeinfo = wip.types.get_type(type.type);
+    const auto& typeinfo = wip.types.get_type(type.type);
+
+    const auto& param_type = get_type(type.type, wip);
 
     // TODO: suggesting positions would REALLY help here
-    auto value = compile_node(param.value, wip, {});
+    // a field passed as a ref has to stay where it is, not be loaded.
+    compiled_result value;
+    auto* access = std::get_if<Ast::AccessMember>(&wip.tree.get(param.value).data);
+    if (access && param_type.ref_type) {
+        value = compile_memberaccess(*access, wip, true);
+    }
+    else {
+        value = compile_node(param.value, wip, {});
+    }
 
     const auto& value_type = get_type(value.type, wip);
-    const auto& param_type = get_type(type.type, wip);
 
     if (!compatible_types(value_type, param_type)) {
         throw "Parameter is the incorrect type";
@@ -1077,19 +2596,24 @@ compiled_result compile_methodparam(Ast::CallParam& param, Types::MethodTypePara
         );
     }
     else if (!param_type.ref_type && value_type.ref_type) {
-        auto ref = get_type(value_type.ref_type.value(), wip);
+        const auto& ref = get_type(value_type.ref_type.value(), wip);
+        count_copy(value_type.ref_type.value(), ref.packed_size(), false, wip);
         wip.add_bytecode(
-            Opcode(Bytecode::Dereference, std::get<BytecodeParam>(value.address), StackSize(LocMemoryDirect, ref.size), store_address)
+            Opcode(Bytecode::Dereference, std::get<BytecodeParam>(value.address), StackSize(LocMemoryDirect, ref.packed_size()), store_address)
         );
     }
     else if (std::get<BytecodeParam>(value.address) != store_address) {
-        auto optypeinfo = get_type(value.type, wip);
+        const auto& optypeinfo = get_type(value.type, wip);
         auto opcode = assignment_opcode(value.type, wip);
+        count_copy(value.type, optypeinfo.size, false, wip);
         wip.add_bytecode(
             Opcode(opcode, std::get<BytecodeParam>(value.address), StackSize(LocMemoryDirect, optypeinfo.size), store_address)
         );
         total_used += typeinfo.size;
     }
+    else {
+        count_copy(value.type, typeinfo.size, true, wip);
+    }
 
     // free any temporaries
     wip.next_stack = last_stack + typeinfo.size;
@@ -1104,32 +2628,307 @@ compiled_result compile_methodparam(Ast::CallParam& param, Types::MethodTypePara
     };
 }
 
-compiled_result compile_methodcall(Ast::MethodCall& method, compiler_wip& wip) {
+// A call to a getter or setter of an imported struct, done as the member access it stands for.
+compiled_result compile_accessorcall(const Ast::ImportedAccessor& accessor, const Ast::AccessMember& access, std::span<const Ast::NodeId> params, compiler_wip& wip) {
+    size_t stack_begin = wip.next_stack;
+    fieldpath path;
+    if (auto* container = std::get_if<Ast::AccessMember>(&wip.tree.get(access.container).data)) {
+        path = compile_fieldpath(*container, wip);
+    }
+    else {
+        path = start_fieldpath(compile_node(access.container, wip, {}));
+    }
+    if (!extend_fieldpath(path, accessor.member, wip)) {
+        throw "Accessor refers to an unknown member";
+    }
+    if (fused_field(path, wip)) {
+        if (!accessor.setter) {
+            return compile_loadfield(path, wip);
+        }
+        auto value = compile_node(std::get<Ast::CallParam>(wip.tree.get(params[0]).data).value, wip, {});
+        auto stored = compile_storefield(path, value, stack_begin, wip);
+        return {
+            type_empty,
+            Types::Mutable::no,
+            false,
+            BytecodeParam(0, 0),
+            0,
+            stored.stack_bytes_used
+        };
+    }
+    auto member = materialize_fieldpath(path, wip);
+    if (!accessor.setter) {
+        return member;
+    }
+
+    if (!member.assignable) {
+        throw "lhs is not assignable";
+    }
+    BytecodeParam assign_address = std::get<BytecodeParam>(member.address);
+    auto value = compile_node(std::get<Ast::CallParam>(wip.tree.get(params[0]).data).value, wip, assign_address);
+    if (member.is_mutable == Types::Mutable::yes && value.is_mutable == Types::Mutable::no) {
+        throw "Unable to assign immutable value to a mutable variable";
+    }
+    if (!compatible_types_by_id(member.type, value.type, wip)) {
+        throw "Parameter is the incorrect type";
+    }
+
+    BytecodeParam from_address = std::get<BytecodeParam>(value.address);
+    if (from_address != assign_address) {
+        wip.add_bytecode(
+            Opcode(assignment_opcode(value.type, wip), from_address, StackSize(LocMemoryDirect, get_type(value.type, wip).size), assign_address)
+        );
+    }
+    size_t total_used = std::max(value.stack_bytes_used, member.stack_bytes_used + value.stack_bytes_returned);
+    wip.next_stack = stack_begin;
+
+    return {
+        type_empty,
+        Types::Mutable::no,
+        false,
+        BytecodeParam(0, 0),
+        0,
+        total_used
+    };
+}
+
+// the kind a From opcode reads a value of type as, and the opcode that converts to type.
+std::optional<std::pair<NumberKind, Bytecode>> number_kind(Types::TypeId type) {
+    switch (type) {
+    case type_s32: return std::make_pair(NumberKind::s32, Bytecode::s32From);
+    case type_f32: return std::make_pair(NumberKind::f32, Bytecode::f32From);
+    case type_s64: return std::make_pair(NumberKind::s64, Bytecode::s64From);
+    case type_u32: return std::make_pair(NumberKind::u32, Bytecode::u32From);
+    case type_u64: return std::make_pair(NumberKind::u64, Bytecode::u64From);
+    case type_f64: return std::make_pair(NumberKind::f64, Bytecode::f64From);
+    case type_u8: return std::make_pair(NumberKind::u8, Bytecode::u8From);
+    case type_s8: return std::make_pair(NumberKind::s8, Bytecode::s8From);
+    case type_u16: return std::make_pair(NumberKind::u16, Bytecode::u16From);
+    case type_s16: return std::make_pair(NumberKind::s16, Bytecode::s16From);
+    }
+    return {};
+}
+
+// `s64(x)`, calling a number type, converts x to it.
+std::optional<compiled_result>
+compile_conversion(const Ast::MethodCall& method, compiler_wip& wip) {
+    auto* name = std::get_if<Ast::Identifier>(&wip.tree.get(method.callable).data);
+    if (!name || name->scopes.count != 0) {
+        return {};
+    }
+    auto to_type = wip.types.find_type(wip.tree.name(name->name));
+    auto to = to_type ? number_kind(to_type.value()) : std::nullopt;
+    auto params = wip.tree.list(method.params);
+    if (!to || params.size() != 1) {
+        return {};
+    }
+
+    size_t stack_start = wip.next_stack;
+    const auto& param = std::get<Ast::CallParam>(wip.tree.get(params[0]).data);
+    auto value = compile_node(param.value, wip, {});
+    auto from = number_kind(value.type);
+    if (!from) {
+        throw "Only numbers can be converted";
+    }
+
+    size_t size = get_type(to_type.value(), wip).size;
+    size_t temp = wip.next_stack;
+    wip.next_stack += size;
+    wip.add_bytecode(Opcode(to.value().second, std::get<BytecodeParam>(value.address), StackSize(LocMemoryDirect, size_t(from.value().first)), StackAddressForward(LocMemoryDirect, temp)));
+
+    return compiled_result{
+        to_type.value(),
+        Types::Mutable::yes,
+        false,
+        StackAddressForward(LocMemoryDirect, temp),
+        size,
+        (temp - stack_start) + size + value.stack_bytes_used
+    };
+}
+
+// the opcodes of the calls only a vector has.
+struct vectoropcodes {
+    Bytecode scale;
+    Bytecode dot;
+    Bytecode length;
+    Bytecode normalize;
+    std::optional<Bytecode> cross;
+};
+
+std::optional<vectoropcodes> vector_opcodes(Types::TypeId type) {
+    switch (type) {
+    case type_vec2: return vectoropcodes{Bytecode::vec2Scale, Bytecode::vec2Dot, Bytecode::vec2Length, Bytecode::vec2Normalize, {}};
+    case type_vec3: return vectoropcodes{Bytecode::vec3Scale, Bytecode::vec3Dot, Bytecode::vec3Length, Bytecode::vec3Normalize, Bytecode::vec3Cross};
+    case type_vec4: return vectoropcodes{Bytecode::vec4Scale, Bytecode::vec4Dot, Bytecode::vec4Length, Bytecode::vec4Normalize, {}};
+    }
+    return {};
+}
+
+// `vec3(x, y, z)`, each f32 is stored straight into its component.
+compiled_result
+compile_vectorconstruct(Types::TypeId type, std::span<const Ast::NodeId> params, compiler_wip& wip) {
+    const auto& typeinfo = get_type(type, wip);
+    size_t components = std::get<Types::StructType>(typeinfo.type).members.size();
+    if (params.size() != components) {
+        throw "A vector is made from an f32 for each component";
+    }
+
+    size_t temp = wip.next_stack;
+    wip.next_stack += typeinfo.size;
+    size_t max_used = 0;
+    for (size_t i = 0; i < components; i++) {
+        auto component = StackAddressForward(LocMemoryDirect, temp + i * sizeof(float));
+        const auto& param = std::get<Ast::CallParam>(wip.tree.get(params[i]).data);
+        auto value = compile_node(param.value, wip, component);
+        if (!compatible_types_by_id(value.type, type_f32, wip)) {
+            throw "A vector is made from an f32 for each component";
+        }
+        if (std::get<BytecodeParam>(value.address) != component) {
+            wip.add_bytecode(Opcode(Bytecode::f32Set, std::get<BytecodeParam>(value.address), StackSize(LocMemoryDirect, sizeof(float)), component));
+        }
+        max_used = std::max(max_used, value.stack_bytes_used);
+        wip.next_stack = temp + typeinfo.size;
+    }
+
+    return compiled_result{
+        type,
+        Types::Mutable::yes,
+        false,
+        StackAddressForward(LocMemoryDirect, temp),
+        typeinfo.size,
+        typeinfo.size + max_used
+    };
+}
+
+// Builds a vector when called by the name of its type, otherwise dot(a, b), cross(a, b), length(a),
+// normalize(a) and scale(a, f) on a vector are each their opcode.
+// A variable or method of the same name is called instead.
+std::optional<compiled_result>
+compile_vectorcall(const Ast::MethodCall& method, compiler_wip& wip) {
+    auto* name = std::get_if<Ast::Identifier>(&wip.tree.get(method.callable).data);
+    if (!name || name->scopes.count != 0) {
+        return {};
+    }
+    const auto& ident = wip.tree.name(name->name);
+    auto params = wip.tree.list(method.params);
+    auto type = wip.types.find_type(ident);
+    if (type && vector_opcodes(type.value())) {
+        return compile_vectorconstruct(type.value(), params, wip);
+    }
+
+    bool binary = ident == "dot" || ident == "cross" || ident == "scale";
+    if (!binary && ident != "length" && ident != "normalize") {
+        return {};
+    }
+    auto scopes = wip.scope_path(name->scopes);
+    if (wip.get_scope(scopes)->variables.find(ident) || find_method(scopes, ident, wip)) {
+        return {};
+    }
+    if (params.size() != (binary ? 2 : 1)) {
+        throw "Incorrect number of params";
+    }
+
+    size_t stack_start = wip.next_stack;
+    auto a = compile_node(std::get<Ast::CallParam>(wip.tree.get(params[0]).data).value, wip, {});
+    const auto& atype = get_type(a.type, wip);
+    Types::TypeId vector_type = atype.ref_type.value_or(a.type);
+    auto ops = vector_opcodes(vector_type);
+    if (!ops) {
+        throw "Only a vector has dot, cross, length, normalize and scale";
+    }
+    size_t max_used = a.stack_bytes_used;
+
+    Types::TypeId result_type = vector_type;
+    Bytecode op = ops->normalize;
+    std::optional<compiled_result> b;
+    if (binary) {
+        b = compile_node(std::get<Ast::CallParam>(wip.tree.get(params[1]).data).value, wip, {});
+        max_used = std::max(max_used, (wip.next_stack - stack_start) + b->stack_bytes_used);
+        if (ident == "scale") {
+            if (!compatible_types_by_id(b->type, type_f32, wip)) {
+                throw "A vector is scaled by an f32";
+            }
+            op = ops->scale;
+        }
+        else if (!compatible_types_by_id(b->type, vector_type, wip)) {
+            throw "Incompatible types";
+        }
+        else if (ident == "dot") {
+            op = ops->dot;
+            result_type = type_f32;
+        }
+        else if (!ops->cross) {
+            throw "Only a vec3 has a cross product";
+        }
+        else {
+            op = ops->cross.value();
+        }
+    }
+    else if (ident == "length") {
+        op = ops->length;
+        result_type = type_f32;
+    }
+
+    size_t size = get_type(result_type, wip).size;
+    auto out = StackAddressForward(LocMemoryDirect, wip.next_stack);
+    wip.next_stack += size;
+    if (b) {
+        wip.add_bytecode(Opcode(op, std::get<BytecodeParam>(a.address), std::get<BytecodeParam>(b->address), out));
+    }
+    else {
+        wip.add_bytecode(Opcode(op, std::get<BytecodeParam>(a.address), out));
+    }
+
+    return compiled_result{
+        result_type,
+        Types::Mutable::yes,
+        false,
+        out,
+        wip.next_stack - stack_start,
+        std::max(max_used, wip.next_stack - stack_start)
+    };
+}
+
+compiled_result compile_methodcall(const Ast::MethodCall& method, compiler_wip& wip) {
+    if (auto conversion = compile_conversion(method, wip)) {
+        return conversion.value();
+    }
+    if (auto vector = compile_vectorcall(method, wip)) {
+        return vector.value();
+    }
     size_t max_used = 0;
 
     auto callable = compile_node(method.callable, wip, {});
     max_used = callable.stack_bytes_used;
-    bool has_implicit = std::holds_alternative<Ast::AccessMember>(method.callable->data);
+    auto* access = std::get_if<Ast::AccessMember>(&wip.tree.get(method.callable).data);
+    bool has_implicit = access != nullptr;
+    auto params = wip.tree.list(method.params);
     size_t implicit_qty = has_implicit ? 1 : 0;
 
-    auto methodtype = wip.types.get_type(callable.type);
+    const auto& methodtype = wip.types.get_type(callable.type);
     if (!std::holds_alternative<Types::MethodType>(methodtype.type)) {
         throw "LHS is not a function";
     }
 
-    auto typeinfo = std::get<Types::MethodType>(methodtype.type);
+    const auto& typeinfo = std::get<Types::MethodType>(methodtype.type);
     // TODO: default params
-    if (typeinfo.parameters.size() != (method.params.size() + implicit_qty)) {
-        std::cerr << "Supplied " << (method.params.size() + implicit_qty) << " for a call requiring " << typeinfo.parameters.size() << "\n";
+    if (typeinfo.parameters.size() != (params.size() + implicit_qty)) {
+        std::cerr << "Supplied " << (params.size() + implicit_qty) << " for a call requiring " << typeinfo.parameters.size() << "\n";
         throw "Incorrect number of params";
     }
-    auto returntype = wip.types.get_type(typeinfo.return_type);
+    const auto& returntype = wip.types.get_type(typeinfo.return_type);
+
+    if (has_implicit && std::holds_alternative<BytecodeParam>(callable.address)) {
+        auto call = std::get<BytecodeParam>(callable.address);
+        if (call.page == 1 && wip.imported_methods[call.offset].accessor) {
+            return compile_accessorcall(wip.imported_methods[call.offset].accessor.value(), *access, params, wip);
+        }
+    }
 
     size_t base = wip.next_stack;
     size_t total_requied = callable.stack_bytes_used;
     if (has_implicit) {
-        auto access = std::get<Ast::AccessMember>(method.callable->data);
-        Ast::CallParam p0 = Ast::CallParam{ access.container };
+        Ast::CallParam p0 = Ast::CallParam{ access->container };
         auto param = compile_methodparam(p0, typeinfo.parameters[0], wip);
         if (total_requied + param.stack_bytes_used > max_used) {
             max_used = total_requied + param.stack_bytes_used;
@@ -1138,8 +2937,8 @@ compiled_result compile_methodcall(Ast::MethodCall& method, compiler_wip& wip) {
     }
 
     // TODO: named params and ordering
-    for (size_t i = 0; i < method.params.size(); i++) {
-        auto param = compile_methodparam(std::get<Ast::CallParam>(method.params[i]->data), typeinfo.parameters[i + implicit_qty], wip);
+    for (size_t i = 0; i < params.size(); i++) {
+        auto param = compile_methodparam(std::get<Ast::CallParam>(wip.tree.get(params[i]).data), typeinfo.parameters[i + implicit_qty], wip);
         if (total_requied + param.stack_bytes_used > max_used) {
             max_used = total_requied + param.stack_bytes_used;
         }
@@ -1179,7 +2978,8 @@ compiled_result compile_methodcall(Ast::MethodCall& method, compiler_wip& wip) {
 //compiled_result compile_(Ast::blah& node, compiler_wip& wip) {
 //}
 
-compiled_result compile_node(std::shared_ptr<Ast::Node> n, compiler_wip& wip, std::optional<BytecodeParam> suggested_return) {
+compiled_result compile_node(Ast::NodeId id, compiler_wip& wip, std::optional<BytecodeParam> suggested_return) {
+    auto n = &wip.tree.get(id);
     if (auto* v = std::get_if<Ast::ConstS32>(&n->data)) {
         return compile_const_s32(*v, wip);
     }
@@ -1189,6 +2989,18 @@ compiled_result compile_node(std::shared_ptr<Ast::Node> n, compiler_wip& wip, st
     else if (auto* v = std::get_if<Ast::ConstBool>(&n->data)) {
         return compile_const_bool(*v, wip);
     }
+    else if (auto* v = std::get_if<Ast::ConstS64>(&n->data)) {
+        return compile_const_number<int64_t>(v->num, type_s64, wip);
+    }
+    else if (auto* v = std::get_if<Ast::ConstU32>(&n->data)) {
+        return compile_const_number<uint32_t>(v->num, type_u32, wip);
+    }
+    else if (auto* v = std::get_if<Ast::ConstU64>(&n->data)) {
+        return compile_const_number<size_t>(v->num, type_u64, wip);
+    }
+    else if (auto* v = std::get_if<Ast::ConstF64>(&n->data)) {
+        return compile_const_number<double>(v->num, type_f64, wip);
+    }
     else if (auto* v = std::get_if<Ast::UnaryOperation>(&n->data)) {
         return compile_unaryop(*v, wip, suggested_return);
     }
@@ -1204,6 +3016,24 @@ compiled_result compile_node(std::shared_ptr<Ast::Node> n, compiler_wip& wip, st
     else if (auto* v = std::get_if<Ast::AccessMember>(&n->data)) {
         return compile_memberaccess(*v, wip);
     }
+    else if (auto* v = std::get_if<Ast::IndexAccess>(&n->data)) {
+        return compile_indexaccess(*v, wip);
+    }
+    else if (auto* v = std::get_if<Ast::ForRange>(&n->data)) {
+        return compile_forrange(*v, wip);
+    }
+    else if (auto* v = std::get_if<Ast::ForEach>(&n->data)) {
+        return compile_foreach(*v, wip);
+    }
+    else if (auto* v = std::get_if<Ast::MatchStmt>(&n->data)) {
+        return compile_match(*v, wip);
+    }
+    else if (std::holds_alternative<Ast::BreakStmt>(n->data)) {
+        return compile_loopexit(false, wip);
+    }
+    else if (std::holds_alternative<Ast::ContinueStmt>(n->data)) {
+        return compile_loopexit(true, wip);
+    }
     else if (auto* v = std::get_if<Ast::VariableDeclaration>(&n->data)) {
         return compile_vardecl(*v, wip);
     }
@@ -1236,7 +3066,7 @@ compiled_result compile_node(std::shared_ptr<Ast::Node> n, compiler_wip& wip, st
 }
 
 void
-generate_bytecode(std::shared_ptr<Ast::Node> ast_root, compiler_wip& wip) {
+generate_bytecode(Ast::NodeId ast_root, compiler_wip& wip) {
     compile_node(ast_root, wip, {});
 }
 
@@ -1259,7 +3089,7 @@ _call_address(size_t jump_to, size_t jump_from) {
 
 bool
 _farcall_required(size_t jump_to, size_t jump_from) {
-    if (jump_to > 0xFFFF) {
+    if (jump_to > ParamAddressOffsetMask) {
         return true;
     }
 
@@ -1270,7 +3100,7 @@ _farcall_required(size_t jump_to, size_t jump_from) {
     else {
         diff = jump_to - jump_from;
     }
-    return diff > 0xFFFF;
+    return diff > ParamAddressOffsetMask;
 }
 
 void
@@ -1348,6 +3178,22 @@ get_cpp_type(const Types::TypeInfo& type) {
             return typeid(int);
         case Types::PrimitiveType::f32:
             return typeid(float);
+        case Types::PrimitiveType::s64:
+            return typeid(int64_t);
+        case Types::PrimitiveType::u32:
+            return typeid(uint32_t);
+        case Types::PrimitiveType::u64:
+            return typeid(uint64_t);
+        case Types::PrimitiveType::f64:
+            return typeid(double);
+        case Types::PrimitiveType::u8:
+            return typeid(uint8_t);
+        case Types::PrimitiveType::s8:
+            return typeid(int8_t);
+        case Types::PrimitiveType::u16:
+            return typeid(uint16_t);
+        case Types::PrimitiveType::s16:
+            return typeid(int16_t);
         }
     }
     if (type.backing_type) {
@@ -1357,17 +3203,18 @@ get_cpp_type(const Types::TypeInfo& type) {
 }
 
 void
-add_scope_to_program(std::shared_ptr<Program> p, compilerscope& scope, compiler_wip& wip) {
-    for (auto& m : scope.local_variables[0]) {
-        auto t = wip.types.get_type(m.second.type);
-        p->add_global_index(m.first, t.size, m.second.address);
+add_scope_to_program(Program& p, compilerscope& scope, compiler_wip& wip) {
+    for (auto& sym : scope.variables.symbols()) {
+        const auto& t = wip.types.get_type(sym.variable.type);
+        p.add_global_index(sym.variable.name, t.name, t.packed_size(), sym.variable.address);
     }
 
     for (auto& it : scope.methods) {
         auto& m = it.second;
-        p->add_method_addr(m.index, m.param_bytes, m.stack_bytes, m.address);
+        auto& mtype = wip.types.get_type(m.type);
+        p.add_method_addr(m.index, m.name, m.param_bytes, m.stack_bytes, m.address, m.size, m.fingerprint, mtype.name, m.branches);
         
-        auto& t = std::get<Types::MethodType>(wip.types.get_type(m.type).type);
+        auto& t = std::get<Types::MethodType>(mtype.type);
         std::vector<std::type_index> types;
         bool has_all = true;
         auto cpp_type = get_cpp_type(wip.types.get_type(t.return_type));
@@ -1385,7 +3232,7 @@ add_scope_to_program(std::shared_ptr<Program> p, compilerscope& scope, compiler_
             types.push_back(cpp_type.value());
         }
         if (has_all) {
-            p->register_method(m.name, m.address, types);
+            p.register_method(m.name, m.address, types);
         }
     }
 
@@ -1394,33 +3241,55 @@ add_scope_to_program(std::shared_ptr<Program> p, compilerscope& scope, compiler_
     }
 }
 
-std::shared_ptr<Program>
-generate_bytecode(std::shared_ptr<Ast::Node> ast_root, const Types::TypeTable& types, const ImportedMethods& imported_methods) {
-    compiler_wip wip(types, imported_methods);
-    generate_bytecode(ast_root, wip);
-    link(wip);
-    print_program(wip);
-
-    auto p = std::make_shared<Program>(wip.next_const);
-
-    for (auto& it : imported_methods) {
-        p->add_builtin(it.name, it.runnable);
+// only the builtins from first on, earlier ones are already in the Program.
+void
+add_builtins_to_program(Program& p, const ImportedMethods& imported_methods, size_t first) {
+    for (size_t i = first; i < imported_methods.size(); i++) {
+        auto& it = imported_methods[i];
+        std::vector<std::type_index> signature = { it.ret_type };
+        signature.insert(signature.end(), it.param_types.begin(), it.param_types.end());
+        p.add_builtin(it.name, it.runnable, signature);
     }
+}
 
+void
+add_constants_to_program(Program& p, compiler_wip& wip) {
     for (auto& v : wip.constant_values) {
         if (std::holds_alternative<int>(v)) {
-            p->add_constant<int>("", std::get<int>(v));
+            p.add_constant<int>("", std::get<int>(v));
         }
         else if (std::holds_alternative<float>(v)) {
-            p->add_constant<float>("", std::get<float>(v));
+            p.add_constant<float>("", std::get<float>(v));
         }
         else if (std::holds_alternative<size_t>(v)) {
-            p->add_constant<size_t>("", std::get<size_t>(v));
+            p.add_constant<size_t>("", std::get<size_t>(v));
+        }
+        else if (std::holds_alternative<double>(v)) {
+            p.add_constant<double>("", std::get<double>(v));
+        }
+        else if (std::holds_alternative<int64_t>(v)) {
+            p.add_constant<int64_t>("", std::get<int64_t>(v));
+        }
+        else if (std::holds_alternative<uint32_t>(v)) {
+            p.add_constant<uint32_t>("", std::get<uint32_t>(v));
         }
         else {
             throw "Unknown constant type";
         }
     }
+}
+
+std::shared_ptr<Program>
+build_program(compiler_wip& wip, const ImportedMethods& imported_methods, bool print_bytecode) {
+    link(wip);
+    if (print_bytecode) {
+        print_program(wip);
+    }
+
+    auto p = std::make_shared<Program>(wip.next_const);
+    add_builtins_to_program(*p, imported_methods, 0);
+    add_constants_to_program(*p, wip);
+
     std::vector<Opcode> bytecodes;
     bytecodes.reserve(wip.bytecodes.size());
     for (auto& b : wip.bytecodes) {
@@ -1428,8 +3297,249 @@ generate_bytecode(std::shared_ptr<Ast::Node> ast_root, const Types::TypeTable& t
     }
     p->add_code(bytecodes);
 
+    add_scope_to_program(*p, wip.rootscope, wip);
+    p->add_copy_stats(wip.copies);
+
+    return p;
+}
+
+// Walks the call graph from the entry points, keeping every method and global they can reach.
+void
+find_reachable(const compilerscope& scope, const std::vector<std::string>& entry_points, std::unordered_set<std::string>& methods, std::unordered_set<std::string>& globals) {
+    std::vector<std::string> pending(entry_points.begin(), entry_points.end());
+    while (!pending.empty()) {
+        auto name = pending.back();
+        pending.pop_back();
+        if (!methods.insert(name).second) {
+            continue;
+        }
+        auto it = scope.methods.find(name);
+        if (it == scope.methods.end()) {
+            throw "Entry point not found";
+        }
+        for (auto& m : it->second.uses_methods) {
+            if (!methods.count(m)) {
+                pending.push_back(m);
+            }
+        }
+        globals.insert(it->second.uses_globals.begin(), it->second.uses_globals.end());
+    }
+}
+
+std::shared_ptr<Program>
+generate_bytecode(const Ast::FileNode& file, const Types::TypeTable& types, const ImportedMethods& imported_methods, const ProfileData* profile, bool print_bytecode, const std::vector<std::string>& entry_points, bool bounds_checks) {
+    compiler_wip wip(file.tree, types, imported_methods, profile);
+    wip.bounds_checks = bounds_checks;
+    generate_bytecode(file.root, wip);
+    if (entry_points.empty()) {
+        return build_program(wip, imported_methods, print_bytecode);
+    }
+
+    // generated again with only what is reachable, so the method indexes, globals
+    // and constants are laid out without gaps and nothing has to be renumbered.
+    compiler_wip stripped(file.tree, types, imported_methods, profile);
+    stripped.bounds_checks = bounds_checks;
+    stripped.keep_methods.emplace();
+    find_reachable(wip.rootscope, entry_points, stripped.keep_methods.value(), stripped.keep_globals);
+    generate_bytecode(file.root, stripped);
+    return build_program(stripped, imported_methods, print_bytecode);
+}
+
+// Whether every global is where the Program has it.
+bool
+same_globals(const compilerscope& scope, const Program& p, compiler_wip& wip, size_t& count) {
+    const auto& globals = p.get_globals();
+    for (auto& sym : scope.variables.symbols()) {
+        const auto& t = wip.types.get_type(sym.variable.type);
+        auto it = globals.find(sym.variable.name);
+        if (it == globals.end() || it->second.address != sym.variable.address || it->second.size != t.packed_size() || it->second.type != t.name) {
+            return false;
+        }
+        count++;
+    }
+    for (auto& it : scope.subscopes) {
+        if (!same_globals(it.second, p, wip, count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether every method that was already in the Program still has the same signature.
+bool
+same_signatures(const compilerscope& scope, compiler_wip& wip) {
+    for (auto& it : scope.methods) {
+        auto previous = wip.previous_methods.find(it.second.name);
+        if (previous != wip.previous_methods.end() && previous->second.metadata->type != wip.types.get_type(it.second.type).name) {
+            return false;
+        }
+    }
+    for (auto& it : scope.subscopes) {
+        if (!same_signatures(it.second, wip)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<compiler_wip>
+generate_changed(const Ast::FileNode& file, const Types::TypeTable& types, const ImportedMethods& imported_methods, const Program& p, bool regenerate_all, std::optional<std::string> only_method, bool bounds_checks) {
+    auto wip = std::make_unique<compiler_wip>(file.tree, types, imported_methods, nullptr);
+    wip->bounds_checks = bounds_checks;
+    for (auto& it : p.get_methods_metadata()) {
+        wip->previous_methods[it.second.name] = previousmethod{it.first, &it.second};
+    }
+    wip->regenerate_all = regenerate_all;
+    wip->only_method = only_method;
+    wip->next_method = p.method_count();
+    // new constants go after the ones already there.
+    wip->next_const = p.constants_table().size();
+    generate_bytecode(file.root, *wip);
+    return wip;
+}
+
+// Puts the generated methods of a recompile into the Program.
+// A method goes back where it was if it still fits, otherwise after all the code.
+// Either way every method stays at its index.
+void
+patch_program(compiler_wip& wip, Program& p, const ImportedMethods& imported_methods, bool globals_kept, bool print_bytecode) {
+    size_t code_end = p.get_code().size();
+    size_t appended = 0;
+    std::vector<size_t> generated_at;
+    std::unordered_map<size_t, methodinfo*> moved;
+    for (auto* m : wip.generated) {
+        generated_at.push_back(m->address);
+        auto previous = wip.previous_methods.find(m->name);
+        if (previous != wip.previous_methods.end()) {
+            auto& was = previous->second;
+            if (m->size <= was.metadata->code_size) {
+                m->address = was.address;
+            }
+            else {
+                m->address = code_end + appended;
+                appended += m->size;
+            }
+            if (m->address != was.address || m->stack_bytes != was.metadata->stack_size) {
+                moved[was.address] = m;
+            }
+        }
+        else {
+            m->address = code_end + appended;
+            appended += m->size;
+        }
+    }
+    link(wip);
+    if (print_bytecode) {
+        print_program(wip);
+    }
+
+    p.reserve_constants(wip.next_const);
+    add_builtins_to_program(p, imported_methods, p.builtin_count());
+    add_constants_to_program(p, wip);
+
+    std::vector<Opcode> tail;
+    tail.reserve(appended);
+    for (size_t i = 0; i < wip.generated.size(); i++) {
+        auto* m = wip.generated[i];
+        if (m->address >= code_end) {
+            for (size_t j = 0; j < m->size; j++) {
+                tail.push_back(wip.bytecodes[generated_at[i] + j].opcode);
+            }
+        }
+    }
+    p.add_code(tail);
+
+    auto code = p.patchable_code();
+    for (size_t i = 0; i < wip.generated.size(); i++) {
+        auto* m = wip.generated[i];
+        if (m->address < code_end) {
+            for (size_t j = 0; j < m->size; j++) {
+                code[m->address + j] = wip.bytecodes[generated_at[i] + j].opcode;
+            }
+        }
+    }
+
+    // near calls in code that was kept still go to where a moved method used to be.
+    for (size_t i = 0; i < code.size(); i++) {
+        auto& bc = code[i];
+        if (bc.op != Bytecode::FCall || address_page(bc.p1) != 0) {
+            continue;
+        }
+        auto it = moved.find(address_offset(bc.p1));
+        if (it == moved.end()) {
+            continue;
+        }
+        auto method = it->second;
+        if (_farcall_required(method->address, i)) {
+            bc.op = Bytecode::Call;
+            bc.set_parameter1(ScriptCall(LocMemoryDirect, method->index));
+        }
+        else {
+            bc.set_parameter1(_call_address(method->address, i));
+        }
+        bc.set_parameter3(StackSize(LocMemoryDirect, method->stack_bytes));
+    }
+
+    if (!globals_kept) {
+        p.reset_globals();
+    }
     add_scope_to_program(p, wip.rootscope, wip);
+    p.add_copy_stats(wip.copies);
+}
+
+ReloadResult
+regenerate_bytecode(const Ast::FileNode& file, const Types::TypeTable& types, const ImportedMethods& imported_methods, Program& p, bool print_bytecode, bool bounds_checks) {
+    auto wip = generate_changed(file, types, imported_methods, p, false, {}, bounds_checks);
+
+    size_t global_count = 0;
+    bool globals_kept = same_globals(wip->rootscope, p, *wip, global_count) && global_count == p.get_globals().size();
+    if (!globals_kept || !same_signatures(wip->rootscope, *wip)) {
+        // the code of every method has the global addresses and the signatures of what it calls baked in.
+        wip = generate_changed(file, types, imported_methods, p, true, {}, bounds_checks);
+    }
+    patch_program(*wip, p, imported_methods, globals_kept, print_bytecode);
+    // methods that were still stubs are generated now too, so nothing is left to do lazily.
+    p.set_lazy_generator(nullptr);
+
+    ReloadResult result = { {}, globals_kept };
+    for (auto* m : wip->generated) {
+        result.regenerated.push_back(m->name);
+    }
+    return result;
+}
 
+// Keeps the parsed file around to generate each method on its first call.
+// The TypeTable is the compiler's, so the compiler has to outlive the Program.
+class lazy_generator : public ILazyGenerator {
+public:
+    lazy_generator(std::shared_ptr<const Ast::FileNode> file, const Types::TypeTable& types, const ImportedMethods& imported_methods, Program& program, bool print_bytecode, bool bounds_checks) :
+        _file(file), _types(types), _imported_methods(imported_methods), _program(program), _print_bytecode(print_bytecode), _bounds_checks(bounds_checks) {}
+
+    size_t generate(size_t index) {
+        const auto& name = _program.get_method_metadata(_program.get_method_index_address(index)).name;
+        auto wip = generate_changed(*_file, _types, _imported_methods, _program, true, name, _bounds_checks);
+        patch_program(*wip, _program, _imported_methods, true, _print_bytecode);
+        return _program.get_method_index_address(index);
+    }
+
+private:
+    std::shared_ptr<const Ast::FileNode> _file;
+    const Types::TypeTable& _types;
+    // a copy, the compiler may import more methods later.
+    ImportedMethods _imported_methods;
+    Program& _program;
+    bool _print_bytecode;
+    bool _bounds_checks;
+};
+
+std::shared_ptr<Program>
+generate_lazy(std::shared_ptr<const Ast::FileNode> file, const Types::TypeTable& types, const ImportedMethods& imported_methods, bool print_bytecode, bool bounds_checks) {
+    compiler_wip wip(file->tree, types, imported_methods, nullptr);
+    wip.lazy = true;
+    wip.bounds_checks = bounds_checks;
+    generate_bytecode(file->root, wip);
+    auto p = build_program(wip, imported_methods, print_bytecode);
+    p->set_lazy_generator(std::make_unique<lazy_generator>(file, types, imported_methods, *p, print_bytecode, bounds_checks));
     return p;
 }
 
@@ -9,13 +9,30 @@
 #include "VMFFI.h"
 #include "Program.h"
 #include "Types.h"
+#include "VMProfile.h"
 
 namespace MattScript {
 namespace Generator {
 
 typedef std::vector<Ast::ImportedMethod> ImportedMethods;
 
-std::shared_ptr<Program> generate_bytecode(std::shared_ptr<Ast::Node> ast_root, const Types::TypeTable& types, const ImportedMethods& imported_methods);
+// When a profile is given, it is used to lay out hot paths and order methods.
+// When entry points are given, only the methods they can call and the globals and constants
+// those use are put in the Program. A method used by name, not only called, counts as reachable.
+// Unless bounds_checks is unset, an array index is checked where it is not already known to be in range.
+// Only reads the type table, so several files may be generated at once.
+std::shared_ptr<Program> generate_bytecode(const Ast::FileNode& file, const Types::TypeTable& types, const ImportedMethods& imported_methods, const ProfileData* profile = nullptr, bool print_bytecode = true, const std::vector<std::string>& entry_points = {}, bool bounds_checks = true);
+
+// Generates only the methods of file that changed since it was generated into program, patching them in.
+// Methods keep their index. Methods that still fit go back where they were, the rest are added to the end
+// and near calls to them are pointed at the new code.
+// A change to the globals or to the signature of an existing method generates every method again.
+ReloadResult regenerate_bytecode(const Ast::FileNode& file, const Types::TypeTable& types, const ImportedMethods& imported_methods, Program& program, bool print_bytecode = true, bool bounds_checks = true);
+
+// Only lays out the methods, each starting as a Stub that generates its code on the first call.
+// The program keeps the file, and the type table has to outlive it.
+// As the types are checked while generating, an error in a method is only thrown once it is called.
+std::shared_ptr<Program> generate_lazy(std::shared_ptr<const Ast::FileNode> file, const Types::TypeTable& types, const ImportedMethods& imported_methods, bool print_bytecode = true, bool bounds_checks = true);
 
 } // bgen
 } // MattScript
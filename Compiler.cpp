@@ -1,7 +1,14 @@
 #include "Compiler.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <functional>
 #include <memory>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <vector>
 
 #include "AST.h"
 #include "BytecodeGenerator.h"
@@ -13,13 +20,104 @@
 
 namespace MattScript {
 
-Compiler::Compiler() {}
+Compiler::Compiler() : _print_bytecode(true), _bounds_checks(true) {}
+
+std::shared_ptr<Program>
+Compiler::_compile(const std::string& filename, const std::string& contents, const ProfileData* profile) {
+    auto tokens = Tokenizer::tokenize(contents);
+    auto ast = Parser::parse_to_ast(filename, tokens, _types);
+    return Generator::generate_bytecode(*ast, _types, _methods, profile, _print_bytecode, _entry_points, _bounds_checks);
+}
 
 std::shared_ptr<Program>
 Compiler::compile(std::string filename, std::string contents) {
-    auto tokens = Tokenizer::tokenize_string(contents);
+    return _compile(filename, contents, nullptr);
+}
+
+std::shared_ptr<Program>
+Compiler::compile(std::string filename, std::string contents, const ProfileData& profile) {
+    return _compile(filename, contents, &profile);
+}
+
+std::vector<std::shared_ptr<Program>>
+Compiler::compile_many(const std::vector<SourceFile>& files, size_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    thread_count = std::min(thread_count, files.size());
+
+    std::vector<std::shared_ptr<Program>> programs(files.size());
+    std::vector<std::exception_ptr> errors(files.size());
+    std::atomic<size_t> next_file = 0;
+
+    // each worker pulls the next file until there are none left.
+    auto worker = [&]() {
+        for (size_t i = next_file++; i < files.size(); i = next_file++) {
+            try {
+                programs[i] = _compile(files[i].filename, files[i].contents, nullptr);
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < thread_count; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : pool) {
+        t.join();
+    }
+
+    for (auto& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+    return programs;
+}
+
+std::shared_ptr<Program>
+Compiler::compile_lazy(std::string filename, std::string contents) {
+    auto tokens = Tokenizer::tokenize(contents);
     auto ast = Parser::parse_to_ast(filename, tokens, _types);
-    return Generator::generate_bytecode(ast->root, _types, _methods);
+    return Generator::generate_lazy(ast, _types, _methods, _print_bytecode, _bounds_checks);
+}
+
+ReloadResult
+Compiler::recompile(Program& program, std::string filename, std::string contents) {
+    auto tokens = Tokenizer::tokenize(contents);
+    auto ast = Parser::parse_to_ast(filename, tokens, _types);
+    return Generator::regenerate_bytecode(*ast, _types, _methods, program, _print_bytecode, _bounds_checks);
+}
+
+std::shared_ptr<Program>
+Compiler::load(std::string filename) {
+    HostImports host;
+    for (auto& m : _methods) {
+        std::vector<std::type_index> signature = { m.ret_type };
+        signature.insert(signature.end(), m.param_types.begin(), m.param_types.end());
+        host.builtins.emplace(m.name, HostBuiltin{m.runnable, signature});
+    }
+    host.types = _types.mapped_types();
+    return Program::load_image(filename, host);
+}
+
+void
+Compiler::set_print_bytecode(bool print) {
+    _print_bytecode = print;
+}
+
+void
+Compiler::set_entry_points(std::vector<std::string> names) {
+    _entry_points = names;
+}
+
+void
+Compiler::set_bounds_checks(bool checks) {
+    _bounds_checks = checks;
 }
 
 }
@@ -3,18 +3,21 @@
 #include <iostream>
 #include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "AST.h"
 #include "Program.h"
 #include "Types.h"
 #include "VMFFI.h"
+#include "VMProfile.h"
 
 namespace MattScript {
 
 template <typename T>
 class StructImportBuilder {
 public:
-    StructImportBuilder(std::string name, Types::TypeTable& types) : _name(name), _types(types) {}
+    StructImportBuilder(std::string name, Types::TypeTable& types, std::vector<Ast::ImportedMethod>& imported) : _types(types), _name(name), _imported(imported) {}
 
     template <typename M>
     StructImportBuilder<T>& add_member(std::string member_name, size_t offset) {
@@ -22,20 +25,71 @@ public:
         return *this;
     }
 
+    // Binds a member function, called from script as value.method(...).
+    template <auto Fn>
+    StructImportBuilder<T>& add_method(std::string method_name) {
+        _methods.push_back([method_name](StructImportBuilder<T>& b) {
+            return b._method(method_name, std::make_shared<ThunkRunnable>(&MemberBuiltin<Fn>::invoke), {}, Fn);
+        });
+        return *this;
+    }
+
+    // For a method that only returns a member, such as a trivial getter.
+    // Script calls to it are generated as a load of the member, with no call.
+    template <typename M>
+    StructImportBuilder<T>& add_getter(std::string method_name, std::string member_name) {
+        _methods.push_back([method_name, member_name](StructImportBuilder<T>& b) {
+            return b.template _method<M>(method_name, nullptr, Ast::ImportedAccessor{member_name, false}, static_cast<M(T::*)()>(nullptr));
+        });
+        return *this;
+    }
+
+    // For a method that only sets a member, generated as a store to it.
+    template <typename M>
+    StructImportBuilder<T>& add_setter(std::string method_name, std::string member_name) {
+        _methods.push_back([method_name, member_name](StructImportBuilder<T>& b) {
+            return b.template _method<void>(method_name, nullptr, Ast::ImportedAccessor{member_name, true}, static_cast<void(T::*)(M)>(nullptr));
+        });
+        return *this;
+    }
+
+    // The methods are imported once the type exists.
     StructImportBuilder<T>& build() {
         _types.imported_struct_type<T>(_name, _members);
+        for (auto& m : _methods) {
+            _imported.push_back(m(*this));
+        }
+        _methods.clear();
         return *this;
     }
 private:
+    template <typename R, typename U, typename... Args>
+    Ast::ImportedMethod _method(const std::string& method_name, std::shared_ptr<IRunnable> runnable, std::optional<Ast::ImportedAccessor> accessor, R(U::*)(Args...)) {
+        return Ast::ImportedMethod{
+            {_name},
+            method_name,
+            runnable,
+            _types.imported_method_type<R, T*, Args...>(),
+            typeid(R),
+            { typeid(T*), typeid(Args)... },
+            accessor
+        };
+    }
+    template <typename R, typename U, typename... Args>
+    Ast::ImportedMethod _method(const std::string& method_name, std::shared_ptr<IRunnable> runnable, std::optional<Ast::ImportedAccessor> accessor, R(U::*)(Args...) const) {
+        return _method(method_name, runnable, accessor, static_cast<R(U::*)(Args...)>(nullptr));
+    }
+
     Types::TypeTable& _types;
     std::string _name;
     std::vector<Types::StructTypeMember> _members;
-    std::vector<Ast::ImportedMethod> _methods;
+    std::vector<Ast::ImportedMethod>& _imported;
+    std::vector<std::function<Ast::ImportedMethod(StructImportBuilder<T>&)>> _methods;
 };
 
 class EnumImportBuilder {
 public:
-    EnumImportBuilder(std::string name, Types::TypeTable& types) : _name(name), _types(types) {}
+    EnumImportBuilder(std::string name, Types::TypeTable& types) : _types(types), _name(name) {}
 
     EnumImportBuilder& add_value(std::string value_name, int value) {
         _values[value_name] = value;
@@ -52,56 +106,174 @@ private:
     std::unordered_map<std::string, int> _values;
 };
 
+// A struct only script uses, with no host type behind it, so the compiler picks the offsets.
+// Members are named by their script type. They are reordered unless another layout is asked for;
+// the given layout puts each member on its own slot.
+class ScriptStructBuilder {
+public:
+    ScriptStructBuilder(std::string name, Types::TypeTable& types) : _types(types), _name(name) {}
+
+    ScriptStructBuilder& add_member(std::string member_name, std::string type_name) {
+        return _add(member_name, type_name, false);
+    }
+
+    // Reordered, the hot members are kept together at the front of the struct.
+    ScriptStructBuilder& add_hot_member(std::string member_name, std::string type_name) {
+        return _add(member_name, type_name, true);
+    }
+
+    Types::TypeId build(Types::StructLayout layout = Types::StructLayout::reordered) {
+        return _types.add_struct(_name, _members, layout);
+    }
+private:
+    ScriptStructBuilder& _add(std::string member_name, std::string type_name, bool hot) {
+        auto type = _types.find_type(type_name);
+        if (!type) {
+            throw "Unknown type for a struct member";
+        }
+        size_t offset = 0;
+        if (!_members.empty()) {
+            offset = _members.back().offset + _types.get_type(_members.back().type).size;
+        }
+        _members.push_back({member_name, offset, type.value(), Types::Mutable::yes, hot});
+        return *this;
+    }
+
+    Types::TypeTable& _types;
+    std::string _name;
+    std::vector<Types::StructTypeMember> _members;
+};
+
+struct SourceFile {
+    std::string filename;
+    std::string contents;
+};
+
 class Compiler {
 public:
     Compiler();
 
     std::shared_ptr<Program> compile(std::string filename, std::string contents);
+    // Uses a profile recorded by a VM (see VMProfile) to lay out the hot paths.
+    std::shared_ptr<Program> compile(std::string filename, std::string contents, const ProfileData& profile);
+    // Compiles independent files in parallel, one Program per file in the same order.
+    // All types and methods must be imported before this is called.
+    // thread_count of 0 uses one thread per core.
+    std::vector<std::shared_ptr<Program>> compile_many(const std::vector<SourceFile>& files, size_t thread_count = 0);
+    // Only parses and checks the declarations, each method is generated the first time it is called.
+    // The compiler must outlive the program, and errors inside a method are thrown by the call.
+    std::shared_ptr<Program> compile_lazy(std::string filename, std::string contents);
+
+    // Recompiles a file into the Program it was compiled into before, in place.
+    // Only the methods whose source changed are generated again. Callables and the globals
+    // states stay valid, unless globals_kept is false: then each state must be passed to
+    // Program::migrate_state before it is used again.
+    ReloadResult recompile(Program& program, std::string filename, std::string contents);
+
+    // Maps a program image saved with Program::save_image, linking it against
+    // the methods and types imported into this compiler.
+    std::shared_ptr<Program> load(std::string filename);
+
+    // The generated bytecode is printed to stdout by default.
+    void set_print_bytecode(bool print);
+    // The methods the host calls. When set, compiled programs only hold what these can reach;
+    // the rest of the methods, and the globals and constants only they use, are stripped.
+    // Not used by compile_lazy, and a recompile puts back everything in the file.
+    void set_entry_points(std::vector<std::string> names);
+    // Array indexes are checked by default, throwing when out of range. Checks are left
+    // out of `for i in 0..a.len` and `for i = 0; i < a.len; i += 1` loops that cannot take i out of a either way.
+    void set_bounds_checks(bool checks);
 
     template <typename T>
     StructImportBuilder<T> build_struct(std::string name) {
-        return StructImportBuilder<T>(name, _types);
+        return StructImportBuilder<T>(name, _types, _methods);
     }
 
     EnumImportBuilder build_enum(std::string name) {
         return EnumImportBuilder(name, _types);
     }
 
+    ScriptStructBuilder build_script_struct(std::string name) {
+        return ScriptStructBuilder(name, _types);
+    }
+
+    // A host math type of 2, 3 or 4 packed floats is used by script as a vec2, vec3 or vec4,
+    // in place with no copy. It has to be mapped before anything using it is imported.
+    template <typename T>
+    void map_vector() {
+        _types.map_vector_type<T>();
+    }
+
     template <typename Ret, typename... Args>
     void import_method(std::string name, std::function<Ret(Args...)> method) {
-        std::string type_name = _types.imported_method_type<Ret, Args...>();
+        Types::TypeId type_id = _types.imported_method_type<Ret, Args...>();
         std::shared_ptr<IRunnable> wrapped = std::make_shared<BuiltinRunnable<Ret, Args...>>(method);
 
         auto m = Ast::ImportedMethod{
             {},
             name,
             wrapped,
-            type_name,
+            type_id,
             typeid(Ret),
-            { typeid(Args)... }
+            { typeid(Args)... },
+            {}
         };
         _methods.push_back(m);
     }
 
+    // Imports a plain function, called by the VM with no std::function or virtual call in between.
+    template <auto Fn>
+    void import_function(std::string name) {
+        _import_function<Fn>({}, name, Fn);
+    }
+
+    template <auto Fn>
+    void import_scoped_function(std::string scope, std::string name) {
+        _import_function<Fn>({scope}, name, Fn);
+    }
+
     template <typename Ret, typename... Args>
     void import_scoped_method(std::string scope, std::string name, std::function<Ret(Args...)> method) {
-        std::string type_name = _types.imported_method_type<Ret, Args...>();
+        Types::TypeId type_id = _types.imported_method_type<Ret, Args...>();
         std::shared_ptr<IRunnable> wrapped = std::make_shared<BuiltinRunnable<Ret, Args...>>(method);
 
         auto m = Ast::ImportedMethod{
             {scope},
             name,
             wrapped,
-            type_name,
+            type_id,
             typeid(Ret),
-            { typeid(Args)... }
+            { typeid(Args)... },
+            {}
         };
         _methods.push_back(m);
     }
 
 private:
+    template <auto Fn, typename Ret, typename... Args>
+    void _import_function(std::vector<std::string> scopes, std::string name, Ret(*)(Args...)) {
+        Types::TypeId type_id = _types.imported_method_type<Ret, Args...>();
+        std::shared_ptr<IRunnable> wrapped = std::make_shared<ThunkRunnable>(&DirectBuiltin<Fn>::invoke);
+
+        auto m = Ast::ImportedMethod{
+            scopes,
+            name,
+            wrapped,
+            type_id,
+            typeid(Ret),
+            { typeid(Args)... },
+            {}
+        };
+        _methods.push_back(m);
+    }
+
+    std::shared_ptr<Program> _compile(const std::string& filename, const std::string& contents, const ProfileData* profile);
+
     Types::TypeTable _types;
     std::vector<Ast::ImportedMethod> _methods;
+    bool _print_bytecode;
+    std::vector<std::string> _entry_points;
+    bool _bounds_checks;
 };
 
 } // MattScript
@@ -2,12 +2,16 @@
 
 #include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cstdint>
 #include <iostream>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <typeinfo>
 #include <unordered_map>
 #include <variant>
@@ -21,87 +25,84 @@ namespace MattScript {
 namespace Parser {
 
 typedef std::shared_ptr<Ast::FileNode> FileNodePtr;
-typedef VectorView<std::shared_ptr<Tokens::Token>> TokenStream;
+
+// the tokens along with the source they refer to.
+class TokenStream : public VectorView<Tokens::Token> {
+public:
+    TokenStream(const Tokens::TokenList& list) : VectorView<Tokens::Token>(list.tokens), _list(list) {}
+
+    std::string_view text(const Tokens::Token& t) const {
+        return _list.text(t);
+    }
+private:
+    const Tokens::TokenList& _list;
+};
 
 struct node_return {
-    std::shared_ptr<Ast::Node> node;
+    Ast::NodeId node;
 };
 
 struct parser_wip {
     Types::TypeTable& types;
+    Ast::Tree& tree;
 };
 
-template<typename T>
-void
-eat_token(TokenStream& tokens) {
-    for (size_t i = 0; i < tokens.size(); i++) {
-        std::shared_ptr<Tokens::Token> token = tokens.peak();
-        if (!std::holds_alternative<T>(token->data)) {
-            return;
-        }
-        tokens.pull_front();
-    }
+bool
+is_next(TokenStream& tokens, Tokens::TokenType type) {
+    return !tokens.empty() && tokens.peak().type == type;
 }
 
-template<typename T>
-bool always_true(T v) { return true; }
+bool
+is_next_operator(TokenStream& tokens, Tokens::Operator want) {
+    return is_next(tokens, Tokens::TokenType::Operator) && tokens.peak().value.oper == want;
+}
 
-template<typename T>
-std::optional<T>
-token_if(TokenStream& tokens, std::function<bool(T)> cond = &always_true<T>) {
-    Tokens::TokenData d = tokens.peak()->data;
-    if (std::holds_alternative<T>(d) && cond(std::get<T>(d))) {
-        return std::get<T>(tokens.pull_front()->data);
-    }
-    return {};
+bool
+is_next_keyword(TokenStream& tokens, Tokens::Keyword want) {
+    return is_next(tokens, Tokens::TokenType::Keyword) && tokens.peak().value.keyword == want;
 }
 
-template<typename T>
-std::optional<T>
-peek_if(TokenStream& tokens, std::function<bool(T)> cond = &always_true<T>) {
-    Tokens::TokenData d = tokens.peak()->data;
-    if (std::holds_alternative<T>(d) && cond(std::get<T>(d))) {
-        return std::get<T>(d);
+std::optional<Tokens::Token>
+token_if(TokenStream& tokens, Tokens::TokenType type) {
+    if (is_next(tokens, type)) {
+        return tokens.pull_front();
     }
     return {};
 }
 
-template<typename T>
 bool
-is_next(TokenStream& tokens, std::function<bool(T)> cond = &always_true<T>) {
-    return peek_if<T>(tokens, cond).has_value();
+token_if_operator(TokenStream& tokens, Tokens::Operator want) {
+    if (is_next_operator(tokens, want)) {
+        tokens.pull_front();
+        return true;
+    }
+    return false;
 }
 
-void
-eat_whitespace(TokenStream& tokens) {
-    return eat_token<Tokens::SpaceToken>(tokens);
+bool
+token_if_keyword(TokenStream& tokens, Tokens::Keyword want) {
+    if (is_next_keyword(tokens, want)) {
+        tokens.pull_front();
+        return true;
+    }
+    return false;
 }
 
-void
-eat_newlines(TokenStream& tokens) {
-    return eat_token<Tokens::NewlineToken>(tokens);
+std::string_view
+pull_identifier(TokenStream& tokens) {
+    if (!is_next(tokens, Tokens::TokenType::Identifier)) {
+        throw "Syntax error, expected an identifier";
+    }
+    return tokens.text(tokens.pull_front());
 }
 
 void
-eat_anyspace(TokenStream& tokens) {
-    for (size_t i = 0; i < tokens.size(); i++) {
-        std::shared_ptr<Tokens::Token> token = tokens.peak();
-        if (!std::holds_alternative<Tokens::SpaceToken>(token->data) && !std::holds_alternative<Tokens::NewlineToken>(token->data)) {
-            return;
-        }
+eat_newlines(TokenStream& tokens) {
+    while (is_next(tokens, Tokens::TokenType::Newline)) {
         tokens.pull_front();
     }
 }
 
-bool
-is_operator(std::string want, Tokens::OperatorToken t) {
-    return want == t.oper;
-}
-bool
-is_keyword(std::string want, Tokens::KeywordToken t) {
-    return want == t.keyword;
-}
-
 // some forward decls
 node_return parse_block(FileNodePtr root, TokenStream& tokens, bool is_global, parser_wip& wip);
 
@@ -112,78 +113,103 @@ parse_expressionstmt(FileNodePtr root, TokenStream& tokens) {
 */
 
 bool
-is_simple_assignment(Tokens::OperatorToken token) {
-    return token.oper == "=";
+is_simple_assignment(Tokens::Operator oper) {
+    return oper == Tokens::Operator::Assign;
 }
 bool
-is_compound_assignment(Tokens::OperatorToken token) {
-    if (token.oper == "+=") { return true; }
-    if (token.oper == "-=") { return true; }
-    if (token.oper == "*=") { return true; }
-    if (token.oper == "/=") { return true; }
-    if (token.oper == "%=") { return true; }
-
-    return false;
+is_compound_assignment(Tokens::Operator oper) {
+    switch (oper) {
+    case Tokens::Operator::AddAssign:
+    case Tokens::Operator::SubtractAssign:
+    case Tokens::Operator::MultiplyAssign:
+    case Tokens::Operator::DivideAssign:
+    case Tokens::Operator::ModuloAssign:
+        return true;
+    default:
+        return false;
+    }
 }
 
 std::pair<int,int>
-binding_power(Tokens::OperatorToken token) {
-    if (token.oper == "+" || token.oper == "-") {
+binding_power(Tokens::Operator oper) {
+    switch (oper) {
+    case Tokens::Operator::Add:
+    case Tokens::Operator::Subtract:
         return {23, 24};
-    }
-    else if (token.oper == "*" || token.oper == "/" || token.oper == "%") {
+    case Tokens::Operator::Multiply:
+    case Tokens::Operator::Divide:
+    case Tokens::Operator::Modulo:
         return {25, 26};
-    }
 
-    else if (token.oper == "<" || token.oper == "<=" || token.oper == ">" || token.oper == ">=") {
+    case Tokens::Operator::Less:
+    case Tokens::Operator::LessEqual:
+    case Tokens::Operator::Greater:
+    case Tokens::Operator::GreaterEqual:
         return {17, 18};
-    }
-    else if (token.oper == "==" || token.oper == "!=") {
+    case Tokens::Operator::Eq:
+    case Tokens::Operator::NotEq:
         return {15, 16};
-    }
 
-    else if (is_simple_assignment(token) || is_compound_assignment(token)) {
+    case Tokens::Operator::Assign:
+    case Tokens::Operator::AddAssign:
+    case Tokens::Operator::SubtractAssign:
+    case Tokens::Operator::MultiplyAssign:
+    case Tokens::Operator::DivideAssign:
+    case Tokens::Operator::ModuloAssign:
         return {4, 3};
-    }
 
-    else if (token.oper == ".") {
+    case Tokens::Operator::Dot:
         return {31, 32};
-    }
 
-    else if (token.oper == "(") {
+    case Tokens::Operator::LParen:
+        return {31, 32};
+
+    case Tokens::Operator::LBracket:
         return {31, 32};
-    }
 
-    return {-1, -1};
+    default:
+        return {-1, -1};
+    }
 }
 Ast::BinaryOps
-binary_operator(Tokens::OperatorToken token) {
-    std::unordered_map<std::string, Ast::BinaryOps> ops = {
-        {"+", Ast::BinaryOps::Add},
-        {"-", Ast::BinaryOps::Subtract},
-        {"*", Ast::BinaryOps::Multiply},
-        {"/", Ast::BinaryOps::Divide},
-        {"%", Ast::BinaryOps::Modulo},
-
-        {"<", Ast::BinaryOps::Less},
-        {"<=", Ast::BinaryOps::LessEqual},
-        {">", Ast::BinaryOps::Greater},
-        {">=", Ast::BinaryOps::GreaterEqual},
-        {"==", Ast::BinaryOps::Eq},
-        {"!=", Ast::BinaryOps::NotEq},
-
-        {"+=", Ast::BinaryOps::Add},
-        {"-=", Ast::BinaryOps::Subtract},
-        {"*=", Ast::BinaryOps::Multiply},
-        {"/=", Ast::BinaryOps::Divide},
-        {"%=", Ast::BinaryOps::Modulo},
-    };
-
-    return ops.at(token.oper);
+binary_operator(Tokens::Operator oper) {
+    switch (oper) {
+    case Tokens::Operator::Add:
+    case Tokens::Operator::AddAssign:
+        return Ast::BinaryOps::Add;
+    case Tokens::Operator::Subtract:
+    case Tokens::Operator::SubtractAssign:
+        return Ast::BinaryOps::Subtract;
+    case Tokens::Operator::Multiply:
+    case Tokens::Operator::MultiplyAssign:
+        return Ast::BinaryOps::Multiply;
+    case Tokens::Operator::Divide:
+    case Tokens::Operator::DivideAssign:
+        return Ast::BinaryOps::Divide;
+    case Tokens::Operator::Modulo:
+    case Tokens::Operator::ModuloAssign:
+        return Ast::BinaryOps::Modulo;
+
+    case Tokens::Operator::Less:
+        return Ast::BinaryOps::Less;
+    case Tokens::Operator::LessEqual:
+        return Ast::BinaryOps::LessEqual;
+    case Tokens::Operator::Greater:
+        return Ast::BinaryOps::Greater;
+    case Tokens::Operator::GreaterEqual:
+        return Ast::BinaryOps::GreaterEqual;
+    case Tokens::Operator::Eq:
+        return Ast::BinaryOps::Eq;
+    case Tokens::Operator::NotEq:
+        return Ast::BinaryOps::NotEq;
+
+    default:
+        throw "Not a binary operator";
+    }
 }
 
 struct typeret {
-    std::string type_name;
+    Types::TypeId type;
     Types::Mutable is_mutable;
 };
 
@@ -192,51 +218,127 @@ parse_type(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
     bool is_ref = false;
     Types::Mutable is_mut = Types::Mutable::no;
 
-    if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "mut"))) {
+    if (token_if_keyword(tokens, Tokens::Keyword::Mut)) {
         is_mut = Types::Mutable::yes;
     }
-    if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "ref"))) {
+    if (token_if_keyword(tokens, Tokens::Keyword::Ref)) {
         is_ref = true;
     }
 
-    auto id = std::get<Tokens::IdentifierToken>(tokens.pull_front()->data).identifier;
+    std::string name(pull_identifier(tokens));
+    // array<T>
+    if (token_if_operator(tokens, Tokens::Operator::Less)) {
+        name += "<" + std::string(pull_identifier(tokens)) + ">";
+        if (!token_if_operator(tokens, Tokens::Operator::Greater)) {
+            throw "Missing > to end the type";
+        }
+    }
+    auto maybe_type = wip.types.find_type(name);
+    if (!maybe_type) {
+        throw "Unknown type";
+    }
+    auto id = maybe_type.value();
     if (is_ref) {
-        id = "ref " + id;
+        auto ref = wip.types.get_type(id).ref_to;
+        if (!ref) {
+            throw "Type cannot be referenced";
+        }
+        id = ref.value();
     }
     return typeret{ id, is_mut };
 }
 
 node_return
 parse_identifier(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
-    auto id = std::get<Tokens::IdentifierToken>(tokens.pull_front()->data).identifier;
-    std::vector<std::string> scopes;
+    auto id = wip.tree.intern(pull_identifier(tokens));
+    std::vector<Ast::Name> scopes;
 
-    while (token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "::"))) {
+    while (token_if_operator(tokens, Tokens::Operator::Scope)) {
         scopes.push_back(id);
-        id = std::get<Tokens::IdentifierToken>(tokens.pull_front()->data).identifier;
+        id = wip.tree.intern(pull_identifier(tokens));
     }
 
-    std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-    node->data = Ast::Identifier { scopes, id };
-    return {node};
+    return {wip.tree.add(Ast::Identifier { wip.tree.add_names(scopes), id })};
+}
+
+bool
+is_next_const(TokenStream& tokens) {
+    if (tokens.empty()) {
+        return false;
+    }
+    switch (tokens.peak().type) {
+    case Tokens::TokenType::S32:
+    case Tokens::TokenType::F32:
+    case Tokens::TokenType::S64:
+    case Tokens::TokenType::U32:
+    case Tokens::TokenType::U64:
+    case Tokens::TokenType::F64:
+    case Tokens::TokenType::Bool:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The value of a number written with its type after it, such as -0x10s64 or 2.5f64.
+template <typename T>
+T
+parse_suffixed_number(std::string_view text) {
+    text.remove_suffix(3);
+    bool negative = !text.empty() && text.front() == '-';
+    std::string_view digits = negative ? text.substr(1) : text;
+
+    T v = 0;
+    std::from_chars_result r;
+    if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+        digits.remove_prefix(2);
+        std::make_unsigned_t<T> bits = 0;
+        r = std::from_chars(digits.data(), digits.data() + digits.size(), bits, 16);
+        v = T(negative ? 0 - bits : bits);
+    }
+    else {
+        r = std::from_chars(text.data(), text.data() + text.size(), v);
+    }
+    if (r.ec != std::errc() || r.ptr != text.data() + text.size()) {
+        throw "Syntax error, invalid number";
+    }
+    return v;
+}
+
+template <>
+double
+parse_suffixed_number<double>(std::string_view text) {
+    text.remove_suffix(3);
+    double v = 0;
+    auto r = std::from_chars(text.data(), text.data() + text.size(), v);
+    if (r.ec != std::errc() || r.ptr != text.data() + text.size()) {
+        throw "Syntax error, invalid number";
+    }
+    return v;
 }
 
 node_return
 parse_const(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
-    if (auto v = token_if<Tokens::S32Token>(tokens)) {
-        std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-        node->data = Ast::ConstS32 { v.value().number };
-        return {node};
+    if (auto v = token_if(tokens, Tokens::TokenType::S32)) {
+        return {wip.tree.add(Ast::ConstS32 { v.value().value.s32 })};
+    }
+    if (auto v = token_if(tokens, Tokens::TokenType::F32)) {
+        return {wip.tree.add(Ast::ConstF32 { v.value().value.f32 })};
+    }
+    if (auto v = token_if(tokens, Tokens::TokenType::Bool)) {
+        return {wip.tree.add(Ast::ConstBool { v.value().value.boolean })};
+    }
+    if (auto v = token_if(tokens, Tokens::TokenType::S64)) {
+        return {wip.tree.add(Ast::ConstS64 { parse_suffixed_number<int64_t>(tokens.text(v.value())) })};
+    }
+    if (auto v = token_if(tokens, Tokens::TokenType::U32)) {
+        return {wip.tree.add(Ast::ConstU32 { parse_suffixed_number<uint32_t>(tokens.text(v.value())) })};
     }
-    if (auto v = token_if<Tokens::F32Token>(tokens)) {
-        std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-        node->data = Ast::ConstF32 { v.value().number };
-        return {node};
+    if (auto v = token_if(tokens, Tokens::TokenType::U64)) {
+        return {wip.tree.add(Ast::ConstU64 { parse_suffixed_number<uint64_t>(tokens.text(v.value())) })};
     }
-    if (auto v = token_if<Tokens::BoolToken>(tokens)) {
-        std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-        node->data = Ast::ConstBool { v.value().value };
-        return {node};
+    if (auto v = token_if(tokens, Tokens::TokenType::F64)) {
+        return {wip.tree.add(Ast::ConstF64 { parse_suffixed_number<double>(tokens.text(v.value())) })};
     }
 
     throw "unknown constant";
@@ -244,19 +346,16 @@ parse_const(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
 
 node_return
 parse_expression(FileNodePtr root, TokenStream& tokens, parser_wip& wip, int min_power) {
-    eat_whitespace(tokens);
-
-    std::shared_ptr<Ast::Node> lhs;
-    if (is_next<Tokens::IdentifierToken>(tokens)) {
+    Ast::NodeId lhs;
+    if (is_next(tokens, Tokens::TokenType::Identifier)) {
         lhs = parse_identifier(root, tokens, wip).node;
     }
-    else if (is_next<Tokens::S32Token>(tokens) || is_next<Tokens::F32Token>(tokens) || is_next<Tokens::BoolToken>(tokens)) {
+    else if (is_next_const(tokens)) {
         lhs = parse_const(root, tokens, wip).node;
     }
-    else if (is_next<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "("))) {
-        tokens.pull_front();
+    else if (token_if_operator(tokens, Tokens::Operator::LParen)) {
         lhs = parse_expression(root, tokens, wip, 0).node;
-        if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ")"))) {
+        if (!token_if_operator(tokens, Tokens::Operator::RParen)) {
             throw "Missing ) to end the expression";
         }
     }
@@ -266,65 +365,61 @@ parse_expression(FileNodePtr root, TokenStream& tokens, parser_wip& wip, int min
     }
 
     while (!tokens.empty()) {
-        eat_whitespace(tokens);
-
-        auto maybe = peek_if<Tokens::OperatorToken>(tokens);
-        if (!maybe) {
+        if (!is_next(tokens, Tokens::TokenType::Operator)) {
             break;
         }
-        auto token = maybe.value();
+        auto oper = tokens.peak().value.oper;
 
-        auto [lbp, rpb] = binding_power(token);
+        auto [lbp, rpb] = binding_power(oper);
         if (lbp < min_power) {
             break;
         }
         tokens.pull_front();
-        eat_whitespace(tokens);
 
-        if (token.oper == "(") {
-            std::vector<std::shared_ptr<Ast::Node>> params;
+        if (oper == Tokens::Operator::LParen) {
+            std::vector<Ast::NodeId> params;
 
-            if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ")"))) {
+            if (!token_if_operator(tokens, Tokens::Operator::RParen)) {
                 while (!tokens.empty()) {
                     auto paramexpr = parse_expression(root, tokens, wip, 0).node;
-                    std::shared_ptr<Ast::Node> pnode = std::make_shared<Ast::Node>();
-                    pnode->data = Ast::CallParam { paramexpr };
-                    params.push_back(pnode);
+                    params.push_back(wip.tree.add(Ast::CallParam { paramexpr }));
                 
-                    if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ","))) {
+                    if (!token_if_operator(tokens, Tokens::Operator::Comma)) {
                         break;
                     }
                 }
-                if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ")"))) {
+                if (!token_if_operator(tokens, Tokens::Operator::RParen)) {
                     throw "function call did not end in )";
                 }
             }
 
-            std::shared_ptr<Ast::Node> callnode = std::make_shared<Ast::Node>();
-            callnode->data = Ast::MethodCall { lhs, params };
-            lhs = callnode;
+            lhs = wip.tree.add(Ast::MethodCall { lhs, wip.tree.add_list(params) });
+            continue;
+        }
+        if (oper == Tokens::Operator::LBracket) {
+            auto index = parse_expression(root, tokens, wip, 0).node;
+            if (!token_if_operator(tokens, Tokens::Operator::RBracket)) {
+                throw "Missing ] to end the index";
+            }
+            lhs = wip.tree.add(Ast::IndexAccess { lhs, index });
             continue;
         }
 
-        std::shared_ptr<Ast::Node> rhs = parse_expression(root, tokens, wip, rpb).node;
-        eat_whitespace(tokens);
+        Ast::NodeId rhs = parse_expression(root, tokens, wip, rpb).node;
 
-        std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-        if (token.oper == ".") {
-            node->data = Ast::AccessMember { lhs, rhs };
+        if (oper == Tokens::Operator::Dot) {
+            lhs = wip.tree.add(Ast::AccessMember { lhs, rhs });
         }
-        else if (is_simple_assignment(token)) {
-            node->data = Ast::SetOperation { {}, lhs, rhs };
+        else if (is_simple_assignment(oper)) {
+            lhs = wip.tree.add(Ast::SetOperation { {}, lhs, rhs });
         }
-        else if (is_compound_assignment(token)) {
-            node->data = Ast::SetOperation { binary_operator(token), lhs, rhs };
+        else if (is_compound_assignment(oper)) {
+            lhs = wip.tree.add(Ast::SetOperation { binary_operator(oper), lhs, rhs });
         }
         else {
-            node->data = Ast::BinaryOperation { binary_operator(token), lhs, rhs };
+            lhs = wip.tree.add(Ast::BinaryOperation { binary_operator(oper), lhs, rhs });
         }
-        lhs = node;
     }
-    eat_whitespace(tokens);
     return {lhs};
 }
 
@@ -332,17 +427,17 @@ node_return
 parse_if(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
     // if condexpr block (else? block|if)
     auto condition = parse_expression(root, tokens, wip, 0).node;
-    if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "{"))) {
+    if (!token_if_operator(tokens, Tokens::Operator::LBrace)) {
         throw "Syntax error, expected block for if statement";
     }
     auto then = parse_block(root, tokens, false, wip).node;
 
-    std::optional<std::shared_ptr<Ast::Node>> elsevalue = {};
-    if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "else"))) {
-        if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "if"))) {
+    std::optional<Ast::NodeId> elsevalue = {};
+    if (token_if_keyword(tokens, Tokens::Keyword::Else)) {
+        if (token_if_keyword(tokens, Tokens::Keyword::If)) {
             elsevalue = parse_if(root, tokens, wip).node;
         }
-        else if (token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "{"))) {
+        else if (token_if_operator(tokens, Tokens::Operator::LBrace)) {
             elsevalue = parse_block(root, tokens, false, wip).node;
         }
         else {
@@ -350,41 +445,101 @@ parse_if(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
         }
     }
 
-    std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-    node->data = Ast::IfStmt { condition, then, elsevalue };
-    return {node};
+    return {wip.tree.add(Ast::IfStmt { condition, then, elsevalue })};
+}
+
+node_return
+parse_match(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
+    // match expr { (expr (, expr)* block)* (else block)? }
+    auto value = parse_expression(root, tokens, wip, 0).node;
+    if (!token_if_operator(tokens, Tokens::Operator::LBrace)) {
+        throw "Syntax error, expected { for match statement";
+    }
+
+    std::vector<Ast::NodeId> cases;
+    std::optional<Ast::NodeId> otherwise = {};
+    while (true) {
+        eat_newlines(tokens);
+        if (tokens.empty()) {
+            throw "Match must end in a }";
+        }
+        if (token_if_operator(tokens, Tokens::Operator::RBrace)) {
+            break;
+        }
+        if (otherwise) {
+            throw "The else of a match must be its last case";
+        }
+
+        if (token_if_keyword(tokens, Tokens::Keyword::Else)) {
+            if (!token_if_operator(tokens, Tokens::Operator::LBrace)) {
+                throw "Syntax error, expected block for else of match";
+            }
+            otherwise = parse_block(root, tokens, false, wip).node;
+            continue;
+        }
+
+        std::vector<Ast::NodeId> values;
+        do {
+            values.push_back(parse_expression(root, tokens, wip, 0).node);
+        } while (token_if_operator(tokens, Tokens::Operator::Comma));
+        if (!token_if_operator(tokens, Tokens::Operator::LBrace)) {
+            throw "Syntax error, expected block for match case";
+        }
+        auto block = parse_block(root, tokens, false, wip).node;
+        cases.push_back(wip.tree.add(Ast::MatchCase { wip.tree.add_list(values), block }));
+    }
+
+    return {wip.tree.add(Ast::MatchStmt { value, wip.tree.add_list(cases), otherwise })};
 }
 
 node_return
 parse_for(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
     // for expr; expr; expr {}
-    // for expr { maybe later
+    // for name in expr..expr {}
+    // for name in expr {}
+
+    if (tokens.size() > 1 && is_next(tokens, Tokens::TokenType::Identifier)) {
+        const auto& after = tokens.slice(1).peak();
+        if (after.type == Tokens::TokenType::Keyword && after.value.keyword == Tokens::Keyword::In) {
+            auto name = wip.tree.intern(pull_identifier(tokens));
+            tokens.pull_front();
+
+            auto first = parse_expression(root, tokens, wip, 0).node;
+            std::optional<Ast::NodeId> end;
+            if (token_if_operator(tokens, Tokens::Operator::Range)) {
+                end = parse_expression(root, tokens, wip, 0).node;
+            }
+            if (!token_if_operator(tokens, Tokens::Operator::LBrace)) {
+                throw "Syntax error, expected block for for statement";
+            }
+            auto block = parse_block(root, tokens, false, wip).node;
+
+            if (end) {
+                return {wip.tree.add(Ast::ForRange { name, first, end.value(), block })};
+            }
+            return {wip.tree.add(Ast::ForEach { name, first, block })};
+        }
+    }
 
     auto start = parse_expression(root, tokens, wip, 0).node;
 
-    if (token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ";"))) {
+    if (token_if_operator(tokens, Tokens::Operator::Semicolon)) {
         auto condition = parse_expression(root, tokens, wip, 0).node;
 
-        if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ";"))) {
+        if (!token_if_operator(tokens, Tokens::Operator::Semicolon)) {
             throw "Syntax error, expected ; between init, condition, and iteration of a for loop";
         }
 
         auto iteration = parse_expression(root, tokens, wip, 0).node;
 
-        if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "{"))) {
+        if (!token_if_operator(tokens, Tokens::Operator::LBrace)) {
             throw "Syntax error, expected block for for statement";
         }
         auto dothething = parse_block(root, tokens, false, wip).node;
-        std::get<Ast::Block>(dothething->data).nodes.push_back(iteration);
-
-        std::shared_ptr<Ast::Node> dowhile = std::make_shared<Ast::Node>();
-        dowhile->data = Ast::DoWhile { dothething, condition };
-        
-        std::shared_ptr<Ast::Node> startcond = std::make_shared<Ast::Node>();
-        startcond->data = Ast::IfStmt { condition, dowhile, {} };
 
-        std::shared_ptr<Ast::Node> surround = std::make_shared<Ast::Node>();
-        surround->data = Ast::Block { { start, startcond } };
+        auto dowhile = wip.tree.add(Ast::DoWhile { dothething, condition, iteration });
+        auto startcond = wip.tree.add(Ast::IfStmt { condition, dowhile, {} });
+        auto surround = wip.tree.add(Ast::Block { wip.tree.add_list({ start, startcond }) });
 
         return {surround};
     }
@@ -394,22 +549,18 @@ parse_for(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
 
 node_return
 parse_let(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
-    auto id = std::get<Tokens::IdentifierToken>(tokens.pull_front()->data).identifier;
+    auto id = wip.tree.intern(pull_identifier(tokens));
 
-    if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ":"))) {
+    if (!token_if_operator(tokens, Tokens::Operator::Colon)) {
         throw "Type of a variable must be specified";
     }
     auto type = parse_type(root, tokens, wip);
 
-    std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-    node->data = Ast::VariableDeclaration { id, type.type_name, type.is_mutable };
+    auto node = wip.tree.add(Ast::VariableDeclaration { id, type.type, type.is_mutable });
 
-    if (token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "="))) {
+    if (token_if_operator(tokens, Tokens::Operator::Assign)) {
         auto expr = parse_expression(root, tokens, wip, 0).node;
-
-        std::shared_ptr<Ast::Node> setnode = std::make_shared<Ast::Node>();
-        setnode->data = Ast::SetOperation { {}, node, expr };
-        node = setnode;
+        node = wip.tree.add(Ast::SetOperation { {}, node, expr });
     }
 
     return {node};
@@ -417,91 +568,66 @@ parse_let(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
 
 node_return
 parse_return(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
-    eat_whitespace(tokens);
-    std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-    if (token_if<Tokens::NewlineToken>(tokens)) {
-        node->data = Ast::ReturnValue { {} };
-    }
-    else {
-        std::shared_ptr<Ast::Node> ret = parse_expression(root, tokens, wip, 0).node;
-        node->data = Ast::ReturnValue { ret };
+    if (token_if(tokens, Tokens::TokenType::Newline)) {
+        return {wip.tree.add(Ast::ReturnValue { {} })};
     }
-    return {node};
+    auto ret = parse_expression(root, tokens, wip, 0).node;
+    return {wip.tree.add(Ast::ReturnValue { ret })};
 }
 
 node_return
 parse_method_decl(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
     //"fn", fn, ws, identifier, ws?, "(", param list ")" ws? ":" NL parse block
-    eat_whitespace(tokens);
+    auto ident = std::get<Ast::Identifier>(wip.tree.get(parse_identifier(root, tokens, wip).node).data);
 
-    auto ident = std::get<Ast::Identifier>(parse_identifier(root, tokens, wip).node->data);
-    eat_whitespace(tokens);
-
-    if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "("))) {
+    if (!token_if_operator(tokens, Tokens::Operator::LParen)) {
         throw "Syntax error, expected ( after identifier for function decl/def";
     }
-    eat_anyspace(tokens);
+    eat_newlines(tokens);
 
-    std::vector<std::string> param_names;
+    std::vector<Ast::Name> param_names;
     std::vector<Types::MethodTypeParameter> param_types;
 
-    auto param_token = token_if<Tokens::IdentifierToken>(tokens);
-    while (param_token) {
-        auto param_name = param_token.value().identifier;
-        eat_whitespace(tokens);
-        param_names.push_back(param_name);
+    while (is_next(tokens, Tokens::TokenType::Identifier)) {
+        param_names.push_back(wip.tree.intern(pull_identifier(tokens)));
 
-        if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ":"))) {
+        if (!token_if_operator(tokens, Tokens::Operator::Colon)) {
             throw "Syntax error, expected : between parameter name and type";
         }
-        eat_whitespace(tokens);
 
         auto param_type = parse_type(root, tokens, wip);
-        eat_whitespace(tokens);
-        param_types.push_back(Types::MethodTypeParameter{param_type.type_name, param_type.is_mutable});
+        param_types.push_back(Types::MethodTypeParameter{param_type.type, param_type.is_mutable});
 
-        if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ","))) {
+        if (!token_if_operator(tokens, Tokens::Operator::Comma)) {
             break;
         }
-        eat_whitespace(tokens);
-
-        param_token = token_if<Tokens::IdentifierToken>(tokens);
     }
-    eat_whitespace(tokens);
 
-    if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ")"))) {
+    if (!token_if_operator(tokens, Tokens::Operator::RParen)) {
         throw "Syntax error, expected ) after parameter list for function decl/def";
     }
-    eat_whitespace(tokens);
 
-    typeret ret_type = {"void", Types::Mutable::no};
-    if (token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, ":"))) {
-        eat_whitespace(tokens);
+    typeret ret_type = {Types::type_void, Types::Mutable::no};
+    if (token_if_operator(tokens, Tokens::Operator::Colon)) {
         ret_type = parse_type(root, tokens, wip);
-
-        eat_whitespace(tokens);
     }
-    eat_whitespace(tokens);
 
-    std::string method_type = wip.types.add_method(ret_type.type_name, ret_type.is_mutable, param_types);
+    auto method_type = wip.types.add_method(ret_type.type, ret_type.is_mutable, param_types);
 
-    if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "{"))) {
+    if (!token_if_operator(tokens, Tokens::Operator::LBrace)) {
         throw "Syntax error, expected block to start method";
     }
-    eat_anyspace(tokens);
+    eat_newlines(tokens);
 
     auto block = parse_block(root, tokens, false, wip);
 
-    std::shared_ptr<Ast::Node> node = std::make_shared<Ast::Node>();
-    node->data = Ast::MethodDefinition{
+    return {wip.tree.add(Ast::MethodDefinition{
         ident.scopes,
         ident.name,
         method_type,
-        param_names,
+        wip.tree.add_names(param_names),
         block.node
-    };
-
-    return {node};
+    })};
 }
 
 node_return
@@ -510,7 +636,8 @@ parse_statement(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
     //"if", = if, WS, expr, WS?, "{", NL parse block.
     //"else", else, WS?, ":", NL parse block. verify above to append to if
     //"fn", fn, ws, identifier, ws?, "(", param list ")" ws? ":" NL parse block
-    //"for", for, ws, identifier or destructor, ws, "in", ws, expr, ws? ":" NL parse block
+    //"for", for, ws, identifier, ws, "in", ws, expr (".." expr)?, ws? "{" NL parse block
+    //"match", match, ws, expr, ws? "{" NL (values block)* (else block)? "}"
     //"in" -> invalid
     // "(" could allow multiline statements
 
@@ -518,20 +645,35 @@ parse_statement(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
 
     eat_newlines(tokens);
 
-    if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "fn"))) {
-        return parse_method_decl(root, tokens, wip);
-    }
-    else if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "return"))) {
-        return parse_return(root, tokens, wip);
-    }
-    else if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "if"))) {
-        return parse_if(root, tokens, wip);
-    }
-    else if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "for"))) {
-        return parse_for(root, tokens, wip);
-    }
-    else if (token_if<Tokens::KeywordToken>(tokens, std::bind_front(is_keyword, "let"))) {
-        return parse_let(root, tokens, wip);
+    if (is_next(tokens, Tokens::TokenType::Keyword)) {
+        switch (tokens.peak().value.keyword) {
+        case Tokens::Keyword::Fn:
+            tokens.pull_front();
+            return parse_method_decl(root, tokens, wip);
+        case Tokens::Keyword::Return:
+            tokens.pull_front();
+            return parse_return(root, tokens, wip);
+        case Tokens::Keyword::If:
+            tokens.pull_front();
+            return parse_if(root, tokens, wip);
+        case Tokens::Keyword::For:
+            tokens.pull_front();
+            return parse_for(root, tokens, wip);
+        case Tokens::Keyword::Match:
+            tokens.pull_front();
+            return parse_match(root, tokens, wip);
+        case Tokens::Keyword::Let:
+            tokens.pull_front();
+            return parse_let(root, tokens, wip);
+        case Tokens::Keyword::Break:
+            tokens.pull_front();
+            return {wip.tree.add(Ast::BreakStmt {})};
+        case Tokens::Keyword::Continue:
+            tokens.pull_front();
+            return {wip.tree.add(Ast::ContinueStmt {})};
+        default:
+            break;
+        }
     }
     else {
         return parse_expression(root, tokens, wip, 0);
@@ -542,67 +684,58 @@ parse_statement(FileNodePtr root, TokenStream& tokens, parser_wip& wip) {
 
 node_return
 parse_block(FileNodePtr root, TokenStream& tokens, bool is_global, parser_wip& wip) {
-    std::vector<std::shared_ptr<Ast::Node>> fndefs;
-    std::vector<std::shared_ptr<Ast::Node>> statements;
+    std::vector<Ast::NodeId> fndefs;
+    std::vector<Ast::NodeId> statements;
 
     while (!tokens.empty()) {
         // TODO need to validate that blocks end
-        if (peek_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "}"))) {
+        if (is_next_operator(tokens, Tokens::Operator::RBrace)) {
             break;
         }
 
         auto statement = parse_statement(root, tokens, wip);
         eat_newlines(tokens);
 
-        if (std::holds_alternative<Ast::MethodDefinition>(statement.node->data)) {
-            statements.push_back(statement.node);
-
-            std::shared_ptr<Ast::Node> declnode = std::make_shared<Ast::Node>();
-            auto& mdef = std::get<Ast::MethodDefinition>(statement.node->data);
-            declnode->data = Ast::MethodDeclaration{
-                mdef.scopes,
-                mdef.name,
-                mdef.type
-            };
-            fndefs.push_back(declnode);
-        }
-        else {
-            statements.push_back(statement.node);
+        statements.push_back(statement.node);
+        if (auto* mdef = std::get_if<Ast::MethodDefinition>(&wip.tree.get(statement.node).data)) {
+            fndefs.push_back(wip.tree.add(Ast::MethodDeclaration{
+                mdef->scopes,
+                mdef->name,
+                mdef->type
+            }));
         }
     }
 
     if (!is_global) {
-        if (!token_if<Tokens::OperatorToken>(tokens, std::bind_front(is_operator, "}"))) {
+        if (!token_if_operator(tokens, Tokens::Operator::RBrace)) {
             throw "Block must end in a }";
         }
     }
 
-    std::vector<std::shared_ptr<Ast::Node>> all;
+    std::vector<Ast::NodeId> all;
+    all.reserve(fndefs.size() + statements.size());
     std::copy(fndefs.begin(), fndefs.end(), std::back_inserter(all));
     std::copy(statements.begin(), statements.end(), std::back_inserter(all));
 
-    std::shared_ptr<Ast::Node> n;
     if (is_global) {
-        n = std::make_shared<Ast::Node>();
-        n->data = Ast::GlobalBlock{ all };
+        return {wip.tree.add(Ast::GlobalBlock{ wip.tree.add_list(all) })};
     }
-    else {
-        n = std::make_shared<Ast::Node>();
-        n->data = Ast::Block{ all };
-    }
-
-    return {n};
+    return {wip.tree.add(Ast::Block{ wip.tree.add_list(all) })};
 }
 
 std::shared_ptr<Ast::FileNode>
-parse_to_ast(std::string file_name, std::vector<std::shared_ptr<Tokens::Token>> tokens, Types::TypeTable& types) {
-    TokenStream view = VectorView<std::shared_ptr<Tokens::Token>>(tokens);
-    parser_wip wip = {
-        types
-    };
+parse_to_ast(std::string file_name, const Tokens::TokenList& tokens, Types::TypeTable& types) {
+    TokenStream view(tokens);
 
     FileNodePtr file = std::make_shared<Ast::FileNode>();
     file->filename = file_name;
+    // a rough guess, most tokens end up as a node
+    file->tree.reserve(tokens.tokens.size());
+
+    parser_wip wip = {
+        types,
+        file->tree
+    };
 
     auto ret = parse_block(file, view, true, wip);
     if (!view.empty()) {
@@ -11,7 +11,7 @@
 namespace MattScript {
 namespace Parser {
 
-std::shared_ptr<Ast::FileNode> parse_to_ast(std::string file_name, std::vector<std::shared_ptr<Tokens::Token>> tokens, Types::TypeTable& types);
+std::shared_ptr<Ast::FileNode> parse_to_ast(std::string file_name, const Tokens::TokenList& tokens, Types::TypeTable& types);
 
 }
 }
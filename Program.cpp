@@ -1,9 +1,26 @@
 #include "Program.h"
 
 #include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iterator>
+#include <ostream>
+#include <span>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
 
-Program::Program(size_t const_bytes) : _globals_size(0), _constants(const_bytes) {}
+#include "ProgramImage.h"
+
+Program::Program(size_t const_bytes) : _globals_size(0), _constants(const_bytes), _copy_stats{}, _previous_globals_size(0) {}
+Program::Program(std::shared_ptr<MappedFile> image, const char* constants, size_t const_bytes) :
+    _globals_size(0),
+    _image(image),
+    // the constants are only ever read, so the mapped pages are never written.
+    _constants(const_cast<char*>(constants), const_bytes),
+    _copy_stats{},
+    _previous_globals_size(0) {}
 Program::~Program() {}
 
 std::shared_ptr<VMFixedStack>
@@ -13,21 +30,71 @@ Program::generate_state() {
 }
 
 void
-Program::add_builtin(std::string name, std::shared_ptr<IRunnable> runnable) {
+Program::migrate_state(VMFixedStack& globals) const {
+    if (_previous_globals.empty()) {
+        return;
+    }
+    std::vector<char> old(_previous_globals_size);
+    std::memcpy(old.data(), globals.data(), old.size());
+
+    globals.resize(_globals_size);
+    std::memset(globals.at<char>(0), 0, _globals_size);
+    for (auto& it : _globals) {
+        auto found = _previous_globals.find(it.first);
+        if (found == _previous_globals.end()) {
+            continue;
+        }
+        auto& was = found->second;
+        if (was.type == it.second.type && was.size == it.second.size) {
+            std::memcpy(globals.at<char>(it.second.address), old.data() + was.address, was.size);
+        }
+    }
+}
+
+void
+Program::add_builtin(std::string name, std::shared_ptr<IRunnable> runnable, std::vector<std::type_index> signature) {
     size_t addr = _builtins.size();
     _builtins.push_back(runnable);
+    auto thunk = dynamic_cast<const ThunkRunnable*>(runnable.get());
+    _builtin_thunks.push_back(thunk ? thunk->thunk() : nullptr);
+    _builtin_names.push_back(name);
+    _builtin_signatures.push_back(signature);
     _builtin_addresses[name] = addr;
 }
 
 void
-Program::add_global_index(std::string name, size_t size, size_t addr) {
-    _global_addresses[name] = addr;
-    _globals_size = addr + size;
+Program::add_global_index(std::string name, std::string type, size_t size, size_t addr) {
+    _globals[name] = GlobalMetadata{type, size, addr};
+    _globals_size = std::max(_globals_size, addr + size);
+}
+
+void
+Program::reset_globals() {
+    _previous_globals = std::move(_globals);
+    _previous_globals_size = _globals_size;
+    _globals.clear();
+    _globals_size = 0;
 }
 
 void
 Program::add_code(std::vector<Opcode> code) {
+    patchable_code();
     std::copy(code.begin(), code.end(), std::back_inserter(_code));
+    _code_view = _code;
+}
+
+std::span<Opcode>
+Program::patchable_code() {
+    if (_code.data() != _code_view.data()) {
+        _code.assign(_code_view.begin(), _code_view.end());
+        _code_view = _code;
+    }
+    return _code;
+}
+
+void
+Program::reserve_constants(size_t bytes) {
+    _constants.resize(bytes);
 }
 
 void
@@ -37,18 +104,26 @@ Program::register_method(std::string name, size_t address, std::vector<std::type
 }
 
 void
-Program::add_method_addr(size_t index, size_t param_size, size_t stack_size, size_t address) {
-    _function_metadata[address] = MethodMetadata{param_size, stack_size};
-    std::shared_ptr<IRunnable> runnable = std::make_shared<BytecodeRunnable>(address, param_size, stack_size);
+Program::add_method_addr(size_t index, std::string name, size_t param_size, size_t stack_size, size_t address, size_t code_size, uint64_t fingerprint, std::string type, std::vector<BranchSite> branches) {
     if (index >= _methods.size()) {
         _methods.resize(index + 1);
+        _method_entries.resize(index + 1);
+    }
+    if (_methods[index]) {
+        // FunctionAddress hands out the runnable itself, so it is moved rather than replaced.
+        _function_metadata.erase(_method_entries[index].address);
+        std::static_pointer_cast<BytecodeRunnable>(_methods[index])->relocate(address, param_size, stack_size);
     }
-    _methods[index] = runnable;
+    else {
+        _methods[index] = std::make_shared<BytecodeRunnable>(address, param_size, stack_size);
+    }
+    _function_metadata[address] = MethodMetadata{name, param_size, stack_size, code_size, index, fingerprint, type, std::move(branches)};
+    _method_entries[index] = MethodEntry{address, stack_size};
 }
 
 size_t
 Program::get_global_address(std::string name) const {
-    return _global_addresses.at(name);
+    return _globals.at(name).address;
 }
 
 size_t
@@ -68,7 +143,7 @@ Program::get_method_address(std::string name) const {
 
 size_t
 Program::current_method_address() const {
-    return _code.size();
+    return _code_view.size();
 }
 
 const MethodMetadata&
@@ -82,24 +157,62 @@ Program::get_method_metadata(size_t address) const {
     return _function_metadata.at(address);
 }
 
+const std::unordered_map<size_t, MethodMetadata>&
+Program::get_methods_metadata() const {
+    return _function_metadata;
+}
+
+size_t
+Program::get_method_index_address(size_t index) const {
+    return _method_entries.at(index).address;
+}
+
+size_t
+Program::method_count() const {
+    return _methods.size();
+}
+
+size_t
+Program::builtin_count() const {
+    return _builtins.size();
+}
+
+const std::unordered_map<std::string, GlobalMetadata>&
+Program::get_globals() const {
+    return _globals;
+}
+
 size_t
 Program::globals_size() const {
     return _globals_size;
 }
 
+const CopyStats&
+Program::copy_stats() const {
+    return _copy_stats;
+}
+
+void
+Program::add_copy_stats(const CopyStats& stats) {
+    _copy_stats.copies += stats.copies;
+    _copy_stats.bytes_copied += stats.bytes_copied;
+    _copy_stats.elided += stats.elided;
+    _copy_stats.bytes_elided += stats.bytes_elided;
+}
+
 //const std::vector<IRunnable*>&
 //Program::get_builtins() const {
 //    return _builtins;
 //}
 
-const std::vector<Opcode>&
+std::span<const Opcode>
 Program::get_code() const {
-    return _code;
+    return _code_view;
 }
 
 const Opcode&
 Program::get_opcode(size_t index) const {
-    return _code.at(index);
+    return _code_view[index];
 }
 
 const VMFixedStack&
@@ -116,3 +229,205 @@ const std::shared_ptr<IRunnable>
 Program::get_method_runnable(size_t addr) const {
     return _methods.at(addr);
 }
+
+void
+Program::set_lazy_generator(std::unique_ptr<ILazyGenerator> lazy) {
+    _lazy = std::move(lazy);
+}
+
+size_t
+Program::generate_method(size_t index) {
+    std::lock_guard lock(_lazy_lock);
+    size_t address = _method_entries.at(index).address;
+    if (_code_view[address].op != Bytecode::Stub) {
+        return address;
+    }
+    if (!_lazy) {
+        throw "Method was never generated";
+    }
+    return _lazy->generate(index);
+}
+
+void
+Program::generate_all() {
+    for (size_t i = 0; i < _methods.size(); i++) {
+        generate_method(i);
+    }
+    _lazy.reset();
+}
+
+static std::vector<std::string>
+signature_names(const std::vector<std::type_index>& types) {
+    std::vector<std::string> names;
+    for (auto& t : types) {
+        names.push_back(t.name());
+    }
+    return names;
+}
+
+void
+Program::write_image(std::ostream& out) const {
+    if (_lazy) {
+        throw "A lazy program must be generated before it is saved";
+    }
+    ImageWriter writer;
+    ProgramImageHeader header = {};
+    header.magic = PROGRAM_IMAGE_MAGIC;
+    header.version = PROGRAM_IMAGE_VERSION;
+    header.pointer_size = sizeof(void*);
+    header.opcode_size = sizeof(Opcode);
+    header.opcode_probe = image_opcode_probe();
+    header.globals_size = _globals_size;
+
+    header.code = writer.add_section<Opcode>(_code_view);
+    header.constants = writer.add_bytes(_constants.data(), _constants.size());
+
+    std::vector<ImageBuiltin> builtins;
+    for (size_t i = 0; i < _builtin_names.size(); i++) {
+        builtins.push_back(ImageBuiltin{
+            writer.add_string(_builtin_names[i]),
+            writer.add_signature(signature_names(_builtin_signatures[i]))
+        });
+    }
+    header.builtins = writer.add_section<ImageBuiltin>(builtins);
+
+    std::vector<ImageMethod> methods;
+    std::vector<ImageBranchSite> branches;
+    for (auto& it : _function_metadata) {
+        auto& m = it.second;
+        methods.push_back(ImageMethod{
+            writer.add_string(m.name), m.index, m.param_size, m.stack_size, it.first, m.code_size,
+            m.fingerprint, writer.add_string(m.type), ImageBranches{branches.size(), m.branches.size()}
+        });
+        for (auto& b : m.branches) {
+            branches.push_back(ImageBranchSite{b.offset, b.site, b.inverted});
+        }
+    }
+    header.methods = writer.add_section<ImageMethod>(methods);
+    header.branches = writer.add_section<ImageBranchSite>(branches);
+
+    std::vector<ImageRegisteredMethod> registered;
+    for (auto& it : _function_ret_params) {
+        registered.push_back(ImageRegisteredMethod{
+            writer.add_string(it.first),
+            _function_addresses.at(it.first),
+            writer.add_signature(signature_names(it.second))
+        });
+    }
+    header.registered = writer.add_section<ImageRegisteredMethod>(registered);
+
+    std::vector<ImageGlobal> globals;
+    for (auto& it : _globals) {
+        globals.push_back(ImageGlobal{
+            writer.add_string(it.first), writer.add_string(it.second.type), it.second.size, it.second.address
+        });
+    }
+    header.globals = writer.add_section<ImageGlobal>(globals);
+
+    writer.write(out, header);
+}
+
+void
+Program::save_image(std::string filename) const {
+    std::ofstream out(filename, std::ios::binary);
+    write_image(out);
+}
+
+std::shared_ptr<Program>
+Program::load_image(std::string filename, const HostImports& host) {
+    auto image = MappedFile::open(filename);
+
+    ProgramImageHeader header;
+    if (image->size() < sizeof(header)) {
+        throw "Corrupt program image";
+    }
+    std::memcpy(&header, image->data(), sizeof(header));
+    if (header.magic != PROGRAM_IMAGE_MAGIC) {
+        throw "Not a program image";
+    }
+    if (header.version != PROGRAM_IMAGE_VERSION) {
+        throw "Unsupported program image version";
+    }
+    if (header.pointer_size != sizeof(void*) || header.opcode_size != sizeof(Opcode) || header.opcode_probe != image_opcode_probe()) {
+        throw "Program image was built for a different host";
+    }
+
+    auto constants = image->section<char>(header.constants);
+    std::shared_ptr<Program> p(new Program(image, constants.data(), constants.size()));
+    p->_code_view = image->section<Opcode>(header.code);
+    p->_globals_size = header.globals_size;
+
+    auto strings = image->section<char>(header.strings);
+    auto text = [&](ImageString s) {
+        if (s.offset > strings.size() || s.length > strings.size() - s.offset) {
+            throw "Corrupt program image";
+        }
+        return std::string(strings.data() + s.offset, s.length);
+    };
+
+    auto type_names = image->section<ImageString>(header.type_names);
+    auto signatures = image->section<uint64_t>(header.signatures);
+    auto signature = [&](ImageSignature s) {
+        if (s.first > signatures.size() || s.count > signatures.size() - s.first) {
+            throw "Corrupt program image";
+        }
+        std::vector<std::string> names;
+        for (auto index : signatures.subspan(s.first, s.count)) {
+            if (index >= type_names.size()) {
+                throw "Corrupt program image";
+            }
+            names.push_back(text(type_names[index]));
+        }
+        return names;
+    };
+
+    // builtin indices are baked into the code, so every one must be found in the same order.
+    std::unordered_map<std::string, std::type_index> host_types;
+    for (auto& t : host.types) {
+        host_types.emplace(t.name(), t);
+    }
+    for (auto& b : image->section<ImageBuiltin>(header.builtins)) {
+        std::string name = text(b.name);
+        auto found = host.builtins.find(name);
+        if (found == host.builtins.end()) {
+            throw "Program image uses a builtin the host does not have";
+        }
+        if (signature(b.signature) != signature_names(found->second.signature)) {
+            throw "Program image builtin does not match the host signature";
+        }
+        p->add_builtin(name, found->second.runnable, found->second.signature);
+        for (auto& t : found->second.signature) {
+            host_types.emplace(t.name(), t);
+        }
+    }
+
+    auto branch_sites = image->section<ImageBranchSite>(header.branches);
+    for (auto& m : image->section<ImageMethod>(header.methods)) {
+        if (m.branches.first > branch_sites.size() || m.branches.count > branch_sites.size() - m.branches.first) {
+            throw "Corrupt program image";
+        }
+        std::vector<BranchSite> branches;
+        for (auto& b : branch_sites.subspan(m.branches.first, m.branches.count)) {
+            branches.push_back(BranchSite{b.offset, b.site, b.inverted != 0});
+        }
+        p->add_method_addr(m.index, text(m.name), m.param_size, m.stack_size, m.address, m.code_size, m.fingerprint, text(m.type), branches);
+    }
+
+    for (auto& r : image->section<ImageRegisteredMethod>(header.registered)) {
+        std::vector<std::type_index> types;
+        for (auto& name : signature(r.signature)) {
+            auto found = host_types.find(name);
+            if (found == host_types.end()) {
+                throw "Program image uses a type the host does not have";
+            }
+            types.push_back(found->second);
+        }
+        p->register_method(text(r.name), r.address, types);
+    }
+
+    for (auto& g : image->section<ImageGlobal>(header.globals)) {
+        p->_globals[text(g.name)] = GlobalMetadata{text(g.type), g.size, g.address};
+    }
+
+    return p;
+}
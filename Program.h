@@ -1,48 +1,136 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <ostream>
+#include <span>
+#include <string>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
 #include <typeindex>
 #include <typeinfo>
 #include <vector>
 
 #include "VMFFI.h"
 #include "VMBytecode.h"
+#include "ProgramImage.h"
 #include "VMStack.h"
 #include "VM.h"
 
+// The conditional jump of an if, so a profile can count it whatever the layout.
+struct BranchSite {
+    // from the start of the method.
+    size_t offset;
+    // which if of the method it is, in source order.
+    size_t site;
+    // the jump was flipped to lay out the else first, so it jumps when the condition holds.
+    bool inverted;
+};
+
 struct MethodMetadata {
+    std::string name;
     size_t param_size;
     size_t stack_size;
+    size_t code_size;
+    size_t index;
+    // identifies the source the code came from, see Compiler::recompile.
+    uint64_t fingerprint;
+    // the name of the method's type, which is its signature.
+    std::string type;
+    std::vector<BranchSite> branches;
+};
+
+struct GlobalMetadata {
+    std::string type;
+    size_t size;
+    size_t address;
+};
+
+// What Compiler::recompile changed in a Program.
+struct ReloadResult {
+    // the methods that were generated again, including new ones.
+    std::vector<std::string> regenerated;
+    // when false the globals moved, and every live state has to go through Program::migrate_state.
+    bool globals_kept;
+};
+
+// The by-value copies of structs and vectors in the generated code, and the ones left out
+// because the value was already built where it had to go.
+struct CopyStats {
+    size_t copies;
+    size_t bytes_copied;
+    size_t elided;
+    size_t bytes_elided;
+};
+
+// A builtin offered by the host, for linking a loaded program image.
+struct HostBuiltin {
+    std::shared_ptr<IRunnable> runnable;
+    // the return type first, then the parameters.
+    std::vector<std::type_index> signature;
+};
+
+// Everything a program image is resolved against when it is loaded.
+// Builtins are matched by name and signature, C++ types by their type_index name.
+struct HostImports {
+    std::unordered_map<std::string, HostBuiltin> builtins;
+    std::vector<std::type_index> types;
 };
 
 class Program;
 
+template <typename Signature>
+class MethodHandle;
+template <typename T>
+class GlobalHandle;
+
+// Where a method starts and the stack it needs, by index.
+struct MethodEntry {
+    size_t address;
+    size_t stack_size;
+};
+
+// Generates the code of a method the first time it is called.
+class ILazyGenerator {
+public:
+    virtual ~ILazyGenerator() = default;
+    // returns the address the method now starts at.
+    virtual size_t generate(size_t index) = 0;
+};
+
+// Refers to the method by index, so it still calls the right code after a recompile.
 template <typename Ret, typename... Args>
 class Callable {
 public:
-    Callable(const Program& p, size_t address, size_t stack_size) :
+    Callable(Program& p, size_t index) :
         _p(p),
-        _address(address),
-        _stack_size(stack_size) {}
+        _index(index) {}
 
     Ret operator()(VM& vm, VMFixedStack& globals, Args... args) {
-        size_t ret = 0;
-        vm.clear_state();
+        size_t frame = vm.begin_call();
         if constexpr (sizeof...(Args) > 0) {
             vm.push_parameters<Args...>(args...);
         } else if constexpr (!std::is_void<Ret>::value) {
             vm.reserve_return<Ret>();
         }
-        vm.run_method(_p, globals, _address, _stack_size);
+        _run(vm, globals, frame);
         if constexpr (!std::is_void<Ret>::value) {
-            return vm.get_return<Ret>(0);
+            Ret r = vm.get_return<Ret>(frame);
+            vm.end_call(frame);
+            return r;
+        }
+        else {
+            vm.end_call(frame);
         }
     }
 private:
-    const Program& _p;
-    size_t _address;
-    size_t _stack_size;
+    // Program is incomplete here.
+    void _run(VM& vm, VMFixedStack& globals, size_t frame) const;
+
+    Program& _p;
+    size_t _index;
 };
 
 // Program is a set of compiled instructions and information to find addresses.
@@ -60,33 +148,26 @@ public:
 
     template <typename Ret, typename... Args>
     std::function<Ret(VM&, VMFixedStack&, Args...)> method(std::string name) {
-        std::vector<std::type_index>& check = _function_ret_params.at(name);
-        std::vector<std::type_index> input = {
-            typeid(Ret),
-            typeid(Args)...
-        };
-        size_t size = check.size();
-        if (input.size() != size) {
-            throw "Incorrect number of parameters";
-        }
-        for (size_t i = 0; i < size; i++) {
-            if (check[i] != input[i]) {
-                throw "Incorrect parameter";
-            }
-        }
-
-        size_t address = get_method_address(name);
-        size_t stack_size = get_method_metadata(address).stack_size;
-        return Callable<Ret, Args...>(*this, address, stack_size);
+        return Callable<Ret, Args...>(*this, _checked_method_index<Ret, Args...>(name));
     }
 
+    // Resolved once, for hosts that call in often. See MethodHandle and GlobalHandle.
+    template <typename Signature>
+    // Running a lazy program generates its methods, so the handles need it mutable.
+    MethodHandle<Signature> method_handle(std::string name);
+    template <typename T>
+    GlobalHandle<T> global_handle(std::string name) const;
+
     // Generates a fixed stack containing all globals.
     std::shared_ptr<VMFixedStack> generate_state();
+    // After a recompile moved the globals, lays out a state made for the old globals the new way.
+    // Globals that kept their name and type keep their value.
+    void migrate_state(VMFixedStack& globals) const;
 
     template <typename T>
     void add_global(std::string name) {
         size_t s = runtimesizeof<T>();
-        _global_addresses[name] = _globals_size;
+        _globals[name] = GlobalMetadata{typeid(T).name(), s, _globals_size};
         _globals_size += s;
     }
     template <typename T>
@@ -94,17 +175,24 @@ public:
         size_t s = runtimesizeof<T>();
         size_t loc = _constants.size();
         _constants.reserve(s);
-        *_constants.at<T>(loc) = value;
+        std::memcpy(_constants.at<T>(loc), &value, sizeof(T));
         _constant_addresses[name] = loc;
     }
-    void add_builtin(std::string name, std::shared_ptr<IRunnable> runnable);
+    void add_builtin(std::string name, std::shared_ptr<IRunnable> runnable, std::vector<std::type_index> signature);
 
     void add_code(std::vector<Opcode> code);
-    void add_global_index(std::string name, size_t size, size_t addr);
+    // The code for patching in place, copied out of an image first if need be.
+    std::span<Opcode> patchable_code();
+    // Makes room for constants up to bytes, keeping the ones already there.
+    void reserve_constants(size_t bytes);
+    void add_global_index(std::string name, std::string type, size_t size, size_t addr);
+    // Drops the globals so they can be laid out again, keeping the old layout for migrate_state.
+    void reset_globals();
 
     // Register a method that is possible to be called by C++.
     void register_method(std::string name, size_t address, std::vector<std::type_index> types);
-    void add_method_addr(size_t index, size_t param_size, size_t stack_size, size_t address);
+    // Adding an index again moves the method, anything holding its runnable follows it.
+    void add_method_addr(size_t index, std::string name, size_t param_size, size_t stack_size, size_t address, size_t code_size, uint64_t fingerprint, std::string type, std::vector<BranchSite> branches);
 
     size_t get_global_address(std::string name) const;
     size_t get_constant_address(std::string name) const;
@@ -114,10 +202,21 @@ public:
 
     const MethodMetadata& get_method_metadata(std::string name) const;
     const MethodMetadata& get_method_metadata(size_t address) const;
+    const std::unordered_map<size_t, MethodMetadata>& get_methods_metadata() const;
+    size_t get_method_index_address(size_t index) const;
+    const MethodEntry& get_method_entry(size_t index) const {
+        return _method_entries[index];
+    }
+    size_t method_count() const;
+    size_t builtin_count() const;
 
+    const std::unordered_map<std::string, GlobalMetadata>& get_globals() const;
     size_t globals_size() const;
+    // Counted as the code is generated, so a recompile or a lazy method adds to it.
+    const CopyStats& copy_stats() const;
+    void add_copy_stats(const CopyStats& stats);
     // const std::vector<std::shared_ptr<IRunnable>>& get_builtins() const;
-    const std::vector<Opcode>& get_code() const;
+    std::span<const Opcode> get_code() const;
 
     const Opcode& get_opcode(size_t index) const;
 
@@ -128,13 +227,68 @@ public:
     const VMFixedStack& constants_table() const;
 
     const std::shared_ptr<IRunnable> get_builtin_runnable(size_t addr) const;
+    // nullptr unless the builtin was imported as a function pointer, see DirectBuiltin.
+    BuiltinThunk get_builtin_thunk(size_t addr) const {
+        return _builtin_thunks[addr];
+    }
     const std::shared_ptr<IRunnable> get_method_runnable(size_t addr) const;
 
+    // A lazy program starts with a Stub for each method, replaced on its first call.
+    // Generating adds and patches code that a running VM reads without a lock, so a lazy
+    // program must not be shared between threads until generate_all has been called.
+    void set_lazy_generator(std::unique_ptr<ILazyGenerator> lazy);
+    // Returns where the method starts, generating it first if it is still a Stub.
+    // Generating is serialized, so two calls never patch the program at once.
+    size_t generate_method(size_t index);
+    // Generates every method left, after which the program is no longer lazy.
+    void generate_all();
+
+    // A linked program can be written out as an image (see ProgramImage.h)
+    // and mapped back in without compiling it again. A lazy program has to be generated first.
+    void write_image(std::ostream& out) const;
+    void save_image(std::string filename) const;
+    // The code and constants are used directly from the mapped file.
+    static std::shared_ptr<Program> load_image(std::string filename, const HostImports& host);
+
 private:
+    Program(std::shared_ptr<MappedFile> image, const char* constants, size_t const_bytes);
+
+    template <typename Ret, typename... Args>
+    size_t _checked_method_index(const std::string& name) const {
+        const std::vector<std::type_index>& check = _function_ret_params.at(name);
+        const std::type_index input[] = {
+            typeid(Ret),
+            typeid(Args)...
+        };
+        size_t size = check.size();
+        if (std::size(input) != size) {
+            throw "Incorrect number of parameters";
+        }
+        for (size_t i = 0; i < size; i++) {
+            if (check[i] != input[i]) {
+                throw "Incorrect parameter";
+            }
+        }
+        return get_method_metadata(get_method_address(name)).index;
+    }
+
+    template <typename Ret, typename... Args>
+    MethodHandle<Ret(Args...)> _method_handle(const std::string& name, Ret(*)(Args...)) {
+        return MethodHandle<Ret(Args...)>(*this, _checked_method_index<Ret, Args...>(name));
+    }
+
     size_t _globals_size;
     std::vector<std::shared_ptr<IRunnable>> _builtins;
+    std::vector<BuiltinThunk> _builtin_thunks;
+    std::vector<std::string> _builtin_names;
+    std::vector<std::vector<std::type_index>> _builtin_signatures;
+    // _code_view is either _code or the code section of _image.
     std::vector<Opcode> _code;
+    std::span<const Opcode> _code_view;
+    std::shared_ptr<MappedFile> _image;
     VMFixedStack _constants;
+    std::unique_ptr<ILazyGenerator> _lazy;
+    std::mutex _lazy_lock;
     //std::unordered_map<size_t, IRunnable*> _methods;
     std::vector<std::shared_ptr<IRunnable>> _methods;
 
@@ -143,5 +297,84 @@ private:
     std::unordered_map<std::string, std::vector<std::type_index>> _function_ret_params;
     std::unordered_map<size_t, MethodMetadata> _function_metadata;
     std::unordered_map<std::string, size_t> _constant_addresses;
-    std::unordered_map<std::string, size_t> _global_addresses;
+    std::unordered_map<std::string, GlobalMetadata> _globals;
+    std::vector<MethodEntry> _method_entries;
+
+    CopyStats _copy_stats;
+
+    // the layout before the last reset_globals.
+    std::unordered_map<std::string, GlobalMetadata> _previous_globals;
+    size_t _previous_globals_size;
+};
+
+template <typename Ret, typename... Args>
+void
+Callable<Ret, Args...>::_run(VM& vm, VMFixedStack& globals, size_t frame) const {
+    const auto& entry = _p.get_method_entry(_index);
+    vm.run_method(_p, globals, entry.address, entry.stack_size, frame);
+}
+
+// A script method checked against a C++ signature once, then called by index.
+// Calling it does no lookups by name and no allocation, and it follows the method through a recompile.
+// Like Callable, it may be called from a builtin while the VM is running.
+template <typename Ret, typename... Args>
+class MethodHandle<Ret(Args...)> {
+public:
+    MethodHandle(Program& p, size_t index) :
+        _p(&p),
+        _index(index) {}
+
+    Ret operator()(VM& vm, VMFixedStack& globals, Args... args) const {
+        size_t frame = vm.begin_call();
+        if constexpr (sizeof...(Args) > 0) {
+            vm.push_parameters<Args...>(args...);
+        } else if constexpr (!std::is_void<Ret>::value) {
+            vm.reserve_return<Ret>();
+        }
+        const auto& entry = _p->get_method_entry(_index);
+        vm.run_method(*_p, globals, entry.address, entry.stack_size, frame);
+        if constexpr (!std::is_void<Ret>::value) {
+            Ret r = vm.get_return<Ret>(frame);
+            vm.end_call(frame);
+            return r;
+        }
+        else {
+            vm.end_call(frame);
+        }
+    }
+
+private:
+    Program* _p;
+    size_t _index;
 };
+
+// A global resolved to its address in every globals state of the Program.
+// Has to be taken again when a recompile does not keep the globals.
+template <typename T>
+class GlobalHandle {
+public:
+    GlobalHandle(size_t address) : _address(address) {}
+
+    T& operator()(VMFixedStack& globals) const {
+        return *globals.at<T>(_address);
+    }
+
+private:
+    size_t _address;
+};
+
+template <typename Signature>
+MethodHandle<Signature>
+Program::method_handle(std::string name) {
+    return _method_handle(name, static_cast<Signature*>(nullptr));
+}
+
+template <typename T>
+GlobalHandle<T>
+Program::global_handle(std::string name) const {
+    const auto& global = _globals.at(name);
+    if (global.size != sizeof(T)) {
+        throw "Incorrect global type";
+    }
+    return GlobalHandle<T>(global.address);
+}
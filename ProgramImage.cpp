@@ -0,0 +1,170 @@
+#include "ProgramImage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "VMBytecode.h"
+
+static size_t
+align_section(size_t offset) {
+    return ((offset + IMAGE_SECTION_ALIGN - 1) / IMAGE_SECTION_ALIGN) * IMAGE_SECTION_ALIGN;
+}
+
+uint64_t
+image_opcode_probe() {
+    // every field holds something different, so a reordered bitfield is caught.
+    Opcode probe(
+        Bytecode::s32Add,
+        StackAddressBackward(LocMemoryIndirect, 1),
+        GlobalAddress(LocMemoryDirect, 2),
+        StackAddressForward(LocMemoryIndirect, 3)
+    );
+    uint64_t words[2] = {};
+    std::memcpy(words, &probe, std::min(sizeof(probe), sizeof(words)));
+    return words[0] ^ (words[1] * 0x9e3779b97f4a7c15ull);
+}
+
+MappedFile::MappedFile() : _data(nullptr), _size(0) {}
+
+#ifdef _WIN32
+
+MappedFile::~MappedFile() {
+    if (_data) {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping) {
+        CloseHandle(_mapping);
+    }
+    if (_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(_file);
+    }
+}
+
+std::shared_ptr<MappedFile>
+MappedFile::open(const std::string& filename) {
+    std::shared_ptr<MappedFile> m(new MappedFile());
+    m->_mapping = nullptr;
+    m->_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m->_file == INVALID_HANDLE_VALUE) {
+        throw "Unable to open program image";
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m->_file, &size) || size.QuadPart == 0) {
+        throw "Unable to open program image";
+    }
+    m->_mapping = CreateFileMappingA(m->_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m->_mapping) {
+        throw "Unable to map program image";
+    }
+    m->_data = static_cast<const char*>(MapViewOfFile(m->_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m->_data) {
+        throw "Unable to map program image";
+    }
+    m->_size = size_t(size.QuadPart);
+    return m;
+}
+
+#else
+
+MappedFile::~MappedFile() {
+    if (_data) {
+        munmap(const_cast<char*>(_data), _size);
+    }
+}
+
+std::shared_ptr<MappedFile>
+MappedFile::open(const std::string& filename) {
+    std::shared_ptr<MappedFile> m(new MappedFile());
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw "Unable to open program image";
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw "Unable to open program image";
+    }
+    void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file alive.
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw "Unable to map program image";
+    }
+    m->_data = static_cast<const char*>(data);
+    m->_size = size_t(st.st_size);
+    return m;
+}
+
+#endif
+
+const char*
+MappedFile::data() const {
+    return _data;
+}
+
+size_t
+MappedFile::size() const {
+    return _size;
+}
+
+ImageWriter::ImageWriter() {}
+
+ImageSection
+ImageWriter::add_bytes(const void* data, size_t bytes) {
+    _body.resize(align_section(_body.size()));
+    size_t offset = _body.size();
+    _body.insert(_body.end(), static_cast<const char*>(data), static_cast<const char*>(data) + bytes);
+    // offsets are from the start of the image, the body follows the header.
+    return ImageSection{align_section(sizeof(ProgramImageHeader)) + offset, bytes};
+}
+
+ImageString
+ImageWriter::add_string(const std::string& s) {
+    ImageString r{_strings.size(), s.size()};
+    _strings += s;
+    return r;
+}
+
+ImageSignature
+ImageWriter::add_signature(const std::vector<std::string>& type_names) {
+    ImageSignature r{_signatures.size(), type_names.size()};
+    for (auto& name : type_names) {
+        auto it = _type_indexes.find(name);
+        if (it == _type_indexes.end()) {
+            it = _type_indexes.emplace(name, _type_names.size()).first;
+            _type_names.push_back(add_string(name));
+        }
+        _signatures.push_back(it->second);
+    }
+    return r;
+}
+
+void
+ImageWriter::write(std::ostream& out, ProgramImageHeader header) {
+    // these are only complete once every other section is added.
+    header.type_names = add_section<ImageString>(_type_names);
+    header.signatures = add_section<uint64_t>(_signatures);
+    header.strings = add_bytes(_strings.data(), _strings.size());
+
+    std::vector<char> start(align_section(sizeof(ProgramImageHeader)), 0);
+    std::memcpy(start.data(), &header, sizeof(header));
+    out.write(start.data(), start.size());
+    out.write(_body.data(), _body.size());
+    if (!out) {
+        throw "Unable to write program image";
+    }
+}
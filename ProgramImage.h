@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The on disk format of a linked Program.
+// The image is laid out so it can be mapped and used in place:
+// the code and the constant pool are never copied, only the name tables are read.
+// Images are only portable between builds of the host with the same Opcode layout,
+// which the header records and checks.
+//
+//   ProgramImageHeader
+//   sections, each aligned to IMAGE_SECTION_ALIGN, located by the header.
+
+const uint32_t PROGRAM_IMAGE_MAGIC = 0x4950534d; // "MSPI"
+const uint32_t PROGRAM_IMAGE_VERSION = 3;
+const size_t IMAGE_SECTION_ALIGN = 16;
+
+// Where a section starts in the image and how many entries it holds.
+struct ImageSection {
+    uint64_t offset;
+    uint64_t count;
+};
+
+// A string within the strings section.
+struct ImageString {
+    uint64_t offset;
+    uint64_t length;
+};
+
+// A run of entries in the signatures section, each an index into type_names.
+// The return type is always first.
+struct ImageSignature {
+    uint64_t first;
+    uint64_t count;
+};
+
+struct ImageBuiltin {
+    ImageString name;
+    ImageSignature signature;
+};
+
+// A run of entries in the branches section.
+struct ImageBranches {
+    uint64_t first;
+    uint64_t count;
+};
+
+struct ImageBranchSite {
+    uint64_t offset;
+    uint64_t site;
+    uint64_t inverted;
+};
+
+struct ImageMethod {
+    ImageString name;
+    uint64_t index;
+    uint64_t param_size;
+    uint64_t stack_size;
+    uint64_t address;
+    uint64_t code_size;
+    uint64_t fingerprint;
+    ImageString type;
+    ImageBranches branches;
+};
+
+struct ImageRegisteredMethod {
+    ImageString name;
+    uint64_t address;
+    ImageSignature signature;
+};
+
+struct ImageGlobal {
+    ImageString name;
+    ImageString type;
+    uint64_t size;
+    uint64_t address;
+};
+
+struct ProgramImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pointer_size;
+    uint32_t opcode_size;
+    // a known Opcode as this build lays it out.
+    uint64_t opcode_probe;
+    uint64_t globals_size;
+
+    ImageSection code;
+    ImageSection constants;
+    ImageSection strings;
+    ImageSection type_names;
+    ImageSection signatures;
+    ImageSection builtins;
+    ImageSection methods;
+    ImageSection registered;
+    ImageSection globals;
+    ImageSection branches;
+};
+
+uint64_t image_opcode_probe();
+
+// A read only view of a whole file.
+// The pages are shared between every process that maps the same file.
+class MappedFile {
+public:
+    ~MappedFile();
+
+    static std::shared_ptr<MappedFile> open(const std::string& filename);
+
+    const char* data() const;
+    size_t size() const;
+
+    template <typename T>
+    std::span<const T> section(ImageSection s) const {
+        size_t bytes = s.count * sizeof(T);
+        if (s.offset % alignof(T) != 0 || s.offset > _size || bytes > _size - s.offset) {
+            throw "Corrupt program image";
+        }
+        return std::span<const T>(reinterpret_cast<const T*>(_data + s.offset), s.count);
+    }
+
+private:
+    MappedFile();
+
+    const char* _data;
+    size_t _size;
+#ifdef _WIN32
+    void* _file;
+    void* _mapping;
+#endif
+};
+
+// Builds up the sections of an image in memory before it is written.
+class ImageWriter {
+public:
+    ImageWriter();
+
+    template <typename T>
+    ImageSection add_section(std::span<const T> entries) {
+        ImageSection s = add_bytes(entries.data(), entries.size() * sizeof(T));
+        s.count = entries.size();
+        return s;
+    }
+    // count is the number of bytes.
+    ImageSection add_bytes(const void* data, size_t bytes);
+
+    ImageString add_string(const std::string& s);
+    ImageSignature add_signature(const std::vector<std::string>& type_names);
+
+    // fills in the string and signature sections of the header.
+    void write(std::ostream& out, ProgramImageHeader header);
+
+private:
+    std::vector<char> _body;
+    std::string _strings;
+    std::vector<ImageString> _type_names;
+    std::unordered_map<std::string, uint64_t> _type_indexes;
+    std::vector<uint64_t> _signatures;
+};
@@ -1,13 +1,18 @@
 #include "Tokenizer.h"
 
+#include <array>
+#include <charconv>
+#include <cctype>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <typeinfo>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -16,9 +21,488 @@
 namespace MattScript {
 namespace Tokenizer {
 
-typedef std::function<std::optional<std::shared_ptr<Tokens::Token>>(std::string, Tokens::Position)> TokenScanner;
+struct keyword_entry {
+    std::string_view text;
+    Tokens::Keyword id;
+};
 
-std::optional<std::shared_ptr<Tokens::Token>>
+constexpr keyword_entry keywords[] = {
+    {"continue", Tokens::Keyword::Continue},
+    {"return", Tokens::Keyword::Return},
+    {"break", Tokens::Keyword::Break},
+    {"match", Tokens::Keyword::Match},
+    {"else", Tokens::Keyword::Else},
+    {"void", Tokens::Keyword::Void},
+    {"ref", Tokens::Keyword::Ref},
+    {"mut", Tokens::Keyword::Mut},
+    {"let", Tokens::Keyword::Let},
+    {"for", Tokens::Keyword::For},
+    {"fn", Tokens::Keyword::Fn},
+    {"if", Tokens::Keyword::If},
+    {"in", Tokens::Keyword::In}
+};
+
+constexpr size_t KEYWORD_TABLE_SIZE = 32;
+constexpr size_t KEYWORD_MIN_LENGTH = 2;
+constexpr size_t KEYWORD_MAX_LENGTH = 8;
+
+constexpr size_t
+keyword_hash(std::string_view word, size_t seed) {
+    return (word.length() + (unsigned char)word.front() * seed + (unsigned char)word.back()) % KEYWORD_TABLE_SIZE;
+}
+
+// finds a seed where no two keywords share a slot, so a lookup is one hash and one compare.
+constexpr size_t
+find_keyword_seed() {
+    for (size_t seed = 1; seed < 1024; seed++) {
+        bool used[KEYWORD_TABLE_SIZE] = {};
+        bool collides = false;
+        for (auto& k : keywords) {
+            size_t h = keyword_hash(k.text, seed);
+            if (used[h]) {
+                collides = true;
+                break;
+            }
+            used[h] = true;
+        }
+        if (!collides) {
+            return seed;
+        }
+    }
+    return 0;
+}
+
+constexpr size_t KEYWORD_SEED = find_keyword_seed();
+static_assert(KEYWORD_SEED != 0, "No perfect hash for the keywords, grow the table");
+
+constexpr std::array<signed char, KEYWORD_TABLE_SIZE>
+build_keyword_table() {
+    std::array<signed char, KEYWORD_TABLE_SIZE> table = {};
+    for (auto& slot : table) {
+        slot = -1;
+    }
+    for (size_t i = 0; i < std::size(keywords); i++) {
+        table[keyword_hash(keywords[i].text, KEYWORD_SEED)] = (signed char)i;
+    }
+    return table;
+}
+
+constexpr auto KEYWORD_TABLE = build_keyword_table();
+
+constexpr std::optional<Tokens::Keyword>
+find_keyword(std::string_view word) {
+    if (word.length() < KEYWORD_MIN_LENGTH || word.length() > KEYWORD_MAX_LENGTH) {
+        return {};
+    }
+    auto index = KEYWORD_TABLE[keyword_hash(word, KEYWORD_SEED)];
+    if (index < 0 || keywords[index].text != word) {
+        return {};
+    }
+    return keywords[index].id;
+}
+
+static_assert(find_keyword("return") == Tokens::Keyword::Return);
+static_assert(!find_keyword("returns"));
+
+struct operator_entry {
+    std::string_view text;
+    Tokens::Operator id;
+};
+
+constexpr operator_entry operators[] = {
+    {"<<=", Tokens::Operator::ShiftLeftAssign},
+    {">>=", Tokens::Operator::ShiftRightAssign},
+    {"||", Tokens::Operator::Or},
+    {"&&", Tokens::Operator::And},
+    {"**", Tokens::Operator::Power},
+    {"==", Tokens::Operator::Eq},
+    {"!=", Tokens::Operator::NotEq},
+    {"<=", Tokens::Operator::LessEqual},
+    {">=", Tokens::Operator::GreaterEqual},
+    {"<<", Tokens::Operator::ShiftLeft},
+    {">>", Tokens::Operator::ShiftRight},
+    {"+=", Tokens::Operator::AddAssign},
+    {"-=", Tokens::Operator::SubtractAssign},
+    {"*=", Tokens::Operator::MultiplyAssign},
+    {"/=", Tokens::Operator::DivideAssign},
+    {"%=", Tokens::Operator::ModuloAssign},
+    {"|=", Tokens::Operator::BitOrAssign},
+    {"&=", Tokens::Operator::BitAndAssign},
+    {"^=", Tokens::Operator::BitXorAssign},
+    {"::", Tokens::Operator::Scope},
+    {"!", Tokens::Operator::Not},
+    {"<", Tokens::Operator::Less},
+    {">", Tokens::Operator::Greater},
+    {"|", Tokens::Operator::BitOr},
+    {"&", Tokens::Operator::BitAnd},
+    {"^", Tokens::Operator::BitXor},
+    {"+", Tokens::Operator::Add},
+    {"-", Tokens::Operator::Subtract},
+    {"*", Tokens::Operator::Multiply},
+    {"/", Tokens::Operator::Divide},
+    {"%", Tokens::Operator::Modulo},
+    {",", Tokens::Operator::Comma},
+    {"(", Tokens::Operator::LParen},
+    {")", Tokens::Operator::RParen},
+    {"{", Tokens::Operator::LBrace},
+    {"}", Tokens::Operator::RBrace},
+    {"[", Tokens::Operator::LBracket},
+    {"]", Tokens::Operator::RBracket},
+    {":", Tokens::Operator::Colon},
+    {";", Tokens::Operator::Semicolon},
+    {"=", Tokens::Operator::Assign},
+    {"..", Tokens::Operator::Range},
+    {".", Tokens::Operator::Dot}
+};
+
+// a node per operator prefix. children are a linked list through sibling.
+struct operator_node {
+    char c;
+    bool terminal;
+    Tokens::Operator id;
+    short child;
+    short sibling;
+};
+
+constexpr size_t
+count_operator_chars() {
+    size_t total = 1;
+    for (auto& o : operators) {
+        total += o.text.length();
+    }
+    return total;
+}
+
+struct operator_trie {
+    std::array<operator_node, count_operator_chars()> nodes;
+    size_t count;
+};
+
+constexpr operator_trie
+build_operator_trie() {
+    operator_trie trie = {};
+    trie.nodes[0] = operator_node{'\0', false, Tokens::Operator::Dot, -1, -1};
+    trie.count = 1;
+
+    for (auto& o : operators) {
+        short node = 0;
+        for (char c : o.text) {
+            short child = trie.nodes[node].child;
+            while (child >= 0 && trie.nodes[child].c != c) {
+                child = trie.nodes[child].sibling;
+            }
+            if (child < 0) {
+                child = (short)trie.count++;
+                trie.nodes[child] = operator_node{c, false, Tokens::Operator::Dot, -1, trie.nodes[node].child};
+                trie.nodes[node].child = child;
+            }
+            node = child;
+        }
+        trie.nodes[node].terminal = true;
+        trie.nodes[node].id = o.id;
+    }
+    return trie;
+}
+
+constexpr operator_trie OPERATOR_TRIE = build_operator_trie();
+
+struct operator_match {
+    Tokens::Operator id;
+    size_t length;
+};
+
+// walks the trie as far as the text allows, keeping the longest operator seen.
+constexpr std::optional<operator_match>
+find_operator(std::string_view text) {
+    std::optional<operator_match> found;
+    short node = 0;
+    for (size_t i = 0; i < text.length(); i++) {
+        short child = OPERATOR_TRIE.nodes[node].child;
+        while (child >= 0 && OPERATOR_TRIE.nodes[child].c != text[i]) {
+            child = OPERATOR_TRIE.nodes[child].sibling;
+        }
+        if (child < 0) {
+            break;
+        }
+        node = child;
+        if (OPERATOR_TRIE.nodes[node].terminal) {
+            found = operator_match{OPERATOR_TRIE.nodes[node].id, i + 1};
+        }
+    }
+    return found;
+}
+
+static_assert(find_operator("<<=1")->id == Tokens::Operator::ShiftLeftAssign);
+static_assert(find_operator("<-")->id == Tokens::Operator::Less);
+static_assert(find_operator("..1")->id == Tokens::Operator::Range);
+static_assert(!find_operator("@"));
+
+bool
+is_identifier_start(char c) {
+    return std::isalpha((unsigned char)c) || c == '_';
+}
+
+bool
+is_identifier_char(char c) {
+    return std::isalnum((unsigned char)c) || c == '_';
+}
+
+bool
+is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+class scanner {
+public:
+    scanner(std::string_view source) : _source(source), _pos(0), _line(1), _line_start(0) {
+        _list.source = source;
+    }
+
+    Tokens::TokenList scan() {
+        // a rough guess to avoid most regrowth
+        _list.tokens.reserve(_source.length() / 3);
+
+        while (_pos < _source.length()) {
+            char c = _source[_pos];
+            switch (c) {
+            case '\n':
+                newline();
+                break;
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\v':
+            case '\f':
+                _pos++;
+                break;
+            case '/':
+                if (peek(1) == '/') {
+                    // just eat the entire comment...
+                    while (_pos < _source.length() && _source[_pos] != '\n') {
+                        _pos++;
+                    }
+                }
+                else {
+                    scan_operator();
+                }
+                break;
+            case '"':
+            case '\'':
+            case '`':
+                scan_string(c);
+                break;
+            case '-':
+                if (is_digit(peek(1))) {
+                    scan_number();
+                }
+                else {
+                    scan_operator();
+                }
+                break;
+            default:
+                if (is_digit(c)) {
+                    scan_number();
+                }
+                else if (is_identifier_start(c)) {
+                    scan_word();
+                }
+                else {
+                    scan_operator();
+                }
+                break;
+            }
+        }
+        newline();
+        return std::move(_list);
+    }
+
+private:
+    char peek(size_t ahead) const {
+        size_t at = _pos + ahead;
+        return at < _source.length() ? _source[at] : '\0';
+    }
+
+    Tokens::Token& add(Tokens::TokenType type, size_t start) {
+        Tokens::Token t;
+        t.type = type;
+        t.offset = (uint32_t)start;
+        t.length = (uint32_t)(_pos - start);
+        t.line = (uint32_t)_line;
+        t.col = (uint32_t)(start - _line_start);
+        t.value.s32 = 0;
+        _list.tokens.push_back(t);
+        return _list.tokens.back();
+    }
+
+    void newline() {
+        // only add a new line if we added something else.
+        // this way we only have one NL
+        auto& tokens = _list.tokens;
+        if (tokens.size() > 0 && tokens.back().type != Tokens::TokenType::Newline) {
+            add(Tokens::TokenType::Newline, _pos);
+        }
+        _pos++;
+        _line++;
+        _line_start = _pos;
+    }
+
+    void scan_word() {
+        size_t start = _pos;
+        _pos++;
+        while (_pos < _source.length() && is_identifier_char(_source[_pos])) {
+            _pos++;
+        }
+        std::string_view word = _source.substr(start, _pos - start);
+
+        if (word == "true" || word == "false") {
+            add(Tokens::TokenType::Bool, start).value.boolean = word == "true";
+            return;
+        }
+        if (auto k = find_keyword(word)) {
+            add(Tokens::TokenType::Keyword, start).value.keyword = k.value();
+            return;
+        }
+        add(Tokens::TokenType::Identifier, start);
+    }
+
+    void scan_number() {
+        size_t start = _pos;
+        if (_source[_pos] == '-') {
+            _pos++;
+        }
+
+        if (_source[_pos] == '0' && (peek(1) == 'x' || peek(1) == 'X')) {
+            _pos += 2;
+            size_t digits = _pos;
+            while (_pos < _source.length() && std::isxdigit((unsigned char)_source[_pos])) {
+                _pos++;
+            }
+            if (_pos == digits) {
+                error("Syntax error, invalid number");
+            }
+            if (auto suffixed = scan_number_suffix(false)) {
+                add(suffixed.value(), start);
+                return;
+            }
+            unsigned int v = 0;
+            if (std::from_chars(_source.data() + digits, _source.data() + _pos, v, 16).ec != std::errc()) {
+                error("Syntax error, invalid number");
+            }
+            // negated while unsigned, so -0x80000000 does not overflow.
+            if (_source[start] == '-') {
+                v = 0u - v;
+            }
+            add(Tokens::TokenType::S32, start).value.s32 = (int)v;
+            return;
+        }
+
+        while (_pos < _source.length() && is_digit(_source[_pos])) {
+            _pos++;
+        }
+        bool is_float = false;
+        if (_pos < _source.length() && _source[_pos] == '.' && peek(1) != '.') {
+            is_float = true;
+            _pos++;
+            while (_pos < _source.length() && is_digit(_source[_pos])) {
+                _pos++;
+            }
+        }
+
+        const char* first = _source.data() + start;
+        const char* last = _source.data() + _pos;
+        if (auto suffixed = scan_number_suffix(is_float)) {
+            add(suffixed.value(), start);
+            return;
+        }
+        if (is_float) {
+            float v = 0;
+            if (std::from_chars(first, last, v).ec != std::errc()) {
+                error("Syntax error, invalid number");
+            }
+            add(Tokens::TokenType::F32, start).value.f32 = v;
+        }
+        else {
+            int v = 0;
+            if (std::from_chars(first, last, v).ec != std::errc()) {
+                error("Syntax error, invalid number");
+            }
+            add(Tokens::TokenType::S32, start).value.s32 = v;
+        }
+    }
+
+    // the type written right after a number, which has to be f64 for one with a fraction.
+    std::optional<Tokens::TokenType> scan_number_suffix(bool is_float) {
+        constexpr std::pair<std::string_view, Tokens::TokenType> suffixes[] = {
+            {"s64", Tokens::TokenType::S64},
+            {"u32", Tokens::TokenType::U32},
+            {"u64", Tokens::TokenType::U64},
+            {"f64", Tokens::TokenType::F64},
+        };
+        for (auto& [text, type] : suffixes) {
+            if (_source.substr(_pos, text.length()) == text && !is_identifier_char(peek(text.length()))) {
+                if (is_float && type != Tokens::TokenType::F64) {
+                    error("Syntax error, invalid number");
+                }
+                _pos += text.length();
+                return type;
+            }
+        }
+        return {};
+    }
+
+    void scan_string(char quote_mark) {
+        size_t start = _pos;
+        _pos++;
+        while (_pos < _source.length() && _source[_pos] != '\n') {
+            if (_source[_pos] == quote_mark) {
+                _pos++;
+                add(Tokens::TokenType::String, start);
+                return;
+            }
+            // a backslash keeps the next character in the string, as the legacy tokenizer does.
+            if (_source[_pos] == '\\') {
+                _pos++;
+            }
+            _pos++;
+        }
+        // an incomplete string
+        _pos = start;
+        error("Syntax error, no token");
+    }
+
+    void scan_operator() {
+        if (auto o = find_operator(_source.substr(_pos))) {
+            size_t start = _pos;
+            _pos += o->length;
+            add(Tokens::TokenType::Operator, start).value.oper = o->id;
+            return;
+        }
+        error("Syntax error, no token");
+    }
+
+    void error(const char* message) {
+        size_t line_end = _source.find('\n', _line_start);
+        std::cerr << _line << " " << (_pos - _line_start) << " " << _source.substr(_line_start, line_end - _line_start) << "\n";
+        throw message;
+    }
+
+    std::string_view _source;
+    size_t _pos;
+    size_t _line;
+    size_t _line_start;
+    Tokens::TokenList _list;
+};
+
+Tokens::TokenList
+tokenize(std::string_view contents) {
+    return scanner(contents).scan();
+}
+
+namespace legacy {
+
+typedef std::function<std::optional<std::shared_ptr<Tokens::legacy::Token>>(std::string, Tokens::Position)> TokenScanner;
+
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_space(std::string line, Tokens::Position start) {
     size_t i = 0;
     while (i < line.length() && std::isspace(line[i])) {
@@ -28,19 +512,19 @@ try_space(std::string line, Tokens::Position start) {
         return {};
     }
     Tokens::Position end = Tokens::Position{start.line, start.col + i};
-    return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::SpaceToken{line.substr(0, i)});
+    return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::SpaceToken{line.substr(0, i)});
 }
 
-std::optional<std::shared_ptr<Tokens::Token>>
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_comment(std::string line, Tokens::Position start) {
     if (line.length() < 2 || line[0] != '/' || line[1] != '/') {
         return {};
     }
     Tokens::Position end = {start.line, start.col + line.length()};
-    return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::CommentToken{line.substr(1)});
+    return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::CommentToken{line.substr(1)});
 }
 
-std::optional<std::shared_ptr<Tokens::Token>>
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_keyword(std::string line, Tokens::Position start) {
     // TODO: optimize
     std::vector<std::string> keywords = {
@@ -64,13 +548,13 @@ try_keyword(std::string line, Tokens::Position start) {
         }
         if (line.substr(0, k.length()) == k) {
             Tokens::Position end = {start.line, start.col + k.length()};
-            return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::KeywordToken{k});
+            return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::KeywordToken{k});
         }
     }
     return {};
 }
 
-std::optional<std::shared_ptr<Tokens::Token>>
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_identifier(std::string line, Tokens::Position start) {
     if (!std::isalpha(line[0]) && line[0] != '_') {
         return {};
@@ -80,10 +564,10 @@ try_identifier(std::string line, Tokens::Position start) {
         i++;
     }
     Tokens::Position end = {start.line, start.col + i};
-    return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::IdentifierToken{line.substr(0, i)});
+    return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::IdentifierToken{line.substr(0, i)});
 }
 
-std::optional<std::shared_ptr<Tokens::Token>>
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_operator(std::string line, Tokens::Position start) {
     std::vector<std::string> ops = {
         "<<=",
@@ -136,13 +620,13 @@ try_operator(std::string line, Tokens::Position start) {
         }
         if (line.substr(0, o.length()) == o) {
             Tokens::Position end = {start.line, start.col + o.length()};
-            return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::OperatorToken{o});
+            return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::OperatorToken{o});
         }
     }
     return {};
 }
 
-std::optional<std::shared_ptr<Tokens::Token>>
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_string(std::string line, Tokens::Position start) {
     auto quote_mark = line[0];
     if (quote_mark != '"' && quote_mark != '\'' && quote_mark != '`') {
@@ -152,7 +636,7 @@ try_string(std::string line, Tokens::Position start) {
     while (i < line.length()) {
         if (line[i] == quote_mark) {
             Tokens::Position end = Tokens::Position{start.line, start.col + i + 1};
-            return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::StringToken{line.substr(1, i)});
+            return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::StringToken{line.substr(1, i)});
         }
         // TODO: escape support
         if (line[i] == '\\') {
@@ -168,7 +652,7 @@ try_string(std::string line, Tokens::Position start) {
     return {};
 }
 
-std::optional<std::shared_ptr<Tokens::Token>>
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_int(std::string line, Tokens::Position start) {
     bool enable_hex = false;
     size_t i = 0;
@@ -179,10 +663,10 @@ try_int(std::string line, Tokens::Position start) {
         return {};
     }
     Tokens::Position end = Tokens::Position{start.line, start.col + i};
-    return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::S32Token{std::stoi(line.substr(0, i))});
+    return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::S32Token{std::stoi(line.substr(0, i))});
 }
 
-std::optional<std::shared_ptr<Tokens::Token>>
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_float(std::string line, Tokens::Position start) {
     // TODO: more floats (expo et al)
     size_t i = 0;
@@ -193,10 +677,10 @@ try_float(std::string line, Tokens::Position start) {
         return {};
     }
     Tokens::Position end = Tokens::Position{start.line, start.col + i};
-    return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::F32Token{std::stof(line.substr(0, i))});
+    return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::F32Token{std::stof(line.substr(0, i))});
 }
 
-std::optional<std::shared_ptr<Tokens::Token>>
+std::optional<std::shared_ptr<Tokens::legacy::Token>>
 try_bool(std::string line, Tokens::Position start) {
     std::vector<std::pair<std::string, bool>> bools = {
         {"true", true},
@@ -210,13 +694,13 @@ try_bool(std::string line, Tokens::Position start) {
         }
         if (line.substr(0, str.length()) == str) {
             Tokens::Position end = {start.line, start.col + str.length()};
-            return std::make_shared<Tokens::Token>(Tokens::Span{start, end}, Tokens::BoolToken{p.second});
+            return std::make_shared<Tokens::legacy::Token>(Tokens::Span{start, end}, Tokens::legacy::BoolToken{p.second});
         }
     }
     return {};
 }
 
-std::vector<std::shared_ptr<Tokens::Token>>
+std::vector<std::shared_ptr<Tokens::legacy::Token>>
 tokenize_string(std::string contents) {
     std::istringstream stream(contents);
 
@@ -234,7 +718,7 @@ tokenize_string(std::string contents) {
         try_float
     };
 
-    std::vector<std::shared_ptr<Tokens::Token>> tokens;
+    std::vector<std::shared_ptr<Tokens::legacy::Token>> tokens;
     std::string line;
     size_t line_num = 0;
     while (std::getline(stream, line)) {
@@ -244,7 +728,7 @@ tokenize_string(std::string contents) {
             Tokens::Position start = Tokens::Position{line_num, col};
             std::string text = line.substr(col);
 
-            std::optional<std::shared_ptr<Tokens::Token>> longest = {};
+            std::optional<std::shared_ptr<Tokens::legacy::Token>> longest = {};
             for (auto& scanner : scanners) {
                 auto maybe = scanner(text, start);
                 if (maybe && (!longest || maybe.value()->span.end.col > longest.value()->span.end.col)) {
@@ -260,29 +744,31 @@ tokenize_string(std::string contents) {
             //    // a space that takes up the entire new line is just eaten up.
             //    break;
             //}
-            if (std::holds_alternative<Tokens::CommentToken>(longest.value()->data)) {
+            if (std::holds_alternative<Tokens::legacy::CommentToken>(longest.value()->data)) {
                 // just eat the entire comment...
                 break;
             }
 
-            if (!std::holds_alternative<Tokens::SpaceToken>(longest.value()->data)) {
+            if (!std::holds_alternative<Tokens::legacy::SpaceToken>(longest.value()->data)) {
                 tokens.push_back(longest.value());
             }
             col = longest.value()->span.end.col;
         }
-        while (tokens.size() > 0 && std::holds_alternative<Tokens::SpaceToken>(tokens[tokens.size() - 1]->data)) {
+        while (tokens.size() > 0 && std::holds_alternative<Tokens::legacy::SpaceToken>(tokens[tokens.size() - 1]->data)) {
             // we don't need empty lines...
             tokens.pop_back();
         }
-        if (tokens.size() > 0 && !std::holds_alternative<Tokens::NewlineToken>(tokens[tokens.size() - 1]->data)) {
+        if (tokens.size() > 0 && !std::holds_alternative<Tokens::legacy::NewlineToken>(tokens[tokens.size() - 1]->data)) {
             // only add a new line if we added something else.
             // this way we only have one NL 
             // TODO: update that token to be larger?
-            tokens.push_back(std::make_shared<Tokens::Token>(Tokens::Span{Tokens::Position{line_num, line.length()}, Tokens::Position{line_num + 1, 0}}, Tokens::NewlineToken{}));
+            tokens.push_back(std::make_shared<Tokens::legacy::Token>(Tokens::Span{Tokens::Position{line_num, line.length()}, Tokens::Position{line_num + 1, 0}}, Tokens::legacy::NewlineToken{}));
         }
     }
     return tokens;
 }
 
+}
+
 }
 }
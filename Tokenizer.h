@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -10,7 +11,15 @@
 namespace MattScript {
 namespace Tokenizer {
 
-std::vector<std::shared_ptr<Tokens::Token>> tokenize_string(std::string contents);
+// Scans the whole source in a single pass.
+// The tokens point back into contents, so it must outlive the returned list.
+Tokens::TokenList tokenize(std::string_view contents);
+
+namespace legacy {
+
+std::vector<std::shared_ptr<Tokens::legacy::Token>> tokenize_string(std::string contents);
+
+}
 
 }
 }
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 namespace MattScript {
 namespace Tokens {
@@ -16,6 +20,115 @@ struct Span {
     Position end;
 };
 
+enum class TokenType: unsigned char {
+    Newline,
+    Keyword,
+    Identifier,
+    Operator,
+    String,
+    S32,
+    F32,
+    // numbers with a type after them, such as 10s64. The value is read from the text.
+    S64,
+    U32,
+    U64,
+    F64,
+    Bool,
+};
+
+enum class Keyword: unsigned char {
+    Continue,
+    Return,
+    Break,
+    Match,
+    Else,
+    Void,
+    Ref,
+    Mut,
+    Let,
+    For,
+    Fn,
+    If,
+    In,
+};
+
+enum class Operator: unsigned char {
+    ShiftLeftAssign,
+    ShiftRightAssign,
+    Or,
+    And,
+    Power,
+    Eq,
+    NotEq,
+    LessEqual,
+    GreaterEqual,
+    ShiftLeft,
+    ShiftRight,
+    AddAssign,
+    SubtractAssign,
+    MultiplyAssign,
+    DivideAssign,
+    ModuloAssign,
+    BitOrAssign,
+    BitAndAssign,
+    BitXorAssign,
+    Scope,
+    Not,
+    Less,
+    Greater,
+    BitOr,
+    BitAnd,
+    BitXor,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Modulo,
+    Comma,
+    LParen,
+    RParen,
+    LBrace,
+    RBrace,
+    LBracket,
+    RBracket,
+    Colon,
+    Semicolon,
+    Assign,
+    Dot,
+    Range,
+};
+
+// Tokens do not own any text, they refer back into the source by offset.
+struct Token {
+    TokenType type;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t line;
+    uint32_t col;
+    union {
+        int s32;
+        float f32;
+        bool boolean;
+        Keyword keyword;
+        Operator oper;
+    } value;
+};
+
+// All the tokens of one source, back to back.
+// The source must outlive the list.
+struct TokenList {
+    std::string_view source;
+    std::vector<Token> tokens;
+
+    std::string_view text(const Token& t) const {
+        return source.substr(t.offset, t.length);
+    }
+};
+
+// The original tokens, one allocation per token.
+// Only kept around to benchmark against.
+namespace legacy {
+
 struct SpaceToken {
     std::string space;
 };
@@ -74,5 +187,7 @@ public:
     TokenData data;
 };
 
+} // legacy
+
 }
 }
@@ -1,8 +1,12 @@
 #include "Types.h"
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string>
 #include <sstream>
 #include <typeindex>
@@ -12,206 +16,455 @@
 
 #include "VMFFI.h"
 
-#define NUMERICAL_BINOPERATORS(vmtype) \
-    {Ast::BinaryOps::Add, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##Add} }}, \
-    {Ast::BinaryOps::Subtract, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##Sub} }}, \
-    {Ast::BinaryOps::Multiply, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##Mul} }}, \
-    {Ast::BinaryOps::Divide, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##Div} }}, \
-    {Ast::BinaryOps::Modulo, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##Mod} }},
+#define NUMERICAL_BINOPERATORS(vmtype, id) \
+    {Ast::BinaryOps::Add, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##Add} }}, \
+    {Ast::BinaryOps::Subtract, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##Sub} }}, \
+    {Ast::BinaryOps::Multiply, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##Mul} }}, \
+    {Ast::BinaryOps::Divide, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##Div} }}, \
+    {Ast::BinaryOps::Modulo, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##Mod} }},
 
-#define EQUAL_BINOPERATORS(vmtype) \
-    {Ast::BinaryOps::Eq, TypeBinaryOperator{ #vmtype, #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##Equal} }}, \
-    {Ast::BinaryOps::NotEq, TypeBinaryOperator{ #vmtype, #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##NotEqual} }},
+#define EQUAL_BINOPERATORS(vmtype, id) \
+    {Ast::BinaryOps::Eq, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##Equal} }}, \
+    {Ast::BinaryOps::NotEq, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##NotEqual} }},
 
-#define ORDINAL_BINOPERATORS(vmtype) \
-    {Ast::BinaryOps::Less, TypeBinaryOperator{ #vmtype, #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##Less} }}, \
-    {Ast::BinaryOps::LessEqual, TypeBinaryOperator{ #vmtype, #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##LessEqual} }}, \
-    {Ast::BinaryOps::Greater, TypeBinaryOperator{ #vmtype, #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##Greater} }}, \
-    {Ast::BinaryOps::GreaterEqual, TypeBinaryOperator{ #vmtype, #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##GreaterEqual} }},
+#define ORDINAL_BINOPERATORS(vmtype, id) \
+    {Ast::BinaryOps::Less, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##Less} }}, \
+    {Ast::BinaryOps::LessEqual, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##LessEqual} }}, \
+    {Ast::BinaryOps::Greater, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##Greater} }}, \
+    {Ast::BinaryOps::GreaterEqual, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##GreaterEqual} }},
 
-#define BOOLLOGIC_BINOPERATORS(vmtype) \
-    {Ast::BinaryOps::And, TypeBinaryOperator{ #vmtype, #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##And} }}, \
-    {Ast::BinaryOps::Or, TypeBinaryOperator{ #vmtype, #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##Or} }},
+#define BOOLLOGIC_BINOPERATORS(vmtype, id) \
+    {Ast::BinaryOps::And, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##And} }}, \
+    {Ast::BinaryOps::Or, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##Or} }},
 
-#define BITWISE_BINOPERATORS(vmtype) \
-    {Ast::BinaryOps::BitShiftLeft, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##ShiftLeft} }}, \
-    {Ast::BinaryOps::BitShiftRight, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##ShiftRight} }}, \
-    {Ast::BinaryOps::BitAnd, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##BitAnd} }}, \
-    {Ast::BinaryOps::BitOr, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##BitOr} }}, \
-    {Ast::BinaryOps::BitXor, TypeBinaryOperator{ #vmtype, #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##BitXor} }},
+#define BITWISE_BINOPERATORS(vmtype, id) \
+    {Ast::BinaryOps::BitShiftLeft, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##ShiftLeft} }}, \
+    {Ast::BinaryOps::BitShiftRight, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##ShiftRight} }}, \
+    {Ast::BinaryOps::BitAnd, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##BitAnd} }}, \
+    {Ast::BinaryOps::BitOr, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##BitOr} }}, \
+    {Ast::BinaryOps::BitXor, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::##vmtype##BitXor} }},
 
-#define COMPARISON_UNOPERATORS(vmtype) \
-    {Ast::UnaryOps::Not, TypeUnaryOperator{ #vmtype, "bool", TypeOperatorBytecode{Bytecode::##vmtype##Not} }},
+#define VECTOR_BINOPERATORS(vmtype, id) \
+    {Ast::BinaryOps::Add, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::vmtype##Add} }}, \
+    {Ast::BinaryOps::Subtract, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::vmtype##Sub} }}, \
+    {Ast::BinaryOps::Multiply, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::vmtype##Mul} }}, \
+    {Ast::BinaryOps::Divide, TypeBinaryOperator{ id, id, id, TypeOperatorBytecode{Bytecode::vmtype##Div} }}, \
+    {Ast::BinaryOps::Eq, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::vmtype##Equal} }}, \
+    {Ast::BinaryOps::NotEq, TypeBinaryOperator{ id, id, type_bool, TypeOperatorBytecode{Bytecode::vmtype##NotEqual} }},
 
-#define NUMERICAL_UNOPERATORS(vmtype) \
-    {Ast::UnaryOps::Negate, TypeUnaryOperator{ #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##Negate} }},
+#define COMPARISON_UNOPERATORS(vmtype, id) \
+    {Ast::UnaryOps::Not, TypeUnaryOperator{ id, type_bool, TypeOperatorBytecode{Bytecode::##vmtype##Not} }},
 
-#define BITWISE_UNOPERATORS(vmtype) \
-    {Ast::UnaryOps::BitNot, TypeUnaryOperator{ #vmtype, #vmtype, TypeOperatorBytecode{Bytecode::##vmtype##BitNot} }},
+#define NUMERICAL_UNOPERATORS(vmtype, id) \
+    {Ast::UnaryOps::Negate, TypeUnaryOperator{ id, id, TypeOperatorBytecode{Bytecode::##vmtype##Negate} }},
+
+#define BITWISE_UNOPERATORS(vmtype, id) \
+    {Ast::UnaryOps::BitNot, TypeUnaryOperator{ id, id, TypeOperatorBytecode{Bytecode::##vmtype##BitNot} }},
 
 
 namespace MattScript {
 namespace Types {
 
-TypeTable::TypeTable() {
-    _types["void"] = TypeInfo{"void", {}, 0, PrimitiveType::empty, typeid(void)};
-    _types["bool"] = TypeInfo{
-        "bool", {}, runtimesizeof<bool>(), PrimitiveType::boolean, typeid(bool),
+TypeTable::TypeTable() : _count(0) {
+    _add(TypeInfo{type_void, "void", {}, {}, 0, PrimitiveType::empty, typeid(void)});
+    _add(TypeInfo{
+        type_bool, "bool", {}, {}, runtimesizeof<bool>(), PrimitiveType::boolean, typeid(bool),
         {},
         {
-            EQUAL_BINOPERATORS(bool)
-            BOOLLOGIC_BINOPERATORS(bool)
+            EQUAL_BINOPERATORS(bool, type_bool)
+            BOOLLOGIC_BINOPERATORS(bool, type_bool)
         },
         {
-            COMPARISON_UNOPERATORS(bool)
+            COMPARISON_UNOPERATORS(bool, type_bool)
         }
-    };
-    _types["s32"] = TypeInfo{
-        "s32", {}, runtimesizeof<int>(), PrimitiveType::s32, typeid(int),
+    });
+    _add(TypeInfo{
+        type_s32, "s32", {}, {}, runtimesizeof<int>(), PrimitiveType::s32, typeid(int),
         {},
         {
-            NUMERICAL_BINOPERATORS(s32)
-            EQUAL_BINOPERATORS(s32)
-            ORDINAL_BINOPERATORS(s32)
-            BITWISE_BINOPERATORS(s32)
+            NUMERICAL_BINOPERATORS(s32, type_s32)
+            EQUAL_BINOPERATORS(s32, type_s32)
+            ORDINAL_BINOPERATORS(s32, type_s32)
+            BITWISE_BINOPERATORS(s32, type_s32)
         },
         {
-            NUMERICAL_UNOPERATORS(s32)
-            BITWISE_UNOPERATORS(s32)
+            NUMERICAL_UNOPERATORS(s32, type_s32)
+            BITWISE_UNOPERATORS(s32, type_s32)
         }
-    };
-    _types["f32"] = TypeInfo{
-        "f32", {}, runtimesizeof<float>(), PrimitiveType::f32, typeid(float),
+    });
+    _add(TypeInfo{
+        type_f32, "f32", {}, {}, runtimesizeof<float>(), PrimitiveType::f32, typeid(float),
         {},
         {
-            NUMERICAL_BINOPERATORS(f32)
-            EQUAL_BINOPERATORS(s32)
-            ORDINAL_BINOPERATORS(s32)
+            NUMERICAL_BINOPERATORS(f32, type_f32)
+            EQUAL_BINOPERATORS(f32, type_f32)
+            ORDINAL_BINOPERATORS(f32, type_f32)
         },
         {
-            NUMERICAL_UNOPERATORS(s32)
+            NUMERICAL_UNOPERATORS(f32, type_f32)
         }
-    };
-    _types["ref bool"] = TypeInfo{"ref bool", "bool", runtimesizeof<bool*>(), PrimitiveType::boolean, typeid(bool*)};
-    _types["ref s32"] = TypeInfo{"ref s32", "s32", runtimesizeof<int*>(), PrimitiveType::s32, typeid(int*)};
-    _types["ref f32"] = TypeInfo{"ref f32", "f32", runtimesizeof<float*>(), PrimitiveType::f32, typeid(float*)};
-    _mapped[typeid(void)] = "void";
-    _mapped[typeid(bool)] = "bool";
-    _mapped[typeid(int)] = "s32";
-    _mapped[typeid(float)] = "f32";
-    _mapped[typeid(bool*)] = "ref bool";
-    _mapped[typeid(int*)] = "ref s32";
-    _mapped[typeid(float*)] = "ref f32";
+    });
+    _add(TypeInfo{
+        type_s64, "s64", {}, {}, runtimesizeof<int64_t>(), PrimitiveType::s64, typeid(int64_t),
+        {},
+        {
+            NUMERICAL_BINOPERATORS(s64, type_s64)
+            EQUAL_BINOPERATORS(s64, type_s64)
+            ORDINAL_BINOPERATORS(s64, type_s64)
+            BITWISE_BINOPERATORS(s64, type_s64)
+        },
+        {
+            NUMERICAL_UNOPERATORS(s64, type_s64)
+            BITWISE_UNOPERATORS(s64, type_s64)
+        }
+    });
+    // no negate for the unsigned types.
+    _add(TypeInfo{
+        type_u32, "u32", {}, {}, runtimesizeof<uint32_t>(), PrimitiveType::u32, typeid(uint32_t),
+        {},
+        {
+            NUMERICAL_BINOPERATORS(u32, type_u32)
+            EQUAL_BINOPERATORS(u32, type_u32)
+            ORDINAL_BINOPERATORS(u32, type_u32)
+            BITWISE_BINOPERATORS(u32, type_u32)
+        },
+        {
+            BITWISE_UNOPERATORS(u32, type_u32)
+        }
+    });
+    _add(TypeInfo{
+        type_u64, "u64", {}, {}, runtimesizeof<uint64_t>(), PrimitiveType::u64, typeid(uint64_t),
+        {},
+        {
+            NUMERICAL_BINOPERATORS(u64, type_u64)
+            EQUAL_BINOPERATORS(u64, type_u64)
+            ORDINAL_BINOPERATORS(u64, type_u64)
+            BITWISE_BINOPERATORS(u64, type_u64)
+        },
+        {
+            BITWISE_UNOPERATORS(u64, type_u64)
+        }
+    });
+    _add(TypeInfo{
+        type_f64, "f64", {}, {}, runtimesizeof<double>(), PrimitiveType::f64, typeid(double),
+        {},
+        {
+            NUMERICAL_BINOPERATORS(f64, type_f64)
+            EQUAL_BINOPERATORS(f64, type_f64)
+            ORDINAL_BINOPERATORS(f64, type_f64)
+        },
+        {
+            NUMERICAL_UNOPERATORS(f64, type_f64)
+        }
+    });
+    // the vectors are structs of f32, so their members are read and written like any other.
+    _add_vector<2>({ VECTOR_BINOPERATORS(vec2, type_vec2) }, { NUMERICAL_UNOPERATORS(vec2, type_vec2) });
+    _add_vector<3>({ VECTOR_BINOPERATORS(vec3, type_vec3) }, { NUMERICAL_UNOPERATORS(vec3, type_vec3) });
+    _add_vector<4>({ VECTOR_BINOPERATORS(vec4, type_vec4) }, { NUMERICAL_UNOPERATORS(vec4, type_vec4) });
+    // the narrow types only hold a value; they are converted to a wider type to work on it.
+    _add(TypeInfo{type_u8, "u8", {}, {}, runtimesizeof<uint8_t>(), PrimitiveType::u8, typeid(uint8_t), {}, {}, {}, {}, sizeof(uint8_t)});
+    _add(TypeInfo{type_s8, "s8", {}, {}, runtimesizeof<int8_t>(), PrimitiveType::s8, typeid(int8_t), {}, {}, {}, {}, sizeof(int8_t)});
+    _add(TypeInfo{type_u16, "u16", {}, {}, runtimesizeof<uint16_t>(), PrimitiveType::u16, typeid(uint16_t), {}, {}, {}, {}, sizeof(uint16_t)});
+    _add(TypeInfo{type_s16, "s16", {}, {}, runtimesizeof<int16_t>(), PrimitiveType::s16, typeid(int16_t), {}, {}, {}, {}, sizeof(int16_t)});
+    TypeId ref_bool = _add(TypeInfo{0, "ref bool", type_bool, {}, runtimesizeof<bool*>(), PrimitiveType::boolean, typeid(bool*)});
+    TypeId ref_s32 = _add(TypeInfo{0, "ref s32", type_s32, {}, runtimesizeof<int*>(), PrimitiveType::s32, typeid(int*)});
+    TypeId ref_f32 = _add(TypeInfo{0, "ref f32", type_f32, {}, runtimesizeof<float*>(), PrimitiveType::f32, typeid(float*)});
+    TypeId ref_s64 = _add(TypeInfo{0, "ref s64", type_s64, {}, runtimesizeof<int64_t*>(), PrimitiveType::s64, typeid(int64_t*)});
+    TypeId ref_u32 = _add(TypeInfo{0, "ref u32", type_u32, {}, runtimesizeof<uint32_t*>(), PrimitiveType::u32, typeid(uint32_t*)});
+    TypeId ref_u64 = _add(TypeInfo{0, "ref u64", type_u64, {}, runtimesizeof<uint64_t*>(), PrimitiveType::u64, typeid(uint64_t*)});
+    TypeId ref_f64 = _add(TypeInfo{0, "ref f64", type_f64, {}, runtimesizeof<double*>(), PrimitiveType::f64, typeid(double*)});
+    TypeId ref_u8 = _add(TypeInfo{0, "ref u8", type_u8, {}, runtimesizeof<uint8_t*>(), PrimitiveType::u8, typeid(uint8_t*)});
+    TypeId ref_s8 = _add(TypeInfo{0, "ref s8", type_s8, {}, runtimesizeof<int8_t*>(), PrimitiveType::s8, typeid(int8_t*)});
+    TypeId ref_u16 = _add(TypeInfo{0, "ref u16", type_u16, {}, runtimesizeof<uint16_t*>(), PrimitiveType::u16, typeid(uint16_t*)});
+    TypeId ref_s16 = _add(TypeInfo{0, "ref s16", type_s16, {}, runtimesizeof<int16_t*>(), PrimitiveType::s16, typeid(int16_t*)});
+    _at(type_bool).ref_to = ref_bool;
+    _at(type_s32).ref_to = ref_s32;
+    _at(type_f32).ref_to = ref_f32;
+    _at(type_s64).ref_to = ref_s64;
+    _at(type_u32).ref_to = ref_u32;
+    _at(type_u64).ref_to = ref_u64;
+    _at(type_f64).ref_to = ref_f64;
+    _at(type_u8).ref_to = ref_u8;
+    _at(type_s8).ref_to = ref_s8;
+    _at(type_u16).ref_to = ref_u16;
+    _at(type_s16).ref_to = ref_s16;
+    _add_vector_ref<2>(type_vec2);
+    _add_vector_ref<3>(type_vec3);
+    _add_vector_ref<4>(type_vec4);
+
+    _mapped[typeid(void)] = type_void;
+    _mapped[typeid(bool)] = type_bool;
+    _mapped[typeid(int)] = type_s32;
+    _mapped[typeid(float)] = type_f32;
+    _mapped[typeid(int64_t)] = type_s64;
+    _mapped[typeid(uint32_t)] = type_u32;
+    _mapped[typeid(uint64_t)] = type_u64;
+    _mapped[typeid(double)] = type_f64;
+    _mapped[typeid(uint8_t)] = type_u8;
+    _mapped[typeid(int8_t)] = type_s8;
+    _mapped[typeid(uint16_t)] = type_u16;
+    _mapped[typeid(int16_t)] = type_s16;
+    _mapped[typeid(bool*)] = ref_bool;
+    _mapped[typeid(int*)] = ref_s32;
+    _mapped[typeid(float*)] = ref_f32;
+    _mapped[typeid(int64_t*)] = ref_s64;
+    _mapped[typeid(uint32_t*)] = ref_u32;
+    _mapped[typeid(uint64_t*)] = ref_u64;
+    _mapped[typeid(double*)] = ref_f64;
+    _mapped[typeid(uint8_t*)] = ref_u8;
+    _mapped[typeid(int8_t*)] = ref_s8;
+    _mapped[typeid(uint16_t*)] = ref_u16;
+    _mapped[typeid(int16_t*)] = ref_s16;
+
+    _add_array<int>(type_s32);
+    _add_array<float>(type_f32);
+    _add_array<int64_t>(type_s64);
+    _add_array<uint32_t>(type_u32);
+    _add_array<uint64_t>(type_u64);
+    _add_array<double>(type_f64);
+    _add_array<uint8_t>(type_u8);
+    _add_array<int8_t>(type_s8);
+    _add_array<uint16_t>(type_u16);
+    _add_array<int16_t>(type_s16);
 }
 
 TypeTable::~TypeTable() {}
 
+TypeId
+TypeTable::_add(TypeInfo info, bool named) {
+    size_t count = _count.load(std::memory_order_relaxed);
+    if (count >= MaxBlocks << BlockBits) {
+        throw "Too many types";
+    }
+    auto& block = _blocks[count >> BlockBits];
+    if (!block) {
+        block = std::make_unique<TypeInfo[]>(BlockMask + 1);
+    }
+    TypeId id = (TypeId)count;
+    info.id = id;
+    if (named) {
+        _names[info.name] = id;
+    }
+    block[count & BlockMask] = std::move(info);
+    // readers that see the new count see the type written above.
+    _count.store(count + 1, std::memory_order_release);
+    return id;
+}
+
+TypeId
+TypeTable::_add_with_ref(TypeInfo info, size_t ref_size, std::optional<std::type_index> ref_backing, bool named) {
+    TypeInfo ref = TypeInfo{
+        0, "ref " + info.name, {}, {},
+        ref_size,
+        info.type,
+        ref_backing
+    };
+
+    // the ref type always comes next, so both are linked before either is published.
+    TypeId id = (TypeId)_count.load(std::memory_order_relaxed);
+    info.ref_to = id + 1;
+    ref.ref_type = id;
+    _add(std::move(info), named);
+    _add(std::move(ref), named);
+    return id;
+}
+
 const TypeInfo&
-TypeTable::get_type(std::string name) const {
-    return _types.at(name);
+TypeTable::get_type(TypeId id) const {
+    if (id >= _count.load(std::memory_order_acquire)) {
+        throw "Unknown type";
+    }
+    return _blocks[id >> BlockBits][id & BlockMask];
+}
+
+std::optional<TypeId>
+TypeTable::find_type(const std::string& name) const {
+    auto it = _names.find(name);
+    if (it == _names.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+TypeId
+TypeTable::get_type_id(const std::string& name) const {
+    auto id = find_type(name);
+    if (!id) {
+        throw "Unknown type";
+    }
+    return id.value();
 }
 
 bool
-TypeTable::type_exists(std::string name) const {
-    return _types.find(name) != _types.end();
+TypeTable::type_exists(const std::string& name) const {
+    return _names.find(name) != _names.end();
+}
+
+TypeId
+TypeTable::mapped_type(std::type_index cpp_type) const {
+    return _mapped.at(cpp_type);
+}
+
+std::vector<std::type_index>
+TypeTable::mapped_types() const {
+    std::vector<std::type_index> v;
+    for (const auto& it : _mapped) {
+        v.push_back(it.first);
+    }
+    return v;
 }
 
 const std::vector<std::string>
 TypeTable::type_names() const {
     std::vector<std::string> v;
-    for (const auto it : _types) {
-        v.push_back(it.first);
+    size_t count = _count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        v.push_back(get_type((TypeId)i).name);
     }
     return v;
 }
 
-std::string
-TypeTable::add_method(std::string return_type, Mutable return_mutable, std::vector<MethodTypeParameter> params) {
+size_t
+_method_signature_hash(TypeId return_type, Mutable return_mutable, const std::vector<MethodTypeParameter>& params) {
+    size_t h = std::hash<TypeId>()(return_type);
+    auto mix = [&h](size_t v) {
+        h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+    };
+    mix(return_mutable == Mutable::yes);
+    for (auto& p : params) {
+        mix(p.type);
+        mix(p.is_mutable == Mutable::yes);
+    }
+    return h;
+}
+
+bool
+_same_signature(const MethodType& m, TypeId return_type, Mutable return_mutable, const std::vector<MethodTypeParameter>& params) {
+    if (m.return_type != return_type || m.return_mutable != return_mutable || m.parameters.size() != params.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < params.size(); i++) {
+        if (m.parameters[i].type != params[i].type || m.parameters[i].is_mutable != params[i].is_mutable) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TypeId
+TypeTable::add_method(TypeId return_type, Mutable return_mutable, const std::vector<MethodTypeParameter>& params) {
+    // the same signature always gets the same id, without building its name again.
+    size_t hash = _method_signature_hash(return_type, return_mutable, params);
+    {
+        std::shared_lock lock(_lock);
+        auto it = _method_signatures.find(hash);
+        if (it != _method_signatures.end()) {
+            for (auto id : it->second) {
+                if (_same_signature(std::get<MethodType>(get_type(id).type), return_type, return_mutable, params)) {
+                    return id;
+                }
+            }
+        }
+    }
+
+    // another thread may have added it between the locks, so check again.
+    std::unique_lock lock(_lock);
+    auto& bucket = _method_signatures[hash];
+    for (auto id : bucket) {
+        if (_same_signature(std::get<MethodType>(get_type(id).type), return_type, return_mutable, params)) {
+            return id;
+        }
+    }
+
     std::ostringstream stream;
-    stream << return_type << "(";
+    stream << get_type(return_type).name << "(";
     bool add_comma = false;
     for (auto& p : params) {
         if (add_comma) {
-        stream << ",";
+            stream << ",";
         }
         else {
             add_comma = true;
         }
-        stream << p.type;
+        stream << get_type(p.type).name;
     }
     stream << ")";
 
-    std::string type_name = stream.str();
-    std::string ref_type = "ref " + type_name;
-
-    _types[type_name] = TypeInfo{
-        type_name, {},
-        0,
-        MethodType{
-            return_type,
-            return_mutable,
-            params
+    TypeId id = _add_with_ref(
+        TypeInfo{
+            0, stream.str(), {}, {},
+            0,
+            MethodType{
+                return_type,
+                return_mutable,
+                params
+            },
+            // There's no backing type at this time.
+            {}
         },
-        // There's no backing type at this time.
-        {}
-    };
-    _types[ref_type] = TypeInfo{
-        ref_type, type_name,
         sizeof(size_t),
-        MethodType{
-            return_type,
-            return_mutable,
-            params
-        },
-        {}
-    };
-    return type_name;
+        {},
+        // method types are never looked up by name, so the names stay untouched while compiling.
+        false
+    );
+    bucket.push_back(id);
+    return id;
 }
 
-std::string
-TypeTable::add_struct(std::string type_name, std::vector<StructTypeMember> members) {
+TypeId
+TypeTable::add_struct(std::string type_name, std::vector<StructTypeMember> members, StructLayout layout) {
+    std::unique_lock lock(_lock);
+    if (layout == StructLayout::reordered) {
+        std::stable_sort(members.begin(), members.end(), [this](const StructTypeMember& a, const StructTypeMember& b) {
+            if (a.hot != b.hot) {
+                return a.hot;
+            }
+            return get_type(a.type).alignment() > get_type(b.type).alignment();
+        });
+    }
     size_t size = 0;
     for (auto& m : members) {
-        size += get_type(m.type).size;
+        const auto& info = get_type(m.type);
+        if (layout == StructLayout::packed) {
+            m.offset = size;
+        } else if (layout == StructLayout::reordered) {
+            m.offset = ((size + info.alignment() - 1) / info.alignment()) * info.alignment();
+        }
+        size = std::max(size, m.offset + info.packed_size());
     }
+    // a struct value still takes whole slots on the stack.
+    size = runtimesizeof<int>() * ((size + runtimesizeof<int>() - 1) / runtimesizeof<int>());
 
     std::unordered_map<std::string, StructTypeMember> mapped_members;
     for (auto member : members) {
         mapped_members[member.name] = member;
     }
 
-    _types[type_name] = TypeInfo{
-        type_name, {},
-        size,
-        StructType{mapped_members},
-        {}
-    };
-    std::string ref_type = "ref " + type_name;
-    _types[ref_type] = TypeInfo{
-        ref_type, type_name,
+    return _add_with_ref(
+        TypeInfo{
+            0, type_name, {}, {},
+            size,
+            StructType{mapped_members},
+            {}
+        },
         sizeof(size_t),
-        StructType{mapped_members},
         {}
-    };
-    return type_name;
+    );
 }
 
-std::string
+TypeId
 TypeTable::add_enum(std::string name, std::unordered_map<std::string, int> values) {
-    _types[name] = TypeInfo{
-        name, {},
-        runtimesizeof<int>(),
-        EnumType{values},
-        {}
-    };
-    std::string ref_type = "ref " + name;
-    _types[ref_type] = TypeInfo{
-        ref_type, name,
+    std::unique_lock lock(_lock);
+    return _add_with_ref(
+        TypeInfo{
+            0, name, {}, {},
+            runtimesizeof<int>(),
+            EnumType{values},
+            {}
+        },
         sizeof(size_t),
-        EnumType{values},
         {}
-    };
-    return name;
+    );
 }
 
 
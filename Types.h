@@ -1,20 +1,32 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string>
 #include <typeindex>
+#include <type_traits>
 #include <typeinfo>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
 #include "AST.h"
 #include "VMBytecode.h"
+#include "VMFFI.h"
 
 namespace MattScript {
 namespace Types {
 
+// An index into the TypeTable.
+typedef uint32_t TypeId;
+
 enum class Mutable {
     yes,
     no
@@ -29,6 +41,14 @@ enum class PrimitiveType: unsigned int {
     boolean,
     s32,
     f32,
+    s64,
+    u32,
+    u64,
+    f64,
+    u8,
+    s8,
+    u16,
+    s16,
 };
 
 //struct TupleTypeValue {
@@ -47,19 +67,32 @@ struct EnumType {
 struct StructTypeMember {
     std::string name;
     size_t offset;
-    std::string type;
+    TypeId type;
     Mutable is_mutable;
+    // a reordered layout puts the hot members first.
+    bool hot = false;
 };
 struct StructType {
     std::unordered_map<std::string, StructTypeMember> members;
 };
 
+// How add_struct places the members.
+enum class StructLayout {
+    // at the offsets they were given.
+    given,
+    // one after another in the order given, with nothing between them.
+    packed,
+    // for a struct only script uses: hot members first, then the widest alignment first,
+    // so each member stays aligned with as little padding as there can be.
+    reordered,
+};
+
 struct MethodTypeParameter {
-    std::string type;
+    TypeId type;
     Mutable is_mutable;
 };
 struct MethodType {
-    std::string return_type;
+    TypeId return_type;
     Mutable return_mutable;
     std::vector<MethodTypeParameter> parameters;
 };
@@ -71,93 +104,222 @@ struct TypeOperatorCall {
     std::string method_name;
 };
 struct TypeBinaryOperator {
-    std::string lhs_type;
-    std::string rhs_type;
-    std::string return_type;
+    TypeId lhs_type;
+    TypeId rhs_type;
+    TypeId return_type;
     std::variant<TypeOperatorBytecode, TypeOperatorCall> method;
 };
 struct TypeUnaryOperator {
-    std::string item_type;
-    std::string return_type;
+    TypeId item_type;
+    TypeId return_type;
     std::variant<TypeOperatorBytecode, TypeOperatorCall> method;
 };
 
 struct TypeInfo {
+    TypeId id;
     std::string name;
     // if this type is a reference type, this will be set to the type it refers to.
-    std::optional<std::string> ref_type;
+    std::optional<TypeId> ref_type;
+    // the reference type to this type, if there is one.
+    std::optional<TypeId> ref_to;
     size_t size;
     std::variant<PrimitiveType, EnumType, StructType, MethodType> type;
     std::optional<std::type_index> backing_type;
     std::unordered_map<std::string, std::string> methods;
     std::unordered_map<Ast::BinaryOps, TypeBinaryOperator> binary_operators;
     std::unordered_map<Ast::UnaryOps, TypeUnaryOperator> unary_operators;
+    // if this type is an array, the type of its elements.
+    std::optional<TypeId> element_type;
+    // for a type narrower than a stack slot, the bytes it takes in a struct or in the globals.
+    // On the stack it still takes size, with the value in the first bytes.
+    std::optional<size_t> narrow_size;
+
+    size_t packed_size() const {
+        return narrow_size.value_or(size);
+    }
+    // what a member of this type is lined up to in a reordered struct.
+    size_t alignment() const {
+        size_t s = packed_size();
+        if (s == 1 || s == 2 || s == 8) {
+            return s;
+        }
+        return runtimesizeof<int>();
+    }
 };
 
+// The primitives are always added first, so their ids are fixed.
+const TypeId type_void = 0;
+const TypeId type_bool = 1;
+const TypeId type_s32 = 2;
+const TypeId type_f32 = 3;
+const TypeId type_s64 = 4;
+const TypeId type_u32 = 5;
+const TypeId type_u64 = 6;
+const TypeId type_f64 = 7;
+const TypeId type_vec2 = 8;
+const TypeId type_vec3 = 9;
+const TypeId type_vec4 = 10;
+const TypeId type_u8 = 11;
+const TypeId type_s8 = 12;
+const TypeId type_u16 = 13;
+const TypeId type_s16 = 14;
+
+// Types are only ever added, so an id (or a reference to a TypeInfo) stays valid.
+// Reading a type takes no lock. Method types can be added while other threads compile;
+// every other type, and the names and mapped C++ types, must be added before the table
+// is shared between threads.
 class TypeTable {
 public:
     TypeTable();
     ~TypeTable();
 
-    bool type_exists(std::string name) const;
-    const TypeInfo& get_type(std::string name) const;
+    bool type_exists(const std::string& name) const;
+    std::optional<TypeId> find_type(const std::string& name) const;
+    TypeId get_type_id(const std::string& name) const;
+    const TypeInfo& get_type(TypeId id) const;
     const std::vector<std::string> type_names() const;
 
-    std::string add_method(std::string return_type, Mutable return_mutable, std::vector<MethodTypeParameter> params);
-    std::string add_struct(std::string name, std::vector<StructTypeMember> members);
-    std::string add_enum(std::string name, std::unordered_map<std::string, int> values);
+    TypeId add_method(TypeId return_type, Mutable return_mutable, const std::vector<MethodTypeParameter>& params);
+    // With a packed or reordered layout the offsets of the members are set here, and any given are ignored.
+    TypeId add_struct(std::string name, std::vector<StructTypeMember> members, StructLayout layout = StructLayout::given);
+    TypeId add_enum(std::string name, std::unordered_map<std::string, int> values);
+
+    TypeId mapped_type(std::type_index cpp_type) const;
+    // every C++ type that maps to a script type.
+    std::vector<std::type_index> mapped_types() const;
 
     template <typename Ret, typename... Args>
-    std::string imported_method_type() {
-        std::type_index r = typeid(Ret);
-        std::string r_name = _mapped.at(r);
+    TypeId imported_method_type() {
+        TypeId r = mapped_type(typeid(Ret));
 
         Types::Mutable mut = std::is_const<Ret>::value ? Types::Mutable::no : Types::Mutable::yes;
         std::vector<MethodTypeParameter> params = {
-            MethodTypeParameter{_mapped.at(typeid(Args)), !std::is_const<Args>::value}...
+            MethodTypeParameter{mapped_type(typeid(Args)), !std::is_const<Args>::value}...
         };
 
-        return add_method(r_name, mut, params);
+        return add_method(r, mut, params);
     }
 
     template <typename T>
     StructTypeMember imported_struct_member(std::string member_name, size_t offset) {
         std::type_index rawtype = typeid(T);
         return StructTypeMember{
-            member_name, offset, _mapped.at(rawtype), !std::is_const<T>::value
+            member_name, offset, mapped_type(rawtype), !std::is_const<T>::value
         };
     }
     template <typename T>
-    std::string imported_struct_type(std::string type_name, std::vector<StructTypeMember> members) {
+    TypeId imported_struct_type(std::string type_name, std::vector<StructTypeMember> members) {
         std::unordered_map<std::string, StructTypeMember> mapped_members;
         for (auto member : members) {
             mapped_members[member.name] = member;
         }
 
-        _types[type_name] = TypeInfo{
-            type_name, {},
-            sizeof(T),
-            StructType{mapped_members},
-            typeid(T)
-        };
-        _mapped[typeid(T)] = type_name;
-        _mapped[typeid(const T)] = type_name;
-
-        std::string ref_type = "ref " + type_name;
-        _types[ref_type] = TypeInfo{
-            ref_type, type_name,
+        std::unique_lock lock(_lock);
+        TypeId id = _add_with_ref(
+            TypeInfo{
+                0, type_name, {}, {},
+                sizeof(T),
+                StructType{mapped_members},
+                typeid(T)
+            },
             sizeof(T*),
-            StructType{mapped_members},
             typeid(T*)
-        };
-        _mapped[typeid(T*)] = ref_type;
-        _mapped[typeid(const T*)] = ref_type;
-        return type_name;
+        );
+        TypeId ref_id = _at(id).ref_to.value();
+        _mapped[typeid(T)] = id;
+        _mapped[typeid(const T)] = id;
+        _mapped[typeid(T*)] = ref_id;
+        _mapped[typeid(const T*)] = ref_id;
+        return id;
+    }
+
+    // Lets a host math type stand in for vec2, vec3 or vec4, picked by how many floats it holds.
+    // Script reads and writes it in place, so it has to be those floats packed with nothing else.
+    template <typename T>
+    void map_vector_type() {
+        static_assert(std::is_trivially_copyable<T>::value && sizeof(T) % sizeof(float) == 0
+            && sizeof(T) >= sizeof(ScriptVec<2>) && sizeof(T) <= sizeof(ScriptVec<4>),
+            "A vector type must be 2 to 4 packed floats");
+        TypeId id = type_vec2 + TypeId(sizeof(T) / sizeof(float) - 2);
+
+        std::unique_lock lock(_lock);
+        TypeId ref_id = _at(id).ref_to.value();
+        _mapped[typeid(T)] = id;
+        _mapped[typeid(const T)] = id;
+        _mapped[typeid(T*)] = ref_id;
+        _mapped[typeid(const T*)] = ref_id;
     }
 
 private:
-    std::unordered_map<std::string, TypeInfo> _types;
-    std::unordered_map<std::type_index, std::string> _mapped;
+    // these expect the lock to already be held. A type that is not named can't be found by find_type.
+    TypeId _add(TypeInfo info, bool named = true);
+    // adds the type along with its reference type, returning the id of the type.
+    TypeId _add_with_ref(TypeInfo info, size_t ref_size, std::optional<std::type_index> ref_backing, bool named = true);
+    // only for a type that is not yet shared, or while the lock is held.
+    TypeInfo& _at(TypeId id) {
+        return _blocks[id >> BlockBits][id & BlockMask];
+    }
+    // adds array<T> for a primitive T, backed by ScriptArray<T>.
+    template <typename T>
+    TypeId _add_array(TypeId element) {
+        TypeId id = _add_with_ref(
+            TypeInfo{
+                0, "array<" + _at(element).name + ">", {}, {},
+                sizeof(ScriptArray<T>),
+                StructType{{
+                    {"len", StructTypeMember{"len", offsetof(ScriptArray<T>, len), type_s32, Mutable::no}}
+                }},
+                typeid(ScriptArray<T>)
+            },
+            sizeof(ScriptArray<T>*),
+            typeid(ScriptArray<T>*)
+        );
+        _at(id).element_type = element;
+        _mapped[typeid(ScriptArray<T>)] = id;
+        _mapped[typeid(ScriptArray<T>*)] = _at(id).ref_to.value();
+        return id;
+    }
+    // adds vecN, with x, y, z and w as its members. Its ref type is added with the others.
+    template <size_t N>
+    TypeId _add_vector(std::unordered_map<Ast::BinaryOps, TypeBinaryOperator> binary_operators, std::unordered_map<Ast::UnaryOps, TypeUnaryOperator> unary_operators) {
+        const char* names[] = {"x", "y", "z", "w"};
+        std::unordered_map<std::string, StructTypeMember> members;
+        for (size_t i = 0; i < N; i++) {
+            members[names[i]] = StructTypeMember{names[i], i * sizeof(float), type_f32, Mutable::yes};
+        }
+        TypeId id = _add(TypeInfo{
+            0, "vec" + std::to_string(N), {}, {},
+            runtimesizeof<ScriptVec<N>>(),
+            StructType{members},
+            typeid(ScriptVec<N>),
+            {},
+            binary_operators,
+            unary_operators
+        });
+        _mapped[typeid(ScriptVec<N>)] = id;
+        return id;
+    }
+    template <size_t N>
+    void _add_vector_ref(TypeId id) {
+        TypeId ref_id = _add(TypeInfo{0, "ref " + _at(id).name, id, {}, runtimesizeof<ScriptVec<N>*>(), _at(id).type, typeid(ScriptVec<N>*)});
+        _at(id).ref_to = ref_id;
+        _mapped[typeid(ScriptVec<N>*)] = ref_id;
+    }
+
+    static constexpr size_t BlockBits = 8;
+    static constexpr size_t BlockMask = (size_t(1) << BlockBits) - 1;
+    static constexpr size_t MaxBlocks = 4096;
+
+    // only writers take the lock.
+    mutable std::shared_mutex _lock;
+    // types live in blocks that never move, so references handed out stay valid as types are added.
+    std::array<std::unique_ptr<TypeInfo[]>, MaxBlocks> _blocks;
+    // how many types can be read; a type is written before the count is raised past it.
+    std::atomic<size_t> _count;
+    std::unordered_map<std::string, TypeId> _names;
+    std::unordered_map<std::type_index, TypeId> _mapped;
+    // method types by the hash of their signature, colliding signatures share a bucket.
+    std::unordered_map<size_t, std::vector<TypeId>> _method_signatures;
 };
 
 } // Types
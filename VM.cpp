@@ -1,7 +1,15 @@
 #include "VM.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
 #include "Program.h"
 
 //
@@ -62,13 +70,13 @@
 // Nothing more is needed. C++ already can do invoke on a class method.
 //
 
-#define ALU_NUMERICALMETHODS(vmtype,realtype) \
+#define ALU_STOREMETHODS(vmtype,realtype) \
         case Bytecode::##vmtype##Set: { \
             _setv<realtype>(constants, globals, _getv<realtype>(constants, globals, oc.l1, oc.p1), oc.l3, oc.p3); \
             break; \
         } \
         case Bytecode::##vmtype##SetFromIndexed: { \
-            size_t offset = _getv<int>(constants, globals, oc.l2, oc.p2); \
+            size_t offset = _getv<int>(constants, globals, oc.l2, oc.p2) * sizeof(realtype); \
             char* p = _getptr<char>(constants, globals, oc.l1, oc.p1); \
             p += offset; \
             realtype v = *((realtype*)p); \
@@ -76,14 +84,17 @@
             break; \
         } \
         case Bytecode::##vmtype##SetIntoIndexed: { \
-            size_t offset = _getv<int>(constants, globals, oc.l2, oc.p2); \
+            size_t offset = _getv<int>(constants, globals, oc.l2, oc.p2) * sizeof(realtype); \
             realtype v = _getv<realtype>(constants, globals, oc.l1, oc.p1); \
             char* p = _getptr<char>(constants, globals, oc.l3, oc.p3); \
             p += offset; \
             realtype* ptr = (realtype*)p; \
             *ptr = v; \
             break; \
-        } \
+        }
+
+#define ALU_NUMERICALMETHODS(vmtype,realtype) \
+        ALU_STOREMETHODS(vmtype,realtype) \
         case Bytecode::##vmtype##Add: { \
             _setv<realtype>(constants, globals, aluadd<realtype>(constants, globals, oc) , oc.l3, oc.p3); \
             break; \
@@ -105,6 +116,18 @@
             break; \
         }
 
+#define ALU_MODMETHODS(vmtype,realtype) \
+        case Bytecode::##vmtype##Mod: { \
+            _setv<realtype>(constants, globals, alumod<realtype>(constants, globals, oc) , oc.l3, oc.p3); \
+            break; \
+        }
+
+#define ALU_CONVERTMETHODS(vmtype,realtype) \
+        case Bytecode::##vmtype##From: { \
+            _setv<realtype>(constants, globals, aluconvert<realtype>(constants, globals, oc) , oc.l3, oc.p3); \
+            break; \
+        }
+
 #define ALU_ORDINALMETHODS(vmtype,realtype) \
         case Bytecode::##vmtype##Less: { \
             _setv<bool>(constants, globals, lt<realtype>(constants, globals, oc) , oc.l3, oc.p3); \
@@ -149,39 +172,45 @@
 
 #define ALU_JUMPMETHODS(vmtype,realtype) \
         case Bytecode::##vmtype##JLT: { \
-            if (lt<realtype>(constants, globals, oc)) { \
-                _jump(constants, globals, oc.l3, oc.p3); \
-            } \
+            _branch(constants, globals, lt<realtype>(constants, globals, oc), oc.l3, oc.p3); \
             break; \
         } \
         case Bytecode::##vmtype##JLE: { \
-            if (le<realtype>(constants, globals, oc)) { \
-                _jump(constants, globals, oc.l3, oc.p3); \
-            } \
+            _branch(constants, globals, le<realtype>(constants, globals, oc), oc.l3, oc.p3); \
             break; \
         } \
         case Bytecode::##vmtype##JGT: { \
-            if (gt<realtype>(constants, globals, oc)) { \
-                _jump(constants, globals, oc.l3, oc.p3); \
-            } \
+            _branch(constants, globals, gt<realtype>(constants, globals, oc), oc.l3, oc.p3); \
             break; \
         } \
         case Bytecode::##vmtype##JGE: { \
-            if (ge<realtype>(constants, globals, oc)) { \
-                _jump(constants, globals, oc.l3, oc.p3); \
-            } \
+            _branch(constants, globals, ge<realtype>(constants, globals, oc), oc.l3, oc.p3); \
             break; \
         } \
         case Bytecode::##vmtype##JEQ: { \
-            if (eq<realtype>(constants, globals, oc)) { \
-                _jump(constants, globals, oc.l3, oc.p3); \
-            } \
+            _branch(constants, globals, eq<realtype>(constants, globals, oc), oc.l3, oc.p3); \
             break; \
         } \
         case Bytecode::##vmtype##JNE: { \
-            if (ne<realtype>(constants, globals, oc)) { \
-                _jump(constants, globals, oc.l3, oc.p3); \
-            } \
+            _branch(constants, globals, ne<realtype>(constants, globals, oc), oc.l3, oc.p3); \
+            break; \
+        }
+
+#define ALU_FLOATNOTJUMPMETHODS(vmtype,realtype) \
+        case Bytecode::##vmtype##JNLT: { \
+            _branch(constants, globals, !lt<realtype>(constants, globals, oc), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::##vmtype##JNLE: { \
+            _branch(constants, globals, !le<realtype>(constants, globals, oc), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::##vmtype##JNGT: { \
+            _branch(constants, globals, !gt<realtype>(constants, globals, oc), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::##vmtype##JNGE: { \
+            _branch(constants, globals, !ge<realtype>(constants, globals, oc), oc.l3, oc.p3); \
             break; \
         }
 
@@ -211,8 +240,55 @@
             break; \
         }
 
+#define ALU_VECTORMETHODS(vmtype,n) \
+        case Bytecode::vmtype##Add: { \
+            _setvec<n>(constants, globals, _mm_add_ps(_getvec<n>(constants, globals, oc.l1, oc.p1), _getvec<n>(constants, globals, oc.l2, oc.p2)), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::vmtype##Sub: { \
+            _setvec<n>(constants, globals, _mm_sub_ps(_getvec<n>(constants, globals, oc.l1, oc.p1), _getvec<n>(constants, globals, oc.l2, oc.p2)), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::vmtype##Mul: { \
+            _setvec<n>(constants, globals, _mm_mul_ps(_getvec<n>(constants, globals, oc.l1, oc.p1), _getvec<n>(constants, globals, oc.l2, oc.p2)), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::vmtype##Div: { \
+            _setvec<n>(constants, globals, _mm_div_ps(_getvec<n>(constants, globals, oc.l1, oc.p1), _getvec<n>(constants, globals, oc.l2, oc.p2, 1.0f)), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::vmtype##Negate: { \
+            _setvec<n>(constants, globals, vec_negate(_getvec<n>(constants, globals, oc.l1, oc.p1)), oc.l2, oc.p2); \
+            break; \
+        } \
+        case Bytecode::vmtype##Scale: { \
+            __m128 by = _mm_set1_ps(_getv<float>(constants, globals, oc.l2, oc.p2)); \
+            _setvec<n>(constants, globals, _mm_mul_ps(_getvec<n>(constants, globals, oc.l1, oc.p1), by), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::vmtype##Dot: { \
+            _setv<float>(constants, globals, vec_dot(_getvec<n>(constants, globals, oc.l1, oc.p1), _getvec<n>(constants, globals, oc.l2, oc.p2)), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::vmtype##Length: { \
+            _setv<float>(constants, globals, vec_length(_getvec<n>(constants, globals, oc.l1, oc.p1)), oc.l2, oc.p2); \
+            break; \
+        } \
+        case Bytecode::vmtype##Normalize: { \
+            _setvec<n>(constants, globals, vec_normalize(_getvec<n>(constants, globals, oc.l1, oc.p1)), oc.l2, oc.p2); \
+            break; \
+        } \
+        case Bytecode::vmtype##Equal: { \
+            _setv<bool>(constants, globals, vec_equal(_getvec<n>(constants, globals, oc.l1, oc.p1), _getvec<n>(constants, globals, oc.l2, oc.p2)), oc.l3, oc.p3); \
+            break; \
+        } \
+        case Bytecode::vmtype##NotEqual: { \
+            _setv<bool>(constants, globals, !vec_equal(_getvec<n>(constants, globals, oc.l1, oc.p1), _getvec<n>(constants, globals, oc.l2, oc.p2)), oc.l3, oc.p3); \
+            break; \
+        }
+
 VM::VM(size_t stack_size)
-    : data(stack_size), _exec_stack(1<<16), _instruction_index(0), _base(0)
+    : data(stack_size), _exec_stack(1<<16), _instruction_index(0), _base(0), _profile(nullptr), _counters(nullptr), _running(0)
 {
     _exec_stack_top = 0;
 }
@@ -228,14 +304,105 @@ VM::clear_state() {
     _instruction_index = 0;
 }
 
+size_t
+VM::begin_call() {
+    if (_running == 0) {
+        clear_state();
+    }
+    return data.size();
+}
+
 void
-VM::run_method(const Program& program, VMFixedStack& globals, size_t address, size_t stack_size) {
-    // set IP to the end, so that returning will jump to the end/break
-    size_t program_size = program.get_code().size();
-    _instruction_index = program_size;
-    _precall(_base, stack_size);
+VM::end_call(size_t frame) {
+    data.unreserve_to(frame);
+}
+
+// What the dispatch loop does around each opcode.
+struct uncounted_dispatch {
+    uncounted_dispatch(VMOpcodeCounters*) {}
+    void begin(size_t, const Opcode&) {}
+    void end() {}
+};
+
+// The op is kept rather than the opcode, as a Stub may move the code.
+struct counted_dispatch {
+    counted_dispatch(VMOpcodeCounters* counters) : _counters(counters), _address(0), _op(Bytecode::Break), _start(0) {}
+    void begin(size_t address, const Opcode& oc) {
+        _counters->record(address, oc);
+        if (_counters->counts_cycles()) {
+            _address = address;
+            _op = oc.op;
+            _start = __rdtsc();
+        }
+    }
+    void end() {
+        if (_counters->counts_cycles()) {
+            _counters->record_cycles(_address, _op, __rdtsc() - _start);
+        }
+    }
+
+    VMOpcodeCounters* _counters;
+    size_t _address;
+    Bytecode _op;
+    uint64_t _start;
+};
+
+// Puts the VM back as it was before a method ran, so when the method throws, a
+// builtin that catches it carries on in its own frame. Keeps the count right too.
+struct running_scope {
+    running_scope(VM& vm) :
+        _vm(vm),
+        _instruction_index(vm._instruction_index),
+        _base(vm._base),
+        _exec_stack_top(vm._exec_stack_top),
+        _exec_stack_size(vm._exec_stack.size()),
+        _data_size(vm.data.size()) {
+        _vm._running++;
+    }
+    ~running_scope() {
+        _vm._running--;
+        _vm._instruction_index = _instruction_index;
+        _vm._base = _base;
+        _vm._exec_stack_top = _exec_stack_top;
+        _vm._exec_stack.unreserve_to(_exec_stack_size);
+        _vm.data.unreserve_to(_data_size);
+    }
+    VM& _vm;
+    size_t _instruction_index;
+    size_t _base;
+    size_t _exec_stack_top;
+    size_t _exec_stack_size;
+    size_t _data_size;
+};
+
+void
+VM::run_method(Program& program, VMFixedStack& globals, size_t address, size_t stack_size, size_t frame) {
+    // a nested call comes back to where the outer one was, even when it throws.
+    running_scope running(*this);
+    // set IP past any code, so that returning will jump to the end/break.
+    // not to the current end, as lazy methods may add code while running.
+    _instruction_index = ~size_t(0);
+    _precall(frame, stack_size);
     _instruction_index = address;
-    _run_next(program, globals);
+    if (_profile) {
+        _profile->record_entry(address);
+    }
+    if (_counters) {
+        _run_next<counted_dispatch>(program, globals);
+    }
+    else {
+        _run_next<uncounted_dispatch>(program, globals);
+    }
+}
+
+void
+VM::set_profile(VMProfile* profile) {
+    _profile = profile;
+}
+
+void
+VM::set_opcode_counters(VMOpcodeCounters* counters) {
+    _counters = counters;
 }
 
 void
@@ -299,18 +466,33 @@ VM::_jump(const VMFixedStack& constants, VMFixedStack& globals, DataLoc l, size_
     }
 }
 
+void
+VM::_branch(const VMFixedStack& constants, VMFixedStack& globals, bool taken, DataLoc l, size_t address) {
+    if (_profile) {
+        // the IP has already moved past the branch.
+        _profile->record_branch(_instruction_index - 1, taken);
+    }
+    if (taken) {
+        _jump(constants, globals, l, address);
+    }
+}
+
+template <typename Dispatch>
 bool
-VM::_run_next(const Program& program, VMFixedStack& globals) {
+VM::_run_next(Program& program, VMFixedStack& globals) {
     const auto& constants = program.constants_table();
     size_t program_size = program.get_code().size();
+    Dispatch dispatch(_counters);
 
     while (_instruction_index < program_size) {
         const auto& oc = program.get_opcode(_instruction_index);
         //std::cout << _instruction_index << " << " << (int)oc.op << "\n";
+        dispatch.begin(_instruction_index, oc);
         _instruction_index++;
 
         switch (oc.op) {
         case Bytecode::Break: {
+            dispatch.end();
             return false;
             break;
         }
@@ -362,24 +544,111 @@ VM::_run_next(const Program& program, VMFixedStack& globals) {
             }
             break;
         }
+        // a member of a packed struct may not be aligned.
+        case Bytecode::s32LoadField: {
+            char* v = _getv<char*>(constants, globals, LocMemoryDirect, oc.p1);
+            _setv<int>(constants, globals, _load<int>(reinterpret_cast<int*>(v + oc.p2)), oc.l3, oc.p3);
+            break;
+        }
+        case Bytecode::s32StoreField: {
+            char* v = _getv<char*>(constants, globals, LocMemoryDirect, oc.p3);
+            _store<int>(reinterpret_cast<int*>(v + oc.p2), _getv<int>(constants, globals, oc.l1, oc.p1));
+            break;
+        }
+        case Bytecode::f32LoadField: {
+            char* v = _getv<char*>(constants, globals, LocMemoryDirect, oc.p1);
+            _setv<float>(constants, globals, _load<float>(reinterpret_cast<float*>(v + oc.p2)), oc.l3, oc.p3);
+            break;
+        }
+        case Bytecode::f32StoreField: {
+            char* v = _getv<char*>(constants, globals, LocMemoryDirect, oc.p3);
+            _store<float>(reinterpret_cast<float*>(v + oc.p2), _getv<float>(constants, globals, oc.l1, oc.p1));
+            break;
+        }
+        case Bytecode::arrayCheck: {
+            // every ScriptArray has the same layout.
+            char* a = _getptr<char>(constants, globals, oc.l1, oc.p1);
+            int len = *reinterpret_cast<int*>(a + offsetof(ScriptArray<char>, len));
+            int index = _getv<int>(constants, globals, oc.l2, oc.p2);
+            if (index < 0 || index >= len) {
+                throw "Array index out of bounds";
+            }
+            break;
+        }
         case Bytecode::memSet: {
             size_t size = oc.p2;
             char* src = _getptr<char>(constants, globals, oc.l1, oc.p1);
-            char* dest = _table_ptr<char>(globals, oc.p3);
-            memcpy(dest, src, size);
+            // a struct member reached through a ref is written where the ref points.
+            char* dest = _getptr<char>(constants, globals, oc.l3, oc.p3);
+            // a temp may overlap the variable it is copied into, see compile_setop.
+            memmove(dest, src, size);
             break;
         }
     
         ALU_NUMERICALMETHODS(f32,float)
+        ALU_MODMETHODS(f32,float)
         ALU_ORDINALMETHODS(f32,float)
         ALU_EQUALMETHODS(f32,float)
         ALU_JUMPMETHODS(f32,float)
+        ALU_FLOATNOTJUMPMETHODS(f32,float)
+        ALU_CONVERTMETHODS(f32,float)
 
         ALU_NUMERICALMETHODS(s32,int)
+        ALU_MODMETHODS(s32,int)
         ALU_ORDINALMETHODS(s32,int)
         ALU_EQUALMETHODS(s32,int)
         ALU_JUMPMETHODS(s32,int)
         ALU_BITWISEMETHODS(s32,int)
+        ALU_CONVERTMETHODS(s32,int)
+
+        ALU_NUMERICALMETHODS(f64,double)
+        ALU_MODMETHODS(f64,double)
+        ALU_ORDINALMETHODS(f64,double)
+        ALU_EQUALMETHODS(f64,double)
+        ALU_JUMPMETHODS(f64,double)
+        ALU_FLOATNOTJUMPMETHODS(f64,double)
+        ALU_CONVERTMETHODS(f64,double)
+
+        ALU_NUMERICALMETHODS(s64,int64_t)
+        ALU_MODMETHODS(s64,int64_t)
+        ALU_ORDINALMETHODS(s64,int64_t)
+        ALU_EQUALMETHODS(s64,int64_t)
+        ALU_JUMPMETHODS(s64,int64_t)
+        ALU_BITWISEMETHODS(s64,int64_t)
+        ALU_CONVERTMETHODS(s64,int64_t)
+
+        ALU_NUMERICALMETHODS(u32,uint32_t)
+        ALU_MODMETHODS(u32,uint32_t)
+        ALU_ORDINALMETHODS(u32,uint32_t)
+        ALU_EQUALMETHODS(u32,uint32_t)
+        ALU_JUMPMETHODS(u32,uint32_t)
+        ALU_BITWISEMETHODS(u32,uint32_t)
+        ALU_CONVERTMETHODS(u32,uint32_t)
+
+        ALU_NUMERICALMETHODS(u64,uint64_t)
+        ALU_MODMETHODS(u64,uint64_t)
+        ALU_ORDINALMETHODS(u64,uint64_t)
+        ALU_EQUALMETHODS(u64,uint64_t)
+        ALU_JUMPMETHODS(u64,uint64_t)
+        ALU_BITWISEMETHODS(u64,uint64_t)
+        ALU_CONVERTMETHODS(u64,uint64_t)
+
+        ALU_STOREMETHODS(u8,uint8_t)
+        ALU_CONVERTMETHODS(u8,uint8_t)
+        ALU_STOREMETHODS(s8,int8_t)
+        ALU_CONVERTMETHODS(s8,int8_t)
+        ALU_STOREMETHODS(u16,uint16_t)
+        ALU_CONVERTMETHODS(u16,uint16_t)
+        ALU_STOREMETHODS(s16,int16_t)
+        ALU_CONVERTMETHODS(s16,int16_t)
+
+        ALU_VECTORMETHODS(vec2,2)
+        ALU_VECTORMETHODS(vec3,3)
+        ALU_VECTORMETHODS(vec4,4)
+        case Bytecode::vec3Cross: {
+            _setvec<3>(constants, globals, vec_cross(_getvec<3>(constants, globals, oc.l1, oc.p1), _getvec<3>(constants, globals, oc.l2, oc.p2)), oc.l3, oc.p3);
+            break;
+        }
 
         ALU_BOOLLOGICMETHODS(bool,bool)
         ALU_EQUALMETHODS(bool,bool)
@@ -388,6 +657,9 @@ VM::_run_next(const Program& program, VMFixedStack& globals) {
             size_t fn_base = _base + address_offset(oc.p2);
             const size_t addr = address_offset(oc.p1);
             size_t stack = oc.p3;
+            if (_profile) {
+                _profile->record_entry(addr);
+            }
             _precall(fn_base, stack);
             _instruction_index = addr;
             break;
@@ -406,18 +678,31 @@ VM::_run_next(const Program& program, VMFixedStack& globals) {
                     r->invoke(*this, data, fn_base);
                     break;
                 case 1: {
-                    r = program.get_builtin_runnable(offset);
-                    r->invoke(*this, data, fn_base);
+                    if (auto thunk = program.get_builtin_thunk(offset)) {
+                        thunk(data, fn_base);
+                    }
+                    else {
+                        r = program.get_builtin_runnable(offset);
+                        r->invoke(*this, data, fn_base);
+                    }
+                    // a builtin calling back into a lazy program may have added code.
+                    program_size = program.get_code().size();
                     break;
                 }
                 case 2:
                     _precall(fn_base, stack);
                     _instruction_index += offset;
+                    if (_profile) {
+                        _profile->record_entry(_instruction_index);
+                    }
                     break;
                 default:
                 case 3:
                     _precall(fn_base, stack);
                     _instruction_index -= offset;
+                    if (_profile) {
+                        _profile->record_entry(_instruction_index);
+                    }
                     break;
                 }
             }
@@ -431,6 +716,33 @@ VM::_run_next(const Program& program, VMFixedStack& globals) {
             _postcall();
             break;
         }
+        case Bytecode::Stub: {
+            // the code may move as the method is added, so oc is not used after.
+            size_t index = address_offset(oc.p1);
+            size_t address = program.generate_method(index);
+            // the caller did not know how much stack the method needs.
+            size_t stack = program.get_method_entry(index).stack_size;
+            if (data.size() < _base + stack) {
+                data.reserve(_base + stack - data.size());
+            }
+            program_size = program.get_code().size();
+            _instruction_index = address;
+            break;
+        }
+
+        case Bytecode::s32ForLoop: {
+            int* counter = _getptr<int>(constants, globals, oc.l1, oc.p1);
+            *counter += 1;
+            _branch(constants, globals, *counter < _getv<int>(constants, globals, oc.l2, oc.p2), oc.l3, oc.p3);
+            break;
+        }
+
+        case Bytecode::s32JumpTable: {
+            int64_t slot = int64_t(_getv<int>(constants, globals, oc.l1, oc.p1)) - _getv<int>(constants, globals, oc.l2, oc.p2);
+            size_t count = oc.p3;
+            _instruction_index += (slot >= 0 && size_t(slot) < count) ? size_t(slot) : count;
+            break;
+        }
 
         case Bytecode::Jump: {
             _jump(constants, globals, oc.l1, oc.p1);
@@ -438,21 +750,19 @@ VM::_run_next(const Program& program, VMFixedStack& globals) {
         }
 
         case Bytecode::boolJTrue: {
-            if (_getv<bool>(constants, globals, oc.l1, oc.p1)) {
-                _jump(constants, globals, oc.l2, oc.p2);
-            }
+            _branch(constants, globals, _getv<bool>(constants, globals, oc.l1, oc.p1), oc.l2, oc.p2);
             break;
         }
         case Bytecode::boolJFalse: {
-            if (!_getv<bool>(constants, globals, oc.l1, oc.p1)) {
-                _jump(constants, globals, oc.l2, oc.p2);
-            }
+            _branch(constants, globals, !_getv<bool>(constants, globals, oc.l1, oc.p1), oc.l2, oc.p2);
             break;
         }
 
         default:
+            dispatch.end();
             return false;
         }
+        dispatch.end();
     }
     return true;
 }
@@ -3,13 +3,20 @@
 #include "VMBytecode.h"
 #include "VMStack.h"
 #include "VMFFI.h"
+#include "VMProfile.h"
+#include "VMVector.h"
 
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <type_traits>
 
 class Program;
 class BytecodeRunnable;
 
+struct running_scope;
+
 class VM {
 public:
     VM(size_t stack_size);
@@ -26,7 +33,7 @@ public:
         size_t addr = data.size();
         //std::cout << "pushing " << typeid(T).name() << " " << (size_t)v << " to " << addr << "\n";
         data.reserve(runtimesizeof<T>());
-        *data.at<T>(addr) = v;
+        _store<T>(data.at<T>(addr), v);
         return addr;
     }
     template <typename Tf, typename Ts, typename... Tr>
@@ -37,19 +44,49 @@ public:
     }
     template <typename T>
     T get_return(size_t addr) {
-        return *data.at<T>(addr);
+        return _load<T>(data.at<T>(addr));
     }
     void clear_state();
-    void run_method(const Program& program, VMFixedStack& globals, size_t address, size_t stack_size);
+    // Starts a call from C++, returning where its parameters and return value go.
+    // While the VM is running, such as in a builtin called by a script, the call is
+    // made on top of the current frame instead of clearing the VM.
+    size_t begin_call();
+    // Drops what the call left on the stack, once the return value is read.
+    void end_call(size_t frame);
+    // The program is mutable as a lazy one generates its methods as they are called.
+    void run_method(Program& program, VMFixedStack& globals, size_t address, size_t stack_size, size_t frame = 0);
+
+    // When set, branches and method entries are counted into the profile.
+    void set_profile(VMProfile* profile);
+    // When set, every opcode run is counted, see VMOpcodeCounters. Only takes effect
+    // for the next run_method, not one already running.
+    void set_opcode_counters(VMOpcodeCounters* counters);
 
 private:
     friend BytecodeRunnable;
+    friend running_scope;
 
     void _precall(size_t param_bytes, size_t stack_bytes);
     // void _setup_stackframe(size_t stack_size);
     void _postcall();
     void _jump(const VMFixedStack& constants, VMFixedStack& globals, DataLoc l, size_t d);
-    bool _run_next(const Program& program, VMFixedStack& globals);
+    void _branch(const VMFixedStack& constants, VMFixedStack& globals, bool taken, DataLoc l, size_t d);
+    // Built for each Dispatch policy, so the uncounted loop has no counting in it.
+    template <typename Dispatch>
+    bool _run_next(Program& program, VMFixedStack& globals);
+
+    // Slots are only 4 byte aligned, so an 8 byte value is copied rather than dereferenced.
+    // For the 4 byte types this is the same single load or store.
+    template<typename T>
+    static T _load(const T* ptr) {
+        T v;
+        std::memcpy(&v, ptr, sizeof(T));
+        return v;
+    }
+    template<typename T>
+    static void _store(T* ptr, T v) {
+        std::memcpy(ptr, &v, sizeof(T));
+    }
 
     template<typename T>
     T _table_value(const VMFixedStack& constants, VMFixedStack& globals, size_t address) {
@@ -62,15 +99,15 @@ private:
             }
             case 1: {
                 //std::cout << "get global " << offset << "\n";
-                return *globals.at<T>(offset);
+                return _load<T>(globals.at<T>(offset));
             }
             case 2: {
                 //std::cout << "get +offset " << offset << ": " << _base+offset << "\n";
-                return *data.at<T>(_base + offset);
+                return _load<T>(data.at<T>(_base + offset));
             }
             default: {
                 //std::cout << "get -offset " << offset << ": " << _base-offset << "\n";
-                return *data.at<T>(_base - offset);
+                return _load<T>(data.at<T>(_base - offset));
             }
         }
     }
@@ -104,7 +141,7 @@ private:
         switch (l) {
             case LocMemoryIndirect: {
                 T* ptr = _table_value<T*>(constants, globals, address);
-                return *ptr;
+                return _load<T>(ptr);
             }
             default: {
                 return _table_value<T>(constants, globals, address);
@@ -128,7 +165,7 @@ private:
     void _setv(const VMFixedStack& constants, VMFixedStack& globals, T v, DataLoc l, size_t address) {
         T* ptr = _getptr<T>(constants, globals, l, address);
         //std::cout << "set " << size_t(ptr) << " to " << v << "\n";
-        *ptr = v;
+        _store<T>(ptr, v);
         //switch (l) {
         //    case LocMemoryIndirect: {
         //        T* ptr = _table_value<T*>(constants, globals, address);
@@ -143,6 +180,16 @@ private:
         //}
     }
 
+    // the lanes past N are filled with fill, so a division does not make NaNs in them.
+    template<size_t N>
+    __m128 _getvec(const VMFixedStack& constants, VMFixedStack& globals, DataLoc l, size_t address, float fill = 0.0f) {
+        return vec_load<N>(_getv<ScriptVec<N>>(constants, globals, l, address), fill);
+    }
+    template<size_t N>
+    void _setvec(const VMFixedStack& constants, VMFixedStack& globals, __m128 v, DataLoc l, size_t address) {
+        _setv<ScriptVec<N>>(constants, globals, vec_store<N>(v), l, address);
+    }
+
     template<typename NT>
     NT aluadd(const VMFixedStack& constants, VMFixedStack& globals, const Opcode& oc) {
         NT a = _getv<NT>(constants, globals, oc.l1, oc.p1);
@@ -176,6 +223,17 @@ private:
         return r;
     }
     template<typename NT>
+    NT alumod(const VMFixedStack& constants, VMFixedStack& globals, const Opcode& oc) {
+        NT a = _getv<NT>(constants, globals, oc.l1, oc.p1);
+        NT b = _getv<NT>(constants, globals, oc.l2, oc.p2);
+        if constexpr (std::is_floating_point<NT>::value) {
+            return std::fmod(a, b);
+        }
+        else {
+            return a % b;
+        }
+    }
+    template<typename NT>
     NT aluneg(const VMFixedStack& constants, VMFixedStack& globals, const Opcode& oc) {
         NT a = _getv<NT>(constants, globals, oc.l1, oc.p1);
         NT r = -a;
@@ -230,6 +288,22 @@ private:
         return r;
     }
 
+    template<typename NT>
+    NT aluconvert(const VMFixedStack& constants, VMFixedStack& globals, const Opcode& oc) {
+        switch (NumberKind(oc.p2)) {
+            case NumberKind::s32: return NT(_getv<int>(constants, globals, oc.l1, oc.p1));
+            case NumberKind::f32: return NT(_getv<float>(constants, globals, oc.l1, oc.p1));
+            case NumberKind::s64: return NT(_getv<int64_t>(constants, globals, oc.l1, oc.p1));
+            case NumberKind::u32: return NT(_getv<uint32_t>(constants, globals, oc.l1, oc.p1));
+            case NumberKind::u64: return NT(_getv<uint64_t>(constants, globals, oc.l1, oc.p1));
+            case NumberKind::u8: return NT(_getv<uint8_t>(constants, globals, oc.l1, oc.p1));
+            case NumberKind::s8: return NT(_getv<int8_t>(constants, globals, oc.l1, oc.p1));
+            case NumberKind::u16: return NT(_getv<uint16_t>(constants, globals, oc.l1, oc.p1));
+            case NumberKind::s16: return NT(_getv<int16_t>(constants, globals, oc.l1, oc.p1));
+            default: return NT(_getv<double>(constants, globals, oc.l1, oc.p1));
+        }
+    }
+
     template<typename NT>
     bool lt(const VMFixedStack& constants, VMFixedStack& globals, const Opcode& oc) {
         NT a = _getv<NT>(constants, globals, oc.l1, oc.p1);
@@ -301,4 +375,9 @@ private:
     VMFixedStack _exec_stack;
     size_t _exec_stack_top;
     VMFixedStack data;
+
+    VMProfile* _profile;
+    VMOpcodeCounters* _counters;
+    // how many run_method calls are on the C++ stack.
+    size_t _running;
 };
@@ -72,6 +72,9 @@ StackSize(DataLoc loc, size_t bytes) {
 
 size_t
 merge_page_offset(BytecodeParam param) {
+    if (param.offset > ParamAddressOffsetMask) {
+        throw "Address too large for an opcode parameter";
+    }
     return (param.page << ParamAddressPageBit) | (param.offset & ParamAddressOffsetMask);
 }
 
@@ -85,6 +88,79 @@ address_offset(size_t address) {
     return address & ParamAddressOffsetMask;
 }
 
+// in the order of the enum, for profiles and listings.
+static const char* const _bytecode_names[] = {
+    // 0
+    "Break", "DataAddress", "FunctionAddress", "Dereference", "refSet", "memSet", "s32Set", "f32Set",
+    // 8
+    "s32SetFromIndexed", "s32SetIntoIndexed", "f32SetFromIndexed", "f32SetIntoIndexed", "refAdd", "s32Add", "s32Sub", "s32Mul",
+    // 16
+    "s32Div", "s32Mod", "s32Less", "s32LessEqual", "s32Greater", "s32GreaterEqual", "s32Equal", "s32NotEqual",
+    // 24
+    "s32Negate", "s32BitNot", "s32BitAnd", "s32BitOr", "s32BitXor", "s32ShiftLeft", "s32ShiftRight", "f32Add",
+    // 32
+    "f32Sub", "f32Mul", "f32Div", "f32Mod", "f32Less", "f32LessEqual", "f32Greater", "f32GreaterEqual",
+    // 40
+    "f32Equal", "f32NotEqual", "f32Negate", "boolAnd", "boolOr", "boolEqual", "boolNotEqual", "boolNot",
+    // 48
+    "Call", "FCall", "Ret", "Jump", "boolJTrue", "boolJFalse", "f32JLT", "f32JLE",
+    // 56
+    "f32JGT", "f32JGE", "f32JEQ", "f32JNE", "s32JLT", "s32JLE", "s32JGT", "s32JGE",
+    // 64
+    "s32JEQ", "s32JNE", "Stub", "s32LoadField", "s32StoreField", "f32LoadField", "f32StoreField", "arrayCheck",
+    // 72
+    "s32ForLoop", "s32JumpTable", "s64Set", "s64SetFromIndexed", "s64SetIntoIndexed", "s64Add", "s64Sub", "s64Mul",
+    // 80
+    "s64Div", "s64Mod", "s64Less", "s64LessEqual", "s64Greater", "s64GreaterEqual", "s64Equal", "s64NotEqual",
+    // 88
+    "s64Negate", "s64BitNot", "s64BitAnd", "s64BitOr", "s64BitXor", "s64ShiftLeft", "s64ShiftRight", "s64JLT",
+    // 96
+    "s64JLE", "s64JGT", "s64JGE", "s64JEQ", "s64JNE", "u32Set", "u32SetFromIndexed", "u32SetIntoIndexed",
+    // 104
+    "u32Add", "u32Sub", "u32Mul", "u32Div", "u32Mod", "u32Less", "u32LessEqual", "u32Greater",
+    // 112
+    "u32GreaterEqual", "u32Equal", "u32NotEqual", "u32Negate", "u32BitNot", "u32BitAnd", "u32BitOr", "u32BitXor",
+    // 120
+    "u32ShiftLeft", "u32ShiftRight", "u32JLT", "u32JLE", "u32JGT", "u32JGE", "u32JEQ", "u32JNE",
+    // 128
+    "u64Set", "u64SetFromIndexed", "u64SetIntoIndexed", "u64Add", "u64Sub", "u64Mul", "u64Div", "u64Mod",
+    // 136
+    "u64Less", "u64LessEqual", "u64Greater", "u64GreaterEqual", "u64Equal", "u64NotEqual", "u64Negate", "u64BitNot",
+    // 144
+    "u64BitAnd", "u64BitOr", "u64BitXor", "u64ShiftLeft", "u64ShiftRight", "u64JLT", "u64JLE", "u64JGT",
+    // 152
+    "u64JGE", "u64JEQ", "u64JNE", "f64Set", "f64SetFromIndexed", "f64SetIntoIndexed", "f64Add", "f64Sub",
+    // 160
+    "f64Mul", "f64Div", "f64Mod", "f64Less", "f64LessEqual", "f64Greater", "f64GreaterEqual", "f64Equal",
+    // 168
+    "f64NotEqual", "f64Negate", "f64JLT", "f64JLE", "f64JGT", "f64JGE", "f64JEQ", "f64JNE",
+    // 176
+    "s32From", "f32From", "s64From", "u32From", "u64From", "f64From", "vec2Add", "vec2Sub",
+    // 184
+    "vec2Mul", "vec2Div", "vec2Negate", "vec2Scale", "vec2Dot", "vec2Length", "vec2Normalize", "vec2Equal",
+    // 192
+    "vec2NotEqual", "vec3Add", "vec3Sub", "vec3Mul", "vec3Div", "vec3Negate", "vec3Scale", "vec3Dot",
+    // 200
+    "vec3Length", "vec3Normalize", "vec3Equal", "vec3NotEqual", "vec3Cross", "vec4Add", "vec4Sub", "vec4Mul",
+    // 208
+    "vec4Div", "vec4Negate", "vec4Scale", "vec4Dot", "vec4Length", "vec4Normalize", "vec4Equal", "vec4NotEqual",
+    // 216
+    "u8Set", "u8SetFromIndexed", "u8SetIntoIndexed", "u8From", "s8Set", "s8SetFromIndexed", "s8SetIntoIndexed", "s8From",
+    // 224
+    "u16Set", "u16SetFromIndexed", "u16SetIntoIndexed", "u16From", "s16Set", "s16SetFromIndexed", "s16SetIntoIndexed", "s16From",
+    // 232
+    "f32JNLT", "f32JNLE", "f32JNGT", "f32JNGE", "f64JNLT", "f64JNLE", "f64JNGT", "f64JNGE",
+};
+static_assert(sizeof(_bytecode_names) / sizeof(_bytecode_names[0]) == size_t(Bytecode::Count), "Every bytecode needs a name");
+
+const char*
+bytecode_name(Bytecode op) {
+    if (op >= Bytecode::Count) {
+        return "unknown";
+    }
+    return _bytecode_names[size_t(op)];
+}
+
 void
 Opcode::set_parameter1(BytecodeParam param) {
     l1 = param.loc;
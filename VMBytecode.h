@@ -17,8 +17,9 @@ enum class Bytecode: size_t {
     f32Set,
 
     // 8
+    // an element of an array, a is where the pointer to the elements is and indx is an element index.
     s32SetFromIndexed, // [a] [indx] [out]
-    s32SetIntoIndexed, // [a] [out] [indx]
+    s32SetIntoIndexed, // [v] [indx] [a]
     f32SetFromIndexed,
     f32SetIntoIndexed,
 
@@ -107,18 +108,253 @@ enum class Bytecode: size_t {
     s32JGE,
     s32JEQ,
     s32JNE,
+
     // 66
+    // the entry of a method that is generated on its first call, see Program::generate_method.
+    Stub, // [method] _ _
+
+    // 67
+    // a field of the struct a ref points to. The offset of the field is an immediate.
+    s32LoadField, // [ref] [offset] [out]
+    s32StoreField, // [a] [offset] [ref]
+    f32LoadField,
+    f32StoreField,
+
+    // 71
+    // throws if indx is not within the array.
+    arrayCheck, // [array] [indx] _
+
+    // 72
+    // adds one to the counter, then jumps while it is less than end.
+    s32ForLoop, // [counter] [end] [jumpto]
+
+    // 73
+    // skips the (a - low)'th of the count Jumps that follow it, or all of them when a is out of the table,
+    // so a falls through to the Jump of its case or the one past the table.
+    s32JumpTable, // [a] [low] [count]
+
+    // 74
+    // each family is laid out as the s32 or f32 one, unsigned division, compares and shifts are their own.
+    s64Set, // [a] [out] _
+    s64SetFromIndexed, // [a] [indx] [out]
+    s64SetIntoIndexed, // [v] [indx] [a]
+    s64Add, // [a] [b] [out]
+    s64Sub,
+    s64Mul,
+    s64Div,
+    s64Mod,
+    s64Less,
+    s64LessEqual,
+    s64Greater,
+    s64GreaterEqual,
+    s64Equal,
+    s64NotEqual,
+    s64Negate, // [a] [out]
+    s64BitNot, // [a] [out]
+    s64BitAnd,
+    s64BitOr,
+    s64BitXor,
+    s64ShiftLeft,
+    s64ShiftRight,
+    s64JLT, // a b [jumpto]
+    s64JLE,
+    s64JGT,
+    s64JGE,
+    s64JEQ,
+    s64JNE,
+
+    // 101
+    u32Set, // [a] [out] _
+    u32SetFromIndexed, // [a] [indx] [out]
+    u32SetIntoIndexed, // [v] [indx] [a]
+    u32Add, // [a] [b] [out]
+    u32Sub,
+    u32Mul,
+    u32Div,
+    u32Mod,
+    u32Less,
+    u32LessEqual,
+    u32Greater,
+    u32GreaterEqual,
+    u32Equal,
+    u32NotEqual,
+    u32Negate, // [a] [out]
+    u32BitNot, // [a] [out]
+    u32BitAnd,
+    u32BitOr,
+    u32BitXor,
+    u32ShiftLeft,
+    u32ShiftRight,
+    u32JLT, // a b [jumpto]
+    u32JLE,
+    u32JGT,
+    u32JGE,
+    u32JEQ,
+    u32JNE,
+
+    // 128
+    u64Set, // [a] [out] _
+    u64SetFromIndexed, // [a] [indx] [out]
+    u64SetIntoIndexed, // [v] [indx] [a]
+    u64Add, // [a] [b] [out]
+    u64Sub,
+    u64Mul,
+    u64Div,
+    u64Mod,
+    u64Less,
+    u64LessEqual,
+    u64Greater,
+    u64GreaterEqual,
+    u64Equal,
+    u64NotEqual,
+    u64Negate, // [a] [out]
+    u64BitNot, // [a] [out]
+    u64BitAnd,
+    u64BitOr,
+    u64BitXor,
+    u64ShiftLeft,
+    u64ShiftRight,
+    u64JLT, // a b [jumpto]
+    u64JLE,
+    u64JGT,
+    u64JGE,
+    u64JEQ,
+    u64JNE,
+
+    // 155
+    f64Set, // [a] [out] _
+    f64SetFromIndexed, // [a] [indx] [out]
+    f64SetIntoIndexed, // [v] [indx] [a]
+    f64Add, // [a] [b] [out]
+    f64Sub,
+    f64Mul,
+    f64Div,
+    f64Mod,
+    f64Less,
+    f64LessEqual,
+    f64Greater,
+    f64GreaterEqual,
+    f64Equal,
+    f64NotEqual,
+    f64Negate, // [a] [out]
+    f64JLT, // a b [jumpto]
+    f64JLE,
+    f64JGT,
+    f64JGE,
+    f64JEQ,
+    f64JNE,
+
+    // 176
+    // converts a, of the kind given by the immediate, to the type of the opcode.
+    s32From, // [a] [kind] [out]
+    f32From,
+    s64From,
+    u32From,
+    u64From,
+    f64From,
+
+    // 182
+    // componentwise, except for Scale which multiplies each by the f32.
+    vec2Add, // [a] [b] [out]
+    vec2Sub,
+    vec2Mul,
+    vec2Div,
+    vec2Negate, // [a] [out]
+    vec2Scale, // [a] [f32] [out]
+    vec2Dot, // [a] [b] [f32 out]
+    vec2Length, // [a] [f32 out]
+    vec2Normalize, // [a] [out]
+    vec2Equal, // [a] [b] [bool out]
+    vec2NotEqual,
+
+    // 193
+    vec3Add, // [a] [b] [out]
+    vec3Sub,
+    vec3Mul,
+    vec3Div,
+    vec3Negate, // [a] [out]
+    vec3Scale, // [a] [f32] [out]
+    vec3Dot, // [a] [b] [f32 out]
+    vec3Length, // [a] [f32 out]
+    vec3Normalize, // [a] [out]
+    vec3Equal, // [a] [b] [bool out]
+    vec3NotEqual,
+    vec3Cross, // [a] [b] [out]
+
+    // 205
+    vec4Add, // [a] [b] [out]
+    vec4Sub,
+    vec4Mul,
+    vec4Div,
+    vec4Negate, // [a] [out]
+    vec4Scale, // [a] [f32] [out]
+    vec4Dot, // [a] [b] [f32 out]
+    vec4Length, // [a] [f32 out]
+    vec4Normalize, // [a] [out]
+    vec4Equal, // [a] [b] [bool out]
+    vec4NotEqual,
+
+    // 216
+    // the narrow types only read and write their own bytes, the value is in the first bytes of a slot.
+    // A From opcode of a wider type extends one, and the From of a narrow type truncates.
+    u8Set, // [a] [out] _
+    u8SetFromIndexed, // [a] [indx] [out]
+    u8SetIntoIndexed, // [v] [indx] [a]
+    u8From, // [a] [kind] [out]
+    s8Set, // [a] [out] _
+    s8SetFromIndexed, // [a] [indx] [out]
+    s8SetIntoIndexed, // [v] [indx] [a]
+    s8From, // [a] [kind] [out]
+    u16Set, // [a] [out] _
+    u16SetFromIndexed, // [a] [indx] [out]
+    u16SetIntoIndexed, // [v] [indx] [a]
+    u16From, // [a] [kind] [out]
+    s16Set, // [a] [out] _
+    s16SetFromIndexed, // [a] [indx] [out]
+    s16SetIntoIndexed, // [v] [indx] [a]
+    s16From, // [a] [kind] [out]
+
+    // 232
+    // jump unless the comparison holds, so a NaN jumps. These are the exact inverses of the
+    // float jumps, for when a profile flips the jump of an if.
+    f32JNLT, // a b [jumpto]
+    f32JNLE,
+    f32JNGT,
+    f32JNGE,
+    f64JNLT,
+    f64JNLE,
+    f64JNGT,
+    f64JNGE,
+    // 240
+    // not an opcode, how many there are. Keep it last.
+    Count,
+};
+
+// the type of the value a From opcode converts.
+enum class NumberKind: size_t {
+    s32,
+    f32,
+    s64,
+    u32,
+    u64,
+    f64,
+    u8,
+    s8,
+    u16,
+    s16,
 };
 
 // we need 4 bits
 typedef size_t DataLoc;
 
 // exact addresses in params work like:
-// bit 17: is stack value (0 for const/global, 1 for stack/jumps). unused by jumps
-// bit 16: 0:const / 1:global, or sign bit for stack/jumps
-// bits 0-15: address
+// bit 16: is stack value (0 for const/global, 1 for stack/jumps). unused by jumps
+// bit 15: 0:const / 1:global, or sign bit for stack/jumps
+// bits 0-14: address
 // for stack, the address is added/subtracted to base to get a final address
 // for jumps, this is added to the IP, using same signbit of stack
+// so a constant, global or stack offset, and a jump distance, can be at most 32767.
+// merge_page_offset throws "Address too large for an opcode parameter" past it.
 const DataLoc LocMemoryDirect = 0x00;
 // use the above rules to determine the location of what holds a size_t aka void*
 // that points to a real-memory address.
@@ -127,9 +363,9 @@ const DataLoc LocMemoryIndirect = 0x01;
 
 // TODO: I might add an auto bitshift left 2 bits.
 
-const size_t ParamAddressPageBit = 16;
+const size_t ParamAddressPageBit = 15;
 const size_t ParamAddressPageMask = 0x03 << ParamAddressPageBit;
-const size_t ParamAddressOffsetMask = (~ParamAddressPageMask) & 0x3FFFF;
+const size_t ParamAddressOffsetMask = (~ParamAddressPageMask) & 0x1FFFF;
 
 struct BytecodeParam {
     DataLoc loc;
@@ -160,12 +396,16 @@ size_t merge_page_offset(BytecodeParam param);
 size_t address_page(size_t address);
 size_t address_offset(size_t address);
 
+// the enum name of the bytecode, such as "s32Add".
+const char* bytecode_name(Bytecode op);
+
 struct Opcode {
 public:
-    size_t p1:18;
-    size_t p2:18;
-    size_t p3:18;
-    Bytecode op:7;
+    size_t p1:17;
+    size_t p2:17;
+    size_t p3:17;
+    // the params gave up a bit each so the opcodes fit beside them, in one 64 bit word.
+    Bytecode op:10;
     DataLoc l1:1;
     DataLoc l2:1;
     DataLoc l3:1;
@@ -173,48 +413,51 @@ public:
     Opcode(
         Bytecode o, BytecodeParam param1, BytecodeParam param2, BytecodeParam param3
     ) : 
+      p1(merge_page_offset(param1)),
+      p2(merge_page_offset(param2)),
+      p3(merge_page_offset(param3)),
       op(o),
       l1(param1.loc),
       l2(param2.loc),
-      l3(param3.loc),
-      p1(merge_page_offset(param1)),
-      p2(merge_page_offset(param2)),
-      p3(merge_page_offset(param3)) {}
+      l3(param3.loc) {}
 
     Opcode(
         Bytecode o, BytecodeParam param1, BytecodeParam param2
     ) : 
+      p1(merge_page_offset(param1)),
+      p2(merge_page_offset(param2)),
+      p3(0),
       op(o),
       l1(param1.loc),
       l2(param2.loc),
-      l3(0),
-      p1(merge_page_offset(param1)),
-      p2(merge_page_offset(param2)),
-      p3(0) {}
+      l3(0) {}
 
     Opcode(
         Bytecode o, BytecodeParam param1
     ) : 
+      p1(merge_page_offset(param1)),
+      p2(0),
+      p3(0),
       op(o),
       l1(param1.loc),
       l2(0),
-      l3(0),
-      p1(merge_page_offset(param1)),
-      p2(0),
-      p3(0) {}
+      l3(0) {}
 
     Opcode(
         Bytecode o
     ) : 
+      p1(0),
+      p2(0),
+      p3(0),
       op(o),
       l1(0),
       l2(0),
-      l3(0),
-      p1(0),
-      p2(0),
-      p3(0) {}
+      l3(0) {}
 
     void set_parameter1(BytecodeParam param);
     void set_parameter2(BytecodeParam param);
     void set_parameter3(BytecodeParam param);
 };
+
+static_assert(sizeof(Opcode) == 8, "An opcode must stay in 64 bits");
+static_assert((size_t)Bytecode::Count <= (1 << 10), "Too many opcodes for Opcode::op");
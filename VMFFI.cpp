@@ -7,8 +7,32 @@ BytecodeRunnable::BytecodeRunnable(size_t address, size_t param_size, size_t sta
 
 BytecodeRunnable::~BytecodeRunnable() {}
 
+void
+BytecodeRunnable::relocate(size_t address, size_t param_size, size_t stack_reserve) {
+    _address = address;
+    _param_size = param_size;
+    _stack_reserve = stack_reserve;
+}
+
 void
 BytecodeRunnable::invoke(VM& vm, VMFixedStack& s, size_t base) const {
     vm._precall(base, _stack_reserve);
     vm._instruction_index = _address;
+    if (vm._profile) {
+        vm._profile->record_entry(_address);
+    }
+}
+
+ThunkRunnable::ThunkRunnable(BuiltinThunk thunk) : _thunk(thunk) {}
+
+ThunkRunnable::~ThunkRunnable() {}
+
+void
+ThunkRunnable::invoke(VM&, VMFixedStack& s, size_t base) const {
+    _thunk(s, base);
+}
+
+BuiltinThunk
+ThunkRunnable::thunk() const {
+    return _thunk;
 }
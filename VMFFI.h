@@ -3,13 +3,19 @@
 #include <array>
 #include <functional>
 #include <iostream>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "VMStack.h"
 
 class VM;
 
+// Sizes are rounded up to 4 bytes, which is all a slot is aligned to.
+// An 8 byte value is not padded out to 8 byte alignment, the VM copies it in and out instead.
 template<typename T>
-size_t
+constexpr size_t
 runtimesizeof() {
     size_t s = sizeof(T);
     if (s == 0) {
@@ -19,6 +25,24 @@ runtimesizeof() {
     size_t adjusted = (((s - 1) / 4) + 1) * 4;
     return adjusted;
 }
+// An array<T> in script: a view of host memory, which is never copied.
+// The vector or span it was made from has to outlive it, and must not be resized while script uses it.
+template <typename T>
+struct ScriptArray {
+    T* data;
+    int len;
+
+    ScriptArray() : data(nullptr), len(0) {}
+    ScriptArray(std::span<T> s) : data(s.data()), len(int(s.size())) {}
+    ScriptArray(std::vector<T>& v) : data(v.data()), len(int(v.size())) {}
+};
+
+// vec2, vec3 and vec4 in script: packed floats, as most host math types are laid out.
+// A host type of the same layout can stand in for one, see TypeTable::map_vector_type.
+template <size_t N>
+struct ScriptVec {
+    float v[N];
+};
 
 class IRunnable {
 public:
@@ -31,12 +55,118 @@ public:
     BytecodeRunnable(size_t address, size_t param_size, size_t stack_reserve);
     ~BytecodeRunnable();
     void invoke(VM& vm, VMFixedStack& s, size_t base) const;
+    // the method was generated again somewhere else.
+    void relocate(size_t address, size_t param_size, size_t stack_reserve);
 private:
     size_t _address;
     size_t _param_size;
     size_t _stack_reserve;
 };
 
+// A builtin the VM calls directly, reading the arguments from the stack at base.
+typedef void (*BuiltinThunk)(VMFixedStack& s, size_t base);
+
+// Wraps a thunk for everything that expects a runnable.
+// Program keeps the thunk itself, so the VM calls it without going through here.
+class ThunkRunnable : public IRunnable {
+public:
+    ThunkRunnable(BuiltinThunk thunk);
+    ~ThunkRunnable();
+    void invoke(VM& vm, VMFixedStack& s, size_t base) const;
+    BuiltinThunk thunk() const;
+private:
+    BuiltinThunk _thunk;
+};
+
+// where each argument is, as they are laid out for a call.
+template <typename... Args>
+constexpr std::array<size_t, sizeof...(Args)>
+builtin_offsets() {
+    std::array<size_t, sizeof...(Args)> offsets{};
+    const size_t sizes[] = { runtimesizeof<Args>()..., 0 };
+    size_t offset = 0;
+    for (size_t i = 0; i < sizeof...(Args); i++) {
+        offsets[i] = offset;
+        offset += sizes[i];
+    }
+    return offsets;
+}
+
+// The thunk for a function known at compile time.
+// The offsets are constants, and Fn is called directly rather than through a std::function.
+template <auto Fn>
+class DirectBuiltin;
+
+template <typename R, typename... Args, R(*Fn)(Args...)>
+class DirectBuiltin<Fn> {
+public:
+    static void invoke(VMFixedStack& s, size_t base) {
+        _invoke(s, base, std::index_sequence_for<Args...>{});
+    }
+private:
+    static constexpr std::array<size_t, sizeof...(Args)> _poffsets = builtin_offsets<Args...>();
+
+    template <std::size_t... Is>
+    static void _invoke(VMFixedStack& s, size_t base, std::index_sequence<Is...>) {
+        if constexpr (std::is_void<R>::value) {
+            Fn((*s.at<Args>(base + _poffsets[Is]))...);
+        }
+        else {
+            R r = Fn((*s.at<Args>(base + _poffsets[Is]))...);
+            *s.at<R>(base) = r;
+        }
+    }
+};
+
+// The thunk for a member function known at compile time.
+// The receiver is the first argument, as a pointer, which is how a call on an imported struct passes it.
+template <auto Fn>
+class MemberBuiltin;
+
+template <typename T, typename R, typename... Args, R(T::*Fn)(Args...)>
+class MemberBuiltin<Fn> {
+public:
+    static void invoke(VMFixedStack& s, size_t base) {
+        _invoke(s, base, std::index_sequence_for<Args...>{});
+    }
+private:
+    static constexpr std::array<size_t, sizeof...(Args) + 1> _poffsets = builtin_offsets<T*, Args...>();
+
+    template <std::size_t... Is>
+    static void _invoke(VMFixedStack& s, size_t base, std::index_sequence<Is...>) {
+        T* self = *s.at<T*>(base);
+        if constexpr (std::is_void<R>::value) {
+            (self->*Fn)((*s.at<Args>(base + _poffsets[Is + 1]))...);
+        }
+        else {
+            R r = (self->*Fn)((*s.at<Args>(base + _poffsets[Is + 1]))...);
+            *s.at<R>(base) = r;
+        }
+    }
+};
+
+template <typename T, typename R, typename... Args, R(T::*Fn)(Args...) const>
+class MemberBuiltin<Fn> {
+public:
+    static void invoke(VMFixedStack& s, size_t base) {
+        _invoke(s, base, std::index_sequence_for<Args...>{});
+    }
+private:
+    static constexpr std::array<size_t, sizeof...(Args) + 1> _poffsets = builtin_offsets<T*, Args...>();
+
+    template <std::size_t... Is>
+    static void _invoke(VMFixedStack& s, size_t base, std::index_sequence<Is...>) {
+        const T* self = *s.at<T*>(base);
+        if constexpr (std::is_void<R>::value) {
+            (self->*Fn)((*s.at<Args>(base + _poffsets[Is + 1]))...);
+        }
+        else {
+            R r = (self->*Fn)((*s.at<Args>(base + _poffsets[Is + 1]))...);
+            *s.at<R>(base) = r;
+        }
+    }
+};
+
 template <typename R, typename... Args>
 class BuiltinRunnable : public IRunnable {
 public:
@@ -0,0 +1,277 @@
+#include "VMProfile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Program.h"
+#include "VMBytecode.h"
+
+const std::string PROFILE_HEADER = "mattscript-profile 2";
+
+VMProfile::VMProfile() {}
+VMProfile::~VMProfile() {}
+
+void
+VMProfile::record_branch(size_t address, bool taken) {
+    auto& b = _branches[address];
+    if (taken) {
+        b.taken++;
+    }
+    else {
+        b.not_taken++;
+    }
+}
+
+void
+VMProfile::record_entry(size_t method_address) {
+    _entries[method_address]++;
+}
+
+void
+VMProfile::reset() {
+    _branches.clear();
+    _entries.clear();
+}
+
+struct profilemethod {
+    size_t address;
+    const MethodMetadata* metadata;
+};
+
+// finds the method containing the instruction, if any.
+const profilemethod*
+_containing_method(const std::vector<profilemethod>& methods, size_t address) {
+    auto it = std::upper_bound(methods.begin(), methods.end(), address, [](size_t a, const profilemethod& m) {
+        return a < m.address;
+    });
+    if (it == methods.begin()) {
+        return nullptr;
+    }
+    it--;
+    if (address >= it->address + it->metadata->code_size) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+void
+VMProfile::write(const Program& program, std::ostream& out) const {
+    std::vector<profilemethod> methods;
+    for (auto& it : program.get_methods_metadata()) {
+        methods.push_back(profilemethod{it.first, &it.second});
+    }
+    std::sort(methods.begin(), methods.end(), [](const profilemethod& a, const profilemethod& b) {
+        return a.address < b.address;
+    });
+
+    out << PROFILE_HEADER << "\n";
+    for (auto& it : _entries) {
+        auto m = _containing_method(methods, it.first);
+        if (m) {
+            out << "method " << m->metadata->name << " " << it.second << "\n";
+        }
+    }
+    for (auto& it : _branches) {
+        auto m = _containing_method(methods, it.first);
+        if (!m) {
+            continue;
+        }
+        size_t offset = it.first - m->address;
+        auto& sites = m->metadata->branches;
+        auto site = std::find_if(sites.begin(), sites.end(), [offset](const BranchSite& b) {
+            return b.offset == offset;
+        });
+        if (site != sites.end()) {
+            // an if jumps past Then when its condition fails, unless the jump was flipped.
+            size_t held = site->inverted ? it.second.taken : it.second.not_taken;
+            size_t failed = site->inverted ? it.second.not_taken : it.second.taken;
+            out << "branch " << m->metadata->name << " " << site->site << " " << held << " " << failed << "\n";
+        }
+    }
+}
+
+void
+VMProfile::save(const Program& program, std::string filename) const {
+    std::ofstream outfile(filename);
+    if (!outfile) {
+        throw "Unable to open profile for writing";
+    }
+    write(program, outfile);
+}
+
+VMOpcodeCounters::VMOpcodeCounters(bool cycles) :
+    _cycles(cycles),
+    _opcodes(size_t(Bytecode::Count)),
+    _opcode_cycles(size_t(Bytecode::Count)),
+    _modes(size_t(Bytecode::Count) << mode_bits) {}
+VMOpcodeCounters::~VMOpcodeCounters() {}
+
+void
+VMOpcodeCounters::reset() {
+    std::fill(_opcodes.begin(), _opcodes.end(), 0);
+    std::fill(_opcode_cycles.begin(), _opcode_cycles.end(), 0);
+    std::fill(_modes.begin(), _modes.end(), 0);
+    _instructions.clear();
+    _instruction_cycles.clear();
+}
+
+struct countedrow {
+    size_t key;
+    uint64_t count;
+    uint64_t cycles;
+};
+
+// the rows that were counted at all, most first, cut to top.
+std::vector<countedrow>
+_top_rows(std::vector<countedrow> rows, size_t top) {
+    rows.erase(std::remove_if(rows.begin(), rows.end(), [](const countedrow& r) { return r.count == 0; }), rows.end());
+    std::sort(rows.begin(), rows.end(), [](const countedrow& a, const countedrow& b) {
+        return a.count > b.count;
+    });
+    if (rows.size() > top) {
+        rows.resize(top);
+    }
+    return rows;
+}
+
+// direct or indirect, then the page, for each operand. Forward and backward are from the
+// base for the stack, or from the instruction for jumps.
+std::string
+_mode_name(size_t mode) {
+    static const char* const pages[] = { "const", "global", "forward", "backward" };
+    std::string name;
+    for (size_t i = 0; i < 3; i++) {
+        size_t m = (mode >> (3 * i)) & 0x7;
+        if (i > 0) {
+            name += ", ";
+        }
+        name += (m & 1) ? "indirect " : "direct ";
+        name += pages[m >> 1];
+    }
+    return name;
+}
+
+void
+VMOpcodeCounters::write(const Program& program, std::ostream& out, size_t top) const {
+    uint64_t total = 0;
+    std::vector<countedrow> opcodes;
+    for (size_t i = 0; i < _opcodes.size(); i++) {
+        total += _opcodes[i];
+        opcodes.push_back(countedrow{i, _opcodes[i], _opcode_cycles[i]});
+    }
+    out << "opcodes: " << total << "\n";
+    for (auto& r : _top_rows(opcodes, top)) {
+        out << "opcode " << bytecode_name(Bytecode(r.key)) << " " << r.count << " " << (100.0 * r.count / total) << "%";
+        if (_cycles) {
+            out << " " << r.cycles << " cycles " << (double(r.cycles) / r.count) << " each";
+        }
+        out << "\n";
+    }
+
+    std::vector<countedrow> modes;
+    for (size_t i = 0; i < _modes.size(); i++) {
+        modes.push_back(countedrow{i, _modes[i], 0});
+    }
+    for (auto& r : _top_rows(modes, top)) {
+        out << "mode " << bytecode_name(Bytecode(r.key >> mode_bits)) << " " << r.count << " " << _mode_name(r.key & ((size_t(1) << mode_bits) - 1)) << "\n";
+    }
+
+    std::vector<profilemethod> sorted;
+    for (auto& it : program.get_methods_metadata()) {
+        sorted.push_back(profilemethod{it.first, &it.second});
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const profilemethod& a, const profilemethod& b) {
+        return a.address < b.address;
+    });
+    std::vector<countedrow> methods(sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        methods[i].key = i;
+    }
+    for (size_t i = 0; i < _instructions.size(); i++) {
+        auto m = _containing_method(sorted, i);
+        if (m) {
+            auto& row = methods[m - sorted.data()];
+            row.count += _instructions[i];
+            row.cycles += _instruction_cycles[i];
+        }
+    }
+    for (auto& r : _top_rows(methods, top)) {
+        out << "method " << sorted[r.key].metadata->name << " " << r.count;
+        if (_cycles) {
+            out << " " << r.cycles << " cycles";
+        }
+        out << "\n";
+    }
+}
+
+ProfileData::ProfileData() {}
+ProfileData::~ProfileData() {}
+
+ProfileData
+ProfileData::load(std::string filename) {
+    std::ifstream infile(filename);
+    if (!infile) {
+        throw "Unable to open profile";
+    }
+    return read(infile);
+}
+
+ProfileData
+ProfileData::read(std::istream& in) {
+    ProfileData data;
+    std::string line;
+    if (!std::getline(in, line) || line != PROFILE_HEADER) {
+        throw "Unknown profile format";
+    }
+
+    while (std::getline(in, line)) {
+        std::istringstream stream(line);
+        std::string kind;
+        std::string name;
+        if (!(stream >> kind >> name)) {
+            continue;
+        }
+
+        if (kind == "method") {
+            size_t entries = 0;
+            stream >> entries;
+            data._entries[name] += entries;
+        }
+        else if (kind == "branch") {
+            size_t site = 0;
+            ProfileCondition c = {0, 0};
+            stream >> site >> c.true_count >> c.false_count;
+            data._branches[name][site] = c;
+        }
+        else {
+            throw "Unknown profile entry";
+        }
+    }
+    return data;
+}
+
+std::optional<ProfileCondition>
+ProfileData::get_branch(const std::string& method, size_t site) const {
+    auto m = _branches.find(method);
+    if (m == _branches.end()) {
+        return {};
+    }
+    auto it = m->second.find(site);
+    if (it == m->second.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+size_t
+ProfileData::get_method_entries(const std::string& method) const {
+    auto it = _entries.find(method);
+    if (it == _entries.end()) {
+        return 0;
+    }
+    return it->second;
+}
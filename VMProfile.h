@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "VMBytecode.h"
+
+class Program;
+
+struct ProfileBranch {
+    size_t taken;
+    size_t not_taken;
+};
+
+// How often the condition of an if held, whichever way its jump was laid out.
+struct ProfileCondition {
+    size_t true_count;
+    size_t false_count;
+};
+
+// Counts collected by a VM while it runs.
+// Everything is keyed by the absolute instruction index, which is only
+// translated to a method name + offset within the method when written out.
+// The jumps of ifs are written by which if of the method they are, with how often the
+// condition held, so a profile from a Program compiled with a profile reads the same.
+class VMProfile {
+public:
+    VMProfile();
+    ~VMProfile();
+
+    void record_branch(size_t address, bool taken);
+    void record_entry(size_t method_address);
+    void reset();
+
+    void write(const Program& program, std::ostream& out) const;
+    void save(const Program& program, std::string filename) const;
+
+private:
+    std::unordered_map<size_t, ProfileBranch> _branches;
+    std::unordered_map<size_t, size_t> _entries;
+};
+
+// Counts of what a VM runs, collected while it has them set (see VM::set_opcode_counters):
+// each opcode, each opcode with the modes of its operands, and each instruction, which are
+// added up by method when written. The VM has a dispatch loop of its own for counting,
+// so running without counters costs nothing.
+class VMOpcodeCounters {
+public:
+    // With cycles, the rdtsc cycles of each opcode are added up too. A call to a builtin
+    // includes the script the builtin runs, which is counted as well.
+    VMOpcodeCounters(bool cycles = false);
+    ~VMOpcodeCounters();
+
+    bool counts_cycles() const {
+        return _cycles;
+    }
+
+    void record(size_t address, const Opcode& oc) {
+        size_t op = size_t(oc.op);
+        _opcodes[op]++;
+        _modes[(op << mode_bits) | operand_modes(oc)]++;
+        if (address >= _instructions.size()) {
+            _instructions.resize(address + 1);
+            _instruction_cycles.resize(address + 1);
+        }
+        _instructions[address]++;
+    }
+    void record_cycles(size_t address, Bytecode op, uint64_t cycles) {
+        _opcode_cycles[size_t(op)] += cycles;
+        _instruction_cycles[address] += cycles;
+    }
+    void reset();
+
+    // The opcodes, operand modes and methods, each sorted by count with only the first top of each.
+    // Opcodes are by name, with the modes of their operands in words.
+    void write(const Program& program, std::ostream& out, size_t top = 20) const;
+
+private:
+    // the direct/indirect bit and the page of each of the three operands.
+    static const size_t mode_bits = 9;
+    static size_t operand_modes(const Opcode& oc) {
+        return (oc.l1 | ((oc.p1 & ParamAddressPageMask) >> (ParamAddressPageBit - 1)))
+            | ((oc.l2 | ((oc.p2 & ParamAddressPageMask) >> (ParamAddressPageBit - 1))) << 3)
+            | ((oc.l3 | ((oc.p3 & ParamAddressPageMask) >> (ParamAddressPageBit - 1))) << 6);
+    }
+
+    bool _cycles;
+    std::vector<uint64_t> _opcodes;
+    std::vector<uint64_t> _opcode_cycles;
+    std::vector<uint64_t> _modes;
+    std::vector<uint64_t> _instructions;
+    std::vector<uint64_t> _instruction_cycles;
+};
+
+// A profile as read back by the compiler.
+// The file is line based:
+//   method <name> <entries>
+//   branch <name> <if> <condition true> <condition false>
+class ProfileData {
+public:
+    ProfileData();
+    ~ProfileData();
+
+    static ProfileData load(std::string filename);
+    static ProfileData read(std::istream& in);
+
+    // by which if of the method it is, counted in source order.
+    std::optional<ProfileCondition> get_branch(const std::string& method, size_t site) const;
+    size_t get_method_entries(const std::string& method) const;
+
+private:
+    std::unordered_map<std::string, size_t> _entries;
+    std::unordered_map<std::string, std::unordered_map<size_t, ProfileCondition>> _branches;
+};
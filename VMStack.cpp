@@ -1,11 +1,14 @@
 #include "VMStack.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 const size_t VMSTACK_PAGE_ADDR_BITS = 16;
 const size_t VMSTACK_PAGE_SIZE = 1 << VMSTACK_PAGE_ADDR_BITS;
 
 VMFixedStack::VMFixedStack(size_t bytes) : _data(bytes), _len(0) {}
+VMFixedStack::VMFixedStack(void* data, size_t bytes) : _data(data), _len(bytes) {}
 VMFixedStack::~VMFixedStack() {}
 
 void
@@ -26,10 +29,27 @@ VMFixedStack::unreserve_to(size_t l) {
 }
 
 size_t
-VMFixedStack::size() {
+VMFixedStack::size() const {
     return _len;
 }
 
+const void*
+VMFixedStack::data() const {
+    return _data.stack;
+}
+
+void
+VMFixedStack::resize(size_t bytes) {
+    void* moved = malloc(bytes);
+    memcpy(moved, _data.stack, std::min(_len, bytes));
+    if (_data.owned) {
+        free(_data.stack);
+    }
+    _data.stack = moved;
+    _data.owned = true;
+    _len = std::min(_len, bytes);
+}
+
 
 VMDynamicStack::VMDynamicStack() : _len(0) {
 }
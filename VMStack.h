@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 
 
@@ -9,27 +10,37 @@ extern const size_t VMSTACK_PAGE_SIZE;
 
 struct VMStackPage {
 public:
-    VMStackPage() {
+    VMStackPage() : owned(true) {
         stack = malloc(VMSTACK_PAGE_SIZE);
     }
-    VMStackPage(size_t size) {
+    VMStackPage(size_t size) : owned(true) {
         stack = malloc(size);
     }
+    // wraps memory owned by something else, it is not freed.
+    VMStackPage(void* data) : stack(data), owned(false) {}
     ~VMStackPage() {
-        free(stack);
+        if (owned) {
+            free(stack);
+        }
     }
     void* stack;
+    bool owned;
 };
 
 class VMFixedStack {
 public:
     VMFixedStack(size_t bytes);
+    // Uses memory that is already filled in, such as a mapped program image.
+    VMFixedStack(void* data, size_t bytes);
     ~VMFixedStack();
 
     void reserve(size_t l);
     void unreserve(size_t l);
     void unreserve_to(size_t l);
-    size_t size();
+    size_t size() const;
+    const void* data() const;
+    // Moves to an owned allocation of the given bytes, keeping what fits.
+    void resize(size_t bytes);
 
     template <typename T>
     T* at(size_t address) {
@@ -38,7 +49,9 @@ public:
 
     template <typename T>
     const T cvalue(size_t address) const {
-        return *(reinterpret_cast<T*>((char*)_data.stack + address));
+        T v;
+        std::memcpy(&v, (char*)_data.stack + address, sizeof(T));
+        return v;
     }
 
 private:
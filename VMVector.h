@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#include <xmmintrin.h>
+
+#include "VMFFI.h"
+
+// The vector opcodes, done in SSE registers four lanes at a time.
+// Slots are only 4 byte aligned and a vec3 is 12 bytes, so a vector is copied into a register
+// rather than loaded from where it is; the lanes past N are filled and never stored.
+// Only SSE1 is used, which every x86 and x64 target has.
+
+template <size_t N>
+inline __m128
+vec_load(const ScriptVec<N>& a, float fill = 0.0f) {
+    float lanes[4] = {fill, fill, fill, fill};
+    std::memcpy(lanes, a.v, sizeof(a.v));
+    return _mm_loadu_ps(lanes);
+}
+
+template <size_t N>
+inline ScriptVec<N>
+vec_store(__m128 r) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, r);
+    ScriptVec<N> a;
+    std::memcpy(a.v, lanes, sizeof(a.v));
+    return a;
+}
+
+// the unused lanes are zero, so they add nothing.
+inline float
+vec_dot(__m128 a, __m128 b) {
+    __m128 m = _mm_mul_ps(a, b);
+    __m128 swapped = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 pairs = _mm_add_ps(m, swapped);
+    __m128 high = _mm_movehl_ps(swapped, pairs);
+    return _mm_cvtss_f32(_mm_add_ss(pairs, high));
+}
+
+inline float
+vec_length(__m128 a) {
+    return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(vec_dot(a, a))));
+}
+
+// a zero vector stays zero rather than becoming NaN.
+inline __m128
+vec_normalize(__m128 a) {
+    float d = vec_dot(a, a);
+    if (d == 0.0f) {
+        return a;
+    }
+    return _mm_div_ps(a, _mm_sqrt_ps(_mm_set1_ps(d)));
+}
+
+inline __m128
+vec_negate(__m128 a) {
+    return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+}
+
+// a * b.yzx - a.yzx * b is the cross product rotated by one lane, so one more rotate puts it back.
+inline __m128
+vec_cross(__m128 a, __m128 b) {
+    __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+inline bool
+vec_equal(__m128 a, __m128 b) {
+    return _mm_movemask_ps(_mm_cmpeq_ps(a, b)) == 0xF;
+}
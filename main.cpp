@@ -3,17 +3,25 @@
 
 #include <chrono>
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "VM.h"
 #include "VMFFI.h"
 #include "Program.h"
 #include "AST.h"
 #include "Compiler.h"
+#include "Tokenizer.h"
 #include "Types.h"
 
 const float iterate_to = 1.0f;
@@ -21,8 +29,43 @@ const float iterate_to = 1.0f;
 struct Point2f {
     float x;
     float y;
+
+    float length_squared() const {
+        return x * x + y * y;
+    }
+    void scale(float by) {
+        x *= by;
+        y *= by;
+    }
+    float get_y() const {
+        return y;
+    }
+    void set_x(float v) {
+        x = v;
+    }
+};
+
+struct Segment2f {
+    Point2f from;
+    Point2f to;
+};
+
+// laid out as a script vec3, so script uses it as one.
+struct Vec3f {
+    float x;
+    float y;
+    float z;
+};
+
+struct Body {
+    Vec3f pos;
+    Vec3f vel;
 };
 
+float sum_vec3f(Vec3f* v) {
+    return v->x + v->y + v->z;
+}
+
 void print_point2f(Point2f* p) {
     std::cout << "Point is: ";
     std::cout << p->x << ", " << p->y << "\n";
@@ -31,6 +74,9 @@ void print_s32(int x) {
     std::cout << "s32: ";
     std::cout << x << "\n";
 }
+int add_one(int x) {
+    return x + 1;
+}
 void print_f32(float x) {
     std::cout << "f32: ";
     std::cout << x << "\n";
@@ -58,9 +104,9 @@ compile_code_test() {
     pointbuilder.add_member<float>("y", offsetof(Point2f, y));
     pointbuilder.build();
 
-    compiler.import_method<void,Point2f*>("print_point2f", print_point2f);
-    compiler.import_method<void,int>("print_s32", print_s32);
-    compiler.import_method<void,float>("print_f32", print_f32);
+    compiler.import_function<print_point2f>("print_point2f");
+    compiler.import_function<print_s32>("print_s32");
+    compiler.import_function<print_f32>("print_f32");
 
     auto program = compiler.compile("test.wut", contents);
 
@@ -93,7 +139,1118 @@ compile_code_test() {
     scripttest(*vm, *globals, &p);
 }
 
+// compares the single pass tokenizer to the original one on a large input.
+void
+tokenizer_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::ifstream infile("test.wut");
+    std::string single(
+        (std::istreambuf_iterator<char>(infile)),
+        (std::istreambuf_iterator<char>())
+    );
+    if (single.empty()) {
+        std::cout << "test.wut not found\n";
+        return;
+    }
+
+    std::string contents;
+    while (contents.size() < 8 * 1024 * 1024) {
+        contents += single;
+        contents += "\n";
+    }
+    double mb = contents.size() / (1024.0 * 1024.0);
+
+    auto m_beg = std::chrono::steady_clock::now();
+    auto old_tokens = MattScript::Tokenizer::legacy::tokenize_string(contents);
+    auto dur = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+    std::cout << "legacy tokenizer: " << old_tokens.size() << " tokens, " << (mb / dur) << " MB/s\n";
+
+    m_beg = std::chrono::steady_clock::now();
+    auto new_tokens = MattScript::Tokenizer::tokenize(contents);
+    dur = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+    std::cout << "tokenizer: " << new_tokens.tokens.size() << " tokens, " << (mb / dur) << " MB/s\n";
+}
+
+// a single method of roughly the given number of lines.
+// locals are declared in blocks of 100 lines so they stay within a stack page.
+std::string
+generate_script(size_t lines) {
+    std::ostringstream out;
+    out << "fn generated(a: mut s32): mut s32 {\n";
+    size_t line = 1;
+    while (line + 2 < lines) {
+        out << "    if a > 0 {\n";
+        line++;
+        for (size_t i = 0; i < 49 && line + 3 < lines; i++) {
+            out << "        let v" << i << ": mut s32 = a + " << (line % 100) << "\n";
+            out << "        a = a - v" << i << "\n";
+            line += 2;
+        }
+        out << "    }\n";
+        line++;
+    }
+    out << "    return a\n";
+    out << "}\n";
+    return out.str();
+}
+
+// compile time should double with the script size.
+void
+compile_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    for (size_t lines = 6250; lines <= 50000; lines *= 2) {
+        std::string contents = generate_script(lines);
+
+        auto m_beg = std::chrono::steady_clock::now();
+        MattScript::Compiler compiler;
+        // the printed bytecode would dominate the time.
+        compiler.set_print_bytecode(false);
+        auto program = compiler.compile("generated.wut", contents);
+        auto dur = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+        std::cout << "compile " << lines << " lines: " << dur << "s, " << (dur * 1000000.0 / lines) << "us per line\n";
+    }
+}
+
+// many small files, one after another and then across all cores.
+void
+compile_many_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::vector<MattScript::SourceFile> files;
+    for (size_t i = 0; i < 64; i++) {
+        files.push_back({ "generated" + std::to_string(i) + ".wut", generate_script(2000) });
+    }
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+
+    auto m_beg = std::chrono::steady_clock::now();
+    for (auto& f : files) {
+        compiler.compile(f.filename, f.contents);
+    }
+    auto serial = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    m_beg = std::chrono::steady_clock::now();
+    auto programs = compiler.compile_many(files);
+    auto parallel = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    std::cout << "compile " << files.size() << " files: " << serial << "s one at a time, " << parallel << "s with compile_many on " << std::thread::hardware_concurrency() << " threads\n";
+}
+
+// a large program compiled from source against the same program mapped from an image.
+void
+image_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents = generate_script(50000);
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+
+    auto m_beg = std::chrono::steady_clock::now();
+    auto compiled = compiler.compile("generated.wut", contents);
+    auto compile_dur = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    compiled->save_image("generated.msi");
+
+    m_beg = std::chrono::steady_clock::now();
+    auto loaded = compiler.load("generated.msi");
+    auto load_dur = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    std::cout << "compile: " << compile_dur << "s, load image: " << load_dur << "s\n";
+
+    VM vm(VMSTACK_PAGE_SIZE);
+    auto compiled_globals = compiled->generate_state();
+    auto loaded_globals = loaded->generate_state();
+    int a = compiled->method<int, int>("generated")(vm, *compiled_globals, 12345);
+    int b = loaded->method<int, int>("generated")(vm, *loaded_globals, 12345);
+    std::cout << "compiled result: " << a << ", loaded result: " << b << "\n";
+}
+
+// changes one method of a program that is in use and reloads it in place.
+void
+hot_reload_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string before =
+        "let total: mut s32\n"
+        "fn scale(x: mut s32): mut s32 {\n"
+        "    return x * 2\n"
+        "}\n"
+        "fn step(x: mut s32): mut s32 {\n"
+        "    total = total + scale(x)\n"
+        "    return total\n"
+        "}\n";
+    std::string after =
+        "let total: mut s32\n"
+        "fn scale(x: mut s32): mut s32 {\n"
+        "    return x * 3 + 1\n"
+        "}\n"
+        "fn step(x: mut s32): mut s32 {\n"
+        "    total = total + scale(x)\n"
+        "    return total\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    auto program = compiler.compile("reload.wut", before);
+    auto step = program->method<int, int>("step");
+    auto globals = program->generate_state();
+    *globals->at<int>(program->get_global_address("total")) = 0;
+
+    VM vm(VMSTACK_PAGE_SIZE);
+    std::cout << "before reload: " << step(vm, *globals, 5) << "\n";
+
+    auto result = compiler.recompile(*program, "reload.wut", after);
+    if (!result.globals_kept) {
+        program->migrate_state(*globals);
+    }
+    std::cout << "regenerated:";
+    for (auto& name : result.regenerated) {
+        std::cout << " " << name;
+    }
+    std::cout << "\n";
+    std::cout << "after reload: " << step(vm, *globals, 5) << "\n";
+}
+
+// many methods of which only a few are ever called, compiled up front and on first call.
+void
+lazy_compile_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::ostringstream out;
+    for (size_t i = 0; i < 5000; i++) {
+        out << "fn helper" << i << "(a: mut s32): mut s32 {\n";
+        out << "    let v: mut s32 = a + " << i << "\n";
+        out << "    if v > 100 {\n";
+        out << "        v = v - 100\n";
+        out << "    }\n";
+        out << "    return v * 2\n";
+        out << "}\n";
+    }
+    out << "fn entry(a: mut s32): mut s32 {\n";
+    out << "    return helper1(a) + helper2(a) + helper4999(a)\n";
+    out << "}\n";
+    std::string contents = out.str();
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    VM vm(VMSTACK_PAGE_SIZE);
+
+    auto m_beg = std::chrono::steady_clock::now();
+    auto eager = compiler.compile("helpers.wut", contents);
+    auto eager_globals = eager->generate_state();
+    int a = eager->method<int, int>("entry")(vm, *eager_globals, 7);
+    auto eager_dur = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    m_beg = std::chrono::steady_clock::now();
+    auto lazy = compiler.compile_lazy("helpers.wut", contents);
+    auto lazy_globals = lazy->generate_state();
+    int b = lazy->method<int, int>("entry")(vm, *lazy_globals, 7);
+    auto lazy_dur = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    std::cout << "compile and first call: " << eager_dur << "s eager, " << lazy_dur << "s lazy\n";
+    std::cout << "eager result: " << a << ", lazy result: " << b << "\n";
+}
+
+// a program with methods the host never calls, compiled whole and stripped to its entry point.
+void
+strip_test() {
+    std::cout << "\n++++++++\n";
+
+    std::ostringstream out;
+    for (size_t i = 0; i < 200; i++) {
+        out << "let counter" << i << ": mut s32\n";
+        out << "fn helper" << i << "(a: mut s32): mut s32 {\n";
+        out << "    counter" << i << " = counter" << i << " + " << (i * 7 + 1000) << "\n";
+        if (i % 10 != 9) {
+            out << "    return helper" << (i + 1) << "(a + " << i << ")\n";
+        }
+        else {
+            out << "    return a\n";
+        }
+        out << "}\n";
+    }
+    out << "fn entry(a: mut s32): mut s32 {\n";
+    out << "    return helper0(a) + helper50(a)\n";
+    out << "}\n";
+    std::string contents = out.str();
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    auto whole = compiler.compile("strip.wut", contents);
+    compiler.set_entry_points({ "entry" });
+    auto stripped = compiler.compile("strip.wut", contents);
+
+    auto whole_globals = whole->generate_state();
+    auto stripped_globals = stripped->generate_state();
+    std::cout << "whole: " << whole->method_count() << " methods, " << whole->get_code().size() << " opcodes, "
+        << whole->constants_table().size() << " constant bytes, " << whole->globals_size() << " global bytes\n";
+    std::cout << "stripped: " << stripped->method_count() << " methods, " << stripped->get_code().size() << " opcodes, "
+        << stripped->constants_table().size() << " constant bytes, " << stripped->globals_size() << " global bytes\n";
+
+    VM vm(VMSTACK_PAGE_SIZE);
+    int a = whole->method<int, int>("entry")(vm, *whole_globals, 3);
+    int b = stripped->method<int, int>("entry")(vm, *stripped_globals, 3);
+    std::cout << "whole result: " << a << ", stripped result: " << b << "\n";
+}
+
+// calls into a script and reads a global the way a host does every frame.
+void
+handle_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "let total: mut s32\n"
+        "fn step(x: mut s32): mut s32 {\n"
+        "    total = total + x\n"
+        "    return total\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    auto program = compiler.compile("handles.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+    const size_t calls = 1000000;
+
+    *globals->at<int>(program->get_global_address("total")) = 0;
+    auto m_beg = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; i++) {
+        program->method<int, int>("step")(vm, *globals, 1);
+        *globals->at<int>(program->get_global_address("total")) -= 1;
+    }
+    auto by_name = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    auto step = program->method_handle<int(int)>("step");
+    auto total = program->global_handle<int>("total");
+    m_beg = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; i++) {
+        step(vm, *globals, 1);
+        total(*globals) -= 1;
+    }
+    auto by_handle = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    std::cout << calls << " calls: " << by_name << "s by name, " << by_handle << "s by handle, total " << total(*globals) << "\n";
+}
+
+// a builtin that calls back into the script on the VM that is running it.
+void
+nested_call_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn twice(x: mut s32): mut s32 {\n"
+        "    return x * 2\n"
+        "}\n"
+        "fn outer(x: mut s32): mut s32 {\n"
+        "    let a: mut s32 = x + 1\n"
+        "    let b: mut s32 = callback(a)\n"
+        "    return a * 100 + b\n"
+        "}\n";
+
+    VM vm(VMSTACK_PAGE_SIZE);
+    std::shared_ptr<VMFixedStack> globals;
+    std::optional<MethodHandle<int(int)>> twice;
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    compiler.import_method<int, int>("callback", std::function<int(int)>([&](int v) {
+        return twice.value()(vm, *globals, v) + 1;
+    }));
+    auto program = compiler.compile("nested.wut", contents);
+    globals = program->generate_state();
+    twice = program->method_handle<int(int)>("twice");
+
+    // (4 + 1) * 100 + (5 * 2 + 1)
+    std::cout << "nested call result: " << program->method_handle<int(int)>("outer")(vm, *globals, 4) << "\n";
+}
+
+// a builtin that catches a throw from the script it calls back into, then carries on.
+void
+nested_throw_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn at(a: array<s32>, i: s32): mut s32 {\n"
+        "    return a[i]\n"
+        "}\n"
+        "fn outer(x: mut s32): mut s32 {\n"
+        "    let a: mut s32 = x + 1\n"
+        "    let b: mut s32 = guarded(a)\n"
+        "    let c: mut s32 = guarded(1)\n"
+        "    return a * 10000 + b * 100 + c\n"
+        "}\n";
+
+    VM vm(VMSTACK_PAGE_SIZE);
+    std::shared_ptr<VMFixedStack> globals;
+    std::optional<MethodHandle<int(ScriptArray<int>, int)>> at;
+    std::vector<int> small = { 3, 5, 7 };
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    compiler.import_method<int, int>("guarded", std::function<int(int)>([&](int i) {
+        try {
+            return at.value()(vm, *globals, small, i);
+        }
+        catch (const char*) {
+            return -1;
+        }
+    }));
+    auto program = compiler.compile("nested_throw.wut", contents);
+    globals = program->generate_state();
+    at = program->method_handle<int(ScriptArray<int>, int)>("at");
+
+    // (4 + 1) * 10000 + (-1) * 100 + 5, every time
+    auto outer = program->method_handle<int(int)>("outer");
+    int first = outer(vm, *globals, 4);
+    bool same = true;
+    for (int i = 0; i < 1000; i++) {
+        same = same && outer(vm, *globals, 4) == first;
+    }
+    std::cout << "nested throw result: " << first << (same ? " every time" : " changed") << "\n";
+}
+
+// a script that does little but call a builtin, imported both ways.
+void
+ffi_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn run_wrapped(n: mut s32): mut s32 {\n"
+        "    let i: mut s32\n"
+        "    for i = 0; i < n; i += 1 {\n"
+        "        i = add_wrapped(i)\n"
+        "    }\n"
+        "    return i\n"
+        "}\n"
+        "fn run_direct(n: mut s32): mut s32 {\n"
+        "    let i: mut s32\n"
+        "    for i = 0; i < n; i += 1 {\n"
+        "        i = add_direct(i)\n"
+        "    }\n"
+        "    return i\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    compiler.import_method<int, int>("add_wrapped", std::function<int(int)>(add_one));
+    compiler.import_function<add_one>("add_direct");
+    auto program = compiler.compile("ffi.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+    const int calls = 10000000;
+
+    auto m_beg = std::chrono::steady_clock::now();
+    int a = program->method_handle<int(int)>("run_wrapped")(vm, *globals, calls);
+    auto wrapped = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    m_beg = std::chrono::steady_clock::now();
+    int b = program->method_handle<int(int)>("run_direct")(vm, *globals, calls);
+    auto direct = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    // the loop steps by one around each call.
+    std::cout << a / 2 << " builtin calls: " << wrapped << "s through std::function, " << b / 2 << " calls: " << direct << "s direct\n";
+}
+
+// member functions of an imported struct, called from script.
+void
+member_binding_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn bound(p: mut ref Point2f): mut f32 {\n"
+        "    p.scale(2.0)\n"
+        "    p.set_x(p.get_y() + 1.0)\n"
+        "    return p.length_squared()\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    compiler.build_struct<Point2f>("Point2f")
+        .add_member<float>("x", offsetof(Point2f, x))
+        .add_member<float>("y", offsetof(Point2f, y))
+        .add_method<&Point2f::length_squared>("length_squared")
+        .add_method<&Point2f::scale>("scale")
+        // these two are generated as field accesses rather than calls.
+        .add_getter<float>("get_y", "y")
+        .add_setter<float>("set_x", "x")
+        .build();
+    auto program = compiler.compile("members.wut", contents);
+    auto globals = program->generate_state();
+
+    VM vm(VMSTACK_PAGE_SIZE);
+    Point2f p = { 1.0f, 2.0f };
+    float r = program->method_handle<float(Point2f*)>("bound")(vm, *globals, &p);
+    // (1, 2) scaled to (2, 4), x set to 5
+    std::cout << "bound result: " << r << ", point: " << p.x << ", " << p.y << "\n";
+}
+
+// fields reached through a ref, some nested in a member held by value.
+void
+field_access_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn stretch(s: mut ref Segment2f, n: mut s32): mut f32 {\n"
+        "    let i: mut s32\n"
+        "    for i = 0; i < n; i += 1 {\n"
+        "        s.to.x = s.to.x + s.from.x\n"
+        "        s.to.y += s.from.y\n"
+        "    }\n"
+        "    return s.to.x + s.to.y\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    compiler.build_struct<Point2f>("Point2f")
+        .add_member<float>("x", offsetof(Point2f, x))
+        .add_member<float>("y", offsetof(Point2f, y))
+        .build();
+    compiler.build_struct<Segment2f>("Segment2f")
+        .add_member<Point2f>("from", offsetof(Segment2f, from))
+        .add_member<Point2f>("to", offsetof(Segment2f, to))
+        .build();
+    auto program = compiler.compile("fields.wut", contents);
+    auto globals = program->generate_state();
+
+    VM vm(VMSTACK_PAGE_SIZE);
+    Segment2f s = { { 1.0f, 0.5f }, { 0.0f, 0.0f } };
+    const int loops = 10000000;
+
+    auto m_beg = std::chrono::steady_clock::now();
+    float r = program->method_handle<float(Segment2f*, int)>("stretch")(vm, *globals, &s, loops);
+    auto took = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+
+    std::cout << "field result: " << r << ", " << program->get_code().size() << " opcodes, " << loops << " loops: " << took << "s\n";
+}
+
+// host vectors passed to script as arrays, without copying.
+void
+array_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn sum(a: array<f32>): mut f32 {\n"
+        "    let total: mut f32 = 0.0\n"
+        "    let i: mut s32\n"
+        "    for i = 0; i < a.len; i += 1 {\n"
+        "        total += a[i]\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "fn scale(a: mut array<f32>, by: f32): mut s32 {\n"
+        "    let i: mut s32\n"
+        "    for i = 0; i < a.len; i += 1 {\n"
+        "        a[i] = a[i] * by\n"
+        "    }\n"
+        "    return a.len\n"
+        "}\n"
+        "fn at(a: array<s32>, i: s32): mut s32 {\n"
+        "    return a[i]\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    auto program = compiler.compile("arrays.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+
+    std::vector<float> values(1000000, 0.5f);
+    auto sum = program->method_handle<float(ScriptArray<float>)>("sum");
+    int scaled = program->method_handle<int(ScriptArray<float>, float)>("scale")(vm, *globals, values, 2.0f);
+
+    auto m_beg = std::chrono::steady_clock::now();
+    float total = sum(vm, *globals, values);
+    auto took = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+    std::cout << "array of " << scaled << " scaled, sum: " << total << " in " << took << "s\n";
+
+    std::vector<int> small = { 3, 5, 7 };
+    auto at = program->method_handle<int(ScriptArray<int>, int)>("at");
+    std::cout << "at 2: " << at(vm, *globals, small, 2) << "\n";
+    try {
+        at(vm, *globals, small, 3);
+    }
+    catch (const char* e) {
+        std::cout << "at 3: " << e << "\n";
+    }
+}
+
+void
+loop_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn triangle(n: s32): mut s32 {\n"
+        "    let total: mut s32 = 0\n"
+        "    for i in 0..n {\n"
+        "        total += i\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "fn positives(a: array<f32>): mut f32 {\n"
+        "    let total: mut f32 = 0.0\n"
+        "    for x in a {\n"
+        "        if x < 0.0 {\n"
+        "            continue\n"
+        "        }\n"
+        "        total += x\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "fn below(a: array<s32>, limit: s32): mut s32 {\n"
+        "    let count: mut s32 = 0\n"
+        "    for i in 0..a.len {\n"
+        "        if a[i] > limit {\n"
+        "            break\n"
+        "        }\n"
+        "        count += 1\n"
+        "    }\n"
+        "    return count\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    auto program = compiler.compile("loops.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+
+    std::cout << "range of 65536: " << program->method_handle<int(int)>("triangle")(vm, *globals, 65536) << "\n";
+
+    std::vector<float> mixed = { 1.5f, -2.0f, 2.5f, -1.0f };
+    std::cout << "positives: " << program->method_handle<float(ScriptArray<float>)>("positives")(vm, *globals, mixed) << "\n";
+
+    std::vector<int> small = { 3, 5, 7, 9 };
+    std::cout << "below 4: " << program->method_handle<int(ScriptArray<int>, int)>("below")(vm, *globals, small, 4) << "\n";
+}
+
+void
+match_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn with_match(n: s32): mut s32 {\n"
+        "    let state: mut s32 = State::Idle\n"
+        "    let total: mut s32 = 0\n"
+        "    for i in 0..n {\n"
+        "        match state {\n"
+        "            State::Idle { state = State::Walk }\n"
+        "            State::Walk { state = State::Run }\n"
+        "            State::Run { state = State::Jump }\n"
+        "            State::Jump { state = State::Fall }\n"
+        "            State::Fall {\n"
+        "                state = State::Idle\n"
+        "                total += 1\n"
+        "            }\n"
+        "        }\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "fn with_if(n: s32): mut s32 {\n"
+        "    let state: mut s32 = State::Idle\n"
+        "    let total: mut s32 = 0\n"
+        "    for i in 0..n {\n"
+        "        if state == State::Idle {\n"
+        "            state = State::Walk\n"
+        "        } else if state == State::Walk {\n"
+        "            state = State::Run\n"
+        "        } else if state == State::Run {\n"
+        "            state = State::Jump\n"
+        "        } else if state == State::Jump {\n"
+        "            state = State::Fall\n"
+        "        } else if state == State::Fall {\n"
+        "            state = State::Idle\n"
+        "            total += 1\n"
+        "        }\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "fn sparse(c: s32): mut s32 {\n"
+        "    let result: mut s32 = 0\n"
+        "    match c {\n"
+        "        -5 { result = 1 }\n"
+        "        1 { result = 2 }\n"
+        "        10, 100 { result = 3 }\n"
+        "        1000 { result = 4 }\n"
+        "        10000 { result = 5 }\n"
+        "        else { result = -1 }\n"
+        "    }\n"
+        "    return result\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    compiler.build_enum("State")
+        .add_value("Idle", 0)
+        .add_value("Walk", 1)
+        .add_value("Run", 2)
+        .add_value("Jump", 3)
+        .add_value("Fall", 4)
+        .build();
+    auto program = compiler.compile("match.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+
+    for (auto name : { "with_match", "with_if" }) {
+        auto run = program->method_handle<int(int)>(name);
+        auto m_beg = std::chrono::steady_clock::now();
+        int cycles = run(vm, *globals, 10000000);
+        auto took = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+        std::cout << name << ": " << cycles << " cycles in " << took << "s\n";
+    }
+
+    auto sparse = program->method_handle<int(int)>("sparse");
+    std::cout << "sparse:";
+    for (int c : { -5, 1, 10, 100, 1000, 10000, 7 }) {
+        std::cout << " " << sparse(vm, *globals, c);
+    }
+    std::cout << "\n";
+}
+
+void
+wide_number_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn big_sum(n: s32): mut s64 {\n"
+        "    let total: mut s64 = 0s64\n"
+        "    for i in 0..n {\n"
+        "        total += s64(i) * 1000000s64\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "fn ticks(now: mut u64, frames: s32): mut u64 {\n"
+        "    for i in 0..frames {\n"
+        "        now += 16667u64\n"
+        "    }\n"
+        "    return now\n"
+        "}\n"
+        "fn compound(balance: mut f64, rate: f64, years: s32): mut f64 {\n"
+        "    for i in 0..years {\n"
+        "        balance = balance * (1.0f64 + rate)\n"
+        "    }\n"
+        "    return balance\n"
+        "}\n"
+        "fn high_half(a: u64): mut u32 {\n"
+        "    return u32(a / 0x100000000u64)\n"
+        "}\n"
+        "fn unsigned_less(a: u32, b: u32): mut bool {\n"
+        "    return a < b\n"
+        "}\n"
+        // these print the same to 6 digits, and must not share a constant.
+        "fn close_apart(): mut f64 {\n"
+        "    return 1.0000002f64 - 1.0000001f64\n"
+        "}\n"
+        "fn most_negative(): mut s32 {\n"
+        "    return -0x80000000\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    auto program = compiler.compile("numbers.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+
+    std::cout << "s64 sum: " << program->method_handle<int64_t(int)>("big_sum")(vm, *globals, 100000) << "\n";
+    std::cout << "u64 ticks: " << program->method_handle<uint64_t(uint64_t, int)>("ticks")(vm, *globals, 1ull << 40, 60) << "\n";
+    std::cout.precision(12);
+    std::cout << "f64 compound: " << program->method_handle<double(double, double, int)>("compound")(vm, *globals, 1000.0, 0.05, 30) << "\n";
+    std::cout.precision(6);
+    std::cout << "u32 high half: " << program->method_handle<uint32_t(uint64_t)>("high_half")(vm, *globals, 0xfedcba9876543210ull) << "\n";
+    std::cout << "u32 less: " << program->method_handle<bool(uint32_t, uint32_t)>("unsigned_less")(vm, *globals, 0xffffffffu, 1u) << "\n";
+    double apart = program->method_handle<double()>("close_apart")(vm, *globals);
+    std::cout << "f64 constants distinct: " << (apart > 0.0 ? "yes" : "no") << " (" << apart << ")\n";
+    std::cout << "s32 most negative: " << program->method_handle<int()>("most_negative")(vm, *globals) << "\n";
+}
+
+// the same movement done a component at a time and with vec3 opcodes.
+void
+vector_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn move_fields(b: mut ref Body, dt: f32, n: s32): mut f32 {\n"
+        "    for i in 0..n {\n"
+        "        b.pos.x += b.vel.x * dt\n"
+        "        b.pos.y += b.vel.y * dt\n"
+        "        b.pos.z += b.vel.z * dt\n"
+        "    }\n"
+        "    return b.pos.x + b.pos.y + b.pos.z\n"
+        "}\n"
+        "fn move_vec(b: mut ref Body, dt: f32, n: s32): mut f32 {\n"
+        "    for i in 0..n {\n"
+        "        b.pos += scale(b.vel, dt)\n"
+        "    }\n"
+        "    return dot(b.pos, vec3(1.0, 1.0, 1.0))\n"
+        "}\n"
+        "fn shape(): mut f32 {\n"
+        "    let up: vec3 = cross(vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0))\n"
+        "    let n: vec3 = normalize(vec3(3.0, 0.0, 4.0))\n"
+        "    return up.z + n.x + length(vec3(3.0, 4.0, 0.0))\n"
+        "}\n"
+        "fn host_sum(b: mut ref Body): mut f32 {\n"
+        "    return sum_vec3f(b.pos) + sum_vec3f(b.vel)\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    compiler.map_vector<Vec3f>();
+    compiler.build_struct<Body>("Body")
+        .add_member<Vec3f>("pos", offsetof(Body, pos))
+        .add_member<Vec3f>("vel", offsetof(Body, vel))
+        .build();
+    compiler.import_function<sum_vec3f>("sum_vec3f");
+    auto program = compiler.compile("vectors.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+    const int loops = 10000000;
+
+    for (const char* name : {"move_fields", "move_vec"}) {
+        Body b = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 2.0f, 3.0f } };
+        auto m_beg = std::chrono::steady_clock::now();
+        float r = program->method_handle<float(Body*, float, int)>(name)(vm, *globals, &b, 0.125f, loops);
+        auto took = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+        std::cout << name << ": " << r << " in " << took << "s\n";
+    }
+    std::cout << "shape: " << program->method_handle<float()>("shape")(vm, *globals) << "\n";
+    Body b = { { 1.0f, 2.0f, 3.0f }, { 0.5f, 0.5f, 0.5f } };
+    std::cout << "host sum: " << program->method_handle<float(Body*)>("host_sum")(vm, *globals, &b) << "\n";
+}
+
+// per-entity state in narrow fields of a script struct in each layout, and a random gather over u8 and s32 arrays.
+void
+narrow_benchmark() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "let e: mut Entity\n"
+        "let flags: mut u8\n"
+        "let spawned: mut u16\n"
+        "fn spawn(hp: s32): mut s32 {\n"
+        "    e.hp = s16(hp)\n"
+        "    e.level = u8(0)\n"
+        "    spawned = u16(1)\n"
+        "    return s32(spawned)\n"
+        "}\n"
+        "fn hit(by: s32): mut s32 {\n"
+        "    e.hp = s16(s32(e.hp) - by)\n"
+        "    e.level = u8(s32(e.level) + 1)\n"
+        "    return s32(e.hp) * 1000 + s32(e.level)\n"
+        "}\n"
+        "fn gather_narrow(values: array<u8>, at: array<s32>): mut s32 {\n"
+        "    let total: mut s32 = 0\n"
+        "    for i in 0..at.len {\n"
+        "        total += s32(values[at[i]])\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "fn gather_wide(values: array<s32>, at: array<s32>): mut s32 {\n"
+        "    let total: mut s32 = 0\n"
+        "    for i in 0..at.len {\n"
+        "        total += values[at[i]]\n"
+        "    }\n"
+        "    return total\n"
+        "}\n";
+
+    const char* layout_names[] = { "given", "packed", "reordered" };
+    for (auto layout : {MattScript::Types::StructLayout::given, MattScript::Types::StructLayout::packed, MattScript::Types::StructLayout::reordered}) {
+        MattScript::Compiler compiler;
+        compiler.set_print_bytecode(false);
+        compiler.build_script_struct("Entity")
+            .add_member("level", "u8")
+            .add_member("speed", "f32")
+            .add_hot_member("hp", "s16")
+            .add_member("kind", "u8")
+            .add_member("team", "u16")
+            .build(layout);
+        auto program = compiler.compile("narrow.wut", contents);
+        auto globals = program->generate_state();
+        VM vm(VMSTACK_PAGE_SIZE);
+
+        auto hit = program->method_handle<int(int)>("hit");
+        program->method_handle<int(int)>("spawn")(vm, *globals, 30000);
+        hit(vm, *globals, 5);
+        std::cout << layout_names[size_t(layout)] << " globals: " << program->globals_size()
+            << " bytes, hit: " << hit(vm, *globals, 70000) << "\n";
+        if (layout != MattScript::Types::StructLayout::reordered) {
+            continue;
+        }
+
+        // 16M entities: 16MB as u8 fits far more of the gather in cache than 64MB as s32.
+        const size_t entities = 1 << 24;
+        std::vector<uint8_t> narrow(entities);
+        std::vector<int> wide(entities);
+        for (size_t i = 0; i < entities; ++i) {
+            narrow[i] = uint8_t(i * 7);
+            wide[i] = narrow[i];
+        }
+        std::vector<int> at(1 << 22);
+        uint32_t seed = 12345;
+        for (auto& a : at) {
+            seed = seed * 1664525u + 1013904223u;
+            a = int(seed % entities);
+        }
+
+        auto m_beg = std::chrono::steady_clock::now();
+        int n = program->method_handle<int(ScriptArray<uint8_t>, ScriptArray<int>)>("gather_narrow")(vm, *globals, narrow, at);
+        auto took = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+        std::cout << "gather u8: " << n << " in " << took << "s\n";
+        m_beg = std::chrono::steady_clock::now();
+        int w = program->method_handle<int(ScriptArray<int>, ScriptArray<int>)>("gather_wide")(vm, *globals, wide, at);
+        took = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+        std::cout << "gather s32: " << w << " in " << took << "s\n";
+    }
+}
+
+// vec3 values returned and passed by value, with the copies the generator made and left out.
+void
+copy_elision_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn make(x: f32): mut vec3 {\n"
+        "    return vec3(x, x * 2.0, x * 3.0)\n"
+        "}\n"
+        "fn flip(v: vec3): mut vec3 {\n"
+        "    return scale(v, 0.5)\n"
+        "}\n"
+        "fn run(n: s32): mut f32 {\n"
+        "    let total: mut f32 = 0.0\n"
+        "    for i in 0..n {\n"
+        "        let a: vec3 = make(1.0)\n"
+        "        let b: vec3 = flip(a)\n"
+        "        total += dot(a, b)\n"
+        "    }\n"
+        "    return total\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    auto program = compiler.compile("copies.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+
+    auto m_beg = std::chrono::steady_clock::now();
+    float r = program->method_handle<float(int)>("run")(vm, *globals, 1000000);
+    auto took = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+    const auto& copies = program->copy_stats();
+    std::cout << "copies: " << copies.copies << " (" << copies.bytes_copied << " bytes), elided: " << copies.elided
+        << " (" << copies.bytes_elided << " bytes), run: " << r << " in " << took << "s\n";
+}
+
+// where the time of a script goes, opcode by opcode, and what counting costs.
+void
+opcode_counters_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn step(i: s32, n: s32): mut s32 {\n"
+        "    if i < n / 2 {\n"
+        "        return 2\n"
+        "    }\n"
+        "    return -1\n"
+        "}\n"
+        "fn run(n: s32): mut s32 {\n"
+        "    let total: mut s32 = 0\n"
+        "    for i in 0..n {\n"
+        "        total += step(i, n)\n"
+        "    }\n"
+        "    return total\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    auto program = compiler.compile("counted.wut", contents);
+    auto globals = program->generate_state();
+    VM vm(VMSTACK_PAGE_SIZE);
+    auto run = program->method_handle<int(int)>("run");
+    const int loops = 1000000;
+
+    VMOpcodeCounters counters(true);
+    for (bool counted : {false, true}) {
+        vm.set_opcode_counters(counted ? &counters : nullptr);
+        auto m_beg = std::chrono::steady_clock::now();
+        int r = run(vm, *globals, loops);
+        auto took = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - m_beg).count();
+        std::cout << (counted ? "counted: " : "uncounted: ") << r << " in " << took << "s\n";
+    }
+    vm.set_opcode_counters(nullptr);
+    counters.write(*program, std::cout, 5);
+    counters.reset();
+}
+
+// offsets and jumps have 15 bits, so each of these compiles just under 32 KB and throws just over.
+void
+limits_test() {
+    std::cout << "\n++++++++\n";
+
+    auto compiles = [](const std::string& contents) -> std::string {
+        MattScript::Compiler compiler;
+        compiler.set_print_bytecode(false);
+        try {
+            compiler.compile("limits.wut", contents);
+        }
+        catch (const char* e) {
+            return e;
+        }
+        return "compiled";
+    };
+
+    // s32 globals, the last one used at 32764 and then 32768.
+    for (size_t count : {8192, 8193}) {
+        std::ostringstream out;
+        for (size_t i = 0; i < count; i++) {
+            out << "let g" << i << ": mut s32\n";
+        }
+        out << "fn last(a: mut s32): mut s32 {\n";
+        out << "    g" << (count - 1) << " = a\n";
+        out << "    return g" << (count - 1) << "\n";
+        out << "}\n";
+        std::cout << count * 4 << " bytes of globals: " << compiles(out.str()) << "\n";
+    }
+
+    // distinct s32 constants, with a few more the method needs of its own.
+    for (size_t count : {8150, 8250}) {
+        std::ostringstream out;
+        out << "fn sum(a: mut s32): mut s32 {\n";
+        for (size_t i = 0; i < count; i++) {
+            out << "    a = a + " << (i + 100000) << "\n";
+        }
+        out << "    return a\n";
+        out << "}\n";
+        std::cout << count * 4 << " bytes of constants: " << compiles(out.str()) << "\n";
+    }
+
+    // an if has to jump over its body.
+    for (size_t count : {32700, 32800}) {
+        std::ostringstream out;
+        out << "fn count(a: mut s32): mut s32 {\n";
+        out << "    if a > 0 {\n";
+        for (size_t i = 0; i < count; i++) {
+            out << "        a = a + 1\n";
+        }
+        out << "    }\n";
+        out << "    return a\n";
+        out << "}\n";
+        std::string contents = out.str();
+        std::string result = compiles(contents);
+        if (result == "compiled") {
+            MattScript::Compiler compiler;
+            compiler.set_print_bytecode(false);
+            auto program = compiler.compile("limits.wut", contents);
+            auto globals = program->generate_state();
+            VM vm(VMSTACK_PAGE_SIZE);
+            result += ", " + std::to_string(program->get_code().size()) + " opcodes, result " +
+                std::to_string(program->method_handle<int(int)>("count")(vm, *globals, 1));
+        }
+        std::cout << "if over " << count << " adds: " << result << "\n";
+    }
+}
+
+// records a profile, compiles with it and checks the profiled build does the same work.
+// A profile recorded on the profiled build has to give the same layout again.
+void
+profile_test() {
+    std::cout << "\n++++++++\n";
+
+    std::string contents =
+        "fn rarely(n: s32): mut s32 {\n"
+        "    return n * 3\n"
+        "}\n"
+        "fn classify(n: s32): mut s32 {\n"
+        "    let total: mut s32 = 0\n"
+        "    for i in 0..n {\n"
+        "        if i < 2 {\n"
+        "            total += 1\n"
+        "        } else {\n"
+        "            if i > 5 {\n"
+        "                total += 10\n"
+        "            } else {\n"
+        "                total += 100\n"
+        "            }\n"
+        "        }\n"
+        "    }\n"
+        "    return total\n"
+        "}\n"
+        "fn fless(a: f32, b: f32): mut s32 {\n"
+        "    if a < b {\n"
+        "        return 1\n"
+        "    } else {\n"
+        "        return 2\n"
+        "    }\n"
+        "}\n";
+
+    MattScript::Compiler compiler;
+    compiler.set_print_bytecode(false);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    // the results of everything, and the profile of the same run.
+    auto run = [&](std::shared_ptr<Program> program, std::string filename) {
+        auto globals = program->generate_state();
+        VM vm(VMSTACK_PAGE_SIZE);
+        VMProfile profile;
+        vm.set_profile(&profile);
+        std::vector<int> results;
+        for (int n : {100, 4, 0}) {
+            results.push_back(program->method_handle<int(int)>("classify")(vm, *globals, n));
+        }
+        for (int i = 0; i < 10; i++) {
+            results.push_back(program->method_handle<int(float, float)>("fless")(vm, *globals, 2.0f, 1.0f));
+        }
+        results.push_back(program->method_handle<int(float, float)>("fless")(vm, *globals, 1.0f, 2.0f));
+        results.push_back(program->method_handle<int(float, float)>("fless")(vm, *globals, nan, 1.0f));
+        results.push_back(program->method_handle<int(int)>("rarely")(vm, *globals, 7));
+        profile.save(*program, filename);
+        std::ifstream infile(filename);
+        std::string text((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+        return std::make_pair(results, text);
+    };
+    auto same_code = [](const Program& a, const Program& b) {
+        auto ca = a.get_code();
+        auto cb = b.get_code();
+        return ca.size() == cb.size() && std::memcmp(ca.data(), cb.data(), ca.size() * sizeof(Opcode)) == 0;
+    };
+
+    auto plain = compiler.compile("profiled.wut", contents);
+    auto first = run(plain, "profile_test.prof");
+    auto profiled = compiler.compile("profiled.wut", contents, ProfileData::load("profile_test.prof"));
+    auto second = run(profiled, "profile_test_2.prof");
+    auto again = compiler.compile("profiled.wut", contents, ProfileData::load("profile_test_2.prof"));
+    auto third = run(again, "profile_test_3.prof");
+
+    std::cout << first.second;
+    std::cout << "profile results same: " << (first.first == second.first && first.first == third.first ? "yes" : "no") << "\n";
+    std::cout << "profile layout changed: " << (same_code(*plain, *profiled) ? "no" : "yes") << "\n";
+    std::cout << "profile stable: " << (first.second == second.second && same_code(*profiled, *again) ? "yes" : "no") << "\n";
+    std::cout << "profile hot method first: " << (profiled->get_method_address("classify") < profiled->get_method_address("rarely") ? "yes" : "no") << "\n";
+}
+
 int main() {
     compile_code_test();
+    tokenizer_benchmark();
+    compile_benchmark();
+    compile_many_benchmark();
+    image_benchmark();
+    hot_reload_test();
+    lazy_compile_benchmark();
+    strip_test();
+    handle_benchmark();
+    nested_call_test();
+    nested_throw_test();
+    ffi_benchmark();
+    member_binding_test();
+    field_access_benchmark();
+    array_test();
+    loop_test();
+    match_benchmark();
+    wide_number_test();
+    vector_benchmark();
+    narrow_benchmark();
+    copy_elision_test();
+    limits_test();
+    opcode_counters_test();
+    profile_test();
     return 0;
 }